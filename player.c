@@ -20,24 +20,328 @@
 #include <math.h>
 #include <windows.h>
 #include <string.h>
+#include "player.h"
 
 #define WAV_BUF_CNT	(2)				// Dual buffer
+#define WAV_BUF_MAX	(4)				// Buffers of a stream with an adaptive depth
+#define WAV_ADAPT_CALM	(50)				// Wakes without a late one before the adaptive depth narrows
 #define WAV_BUF_TME	(1000)				// The expected playtime of the buffer in milliseconds: 1000ms
 #define WAV_BUF_LEN	(44100*2*2*(WAV_BUF_TME/1000))	// 44100Hz, 16-bit, 2-channel, 1 second buffer
+#define WAV_VOL_LEAD	(40)				// Milliseconds ahead of the play position that queued audio is still rescaled
+#define WAV_VOL_RAMP	(5)				// Milliseconds of linear gain ramp on a volume change
+#define CACHE_TRACKS	(99)				// Whole tracks the disc cache keeps track of
+#define CACHE_CHUNK	(1024*1024)			// Read size while loading a track
+#define CACHE_CLOSE_WAIT	(1000)			// ms the prefetch thread gets to finish its chunk on close
+#define PLR_MAX		(8)				// Streams that can exist at once
 
-bool		plr_run			= false;
-bool		plr_bsy			= false;
-unsigned int	plr_len			= 0;
-float		plr_vol[2]		= {1.0, 1.0}; // Left, Right
+/* Resident head cache. The first milliseconds of every track live in one arena, so PLAY submits before the file is open. */
+struct plr_head
+{
+	const char *path;
+	WAVEFORMATEX fmt;
+	unsigned int end; // size of PCM data in the file
+	unsigned int len; // bytes resident
+	char *data;
+};
+
+/* Whole-disc cache. Tracks are loaded by a prefetch thread within a byte budget and evicted least recently used first. */
+struct plr_cached
+{
+	const char *path;
+	WAVEFORMATEX fmt;
+	char *data; // PCM, NULL while not resident
+	unsigned int len;
+	DWORD used; // LRU stamp
+	int pins; // streams playing it, never evicted while set
+	bool failed; // unreadable or larger than the budget
+};
+
+/* One stream: its output device, buffer queue and the range being read */
+struct player
+{
+	bool		run;
+	bool		bsy;
+	bool		paused;
+	bool		halt; // plr_stop came in, plr_reset cuts what is queued instead of draining it
+	unsigned int	len; // bytes left to play
+	unsigned int	dat; // file offset of PCM data
+	unsigned int	end; // size of PCM data
+	const char*	path; // file being played, identifies plr_seek targets
+	bool		req; // pending in-place seek
+	unsigned int	req_from;
+	unsigned int	req_to;
+	int		loop_buf; // buffer ending the range that plr_loop requeued behind
+	bool		lead; // playing the start plr_loop queued, plr_extend may still come
+	unsigned int	rest; // bytes of the looped range held back behind its lead
+	bool		ext; // pending plr_extend
+	CRITICAL_SECTION cs;
+	float		tail[2]; // gain at the end of everything queued
+	volatile bool	vol_req; // plr_vol changed, rescale what is queued
+	const float*	vol; // plr_vol, or own for streams with a volume of their own
+	float		own[2];
+
+	HWAVEOUT	hw;
+	HANDLE		ev;
+	FILE*		fp;
+	WAVEFORMATEX	fmt;
+	int		que;
+	int		sub; // buffers submitted since plr_play
+	DWORD		bytes; // bytes written to the device since it was opened or reset
+	int		sta[WAV_BUF_MAX];
+	WAVEHDR		hdr[WAV_BUF_MAX];
+	char*		mem; // buf and src of every buffer in one block, allocated by the first plr_play
+	unsigned int	blen; // bytes each buffer holds
+	char*		buf[WAV_BUF_MAX];
+	char*		src[WAV_BUF_MAX]; // unscaled PCM of each buffer
+	DWORD		at[WAV_BUF_MAX]; // device byte offset each buffer starts at
+	float		gain[WAV_BUF_MAX][2]; // gain each buffer ends with
+	unsigned int	depth; // milliseconds queued over all buffers, adaptive
+	unsigned int	calm; // wakes since the depth last changed
+	unsigned int	late; // latest wake in milliseconds since the depth last changed
+
+	struct plr_head*	hd; // head of the track being played
+	struct plr_cached*	ce; // resident track being played, pinned
+	unsigned int	off; // PCM offset of the next read
+	unsigned int	fpos; // PCM offset of fp
+	unsigned int	t0; // plr_usec of the last start or seek
+	unsigned int	t_stop; // plr_usec of a STOP the device was not reset for yet
+
+	bool		hold; // paused while rendering
+	ULONGLONG	rpos; // byte offset of the rendered file the next buffer is mixed at
+};
+
+float		plr_vol[2]		= {1.0, 1.0}; // Left, Right, shared by every stream
+CRITICAL_SECTION plr_cs; // guards the stream list and the disc cache, taken before a stream's lock, never inside it
+struct player*	plr_list[PLR_MAX];
+int		plr_cnt			= 0;
+int		plr_bufs		= WAV_BUF_CNT; // buffers per stream, WAV_BUF_MAX with an adaptive depth
+unsigned int	plr_dmin		= 0; // bounds of the adaptive depth in milliseconds, 0: fixed 1 second buffers
+unsigned int	plr_dmax		= 0;
+
+/* Playback health counters. Only updated with interlocked ops, so reading them never blocks the player. */
+volatile LONG	plr_st_submit		= 0; // buffers submitted
+volatile LONG	plr_st_underrun		= 0; // wakes with every buffer already played
+volatile LONG	plr_st_fail		= 0; // waveOutWrite failures
+volatile LONG	plr_st_reads		= 0; // fread calls
+volatile LONG	plr_st_readkb		= 0; // kilobytes read
+volatile LONG	plr_st_streams		= 0; // most streams playing at once
+volatile LONG	plr_st_grow		= 0; // adaptive depth widened
+volatile LONG	plr_st_shrink		= 0; // adaptive depth narrowed
+volatile LONG	plr_st_depth		= 0; // last adaptive depth in milliseconds
+volatile LONG	plr_st_waves		= 0; // waveOut handles open now
+volatile LONG	plr_st_files		= 0; // stream files open now
+volatile LONG	plr_st_events		= 0; // stream events open now
+volatile LONG	plr_st_hist[PLR_HIST_CNT][PLR_HIST_LEN] = {{0}}; // log2 microsecond buckets
+LARGE_INTEGER	plr_freq		= {0};
+
+/* Offline render sink. Buffers are consumed as fast as they are produced and time is virtual.
+ * Every stream mixes into the one file at its own position, so overlapping streams add up. */
+FILE*		plr_rf			= NULL;
+WAVEFORMATEX	plr_rfmt		= {0};
+unsigned int	plr_rlen		= 0; // bytes of PCM written
+ULONGLONG	plr_rend		= 0; // furthest stream position in bytes
+ULONGLONG	plr_wus			= 0; // wall time spent rendering
+CRITICAL_SECTION plr_rcs;
+short		plr_mix[WAV_BUF_LEN/2]; // PCM already rendered under a buffer
+
+struct plr_head*	plr_heads	= NULL;
+int		plr_head_cnt		= 0;
+unsigned int	plr_head_ms		= 0;
+unsigned int	plr_head_max		= 0; // bytes per slot
+volatile LONG	plr_st_head		= 0; // plays started from the head cache
+
+struct plr_cached	plr_cache[CACHE_TRACKS];
+int		plr_cache_cnt		= 0;
+ULONGLONG	plr_cache_budget	= 0; // bytes, 0: disabled
+ULONGLONG	plr_cache_bytes		= 0; // bytes resident or being loaded
+DWORD		plr_cache_stamp		= 0;
+HANDLE		plr_cache_ev		= NULL;
+HANDLE		plr_cache_th		= NULL;
+volatile bool	plr_cache_run		= false;
+const char*	plr_want[CACHE_TRACKS]; // prefetch order
+int		plr_want_cnt		= 0;
+LONG		plr_want_gen		= 0;
+volatile LONG	plr_st_hit		= 0; // plays served from memory
+volatile LONG	plr_st_miss		= 0; // plays streamed from the file
+volatile LONG	plr_st_evict		= 0; // tracks evicted to make room
+volatile LONG	plr_st_snd_hit		= 0; // PlaySound calls served from the sound cache
+volatile LONG	plr_st_snd_miss		= 0; // PlaySound calls that loaded the sound
+volatile LONG	plr_st_relay		= 0; // MCI calls passed to the system winmm, counted with DriverCheck
+volatile LONG	plr_st_mcicda		= 0; // of those, calls that returned with its CD audio driver loaded
+volatile LONG	plr_st_seq_hit		= 0; // sequencer opens served from parsed songs
+volatile LONG	plr_st_seq_miss		= 0; // sequencer opens that parsed the file
+
+static const char *plr_hist_name[PLR_HIST_CNT] = {"wake", "read", "cmd", "start", "timer", "sound", "stop", "pause", "midi"};
+
+/* Performance counter ticks to microseconds. ticks * 1000000 overflows after 10 days of uptime at 10 MHz, so the whole
+ * seconds and the rest are scaled apart. */
+ULONGLONG plr_ticks_usec(LONGLONG ticks, LONGLONG freq)
+{
+	return (ULONGLONG)(ticks / freq) * 1000000 + (ULONGLONG)(ticks % freq) * 1000000 / freq;
+}
+
+unsigned int plr_usec()
+{
+	LARGE_INTEGER now;
+	if (!plr_freq.QuadPart && !QueryPerformanceFrequency(&plr_freq)) plr_freq.QuadPart = -1;
+	if (plr_freq.QuadPart < 0) return GetTickCount() * 1000;
+	QueryPerformanceCounter(&now);
+	return (unsigned int)plr_ticks_usec(now.QuadPart, plr_freq.QuadPart);
+}
+
+void plr_hist(int hist, unsigned int usec)
+{
+	int i = 0;
+	while (usec > 1 && i < PLR_HIST_LEN-1) {
+		usec >>= 1;
+		i++;
+	}
+	InterlockedIncrement(&plr_st_hist[hist][i]);
+}
+
+void plr_sound(BOOL hit)
+{
+	InterlockedIncrement(hit ? &plr_st_snd_hit : &plr_st_snd_miss);
+}
 
-HWAVEOUT	plr_hw	 		= NULL;
-HANDLE		plr_ev  		= NULL;
-FILE*		plr_fp			= NULL;
-WAVEFORMATEX	plr_fmt			= {0};
-int		plr_que			= 0;
-int		plr_sta[WAV_BUF_CNT]	= {0};
-WAVEHDR		plr_hdr[WAV_BUF_CNT]	= {0};
-char		plr_buf[WAV_BUF_CNT][WAV_BUF_LEN] __attribute__ ((aligned(4)));
+void plr_relay(BOOL driver)
+{
+	InterlockedIncrement(&plr_st_relay);
+	if (driver) InterlockedIncrement(&plr_st_mcicda);
+}
+
+void plr_sequence(BOOL hit)
+{
+	InterlockedIncrement(hit ? &plr_st_seq_hit : &plr_st_seq_miss);
+}
+
+/* Upper bound (in microseconds) of the bucket holding the given percentile */
+static unsigned int plr_pct(int hist, int pct)
+{
+	LONG total = 0, sum = 0;
+	for (int i = 0; i < PLR_HIST_LEN; i++) total += plr_st_hist[hist][i];
+	if (!total) return 0;
+	for (int i = 0; i < PLR_HIST_LEN; i++) {
+		sum += plr_st_hist[hist][i];
+		if (sum * 100 >= total * pct) return 2u << i;
+	}
+	return 2u << (PLR_HIST_LEN-1);
+}
+
+int plr_stats(char *buf, int len, BOOL full)
+{
+	int n = snprintf(buf, len, "submitted=%ld underruns=%ld failures=%ld reads=%ld readkb=%ld",
+		(long)plr_st_submit, (long)plr_st_underrun, (long)plr_st_fail, (long)plr_st_reads, (long)plr_st_readkb);
+
+	for (int h = 0; h < PLR_HIST_CNT && n >= 0 && n < len; h++) {
+		n += snprintf(buf+n, len-n, " %s_p50=%u %s_p95=%u %s_p99=%u", plr_hist_name[h], plr_pct(h, 50),
+			plr_hist_name[h], plr_pct(h, 95), plr_hist_name[h], plr_pct(h, 99));
+		if (!full) continue;
+		for (int i = 0; i < PLR_HIST_LEN && n >= 0 && n < len; i++) {
+			n += snprintf(buf+n, len-n, "%s%ld", i ? "," : " [", (long)plr_st_hist[h][i]);
+		}
+		if (n >= 0 && n < len) n += snprintf(buf+n, len-n, "]");
+	}
+	if (plr_dmax && n >= 0 && n < len) {
+		n += snprintf(buf+n, len-n, " depth_ms=%ld depth_grows=%ld depth_shrinks=%ld", (long)plr_st_depth,
+			(long)plr_st_grow, (long)plr_st_shrink);
+	}
+	if (plr_st_streams > 1 && n >= 0 && n < len) {
+		n += snprintf(buf+n, len-n, " streams=%ld", (long)plr_st_streams);
+	}
+	if (n >= 0 && n < len) {
+		n += snprintf(buf+n, len-n, " open_waves=%ld open_files=%ld open_events=%ld", (long)plr_st_waves,
+			(long)plr_st_files, (long)plr_st_events);
+	}
+	if (plr_rf && n >= 0 && n < len) {
+		ULONGLONG vus = plr_rfmt.nAvgBytesPerSec ? plr_rend * 1000000 / plr_rfmt.nAvgBytesPerSec : 0;
+		n += snprintf(buf+n, len-n, " render_ms=%u render_x=%u", (unsigned int)(vus / 1000), plr_wus ? (unsigned int)(vus / plr_wus) : 0);
+	}
+	if (plr_heads && n >= 0 && n < len) {
+		n += snprintf(buf+n, len-n, " head_ms=%u head_hits=%ld", plr_head_ms, (long)plr_st_head);
+	}
+	if (plr_cache_budget && n >= 0 && n < len) {
+		n += snprintf(buf+n, len-n, " cache_hits=%ld cache_misses=%ld cache_kb=%u cache_evictions=%ld",
+			(long)plr_st_hit, (long)plr_st_miss, (unsigned int)(plr_cache_bytes >> 10), (long)plr_st_evict);
+	}
+	if ((plr_st_snd_hit || plr_st_snd_miss) && n >= 0 && n < len) {
+		n += snprintf(buf+n, len-n, " sound_hits=%ld sound_misses=%ld", (long)plr_st_snd_hit, (long)plr_st_snd_miss);
+	}
+	if (plr_st_relay && n >= 0 && n < len) {
+		n += snprintf(buf+n, len-n, " mci_relays=%ld mcicda=%ld", (long)plr_st_relay, (long)plr_st_mcicda);
+	}
+	if ((plr_st_seq_hit || plr_st_seq_miss) && n >= 0 && n < len) {
+		n += snprintf(buf+n, len-n, " midi_hits=%ld midi_misses=%ld", (long)plr_st_seq_hit, (long)plr_st_seq_miss);
+	}
+	return n;
+}
+
+static void plr_render_header()
+{
+	unsigned char header[44] = "RIFF\0\0\0\0WAVEfmt \x10\0\0\0";
+	unsigned int riff = plr_rlen + 36;
+	memcpy(header+4, &riff, 4);
+	memcpy(header+20, &plr_rfmt, 16);
+	memcpy(header+36, "data", 4);
+	memcpy(header+40, &plr_rlen, 4);
+	fseek(plr_rf, 0, SEEK_SET);
+	fwrite(header, 1, 44, plr_rf);
+	fseek(plr_rf, 0, SEEK_END);
+}
+
+int plr_render(const char *path)
+{
+	plr_rf = fopen(path, "w+b"); // Read back where streams overlap
+	if (!plr_rf) return 0;
+	plr_render_header();
+	return 1;
+}
+
+void plr_render_close()
+{
+	if (!plr_rf) return;
+	plr_render_header();
+	fclose(plr_rf);
+	plr_rf = NULL;
+}
+
+/* Mix a buffer into the rendered file at the stream's position */
+static void plr_render_mix(struct player *p, const char *data, unsigned int len)
+{
+	EnterCriticalSection(&plr_rcs);
+	/* Drop PCM that does not match the format of the rendered file, its time still passes */
+	if (!memcmp(&p->fmt, &plr_rfmt, sizeof(WAVEFORMATEX))) {
+		unsigned int at = (unsigned int)p->rpos;
+		unsigned int mix = at < plr_rlen ? plr_rlen - at : 0;
+		if (mix > len) mix = len;
+		fseek(plr_rf, 44 + at, SEEK_SET);
+		if (mix) {
+			const short *src = (const short *)data;
+			mix = fread(plr_mix, 1, mix, plr_rf) / 2 * 2;
+			for (unsigned int i = 0; i < mix / 2; i++) {
+				int s = plr_mix[i] + src[i];
+				plr_mix[i] = s > 32767 ? 32767 : s < -32768 ? -32768 : s;
+			}
+			fseek(plr_rf, 44 + at, SEEK_SET);
+			fwrite(plr_mix, 1, mix, plr_rf);
+		}
+		fwrite(data + mix, 1, len - mix, plr_rf);
+		if (at + len > plr_rlen) plr_rlen = at + len;
+		p->rpos += len;
+	} else {
+		unsigned int align = plr_rfmt.nBlockAlign;
+		p->rpos += (ULONGLONG)len * plr_rfmt.nAvgBytesPerSec / p->fmt.nAvgBytesPerSec / align * align;
+	}
+	if (p->rpos > plr_rend) plr_rend = p->rpos;
+	LeaveCriticalSection(&plr_rcs);
+}
+
+/* Millisecond clock matching the stream's output, virtual when rendering offline */
+DWORD plr_clock(struct player *p)
+{
+	if (!plr_rf) return GetTickCount();
+	return plr_rfmt.nAvgBytesPerSec ? (DWORD)(p->rpos * 1000 / plr_rfmt.nAvgBytesPerSec) : 0;
+}
 
 void plr_volume(int vol_l, int vol_r)
 {
@@ -46,6 +350,99 @@ void plr_volume(int vol_l, int vol_r)
 
 	if (vol_r < 0 || vol_r > 99) plr_vol[1] = 1.0;
 	else plr_vol[1] = vol_r / 100.0;
+
+	/* Let every pump rescale its queued audio now instead of at the next refill */
+	EnterCriticalSection(&plr_cs);
+	for (int i = 0; i < plr_cnt; i++) {
+		struct player *p = plr_list[i];
+		EnterCriticalSection(&p->cs);
+		if (p->path) {
+			p->vol_req = true;
+			SetEvent(p->ev);
+		}
+		LeaveCriticalSection(&p->cs);
+	}
+	LeaveCriticalSection(&plr_cs);
+}
+
+/* Give a stream a fixed volume of its own instead of the shared CD audio volume */
+void plr_gain(struct player *p, int vol)
+{
+	p->own[0] = p->own[1] = vol < 0 || vol > 99 ? 1.0 : vol / 100.0;
+	p->vol = p->own;
+}
+
+/* Scale frames of src into dst, ramping linearly from gain g0 to g1 over the first ramp frames */
+static void plr_scale(struct player *p, short *dst, const short *src, unsigned int frames, const float *g0, const float *g1, unsigned int ramp)
+{
+	int ch = p->fmt.nChannels;
+	if (g0[0] == 1.0 && g0[1] == 1.0 && g1[0] == 1.0 && g1[1] == 1.0) {
+		memcpy(dst, src, frames * ch * sizeof(short));
+		return;
+	}
+	for (unsigned int f = 0; f < frames; f++, dst += ch, src += ch) {
+		float t = f < ramp ? (float)f / ramp : 1.0;
+		for (int c = 0; c < ch; c++) {
+			int k = c ? 1 : 0;
+			dst[c] = src[c] * (g0[k] + (g1[k] - g0[k]) * t);
+		}
+	}
+}
+
+/* Apply a volume change to the audio already queued, starting shortly ahead of the play position */
+static void plr_rescale(struct player *p)
+{
+	float vol[2] = {p->vol[0], p->vol[1]};
+	unsigned int align = p->fmt.nBlockAlign;
+	MMTIME mt;
+
+	p->vol_req = false;
+	mt.wType = TIME_BYTES;
+	if (!p->hw || waveOutGetPosition(p->hw, &mt, sizeof(mt)) != MMSYSERR_NOERROR || mt.wType != TIME_BYTES) return;
+
+	/* The device may already hold the next few milliseconds, leave those alone */
+	DWORD from = mt.u.cb + p->fmt.nAvgBytesPerSec * WAV_VOL_LEAD / 1000 / align * align;
+	unsigned int ramp = p->fmt.nSamplesPerSec * WAV_VOL_RAMP / 1000;
+	bool first = true;
+
+	for (int n = 0, i = p->que; n < plr_bufs; n++, i = (i+1) % plr_bufs) {
+		WAVEHDR *hdr = &p->hdr[i];
+		if (p->sta[i] != 0 || (hdr->dwFlags & WHDR_DONE)) continue;
+
+		DWORD off = (int)(from - p->at[i]) > 0 ? (from - p->at[i]) / align * align : 0;
+		if (off >= hdr->dwBufferLength) continue;
+
+		plr_scale(p, (short *)(hdr->lpData + off), (short *)(p->src[i] + off), (hdr->dwBufferLength - off) / align,
+			p->gain[i], vol, first ? ramp : 0);
+		p->gain[i][0] = vol[0];
+		p->gain[i][1] = vol[1];
+		first = false;
+	}
+	p->tail[0] = vol[0];
+	p->tail[1] = vol[1];
+}
+
+/* Parse a canonical 44-byte WAV header, returns the size of the PCM data or 0 */
+static unsigned int plr_header(FILE *f, WAVEFORMATEX *fmt, int *audioFormat)
+{
+	unsigned char header[44];
+	if (fread(header, 1, 44, f) < 44) return 0;
+	if (memcmp(header, "RIFF", 4) != 0 || memcmp(header+8, "WAVE", 4) != 0) return 0;
+
+	int channels       = header[22] | (header[23] << 8);
+	int sampleRate     = header[24] | (header[25] << 8) | (header[26] << 16) | (header[27] << 24);
+	int bitsPerSample  = header[34] | (header[35] << 8);
+	*audioFormat       = header[20] | (header[21] << 8);
+
+	fmt->wFormatTag      = WAVE_FORMAT_PCM;
+	fmt->nChannels       = channels;
+	fmt->nSamplesPerSec  = sampleRate;
+	fmt->wBitsPerSample  = bitsPerSample;
+	fmt->nBlockAlign     = channels * (bitsPerSample / 8);
+	fmt->nAvgBytesPerSec = fmt->nBlockAlign * sampleRate;
+	fmt->cbSize          = 0;
+
+	return header[40] | (header[41] << 8) | (header[42] << 16) | (header[43] << 24);
 }
 
 unsigned int plr_length(const char *path) // in milliseconds
@@ -53,193 +450,855 @@ unsigned int plr_length(const char *path) // in milliseconds
 	FILE* f = fopen(path, "rb");
 	if (!f) return 0;
 
-	unsigned char header[44];
-	if (fread(header, 1, 44, f) < 44) {
-		fclose(f);
-		return 0;
+	WAVEFORMATEX fmt;
+	int audioFormat;
+	unsigned int dataSize = plr_header(f, &fmt, &audioFormat);
+	fclose(f);
+
+	return fmt.nAvgBytesPerSec > 0 ? (ULONGLONG)dataSize * 1000 / fmt.nAvgBytesPerSec : 0;
+}
+
+/* Length in milliseconds of a file plr_play can stream, 0 for anything else */
+unsigned int plr_probe(const char *path, WAVEFORMATEX *fmt)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) return 0;
+
+	int audioFormat;
+	unsigned int dataSize = plr_header(f, fmt, &audioFormat);
+	fclose(f);
+
+	if (!dataSize || audioFormat != 1 || fmt->wBitsPerSample != 16 || !fmt->nBlockAlign) return 0;
+	return (ULONGLONG)dataSize * 1000 / fmt->nAvgBytesPerSec;
+}
+
+/* Position the reader at [from, to] milliseconds of the track, to == -1: end of file */
+static void plr_position(struct player *p, unsigned int from, unsigned int to)
+{
+	ULONGLONG align = p->fmt.nBlockAlign;
+	ULONGLONG beg = (ULONGLONG)from * p->fmt.nAvgBytesPerSec / 1000 / align * align;
+	ULONGLONG end = to == -1 ? p->end : (ULONGLONG)to * p->fmt.nAvgBytesPerSec / 1000 / align * align;
+	if (end > p->end) end = p->end;
+	if (beg > end) beg = end;
+
+	p->off = beg;
+	p->len = end - beg;
+}
+
+/* Read the next PCM of the range, from the head cache while it covers p->off, else from the file (opened on first use) */
+static unsigned int plr_read(struct player *p, char *buf, unsigned int len)
+{
+	if (len > p->len) len = p->len;
+	if (!len) return 0;
+
+	/* Switch to memory as soon as the prefetcher finished the track being streamed */
+	if (!p->ce && plr_cache_budget) {
+		EnterCriticalSection(&plr_cs);
+		for (int i = 0; i < plr_cache_cnt; i++) {
+			if (plr_cache[i].path == p->path && plr_cache[i].data && plr_cache[i].len == p->end) {
+				p->ce = &plr_cache[i];
+				p->ce->pins++;
+				p->ce->used = ++plr_cache_stamp;
+				break;
+			}
+		}
+		LeaveCriticalSection(&plr_cs);
 	}
-	if (memcmp(header, "RIFF", 4) != 0 || memcmp(header+8, "WAVE", 4) != 0) {
-		fclose(f);
-		return 0;
+
+	if (p->ce) {
+		memcpy(buf, p->ce->data + p->off, len);
+	} else if (p->hd && p->off < p->hd->len) {
+		if (len > p->hd->len - p->off) len = p->hd->len - p->off;
+		memcpy(buf, p->hd->data + p->off, len);
+	} else {
+		if (!p->fp) {
+			if (!(p->fp = fopen(p->path, "rb"))) return 0;
+			InterlockedIncrement(&plr_st_files);
+		}
+		if (p->fpos != p->off) fseek(p->fp, p->dat + p->off, SEEK_SET);
+		len = fread(buf, 1, len, p->fp);
+		p->fpos = p->off + len;
+		InterlockedIncrement(&plr_st_reads);
+		InterlockedExchangeAdd(&plr_st_readkb, (LONG)(len >> 10));
 	}
-	int channels = header[22] | (header[23] << 8);
-	int sampleRate = header[24] | (header[25] << 8) | (header[26] << 16) | (header[27] << 24);
-	int bitsPerSample = header[34] | (header[35] << 8);
-	unsigned int dataSize = header[40] | (header[41] << 8) | (header[42] << 16) | (header[43] << 24);
+	p->off += len;
+	p->len -= len;
+	return len;
+}
 
-	int bytesPerSec = sampleRate * channels * (bitsPerSample / 8);
-	int millis = (bytesPerSec > 0) ? (dataSize * 1000 / bytesPerSec) : 0;
+/* Allocate the head cache arena: count slots holding the first ms of a track each */
+void plr_head_init(unsigned int ms, int count)
+{
+	if (ms > WAV_BUF_TME * WAV_BUF_CNT) ms = WAV_BUF_TME * WAV_BUF_CNT; // A full queue is all a start can use
+	if (!ms || count <= 0) return;
 
+	unsigned int slot = (ULONGLONG)ms * WAV_BUF_LEN / WAV_BUF_TME;
+	char *arena = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, count * (sizeof(struct plr_head) + slot));
+	if (!arena) return;
+
+	plr_heads = (struct plr_head *)arena;
+	arena += count * sizeof(struct plr_head);
+	for (int i = 0; i < count; i++, arena += slot) plr_heads[i].data = arena;
+	plr_head_cnt = count;
+	plr_head_ms = ms;
+	plr_head_max = slot;
+}
+
+/* Fill a head cache slot from the track, returns its length in milliseconds like plr_length */
+unsigned int plr_head_load(int slot, const char *path)
+{
+	if (slot < 0 || slot >= plr_head_cnt) return plr_length(path);
+
+	FILE* f = fopen(path, "rb");
+	if (!f) return 0;
+
+	struct plr_head *hd = &plr_heads[slot];
+	int audioFormat;
+	unsigned int dataSize = plr_header(f, &hd->fmt, &audioFormat);
+	if (dataSize && audioFormat == 1 && hd->fmt.wBitsPerSample == 16 && hd->fmt.nBlockAlign) {
+		ULONGLONG len = (ULONGLONG)plr_head_ms * hd->fmt.nAvgBytesPerSec / 1000;
+		if (len > plr_head_max) len = plr_head_max; // Rates above CD quality get fewer milliseconds
+		if (len > dataSize) len = dataSize;
+		len = len / hd->fmt.nBlockAlign * hd->fmt.nBlockAlign;
+		hd->len = fread(hd->data, 1, len, f);
+		hd->end = dataSize;
+		hd->path = path;
+	}
 	fclose(f);
-	return millis;
+
+	return hd->fmt.nAvgBytesPerSec > 0 ? (ULONGLONG)dataSize * 1000 / hd->fmt.nAvgBytesPerSec : 0;
 }
 
-void plr_reset(BOOL wait)
+/* Find or add the cache entry of a path, call with plr_cs held */
+static struct plr_cached *plr_cache_entry(const char *path)
 {
-	if (plr_fp) {
-		fclose(plr_fp);
-		plr_fp = NULL;
+	for (int i = 0; i < plr_cache_cnt; i++) {
+		if (plr_cache[i].path == path) return &plr_cache[i];
 	}
+	if (plr_cache_cnt == CACHE_TRACKS) return NULL;
+	plr_cache[plr_cache_cnt].path = path;
+	return &plr_cache[plr_cache_cnt++];
+}
 
-	if (plr_hw) {
-		if (wait) {
-			for (int n = 0; n < WAV_BUF_CNT; n++, plr_que = (plr_que+1) % WAV_BUF_CNT) {
-				if (!(plr_hdr[plr_que].dwFlags & WHDR_DONE)) WaitForSingleObject(plr_ev, WAV_BUF_TME);
-			}
-		}
-		waveOutReset(plr_hw);
-		for (int i = 0; i < WAV_BUF_CNT; i++) {
-			waveOutUnprepareHeader(plr_hw, &plr_hdr[i], sizeof(WAVEHDR));
+/* Free least recently used tracks outside the first keep wanted ones until need more bytes fit, call with plr_cs held */
+static bool plr_cache_evict(ULONGLONG need, int keep)
+{
+	while (plr_cache_bytes + need > plr_cache_budget) {
+		struct plr_cached *lru = NULL;
+		for (int i = 0; i < plr_cache_cnt; i++) {
+			struct plr_cached *ce = &plr_cache[i];
+			if (!ce->data || ce->pins) continue;
+			bool wanted = false;
+			for (int k = 0; k < keep && !wanted; k++) wanted = plr_want[k] == ce->path;
+			if (!wanted && (!lru || ce->used < lru->used)) lru = ce;
 		}
-		waveOutClose(plr_hw);
-		plr_hw = NULL;
+		if (!lru) return false;
+
+		HeapFree(GetProcessHeap(), 0, lru->data);
+		lru->data = NULL;
+		plr_cache_bytes -= lru->len;
+		InterlockedIncrement(&plr_st_evict);
+	}
+	return true;
+}
+
+/* Load one track into memory, false when the budget is taken by tracks wanted earlier */
+static bool plr_cache_load(struct plr_cached *ce, int keep, LONG gen)
+{
+	FILE* f = fopen(ce->path, "rb");
+	if (!f) {
+		ce->failed = true;
+		return true;
+	}
+
+	WAVEFORMATEX fmt;
+	int audioFormat;
+	unsigned int len = plr_header(f, &fmt, &audioFormat);
+	if (!len || len > plr_cache_budget || audioFormat != 1 || fmt.wBitsPerSample != 16 || !fmt.nBlockAlign) {
+		fclose(f);
+		ce->failed = true;
+		return true;
+	}
+
+	EnterCriticalSection(&plr_cs);
+	bool room = plr_cache_evict(len, keep);
+	if (room) plr_cache_bytes += len;
+	LeaveCriticalSection(&plr_cs);
+	if (!room) {
+		fclose(f);
+		return false;
+	}
+
+	char *data = HeapAlloc(GetProcessHeap(), 0, len);
+	unsigned int pos = 0;
+	while (data && pos < len && plr_cache_run && plr_want_gen == gen) {
+		size_t bytes = fread(data + pos, 1, len - pos < CACHE_CHUNK ? len - pos : CACHE_CHUNK, f);
+		if (!bytes) break;
+		pos += (unsigned int)bytes;
+	}
+	fclose(f);
+
+	EnterCriticalSection(&plr_cs);
+	if (pos == len) {
+		ce->fmt = fmt;
+		ce->len = len;
+		ce->data = data;
+		ce->used = ++plr_cache_stamp;
+	} else {
+		plr_cache_bytes -= len;
+		if (data) HeapFree(GetProcessHeap(), 0, data);
+		if (plr_want_gen == gen && plr_cache_run) ce->failed = true; // Short read, not an interrupted load
 	}
+	LeaveCriticalSection(&plr_cs);
+	return true;
+}
 
-	if (plr_ev) {
-		CloseHandle(plr_ev);
-		plr_ev = NULL;
+/* Prefetch thread: walks the wanted tracks in order and loads whatever is not resident yet */
+static DWORD WINAPI plr_cache_main(void *unused)
+{
+	while (WaitForSingleObject(plr_cache_ev, INFINITE) == 0 && plr_cache_run) {
+		LONG gen;
+		int k = 0;
+		do {
+			struct plr_cached *ce = NULL;
+			EnterCriticalSection(&plr_cs);
+			gen = plr_want_gen;
+			for (; k < plr_want_cnt && !ce; k++) {
+				struct plr_cached *e = plr_cache_entry(plr_want[k]);
+				if (e && !e->data && !e->failed) ce = e;
+			}
+			LeaveCriticalSection(&plr_cs);
+			if (!ce || !plr_cache_load(ce, k, gen)) break;
+		} while (plr_cache_run && plr_want_gen == gen);
 	}
+	return 0;
 }
 
-int plr_play(const char *path, unsigned int from, unsigned int to)
+/* Enable the disc cache with a budget in megabytes and start its prefetch thread */
+void plr_cache_init(unsigned int mb)
 {
-	(void)from; (void)to; // WAV seeking not implemented
+	DWORD id;
+	if (!mb || plr_cache_ev) return;
+	plr_cache_ev = CreateEvent(NULL, 0, 0, NULL);
+	if (!plr_cache_ev) return;
+	plr_cache_budget = (ULONGLONG)mb << 20;
+	plr_cache_run = true;
+	plr_cache_th = CreateThread(NULL, 0, plr_cache_main, NULL, 0, &id);
+	if (!plr_cache_th) {
+		plr_cache_run = false;
+		plr_cache_budget = 0;
+	}
+}
 
-	plr_fp = fopen(path, "rb");
-	if (!plr_fp) return 0;
+/* Replace the prefetch order, the first tracks are loaded first and evicted last */
+void plr_cache_prefetch(const char **paths, int count)
+{
+	if (!plr_cache_run) return;
+	if (count > CACHE_TRACKS) count = CACHE_TRACKS;
+	EnterCriticalSection(&plr_cs);
+	memcpy(plr_want, paths, count * sizeof(*paths));
+	plr_want_cnt = count;
+	plr_want_gen++;
+	LeaveCriticalSection(&plr_cs);
+	SetEvent(plr_cache_ev);
+}
 
-	unsigned char header[44];
-	if (fread(header, 1, 44, plr_fp) < 44) {
-		fclose(plr_fp);
-		plr_fp = NULL;
-		return 0;
+/* Stop prefetching and free the resident tracks once no stream plays them. A load in flight gives up at its next chunk,
+ * a thread that does not exit in time keeps the event and the tracks it may still store into. */
+void plr_cache_close()
+{
+	if (!plr_cache_ev) return;
+	plr_cache_run = false;
+	SetEvent(plr_cache_ev);
+	if (plr_cache_th) {
+		DWORD res = WaitForSingleObject(plr_cache_th, CACHE_CLOSE_WAIT);
+		CloseHandle(plr_cache_th);
+		plr_cache_th = NULL;
+		if (res != WAIT_OBJECT_0) return;
 	}
+	CloseHandle(plr_cache_ev);
+	plr_cache_ev = NULL;
 
-	if (memcmp(header, "RIFF", 4) != 0 || memcmp(header+8, "WAVE", 4) != 0) {
-		fclose(plr_fp);
-		plr_fp = NULL;
-		return 0;
+	EnterCriticalSection(&plr_cs);
+	for (int i = 0; i < plr_cache_cnt; i++) {
+		if (plr_cache[i].data) HeapFree(GetProcessHeap(), 0, plr_cache[i].data);
 	}
+	memset(plr_cache, 0, sizeof(plr_cache));
+	plr_cache_cnt = 0;
+	plr_cache_bytes = 0;
+	plr_cache_budget = 0;
+	LeaveCriticalSection(&plr_cs);
+}
 
-	int audioFormat    = header[20] | (header[21] << 8);
-	int channels       = header[22] | (header[23] << 8);
-	int sampleRate     = header[24] | (header[25] << 8) | (header[26] << 16) | (header[27] << 24);
-	int bitsPerSample  = header[34] | (header[35] << 8);
+void plr_init()
+{
+	InitializeCriticalSection(&plr_cs);
+	InitializeCriticalSection(&plr_rcs);
+}
 
-	if (audioFormat != 1 || bitsPerSample != 16) {
-		fclose(plr_fp);
-		plr_fp = NULL;
-		return 0;
+/* Create a stream, NULL when out of memory or PLR_MAX streams exist */
+struct player *plr_new()
+{
+	struct player *p = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct player));
+	if (!p) return NULL;
+	p->loop_buf = -1;
+	p->tail[0] = p->tail[1] = 1.0;
+	p->vol = plr_vol;
+	InitializeCriticalSection(&p->cs);
+
+	EnterCriticalSection(&plr_cs);
+	bool added = plr_cnt < PLR_MAX;
+	if (added) plr_list[plr_cnt++] = p;
+	LeaveCriticalSection(&plr_cs);
+	if (!added) {
+		DeleteCriticalSection(&p->cs);
+		HeapFree(GetProcessHeap(), 0, p);
+		return NULL;
+	}
+	return p;
+}
+
+/* Destroy a stream, nothing may be pumping it anymore */
+void plr_free(struct player *p)
+{
+	if (!p) return;
+	plr_reset(p, FALSE);
+
+	EnterCriticalSection(&plr_cs);
+	for (int i = 0; i < plr_cnt; i++) {
+		if (plr_list[i] == p) {
+			plr_list[i] = plr_list[--plr_cnt];
+			break;
+		}
+	}
+	LeaveCriticalSection(&plr_cs);
+	DeleteCriticalSection(&p->cs);
+	if (p->mem) HeapFree(GetProcessHeap(), 0, p->mem);
+	HeapFree(GetProcessHeap(), 0, p);
+}
+
+/* Size the buffers for plr_bufs of what plr_fill reads of the format at most, nothing may be queued */
+static bool plr_alloc(struct player *p)
+{
+	unsigned int len = WAV_BUF_LEN, align = p->fmt.nBlockAlign;
+	if (plr_dmax && !plr_rf) {
+		ULONGLONG max = (ULONGLONG)plr_dmax * p->fmt.nAvgBytesPerSec / 1000 / plr_bufs / align * align;
+		if (max < len) len = (unsigned int)max + align;
+	}
+	len = (len + 3) & ~3;
+	if (p->mem && p->blen >= len) return true;
+
+	char *mem = HeapAlloc(GetProcessHeap(), 0, (SIZE_T)len * plr_bufs * 2);
+	if (!mem) return false;
+	if (p->mem) HeapFree(GetProcessHeap(), 0, p->mem);
+	p->mem = mem;
+	p->blen = len;
+	for (int i = 0; i < plr_bufs; i++) {
+		p->buf[i] = mem + (SIZE_T)len * i;
+		p->src[i] = mem + (SIZE_T)len * (plr_bufs + i);
+	}
+	return true;
+}
+
+void plr_reset(struct player *p, BOOL wait)
+{
+	EnterCriticalSection(&p->cs);
+	if (p->fp) {
+		fclose(p->fp);
+		p->fp = NULL;
+		InterlockedDecrement(&plr_st_files);
+	}
+	p->path = NULL;
+	p->hd = NULL;
+	p->req = false;
+	p->ext = false;
+	LeaveCriticalSection(&p->cs);
+	EnterCriticalSection(&plr_cs);
+	if (p->ce) p->ce->pins--;
+	p->ce = NULL;
+	LeaveCriticalSection(&plr_cs);
+	p->loop_buf = -1;
+	p->lead = false;
+	p->rest = 0;
+
+	if (p->hw && wait) {
+		bool halt = false;
+		for (int n = 0; n < plr_bufs && !halt; n++, p->que = (p->que+1) % plr_bufs) {
+			/* A paused buffer never completes, wait for plr_resume or plr_stop instead of timing out and cutting it */
+			for (bool late = false;;) {
+				EnterCriticalSection(&p->cs);
+				bool paused = p->paused;
+				halt = p->halt;
+				LeaveCriticalSection(&p->cs);
+				if (halt || (p->hdr[p->que].dwFlags & WHDR_DONE) || (late && !paused)) break;
+				late = WaitForSingleObject(p->ev, paused ? INFINITE : WAV_BUF_TME) == WAIT_TIMEOUT;
+			}
+		}
+	}
+
+	/* Stop, pause and resume come from the callers' threads, they only touch the device and event under the lock */
+	EnterCriticalSection(&p->cs);
+	if (p->hw) {
+		waveOutReset(p->hw);
+		if (p->t_stop) plr_hist(PLR_HIST_STOP, plr_usec() - p->t_stop);
+		for (int i = 0; i < plr_bufs; i++) {
+			waveOutUnprepareHeader(p->hw, &p->hdr[i], sizeof(WAVEHDR));
+		}
+		waveOutClose(p->hw);
+		p->hw = NULL;
+		InterlockedDecrement(&plr_st_waves);
+	}
+	p->t_stop = 0;
+	p->halt = false;
+
+	if (p->ev) {
+		CloseHandle(p->ev);
+		p->ev = NULL;
+		InterlockedDecrement(&plr_st_events);
+	}
+	LeaveCriticalSection(&p->cs);
+}
+
+int plr_play(struct player *p, const char *path, unsigned int from, unsigned int to)
+{
+	p->t0 = plr_usec();
+	p->hd = NULL;
+	if (plr_cache_budget) {
+		EnterCriticalSection(&plr_cs);
+		for (int i = 0; i < plr_cache_cnt; i++) {
+			if (plr_cache[i].path == path && plr_cache[i].data) {
+				p->ce = &plr_cache[i];
+				p->ce->pins++;
+				p->ce->used = ++plr_cache_stamp;
+				break;
+			}
+		}
+		LeaveCriticalSection(&plr_cs);
+		InterlockedIncrement(p->ce ? &plr_st_hit : &plr_st_miss);
+	}
+	for (int i = 0; i < plr_head_cnt && !p->ce; i++) {
+		if (plr_heads[i].path == path) {
+			p->hd = &plr_heads[i];
+			break;
+		}
 	}
 
-	plr_fmt.wFormatTag      = WAVE_FORMAT_PCM;
-	plr_fmt.nChannels       = channels;
-	plr_fmt.nSamplesPerSec  = sampleRate;
-	plr_fmt.wBitsPerSample  = bitsPerSample;
-	plr_fmt.nBlockAlign     = channels * (bitsPerSample / 8);
-	plr_fmt.nAvgBytesPerSec = plr_fmt.nBlockAlign * sampleRate;
-	plr_fmt.cbSize          = 0;
+	/* A resident track or cached head already knows the format, the file is opened once the reader runs past it */
+	if (p->ce) {
+		p->fmt = p->ce->fmt;
+		p->end = p->ce->len;
+	} else if (p->hd) {
+		p->fmt = p->hd->fmt;
+		p->end = p->hd->end;
+	} else {
+		p->fp = fopen(path, "rb");
+		if (!p->fp) return 0;
+		InterlockedIncrement(&plr_st_files);
 
-	plr_ev = CreateEvent(NULL, 0, 1, NULL);
+		int audioFormat;
+		p->end = plr_header(p->fp, &p->fmt, &audioFormat);
+		if (!p->end || audioFormat != 1 || p->fmt.wBitsPerSample != 16 || !p->fmt.nBlockAlign) {
+			fclose(p->fp);
+			p->fp = NULL;
+			InterlockedDecrement(&plr_st_files);
+			return 0;
+		}
+	}
+	p->dat = 44;
+	p->fpos = 0;
+	plr_position(p, from, to);
+
+	HANDLE ev = CreateEvent(NULL, 0, 1, NULL);
+	HWAVEOUT hw = NULL;
+	if (ev) InterlockedIncrement(&plr_st_events);
 
-	if (waveOutOpen(&plr_hw, WAVE_MAPPER, &plr_fmt, (DWORD_PTR)plr_ev, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR) {
-		fclose(plr_fp); plr_fp = NULL;
-		CloseHandle(plr_ev); plr_ev = NULL;
+	bool ok = plr_alloc(p);
+	if (ok && plr_rf) {
+		/* Join the other streams where they are mixing now, or start after everything rendered so far */
+		EnterCriticalSection(&plr_cs);
+		EnterCriticalSection(&plr_rcs);
+		if (!plr_rfmt.nAvgBytesPerSec) plr_rfmt = p->fmt;
+		ULONGLONG at = plr_rlen;
+		for (int i = 0; i < plr_cnt; i++) {
+			if (plr_list[i] != p && plr_list[i]->path && plr_list[i]->rpos < at) at = plr_list[i]->rpos;
+		}
+		if (at > p->rpos) p->rpos = at;
+		LeaveCriticalSection(&plr_rcs);
+		LeaveCriticalSection(&plr_cs);
+	} else if (!ok || waveOutOpen(&hw, WAVE_MAPPER, &p->fmt, (DWORD_PTR)ev, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+		/* Live streams open a device each, the system mixes them */
+		if (p->fp) {
+			fclose(p->fp);
+			p->fp = NULL;
+			InterlockedDecrement(&plr_st_files);
+		}
+		p->hd = NULL;
+		EnterCriticalSection(&plr_cs);
+		if (p->ce) p->ce->pins--;
+		p->ce = NULL;
+		LeaveCriticalSection(&plr_cs);
+		if (ev) InterlockedDecrement(&plr_st_events);
+		CloseHandle(ev);
 		return 0;
 	}
+	/* Stop, pause and resume read them under the lock */
+	EnterCriticalSection(&p->cs);
+	p->ev = ev;
+	p->hw = hw;
+	p->hold = false;
+	p->paused = false;
+	LeaveCriticalSection(&p->cs);
+	if (p->hw) InterlockedIncrement(&plr_st_waves);
+	if (p->hd) InterlockedIncrement(&plr_st_head);
 
-	plr_que = 0;
-	for (int i = 0; i < WAV_BUF_CNT; i++) {
-		plr_sta[i] = 0;
-		plr_hdr[i].dwFlags = WHDR_DONE;
+	p->que = 0;
+	p->sub = 0;
+	p->bytes = 0;
+	p->tail[0] = p->vol[0];
+	p->tail[1] = p->vol[1];
+	for (int i = 0; i < plr_bufs; i++) {
+		p->sta[i] = 0;
+		p->hdr[i].dwFlags = WHDR_DONE;
 	}
 
-	plr_run = true;
+	EnterCriticalSection(&p->cs);
+	p->path = path;
+	p->req = false;
+	p->run = true;
+	LeaveCriticalSection(&p->cs);
+
+	LONG streams = 0;
+	EnterCriticalSection(&plr_cs);
+	for (int i = 0; i < plr_cnt; i++) {
+		EnterCriticalSection(&plr_list[i]->cs);
+		if (plr_list[i]->path) streams++;
+		LeaveCriticalSection(&plr_list[i]->cs);
+	}
+	if (streams > plr_st_streams) plr_st_streams = streams;
+	LeaveCriticalSection(&plr_cs);
 	return 1;
 }
 
-void plr_stop()
+/* Retarget the playing file in place, the device and file stay open. Fails if path is not being played. */
+int plr_seek(struct player *p, const char *path, unsigned int from, unsigned int to)
 {
-	if (!plr_run) return;
+	int ok = 0;
+	EnterCriticalSection(&p->cs);
+	if (p->run && p->path == path) {
+		p->req_from = from;
+		p->req_to = to;
+		p->req = true;
+		SetEvent(p->ev);
+		ok = 1;
+	}
+	LeaveCriticalSection(&p->cs);
+	return ok;
+}
 
-	plr_run = false;
+/* Once the range has been read, queue the first lead milliseconds of [from, to] of the same file right behind it so a
+ * loop is sample-continuous. plr_pump returns 2 when the buffer ending the range has played, and 0 once the lead has
+ * played without plr_extend. */
+void plr_loop(struct player *p, unsigned int from, unsigned int to, unsigned int lead)
+{
+	if (!p->path) return;
+	ULONGLONG align = p->fmt.nBlockAlign;
+	unsigned int max = (ULONGLONG)lead * p->fmt.nAvgBytesPerSec / 1000 / align * align;
+	p->loop_buf = (p->que + plr_bufs - 1) % plr_bufs;
+	plr_position(p, from, to);
+	p->rest = p->len > max ? p->len - max : 0;
+	p->len -= p->rest;
+	p->lead = true;
+	p->run = true;
+	SetEvent(p->ev);
+}
 
-	if (plr_ev) {
-		SetEvent(plr_ev);
-		while (plr_bsy) {
-			Sleep(1);
+/* The looped range was played again, read on past its lead to its end */
+void plr_extend(struct player *p)
+{
+	EnterCriticalSection(&p->cs);
+	p->ext = true;
+	SetEvent(p->ev);
+	LeaveCriticalSection(&p->cs);
+}
+
+/* Milliseconds until the last submitted sample has played */
+DWORD plr_remaining(struct player *p)
+{
+	MMTIME mt;
+	DWORD left = 0;
+	if (!p->hw || !p->fmt.nAvgBytesPerSec) return 0;
+
+	mt.wType = TIME_BYTES;
+	if (waveOutGetPosition(p->hw, &mt, sizeof(mt)) == MMSYSERR_NOERROR && mt.wType == TIME_BYTES) {
+		left = p->bytes - mt.u.cb; // Both wrap at 4 GB
+		if (left > p->bytes) left = 0;
+	} else {
+		/* No byte position from the driver, fall back to whatever is still queued */
+		for (int i = 0; i < plr_bufs; i++) {
+			if (!(p->hdr[i].dwFlags & WHDR_DONE)) left += p->hdr[i].dwBufferLength;
 		}
 	}
+	return (ULONGLONG)left * 1000 / p->fmt.nAvgBytesPerSec;
 }
 
-void plr_pause()
+/* Let the duration queued by every stream adapt between min_ms and max_ms, 0: dual 1 second buffers. Call before playing. */
+void plr_depth(unsigned int min_ms, unsigned int max_ms)
 {
-	if (plr_hw) waveOutPause(plr_hw);
+	if (!max_ms) return;
+	if (max_ms > WAV_BUF_MAX * WAV_BUF_TME) max_ms = WAV_BUF_MAX * WAV_BUF_TME;
+	if (min_ms < 40) min_ms = 40;
+	if (min_ms > max_ms) min_ms = max_ms;
+	plr_dmin = min_ms;
+	plr_dmax = max_ms;
+	plr_bufs = WAV_BUF_MAX;
 }
 
-void plr_resume()
+/* Bytes to read into the next buffer: a whole one, or its share of the adaptive depth */
+static unsigned int plr_fill(struct player *p)
 {
-	if (plr_hw) waveOutRestart(plr_hw);
+	if (!plr_dmax || plr_rf || !p->fmt.nBlockAlign) return WAV_BUF_LEN;
+	if (!p->depth) InterlockedExchange(&plr_st_depth, p->depth = plr_dmax); // start deep, the first calm wakes narrow it
+	unsigned int align = p->fmt.nBlockAlign;
+	unsigned int len = (ULONGLONG)p->depth * p->fmt.nAvgBytesPerSec / 1000 / plr_bufs / align * align;
+	if (len > p->blen) len = p->blen / align * align;
+	return len ? len : align;
+}
+
+/* Widen the depth at once when a wake finds one buffer or none still queued, it came half the depth late.
+ * Narrow it by a quarter once WAV_ADAPT_CALM wakes in a row came within an eighth of it. */
+static void plr_adapt(struct player *p, int done)
+{
+	MMTIME mt;
+	int i = p->que; // oldest buffer, the first to complete
+	mt.wType = TIME_BYTES;
+	if (p->fmt.nAvgBytesPerSec && waveOutGetPosition(p->hw, &mt, sizeof(mt)) == MMSYSERR_NOERROR && mt.wType == TIME_BYTES) {
+		LONG over = (LONG)(mt.u.cb - (p->at[i] + p->hdr[i].dwBufferLength));
+		unsigned int ms = over > 0 ? (ULONGLONG)over * 1000 / p->fmt.nAvgBytesPerSec : 0;
+		if (ms > p->late) p->late = ms;
+	}
+
+	unsigned int depth = p->depth;
+	if (plr_bufs - done <= 1) {
+		depth = depth * 2 < plr_dmax ? depth * 2 : plr_dmax;
+		p->calm = 0;
+		p->late = 0;
+	} else if (++p->calm >= WAV_ADAPT_CALM) {
+		if (p->late * 8 < depth) depth = depth * 3 / 4 > plr_dmin ? depth * 3 / 4 : plr_dmin;
+		p->calm = 0;
+		p->late = 0;
+	}
+	if (depth != p->depth) {
+		InterlockedIncrement(depth > p->depth ? &plr_st_grow : &plr_st_shrink);
+		InterlockedExchange(&plr_st_depth, depth);
+		p->depth = depth;
+	}
 }
 
-int plr_pump()
+void plr_stop(struct player *p)
 {
-	if (!plr_run || !plr_fp) return -1;
+	/* hw without run: the range ended and plr_reset drains it. Checked under the lock, a halt left behind by a reset
+	   that finished meanwhile would cut the next range as soon as it drains. */
+	EnterCriticalSection(&p->cs);
+	if (!p->run && !p->hw) {
+		LeaveCriticalSection(&p->cs);
+		return;
+	}
+	p->t_stop = plr_usec();
+	p->run = false;
+	p->halt = true;
+	bool wake = p->ev != NULL;
+	if (wake) SetEvent(p->ev);
+	LeaveCriticalSection(&p->cs);
+	while (wake && p->bsy) {
+		Sleep(1);
+	}
+}
 
-	plr_bsy = true;
+void plr_pause(struct player *p)
+{
+	EnterCriticalSection(&p->cs);
+	if (p->hw) {
+		unsigned int t = plr_usec();
+		waveOutPause(p->hw);
+		plr_hist(PLR_HIST_PAUSE, plr_usec() - t);
+		p->paused = true;
+	}
+	else if (plr_rf) p->hold = true;
+	LeaveCriticalSection(&p->cs);
+}
 
-	if (WaitForSingleObject(plr_ev, INFINITE) != 0 || !plr_run) {
-		plr_bsy = false;
+void plr_resume(struct player *p)
+{
+	EnterCriticalSection(&p->cs);
+	if (p->hw) {
+		unsigned int t = plr_usec();
+		waveOutRestart(p->hw);
+		plr_hist(PLR_HIST_PAUSE, plr_usec() - t);
+		p->paused = false;
+		if (p->ev) SetEvent(p->ev); // A draining plr_reset waits for us
+	}
+	else if (plr_rf && p->hold) {
+		p->hold = false;
+		if (p->ev) SetEvent(p->ev);
+	}
+	LeaveCriticalSection(&p->cs);
+}
+
+int plr_pump(struct player *p)
+{
+	if (!p->run || !p->path) return -1;
+
+	p->bsy = true;
+
+	DWORD w = WaitForSingleObject(p->ev, INFINITE);
+	if ((w != 0 && w != WAIT_TIMEOUT) || !p->run) {
+		p->bsy = false;
 		return -1;
 	}
 
-	for (int n = 0, i = plr_que; n < WAV_BUF_CNT; n++, i = (i+1) % WAV_BUF_CNT) {
-		if (plr_sta[i] != 0) continue;
+	/* Flush whatever is queued and refill from the new position */
+	EnterCriticalSection(&p->cs);
+	if (p->req) {
+		p->req = false;
+		if (p->hw) {
+			waveOutReset(p->hw);
+			ResetEvent(p->ev); // Completions of the dropped buffers, we are awake already
+			if (p->paused) {
+				waveOutRestart(p->hw);
+				p->paused = false;
+			}
+		}
+		for (int i = 0; i < plr_bufs; i++) {
+			p->sta[i] = 0;
+			p->hdr[i].dwFlags |= WHDR_DONE;
+		}
+		p->sub = 0;
+		p->bytes = 0;
+		p->hold = false;
+		p->loop_buf = -1;
+		p->lead = false;
+		p->rest = 0;
+		p->ext = false;
+		p->t0 = plr_usec();
+		plr_position(p, p->req_from, p->req_to);
+	}
+	if (p->ext) {
+		p->ext = false;
+		p->lead = false;
+		p->len += p->rest;
+		p->rest = 0;
+	}
+	LeaveCriticalSection(&p->cs);
+
+	if (p->vol_req) plr_rescale(p);
+
+	/* The render sink stops consuming while paused, plr_resume wakes us again */
+	if (p->hold) {
+		p->bsy = false;
+		return 1;
+	}
+
+	/* The end of a looped range is audible once its buffer is done, report it before the buffer is refilled */
+	int ret = 1;
+	if (p->loop_buf >= 0 && (p->hdr[p->loop_buf].dwFlags & WHDR_DONE)) {
+		p->loop_buf = -1;
+		ret = 2;
+	}
+
+	unsigned int wake = plr_usec();
+	bool eof = false;
+	int done = 0;
+	for (int i = 0; i < plr_bufs; i++) {
+		if (p->hdr[i].dwFlags & WHDR_DONE) done++;
+	}
+	if (done == plr_bufs && p->sub && !plr_rf) InterlockedIncrement(&plr_st_underrun);
+	if (plr_dmax && done && p->sub && p->len && !plr_rf) plr_adapt(p, done);
 
-		WAVEHDR *hdr = &plr_hdr[i];
+	for (int n = 0, i = p->que; n < plr_bufs; n++, i = (i+1) % plr_bufs) {
+		if (p->sta[i] != 0) continue;
+
+		WAVEHDR *hdr = &p->hdr[i];
 		if (!(hdr->dwFlags & WHDR_DONE)) break;
 
-		char *buf = plr_buf[i];
+		char *buf = p->buf[i];
 		unsigned int pos = 0;
-		size_t bytes = fread(buf, 1, WAV_BUF_LEN, plr_fp);
-		pos += (unsigned int)bytes;
+		unsigned int t = plr_usec();
+		pos += plr_read(p, p->src[i], plr_fill(p));
+		plr_hist(PLR_HIST_READ, plr_usec() - t);
 
 		if (pos == 0) {
-			plr_run = false;
-			plr_bsy = false;
-			return 0;
+			eof = true;
+			break;
 		}
 
-		if (plr_vol[0] != 1.0 || plr_vol[1] != 1.0) {
-			short *sbuf = (short *)buf;
-			for (int j = 0, end = pos / 2; j < end; j+=2) {
-				sbuf[j]   *= plr_vol[0];
-				sbuf[j+1] *= plr_vol[1];
-			}
-		}
+		/* Keep the unscaled copy so a volume change can rescale this buffer while it waits in the queue */
+		float vol[2] = {p->vol[0], p->vol[1]};
+		plr_scale(p, (short *)buf, (short *)p->src[i], pos / p->fmt.nBlockAlign, p->tail, vol,
+			p->fmt.nSamplesPerSec * WAV_VOL_RAMP / 1000);
+		p->gain[i][0] = p->tail[0] = vol[0];
+		p->gain[i][1] = p->tail[1] = vol[1];
 
-		waveOutUnprepareHeader(plr_hw, hdr, sizeof(WAVEHDR));
+		waveOutUnprepareHeader(p->hw, hdr, sizeof(WAVEHDR));
 		hdr->lpData = buf;
 		hdr->dwBufferLength = pos;
 		hdr->dwUser = 0xCDDA7777;
 		hdr->dwFlags = 0;
 		hdr->dwLoops = 0;
 
-		plr_sta[i] = 1;
+		p->sta[i] = 1;
+
+		/* Submit what the head cache gave before paying for the file open, the next wake reads on */
+		if (!p->fp && !p->ce && p->hd && p->len && p->off >= p->hd->len) {
+			SetEvent(p->ev);
+			break;
+		}
 	}
 
-	for (int n = 0; n < WAV_BUF_CNT; n++, plr_que = (plr_que+1) % WAV_BUF_CNT) {
-		if (plr_sta[plr_que] != 1) break;
-		WAVEHDR *hdr = &plr_hdr[plr_que];
-		if (waveOutPrepareHeader(plr_hw, hdr, sizeof(WAVEHDR)) != MMSYSERR_NOERROR ||
-		    waveOutWrite(plr_hw, hdr, sizeof(WAVEHDR)) != MMSYSERR_NOERROR) {
-			SetEvent(plr_ev);
+	for (int n = 0; n < plr_bufs; n++, p->que = (p->que+1) % plr_bufs) {
+		if (p->sta[p->que] != 1) break;
+		WAVEHDR *hdr = &p->hdr[p->que];
+		if (plr_rf) {
+			plr_render_mix(p, hdr->lpData, hdr->dwBufferLength);
+			hdr->dwFlags = WHDR_DONE;
+			SetEvent(p->ev);
+		} else if (waveOutPrepareHeader(p->hw, hdr, sizeof(WAVEHDR)) != MMSYSERR_NOERROR ||
+		    waveOutWrite(p->hw, hdr, sizeof(WAVEHDR)) != MMSYSERR_NOERROR) {
+			InterlockedIncrement(&plr_st_fail);
+			SetEvent(p->ev);
 			Sleep(1);
 			break;
 		}
-		plr_sta[plr_que] = 0;
+		p->sta[p->que] = 0;
+		p->at[p->que] = p->bytes;
+		p->bytes += hdr->dwBufferLength;
+		if (!p->sub++) plr_hist(PLR_HIST_START, plr_usec() - p->t0);
+		InterlockedIncrement(&plr_st_submit);
+		plr_hist(PLR_HIST_WAKE, plr_usec() - wake);
 	}
 
-	plr_bsy = false;
-	return 1;
+	if (plr_rf) {
+		EnterCriticalSection(&plr_rcs);
+		plr_wus += plr_usec() - wake;
+		LeaveCriticalSection(&plr_rcs);
+	}
+
+	/* End of range once everything read has been submitted, unless a seek came in meanwhile or a loop end is reported
+	   first. A lead queued by plr_loop ends once it has played, plr_extend may still come meanwhile. */
+	if (eof && p->sta[p->que] == 0) {
+		bool lead = p->loop_buf >= 0;
+		for (int i = 0; i < plr_bufs && p->lead && !lead; i++) {
+			if (!(p->hdr[i].dwFlags & WHDR_DONE)) lead = true;
+		}
+		EnterCriticalSection(&p->cs);
+		if (p->req || p->ext || ret == 2) SetEvent(p->ev);
+		else if (!lead) p->run = false;
+		LeaveCriticalSection(&p->cs);
+		if (!p->run) {
+			p->bsy = false;
+			return 0;
+		}
+	}
+
+	p->bsy = false;
+	return ret;
 }
@@ -1,8 +1,47 @@
+#define PLR_HIST_WAKE	(0)	// pump wake-to-submit latency
+#define PLR_HIST_READ	(1)	// fread latency
+#define PLR_HIST_CMD	(2)	// MCI command latency
+#define PLR_HIST_START	(3)	// PLAY or seek to first buffer submitted
+#define PLR_HIST_TIMER	(4)	// timer engine lateness past the due time
+#define PLR_HIST_SOUND	(5)	// asynchronous PlaySound call latency
+#define PLR_HIST_STOP	(6)	// STOP to the device reset
+#define PLR_HIST_PAUSE	(7)	// PAUSE or RESUME to the device paused or restarted
+#define PLR_HIST_MIDI	(8)	// sequencer event lateness past its due time
+#define PLR_HIST_CNT	(9)
+#define PLR_HIST_LEN	(20)	// log2 microsecond buckets, up to ~1s
+
+struct player;
+
+void plr_init();
+struct player *plr_new();
+void plr_free(struct player *p);
 void plr_volume(int vol_l, int vol_r);
-void plr_reset(BOOL wait);
-void plr_stop();
-void plr_pause();
-void plr_resume();
-int plr_pump();
-int plr_play(const char *path, unsigned int from, unsigned int to);
-int plr_length(const char *path);
+void plr_gain(struct player *p, int vol);
+void plr_reset(struct player *p, BOOL wait);
+void plr_stop(struct player *p);
+void plr_pause(struct player *p);
+void plr_resume(struct player *p);
+int plr_pump(struct player *p);
+int plr_play(struct player *p, const char *path, unsigned int from, unsigned int to);
+int plr_seek(struct player *p, const char *path, unsigned int from, unsigned int to);
+void plr_loop(struct player *p, unsigned int from, unsigned int to, unsigned int lead);
+void plr_extend(struct player *p);
+void plr_depth(unsigned int min_ms, unsigned int max_ms);
+DWORD plr_remaining(struct player *p);
+unsigned int plr_length(const char *path);
+unsigned int plr_probe(const char *path, WAVEFORMATEX *fmt);
+void plr_head_init(unsigned int ms, int count);
+unsigned int plr_head_load(int slot, const char *path);
+void plr_cache_init(unsigned int mb);
+void plr_cache_prefetch(const char **paths, int count);
+void plr_cache_close();
+ULONGLONG plr_ticks_usec(LONGLONG ticks, LONGLONG freq);
+unsigned int plr_usec();
+void plr_hist(int hist, unsigned int usec);
+void plr_sound(BOOL hit);
+void plr_relay(BOOL driver);
+void plr_sequence(BOOL hit);
+int plr_stats(char *buf, int len, BOOL full);
+int plr_render(const char *path);
+void plr_render_close();
+DWORD plr_clock(struct player *p);
@@ -0,0 +1,669 @@
+/*
+ * This file is part of wav-winmm, a fork of ogg-winmm.
+ *
+ * wav-winmm is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2,
+ * as published by the Free Software Foundation.
+ *
+ * wav-winmm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <windows.h>
+#include <string.h>
+#include "player.h"
+#include "sequencer.h"
+
+#define SEQ_SONGS	(8)				// Parsed songs kept for the next open of the same file
+#define SEQ_MAX_SIZE	(4*1024*1024)			// Larger files are left to the system sequencer
+#define SEQ_LEAD	(500)				// Microseconds early an event is sent rather than waiting another timer period
+#define SEQ_BATCH	(64)				// Events sent per hold of the lock, a dense chord does not hold off STOP
+#define SEQ_VOLUME	(100)				// Channel volume a song starts with until it sets its own
+
+/* One channel message of a song at its absolute tick */
+struct seq_event
+{
+	DWORD tick;
+	DWORD msg; // status | data1 << 8 | data2 << 16, as midiOutShortMsg takes it
+};
+
+/* Tempo map segment: from tick on, every tick lasts upq / division microseconds */
+struct seq_tempo
+{
+	DWORD tick;
+	ULONGLONG usec; // song time at tick
+	DWORD upq; // microseconds per quarter note
+};
+
+/* A Standard MIDI File parsed into one event array, all tracks merged in time order */
+struct seq_song
+{
+	char path[MAX_PATH]; // empty once the file changed on disk, freed with the last reference
+	DWORD size;
+	FILETIME mtime;
+	struct seq_event *ev;
+	int cnt;
+	struct seq_tempo *tempo;
+	int tempos;
+	DWORD division; // ticks per quarter note
+	ULONGLONG end; // song time of the last tick in microseconds
+	DWORD used; // LRU stamp
+	int refs; // open devices, never evicted while set
+};
+
+/* The stream being played: one song at a time on the one MIDI output */
+struct seq_stream
+{
+	struct seq_song *song; // NULL while stopped
+	void *arg; // owner, handed back to done
+	seq_done_cb done;
+	int next; // next event to send
+	int last; // first event past the range
+	ULONGLONG end; // song time the range ends at
+	ULONGLONG base; // clock at song time 0
+	ULONGLONG paused; // clock when paused, 0 while playing
+};
+
+static struct seq_song	seqSongs[SEQ_SONGS];
+static DWORD		seqStamp	= 0;
+static struct seq_stream	seqPlay;
+static CRITICAL_SECTION	seqCs;
+static HANDLE		seqEv		= NULL;
+static HANDLE		seqThread	= NULL;
+static volatile BOOL	seqQuit		= FALSE;
+static void * volatile	seqCalling	= NULL; // owner whose stream ended, its done callback is running on the thread
+static HMIDIOUT		seqOut		= NULL;
+static BOOL		seqOpening	= FALSE; // midiOutOpen in progress on some thread
+static BOOL		seqReady	= FALSE;
+static int		seqVol		= 100;
+static LARGE_INTEGER	seqFreq;
+
+void seq_init(int vol)
+{
+	if (!QueryPerformanceFrequency(&seqFreq)) return;
+	InitializeCriticalSection(&seqCs);
+	seqVol = vol < 0 || vol > 100 ? 100 : vol;
+	seqReady = TRUE;
+}
+
+static ULONGLONG seq_now()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return plr_ticks_usec(now.QuadPart, seqFreq.QuadPart);
+}
+
+static DWORD seq_be(const BYTE *p, int n)
+{
+	DWORD v = 0;
+	while (n--) v = v << 8 | *p++;
+	return v;
+}
+
+/* Variable-length quantity, at most four bytes */
+static DWORD seq_vlq(const BYTE **p, const BYTE *end)
+{
+	DWORD v = 0;
+	for (int i = 0; i < 4 && *p < end; i++) {
+		BYTE b = *(*p)++;
+		v = v << 7 | (b & 0x7F);
+		if (!(b & 0x80)) break;
+	}
+	return v;
+}
+
+/* Stable merge sort by tick, events of one tick keep their track order */
+static void seq_sort(struct seq_event *ev, struct seq_event *tmp, int cnt)
+{
+	for (int w = 1; w < cnt; w *= 2) {
+		for (int lo = 0; lo < cnt; lo += 2 * w) {
+			int mid = lo + w < cnt ? lo + w : cnt, hi = lo + 2 * w < cnt ? lo + 2 * w : cnt;
+			int a = lo, b = mid, o = lo;
+			while (a < mid && b < hi) tmp[o++] = ev[b].tick < ev[a].tick ? ev[b++] : ev[a++];
+			while (a < mid) tmp[o++] = ev[a++];
+			while (b < hi) tmp[o++] = ev[b++];
+		}
+		memcpy(ev, tmp, cnt * sizeof(*ev));
+	}
+}
+
+/* The tempo segment a tick falls in */
+static const struct seq_tempo *seq_segment(const struct seq_song *s, DWORD tick)
+{
+	int lo = 0, hi = s->tempos - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (s->tempo[mid].tick <= tick) lo = mid;
+		else hi = mid - 1;
+	}
+	return &s->tempo[lo];
+}
+
+/* Song time of a tick in microseconds */
+static ULONGLONG seq_usec(const struct seq_song *s, DWORD tick)
+{
+	const struct seq_tempo *t = seq_segment(s, tick);
+	return t->usec + (ULONGLONG)(tick - t->tick) * t->upq / s->division;
+}
+
+/* First event at or after a song time: the tempo map gives the tick, the event array is searched for it */
+static int seq_find(const struct seq_song *s, ULONGLONG usec)
+{
+	int lo = 0, hi = s->tempos - 1;
+	while (lo < hi) {
+		int mid = (lo + hi + 1) / 2;
+		if (s->tempo[mid].usec <= usec) lo = mid;
+		else hi = mid - 1;
+	}
+	const struct seq_tempo *t = &s->tempo[lo];
+	ULONGLONG tick = t->tick + ((usec - t->usec) * s->division + t->upq - 1) / t->upq;
+
+	lo = 0;
+	hi = s->cnt;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (s->ev[mid].tick < tick) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+/* Parse a file image into s, false for anything but a format 0 or 1 SMF or RMID file */
+static bool seq_parse(struct seq_song *s, const BYTE *data, DWORD size)
+{
+	const BYTE *p = data, *end = data + size;
+
+	/* RMID files wrap the SMF in the data chunk of a RIFF file */
+	if (size >= 12 && !memcmp(p, "RIFF", 4) && !memcmp(p + 8, "RMID", 4)) {
+		for (p += 12; end - p >= 8 && memcmp(p, "data", 4); ) {
+			DWORD len = *(DWORD *)(p + 4);
+			if (len > (DWORD)(end - p) - 8) return false;
+			p += 8 + ((len + 1) & ~1u);
+		}
+		if (end - p < 8) return false;
+		DWORD len = *(DWORD *)(p + 4);
+		p += 8;
+		if (len < (DWORD)(end - p)) end = p + len;
+	}
+
+	if (end - p < 14 || memcmp(p, "MThd", 4)) return false;
+	DWORD hlen = seq_be(p + 4, 4);
+	int format = seq_be(p + 8, 2), tracks = seq_be(p + 10, 2);
+	DWORD division = seq_be(p + 12, 2);
+	if (format > 1 || !division || hlen < 6 || hlen > (DWORD)(end - p) - 8) return false;
+	p += 8 + hlen;
+
+	/* Every channel event takes at least two bytes and every tempo event seven, the arrays are trimmed after parsing */
+	int cap = (end - p) / 2 + 1, tcap = (end - p) / 7 + 2;
+	s->ev = HeapAlloc(GetProcessHeap(), 0, cap * sizeof(*s->ev));
+	s->tempo = HeapAlloc(GetProcessHeap(), 0, tcap * sizeof(*s->tempo));
+	if (!s->ev || !s->tempo) return false;
+	s->cnt = 0;
+	s->tempos = 1;
+	s->tempo[0].tick = 0;
+	s->tempo[0].usec = 0;
+	s->tempo[0].upq = 500000; // 120 bpm until the song sets a tempo
+
+	/* SMPTE division: ticks are a fixed fraction of a second and tempo events do not apply */
+	bool smpte = division & 0x8000;
+	if (smpte) {
+		division = -(signed char)(division >> 8) * (division & 0xFF);
+		s->tempo[0].upq = 1000000;
+		if (!division) return false;
+	}
+	s->division = division;
+
+	DWORD last = 0;
+	for (int t = 0; t < tracks && end - p >= 8; ) {
+		DWORD len = seq_be(p + 4, 4);
+		const BYTE *q = p + 8, *tend = len < (DWORD)(end - q) ? q + len : end;
+		bool track = !memcmp(p, "MTrk", 4);
+		p = tend;
+		if (!track) continue; // unknown chunks are skipped
+
+		DWORD tick = 0;
+		BYTE status = 0;
+		while (q < tend) {
+			tick += seq_vlq(&q, tend);
+			if (q >= tend) break;
+			BYTE b = *q;
+			if (b & 0x80) q++;
+			else if (status) b = status; // running status, b was the first data byte
+			else break;
+
+			if (b == 0xFF) {
+				if (q >= tend) break;
+				BYTE type = *q++;
+				DWORD n = seq_vlq(&q, tend);
+				if (n > (DWORD)(tend - q)) break;
+				if (type == 0x51 && n == 3 && !smpte) {
+					s->tempo[s->tempos].tick = tick;
+					s->tempo[s->tempos++].upq = seq_be(q, 3);
+				}
+				q += n;
+				status = 0;
+				if (type == 0x2F) break; // end of track
+			} else if (b == 0xF0 || b == 0xF7) {
+				DWORD n = seq_vlq(&q, tend);
+				if (n > (DWORD)(tend - q)) break;
+				q += n; // system exclusive messages are not sent
+				status = 0;
+			} else if (b > 0xF0) {
+				break; // not valid in a file
+			} else {
+				int n = (b & 0xE0) == 0xC0 ? 1 : 2; // program change and channel pressure take one data byte
+				if (tend - q < n) break;
+				s->ev[s->cnt].tick = tick;
+				s->ev[s->cnt++].msg = b | q[0] << 8 | (n == 2 ? q[1] << 16 : 0);
+				q += n;
+				status = b;
+			}
+		}
+		if (tick > last) last = tick;
+		t++;
+	}
+
+	/* Tracks were appended one after the other, merge them and build the tempo map from the changes in time order */
+	struct seq_event *tmp = HeapAlloc(GetProcessHeap(), 0, (s->cnt + 1) * sizeof(*tmp));
+	if (!tmp) return false;
+	seq_sort(s->ev, tmp, s->cnt);
+	HeapFree(GetProcessHeap(), 0, tmp);
+
+	for (int i = 2; i < s->tempos; i++) {
+		struct seq_tempo t = s->tempo[i];
+		int j = i;
+		for (; j > 1 && s->tempo[j-1].tick > t.tick; j--) s->tempo[j] = s->tempo[j-1];
+		s->tempo[j] = t;
+	}
+	int n = 1;
+	for (int i = 1; i < s->tempos; i++) {
+		struct seq_tempo *prev = &s->tempo[n-1];
+		if (s->tempo[i].tick == prev->tick) {
+			prev->upq = s->tempo[i].upq;
+			continue;
+		}
+		s->tempo[n].tick = s->tempo[i].tick;
+		s->tempo[n].upq = s->tempo[i].upq;
+		s->tempo[n].usec = prev->usec + (ULONGLONG)(s->tempo[n].tick - prev->tick) * prev->upq / division;
+		n++;
+	}
+	s->tempos = n;
+	s->end = seq_usec(s, last);
+
+	struct seq_event *ev = HeapReAlloc(GetProcessHeap(), 0, s->ev, (s->cnt + 1) * sizeof(*s->ev));
+	struct seq_tempo *tempo = HeapReAlloc(GetProcessHeap(), 0, s->tempo, s->tempos * sizeof(*s->tempo));
+	if (ev) s->ev = ev;
+	if (tempo) s->tempo = tempo;
+	return true;
+}
+
+static void seq_free(struct seq_song *s)
+{
+	if (s->ev) HeapFree(GetProcessHeap(), 0, s->ev);
+	if (s->tempo) HeapFree(GetProcessHeap(), 0, s->tempo);
+	memset(s, 0, sizeof(*s));
+}
+
+/* Read and parse a file outside the lock, the scheduler keeps running meanwhile */
+static bool seq_load(struct seq_song *s, const char *path, DWORD size)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) return false;
+	BYTE *data = HeapAlloc(GetProcessHeap(), 0, size);
+	bool ok = data && fread(data, 1, size, f) == size && seq_parse(s, data, size);
+	fclose(f);
+	if (data) HeapFree(GetProcessHeap(), 0, data);
+	if (!ok) seq_free(s);
+	return ok;
+}
+
+/* The MIDI output stays open from the first song on, opening it is what makes the system sequencer slow to start */
+static BOOL seq_output()
+{
+	EnterCriticalSection(&seqCs);
+	while (seqOpening) {
+		LeaveCriticalSection(&seqCs);
+		Sleep(1);
+		EnterCriticalSection(&seqCs);
+	}
+	BOOL open = seqOut != NULL;
+	if (!open) seqOpening = TRUE;
+	LeaveCriticalSection(&seqCs);
+	if (open) return TRUE;
+
+	HMIDIOUT out = NULL;
+	if (midiOutOpen(&out, MIDI_MAPPER, 0, 0, CALLBACK_NULL) != MMSYSERR_NOERROR) out = NULL;
+	EnterCriticalSection(&seqCs);
+	seqOut = out;
+	seqOpening = FALSE;
+	LeaveCriticalSection(&seqCs);
+	return out != NULL;
+}
+
+/* Parsed song for a file, from the cache unless it changed on disk. NULL leaves the file to the system sequencer. */
+struct seq_song *seq_open(const char *path)
+{
+	WIN32_FILE_ATTRIBUTE_DATA fa;
+	if (!seqReady || !GetFileAttributesEx(path, GetFileExInfoStandard, &fa)) return NULL;
+	if (fa.nFileSizeHigh || !fa.nFileSizeLow || fa.nFileSizeLow > SEQ_MAX_SIZE || (fa.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) return NULL;
+	if (!seq_output()) return NULL;
+
+	struct seq_song *s = NULL, parsed;
+	bool hit = false;
+	for (int pass = 0; pass < 2 && !s; pass++) {
+		EnterCriticalSection(&seqCs);
+		for (int i = 0; i < SEQ_SONGS && !s; i++) {
+			struct seq_song *c = &seqSongs[i];
+			if (!c->path[0] || stricmp(c->path, path)) continue;
+			if (c->size == fa.nFileSizeLow && !memcmp(&c->mtime, &fa.ftLastWriteTime, sizeof(FILETIME))) {
+				s = c;
+				hit = pass == 0;
+			} else if (c->refs) {
+				c->path[0] = '\0'; // still open elsewhere, freed with its last reference
+			} else {
+				seq_free(c);
+			}
+		}
+		if (!s && pass == 1) {
+			/* Parsed by this call: the least recently used song nobody has open makes room for it */
+			struct seq_song *lru = NULL;
+			for (int i = 0; i < SEQ_SONGS; i++) {
+				struct seq_song *c = &seqSongs[i];
+				if (!c->ev) {
+					lru = c;
+					break;
+				}
+				if (!c->refs && c->path[0] && (!lru || c->used - lru->used > 0x80000000u)) lru = c;
+			}
+			if (lru) {
+				seq_free(lru);
+				*lru = parsed;
+				snprintf(lru->path, sizeof(lru->path), "%s", path);
+				lru->size = fa.nFileSizeLow;
+				lru->mtime = fa.ftLastWriteTime;
+				s = lru;
+			} else {
+				seq_free(&parsed);
+			}
+		} else if (s && pass == 1) {
+			seq_free(&parsed); // another open parsed the same file first
+		}
+		if (s) {
+			s->used = ++seqStamp;
+			s->refs++;
+		}
+		LeaveCriticalSection(&seqCs);
+
+		if (!s && pass == 0) {
+			memset(&parsed, 0, sizeof(parsed));
+			if (!seq_load(&parsed, path, fa.nFileSizeLow)) break;
+		}
+	}
+	if (s) plr_sequence(hit);
+	return s;
+}
+
+void seq_release(struct seq_song *s)
+{
+	if (!s) return;
+	EnterCriticalSection(&seqCs);
+	if (!--s->refs && !s->path[0]) seq_free(s);
+	LeaveCriticalSection(&seqCs);
+}
+
+unsigned int seq_length(struct seq_song *s)
+{
+	return s->end / 1000;
+}
+
+/* Channel volume is where MIDIVolume applies, every event setting it is scaled on its way out */
+static DWORD seq_scale(DWORD msg)
+{
+	if ((msg & 0xF0) == 0xB0 && (msg >> 8 & 0x7F) == 7 && seqVol != 100) {
+		msg = (msg & 0xFFFF) | ((msg >> 16 & 0x7F) * seqVol / 100) << 16;
+	}
+	return msg;
+}
+
+/* Release held notes and the sustain pedal on every channel, call with seqCs held */
+static void seq_silence()
+{
+	for (DWORD ch = 0; ch < 16; ch++) {
+		midiOutShortMsg(seqOut, 0xB0 | ch | 64 << 8);
+		midiOutShortMsg(seqOut, 0xB0 | ch | 123 << 8);
+	}
+}
+
+/* Send the programs, controllers and pitch bends the events before a start point left behind, call with seqCs held */
+static void seq_chase(const struct seq_song *s, int first)
+{
+	static signed char ctl[16][128];
+	short prog[16], bend[16];
+	memset(ctl, -1, sizeof(ctl));
+	for (int ch = 0; ch < 16; ch++) {
+		prog[ch] = bend[ch] = -1;
+		ctl[ch][7] = SEQ_VOLUME;
+	}
+	for (int i = 0; i < first; i++) {
+		DWORD msg = s->ev[i].msg, ch = msg & 0x0F;
+		switch (msg & 0xF0) {
+			case 0xB0:
+				ctl[ch][msg >> 8 & 0x7F] = msg >> 16 & 0x7F;
+				break;
+			case 0xC0:
+				prog[ch] = msg >> 8 & 0x7F;
+				break;
+			case 0xE0:
+				bend[ch] = msg >> 8 & 0x3FFF;
+				break;
+		}
+	}
+	for (DWORD ch = 0; ch < 16; ch++) {
+		if (prog[ch] >= 0) midiOutShortMsg(seqOut, 0xC0 | ch | prog[ch] << 8);
+		for (DWORD c = 0; c < 120; c++) { // 120 and up are channel mode messages, not state
+			if (ctl[ch][c] >= 0) midiOutShortMsg(seqOut, seq_scale(0xB0 | ch | c << 8 | ctl[ch][c] << 16));
+		}
+		if (bend[ch] >= 0) midiOutShortMsg(seqOut, 0xE0 | ch | bend[ch] << 8);
+	}
+}
+
+/* End the stream, call with seqCs held. The owner's done callback is returned to be called after the lock is left. */
+static struct seq_stream seq_halt()
+{
+	struct seq_stream old = seqPlay;
+	if (old.song) {
+		seq_silence();
+		ULONGLONG now = old.paused ? old.paused : seq_now();
+		old.base = now > old.base ? now - old.base : 0; // song time reached
+		if (old.base > old.end) old.base = old.end;
+	}
+	seqPlay.song = NULL;
+	seqPlay.arg = NULL;
+	return old;
+}
+
+/* Whole timer periods to sleep before an event: rounded down, the wake short of it sleeps once more or sends within SEQ_LEAD */
+static DWORD seq_wait(ULONGLONG due, ULONGLONG now)
+{
+	DWORD ms = (DWORD)((due - now) / 1000);
+	return ms ? ms : 1;
+}
+
+/* Scheduling thread: sends every due event of the stream and sleeps until the next one */
+static DWORD WINAPI seq_main(void *unused)
+{
+	BOOL period = FALSE;
+	while (!seqQuit) {
+		DWORD wait = INFINITE;
+		struct seq_stream done = {0};
+		EnterCriticalSection(&seqCs);
+		struct seq_stream *st = &seqPlay;
+		if (st->song && !st->paused) {
+			ULONGLONG now = seq_now();
+			int n = 0;
+			while (st->next < st->last && n < SEQ_BATCH) {
+				ULONGLONG due = st->base + seq_usec(st->song, st->song->ev[st->next].tick);
+				if (due > now + SEQ_LEAD) {
+					wait = seq_wait(due, now);
+					break;
+				}
+				plr_hist(PLR_HIST_MIDI, now > due ? (unsigned int)(now - due) : 0);
+				midiOutShortMsg(seqOut, seq_scale(st->song->ev[st->next++].msg));
+				n++;
+			}
+			if (n == SEQ_BATCH) {
+				wait = 0;
+			} else if (st->next >= st->last) {
+				ULONGLONG due = st->base + st->end;
+				if (due <= now + SEQ_LEAD) done = seq_halt();
+				else wait = seq_wait(due, now);
+			}
+		}
+		BOOL active = st->song && !st->paused;
+		if (done.song) seqCalling = done.arg;
+		LeaveCriticalSection(&seqCs);
+
+		/* A 1 ms timer period only while a song plays */
+		if (active != period) {
+			if (active) timeBeginPeriod(1);
+			else timeEndPeriod(1);
+			period = active;
+		}
+
+		if (done.song) {
+			done.done(done.arg, done.base / 1000, TRUE);
+			seqCalling = NULL;
+		} else if (wait) {
+			WaitForSingleObject(seqEv, wait);
+		}
+	}
+	if (period) timeEndPeriod(1);
+	return 0;
+}
+
+/* Start the scheduling thread on first use, never from DllMain */
+static BOOL seq_start()
+{
+	EnterCriticalSection(&seqCs);
+	if (!seqThread && !seqQuit) {
+		DWORD id;
+		seqEv = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (seqEv) seqThread = CreateThread(NULL, 0, seq_main, NULL, 0, &id);
+		if (seqThread) {
+			SetThreadPriority(seqThread, THREAD_PRIORITY_TIME_CRITICAL);
+		} else if (seqEv) {
+			CloseHandle(seqEv);
+			seqEv = NULL;
+		}
+	}
+	LeaveCriticalSection(&seqCs);
+	return seqThread != NULL;
+}
+
+/* Play from..to milliseconds of a song, to == -1 plays to its end. A stream another owner had playing is ended first. */
+BOOL seq_play(struct seq_song *s, unsigned int from, unsigned int to, seq_done_cb done, void *arg)
+{
+	if (!seqReady || !seq_start()) return FALSE;
+	while (seqCalling == arg) Sleep(1); // a late end of its last range must not land on this one
+
+	EnterCriticalSection(&seqCs);
+	struct seq_stream old = seq_halt();
+	ULONGLONG end = to == -1 ? s->end : (ULONGLONG)to * 1000;
+	if (end > s->end) end = s->end;
+	seqPlay.song = s;
+	seqPlay.arg = arg;
+	seqPlay.done = done;
+	seqPlay.next = seq_find(s, (ULONGLONG)from * 1000);
+	seqPlay.last = to == -1 ? s->cnt : seq_find(s, end);
+	seqPlay.end = end;
+	seqPlay.paused = 0;
+	seq_chase(s, seqPlay.next);
+	seqPlay.base = seq_now() - (ULONGLONG)from * 1000;
+	SetEvent(seqEv);
+	LeaveCriticalSection(&seqCs);
+
+	if (old.song) old.done(old.arg, old.base / 1000, FALSE);
+	return TRUE;
+}
+
+/* Stop the stream if arg owns it. Its done callback has run when this returns, also one for a range that just ended. */
+void seq_stop(void *arg)
+{
+	if (!seqReady) return;
+	EnterCriticalSection(&seqCs);
+	struct seq_stream old = {0};
+	if (seqPlay.song && seqPlay.arg == arg) old = seq_halt();
+	LeaveCriticalSection(&seqCs);
+	if (old.song) old.done(old.arg, old.base / 1000, FALSE);
+	while (seqCalling == arg) Sleep(1);
+}
+
+void seq_pause(void *arg)
+{
+	if (!seqReady) return;
+	EnterCriticalSection(&seqCs);
+	if (seqPlay.song && seqPlay.arg == arg && !seqPlay.paused) {
+		seqPlay.paused = seq_now();
+		seq_silence();
+	}
+	LeaveCriticalSection(&seqCs);
+}
+
+void seq_resume(void *arg)
+{
+	if (!seqReady) return;
+	EnterCriticalSection(&seqCs);
+	if (seqPlay.song && seqPlay.arg == arg && seqPlay.paused) {
+		seqPlay.base += seq_now() - seqPlay.paused;
+		seqPlay.paused = 0;
+		SetEvent(seqEv);
+	}
+	LeaveCriticalSection(&seqCs);
+}
+
+/* Song position of the stream arg owns in milliseconds, -1 when it has none */
+unsigned int seq_position(void *arg)
+{
+	unsigned int ms = -1;
+	if (!seqReady) return ms;
+	EnterCriticalSection(&seqCs);
+	if (seqPlay.song && seqPlay.arg == arg) {
+		ULONGLONG now = seqPlay.paused ? seqPlay.paused : seq_now();
+		ULONGLONG pos = now > seqPlay.base ? now - seqPlay.base : 0;
+		ms = (pos > seqPlay.end ? seqPlay.end : pos) / 1000;
+	}
+	LeaveCriticalSection(&seqCs);
+	return ms;
+}
+
+/* Stop playback and the thread, close the output and drop the parsed songs */
+void seq_close()
+{
+	if (!seqReady) return;
+	EnterCriticalSection(&seqCs);
+	seq_halt();
+	seqQuit = TRUE;
+	LeaveCriticalSection(&seqCs);
+	if (seqThread) {
+		SetEvent(seqEv);
+		WaitForSingleObject(seqThread, INFINITE);
+		CloseHandle(seqThread);
+		CloseHandle(seqEv);
+		seqThread = NULL;
+		seqEv = NULL;
+	}
+	if (seqOut) {
+		midiOutReset(seqOut);
+		midiOutClose(seqOut);
+		seqOut = NULL;
+	}
+	for (int i = 0; i < SEQ_SONGS; i++) seq_free(&seqSongs[i]);
+}
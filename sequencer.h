@@ -0,0 +1,14 @@
+struct seq_song;
+
+typedef void (*seq_done_cb)(void *arg, unsigned int ms, BOOL end);
+
+void seq_init(int vol);
+void seq_close();
+struct seq_song *seq_open(const char *path);
+void seq_release(struct seq_song *s);
+unsigned int seq_length(struct seq_song *s);
+BOOL seq_play(struct seq_song *s, unsigned int from, unsigned int to, seq_done_cb done, void *arg);
+void seq_stop(void *arg);
+void seq_pause(void *arg);
+void seq_resume(void *arg);
+unsigned int seq_position(void *arg);
@@ -1,5 +1,18 @@
 void stub_midivol(int vol);
 void stub_wavevol(int vol);
+void stub_timer(int enable);
+void stub_timer_close();
+void stub_mmio(int enable);
+void stub_sound(int kb);
+void stub_joyprobe(int ms);
+void stub_cdcheck(int enable);
 void unloadRealDLL();
 MCIERROR WINAPI relay_mciSendCommandA(MCIDEVICEID a0, UINT a1, DWORD a2, DWORD a3);
 MCIERROR WINAPI relay_mciSendStringA(LPCSTR a0, LPSTR a1, UINT a2, HWND a3);
+MCIERROR WINAPI relay_mciSendCommandW(MCIDEVICEID a0, UINT a1, DWORD a2, DWORD a3);
+MCIERROR WINAPI relay_mciSendStringW(LPCWSTR a0, LPWSTR a1, UINT a2, HWND a3);
+MCIDEVICEID WINAPI relay_mciGetDeviceIDA(LPCSTR a0);
+MCIDEVICEID WINAPI relay_mciGetDeviceIDW(LPCWSTR a0);
+BOOL WINAPI relay_mciExecute(LPCSTR a0);
+BOOL WINAPI relay_mciGetErrorStringA(MCIERROR a0, LPSTR a1, UINT a2);
+BOOL WINAPI relay_mciGetErrorStringW(MCIERROR a0, LPWSTR a1, UINT a2);
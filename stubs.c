@@ -5,7 +5,6 @@
 
 static float midiVol = 1.0;
 static float waveVol = 1.0;
-static int waveBits = -1;
 
 static HINSTANCE realWinmmDLL = NULL;
 
@@ -66,16 +65,193 @@ MMRESULT WINAPI fake_midiStreamOut(HMIDISTRM a0, LPMIDIHDR a1, UINT a2)
 	return (*funcp)(a0, a1, a2);
 }
 
-MMRESULT WINAPI fake_waveOutOpen(LPHWAVEOUT a0, UINT a1, LPCWAVEFORMATEX a2, DWORD a3, DWORD a4, DWORD a5)
+/* Gain is applied into shadow buffers submitted with our own headers, the game's buffers are never touched. */
+/* Handles opened with scaled volume get a proxy callback that completes the game's header and forwards the message. */
+#define WAVE_HANDLES	(32)
+#define WAVE_CLASSES	(16)	// shadow buffer size classes: 1KB << n, up to 32MB
+
+struct wave_shadow
+{
+	struct wave_shadow *next;
+	WAVEHDR wh;		/* our header, submitted in place of the game's */
+	LPWAVEHDR hdr;		/* the game's header while in flight */
+	int cls;		/* size class */
+	BOOL prepared;
+};
+
+struct wave_ctx
+{
+	volatile LONG used;
+	HWAVEOUT hwo;
+	DWORD type;		/* the game's callback */
+	DWORD_PTR callback;
+	DWORD_PTR instance;
+	int bits;
+	CRITICAL_SECTION cs;
+	struct wave_shadow *pool[WAVE_CLASSES];
+	struct wave_shadow *busy;
+};
+
+static struct wave_ctx waveCtx[WAVE_HANDLES];
+
+MMRESULT WINAPI fake_waveOutPrepareHeader(HWAVEOUT a0, LPWAVEHDR a1, UINT a2);
+MMRESULT WINAPI fake_waveOutUnprepareHeader(HWAVEOUT a0, LPWAVEHDR a1, UINT a2);
+
+static void wave_scale(void *dst, const void *src, DWORD len, int bits, float vol)
+{
+	if (bits == 16) {
+		const short *s = (const short *)src;
+		short *d = (short *)dst;
+		for (int i = 0, j = len/2; i < j; i++) {
+			d[i] = s[i] * vol;
+		}
+	} else { /* 8-bit PCM is unsigned */
+		const unsigned char *s = (const unsigned char *)src;
+		unsigned char *d = (unsigned char *)dst;
+		for (int i = 0, j = len; i < j; i++) {
+			d[i] = (s[i] - 128) * vol + 128;
+		}
+	}
+}
+
+static struct wave_ctx *wave_find(HWAVEOUT hwo)
+{
+	for (int i = 0; i < WAVE_HANDLES; i++) {
+		if (waveCtx[i].used && waveCtx[i].hwo == hwo) return &waveCtx[i];
+	}
+	return NULL;
+}
+
+static void wave_put(struct wave_ctx *ctx, struct wave_shadow *sh)
+{
+	sh->hdr = NULL;
+	sh->next = ctx->pool[sh->cls];
+	ctx->pool[sh->cls] = sh;
+}
+
+static struct wave_shadow *wave_get(struct wave_ctx *ctx, DWORD len)
+{
+	struct wave_shadow *sh = NULL;
+	int cls = 0;
+	while (cls < WAVE_CLASSES && (1024u << cls) < len) cls++;
+	if (cls == WAVE_CLASSES) return NULL;
+
+	EnterCriticalSection(&ctx->cs);
+	if (ctx->pool[cls]) {
+		sh = ctx->pool[cls];
+		ctx->pool[cls] = sh->next;
+	}
+	LeaveCriticalSection(&ctx->cs);
+
+	/* Only reached while the pool warms up */
+	if (!sh) {
+		sh = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(struct wave_shadow) + (1024u << cls));
+		if (!sh) return NULL;
+		sh->cls = cls;
+		sh->wh.lpData = (LPSTR)(sh + 1);
+	}
+
+	/* Keep the header prepared across submits of the same length */
+	if (sh->prepared && sh->wh.dwBufferLength != len) {
+		fake_waveOutUnprepareHeader(ctx->hwo, &sh->wh, sizeof(WAVEHDR));
+		sh->prepared = FALSE;
+	}
+	sh->wh.dwBufferLength = len;
+	sh->wh.dwFlags &= WHDR_PREPARED;
+	if (!sh->prepared) {
+		if (fake_waveOutPrepareHeader(ctx->hwo, &sh->wh, sizeof(WAVEHDR)) != MMSYSERR_NOERROR) {
+			EnterCriticalSection(&ctx->cs);
+			wave_put(ctx, sh);
+			LeaveCriticalSection(&ctx->cs);
+			return NULL;
+		}
+		sh->prepared = TRUE;
+	}
+	return sh;
+}
+
+/* Detach the shadow header from the in-flight list, NULL if it is not one of ours */
+static struct wave_shadow *wave_done(struct wave_ctx *ctx, LPWAVEHDR wh)
+{
+	for (struct wave_shadow **p = &ctx->busy; *p; p = &(*p)->next) {
+		if (&(*p)->wh == wh) {
+			struct wave_shadow *sh = *p;
+			*p = sh->next;
+			return sh;
+		}
+	}
+	return NULL;
+}
+
+static void CALLBACK wave_proc(HWAVEOUT hwo, UINT msg, DWORD_PTR inst, DWORD_PTR p1, DWORD_PTR p2)
+{
+	struct wave_ctx *ctx = (struct wave_ctx *)inst;
+
+	if (msg == WOM_DONE) {
+		EnterCriticalSection(&ctx->cs);
+		struct wave_shadow *sh = wave_done(ctx, (LPWAVEHDR)p1);
+		if (sh) {
+			LPWAVEHDR hdr = sh->hdr;
+			hdr->dwFlags = (hdr->dwFlags & ~WHDR_INQUEUE) | WHDR_DONE;
+			p1 = (DWORD_PTR)hdr;
+			wave_put(ctx, sh);
+		}
+		LeaveCriticalSection(&ctx->cs);
+	}
+
+	switch (ctx->type & CALLBACK_TYPEMASK) {
+		case CALLBACK_FUNCTION:
+			if (ctx->callback) ((LPDRVCALLBACK)ctx->callback)((HANDLE)hwo, msg, ctx->instance, p1, p2);
+			break;
+		case CALLBACK_EVENT:
+			SetEvent((HANDLE)ctx->callback);
+			break;
+		case CALLBACK_WINDOW:
+			PostMessage((HWND)ctx->callback, msg, (WPARAM)hwo, (LPARAM)p1);
+			break;
+		case CALLBACK_THREAD:
+			PostThreadMessage((DWORD)ctx->callback, msg, (WPARAM)hwo, (LPARAM)p1);
+			break;
+	}
+}
+
+MMRESULT WINAPI fake_waveOutOpen(LPHWAVEOUT a0, UINT a1, LPCWAVEFORMATEX a2, DWORD_PTR a3, DWORD_PTR a4, DWORD a5)
 {
-	static MMRESULT(WINAPI *funcp)(LPHWAVEOUT a0, UINT a1, LPCWAVEFORMATEX a2, DWORD a3, DWORD a4, DWORD a5) = NULL;
+	static MMRESULT(WINAPI *funcp)(LPHWAVEOUT a0, UINT a1, LPCWAVEFORMATEX a2, DWORD_PTR a3, DWORD_PTR a4, DWORD a5) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "waveOutOpen");
 
-	/* FIXME: waveOutOpen can be called multiple times with different sample bits for sound mixing */
-	/* However, it is almost always to be 16-bits; extremely rarely to be 8-bits or of a mixed-up */
-	if (a2) waveBits = a2->wBitsPerSample;
-	return (*funcp)(a0, a1, a2, a3, a4, a5);
+	/* our own CDDA player does its own volume control */
+	MEMORY_BASIC_INFORMATION mbi, self;
+	VirtualQuery(__builtin_return_address(0), &mbi, sizeof(MEMORY_BASIC_INFORMATION));
+	VirtualQuery(fake_waveOutOpen, &self, sizeof(MEMORY_BASIC_INFORMATION));
+
+	if ((waveVol == 1.0 && midiVol == 1.0) || !a0 || !a2 || (a5 & WAVE_FORMAT_QUERY) || mbi.AllocationBase == self.AllocationBase)
+		return (*funcp)(a0, a1, a2, a3, a4, a5);
+
+	struct wave_ctx *ctx = NULL;
+	for (int i = 0; i < WAVE_HANDLES && !ctx; i++) {
+		if (InterlockedCompareExchange(&waveCtx[i].used, 1, 0) == 0) ctx = &waveCtx[i];
+	}
+	if (!ctx) return (*funcp)(a0, a1, a2, a3, a4, a5); /* volume is not scaled on this handle */
+
+	ctx->hwo = NULL;
+	ctx->type = a5;
+	ctx->callback = a3;
+	ctx->instance = a4;
+	ctx->bits = a2->wBitsPerSample;
+	ctx->busy = NULL;
+	memset(ctx->pool, 0, sizeof(ctx->pool));
+	InitializeCriticalSection(&ctx->cs);
+
+	MMRESULT ret = (*funcp)(a0, a1, a2, (DWORD_PTR)wave_proc, (DWORD_PTR)ctx, (a5 & ~CALLBACK_TYPEMASK) | CALLBACK_FUNCTION);
+	if (ret != MMSYSERR_NOERROR) {
+		DeleteCriticalSection(&ctx->cs);
+		InterlockedExchange(&ctx->used, 0);
+		return ret;
+	}
+	ctx->hwo = *a0;
+	return ret;
 }
 
 /* on Windows Vista and later, waveOutSetVolume is always tied to master volume */
@@ -86,7 +262,9 @@ MMRESULT WINAPI fake_waveOutWrite(HWAVEOUT a0, LPWAVEHDR a1, UINT a2)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "waveOutWrite");
 
 	/* let owr own WAV wave pass through */
-	if ((waveVol != 1.0 || midiVol != 1.0 ) && a1 && a1->lpData && a1->dwUser != 0xCDDA7777) {
+	struct wave_ctx *ctx;
+	if ((waveVol != 1.0 || midiVol != 1.0 ) && a1 && a1->lpData && a1->dwUser != 0xCDDA7777 &&
+	    (a1->dwFlags & (WHDR_PREPARED | WHDR_INQUEUE)) == WHDR_PREPARED && (ctx = wave_find(a0))) {
 		/* Windows is f**ked up. MIDI synth driver converts MIDI to WAVE and then calls winmm.waveOutWrite!!! */
 		void *addr = __builtin_return_address(0);
 		char caller[MAX_PATH];
@@ -100,37 +278,62 @@ MMRESULT WINAPI fake_waveOutWrite(HWAVEOUT a0, LPWAVEHDR a1, UINT a2)
 		if (strstr(pos, "wdmaud.drv")) vol = midiVol;
 		else if (!strstr(pos, ".drv")) vol = waveVol;
 
-		if (vol != 1.0) {
-			short *wave16;
-			char *wave8;
-			switch (waveBits) {
-				case 16:
-					wave16 = (short *)a1->lpData;
-					for (int i = 0, j = a1->dwBufferLength/2; i < j; i++) {
-						wave16[i] *= vol;
-					}
-					break;
-				case 8:
-					wave8 = (char *)a1->lpData;
-					for (int i = 0, j = a1->dwBufferLength; i < j; i++) {
-						wave8[i] *= vol;
-					}
-					break;
-				default:
-					; /* WTF? */
+		struct wave_shadow *sh;
+		if (vol != 1.0 && (ctx->bits == 16 || ctx->bits == 8) && (sh = wave_get(ctx, a1->dwBufferLength))) {
+			wave_scale(sh->wh.lpData, a1->lpData, a1->dwBufferLength, ctx->bits, vol);
+			sh->wh.dwFlags |= a1->dwFlags & (WHDR_BEGINLOOP | WHDR_ENDLOOP);
+			sh->wh.dwLoops = a1->dwLoops;
+			sh->hdr = a1;
+
+			EnterCriticalSection(&ctx->cs);
+			sh->next = ctx->busy;
+			ctx->busy = sh;
+			a1->dwFlags = (a1->dwFlags & ~WHDR_DONE) | WHDR_INQUEUE;
+			LeaveCriticalSection(&ctx->cs);
+
+			MMRESULT ret = (*funcp)(a0, &sh->wh, sizeof(WAVEHDR));
+			if (ret != MMSYSERR_NOERROR) {
+				EnterCriticalSection(&ctx->cs);
+				if (wave_done(ctx, &sh->wh)) {
+					a1->dwFlags &= ~WHDR_INQUEUE;
+					wave_put(ctx, sh);
+				}
+				LeaveCriticalSection(&ctx->cs);
 			}
+			return ret;
 		}
 	}
 
 	return (*funcp)(a0, a1, a2);
 }
 
+/* Test mode: count MCI calls passed to the system winmm and fail the ones that left its CD audio driver loaded */
+static int cdCheck = 0;
+
+void stub_cdcheck(int enable) { cdCheck = enable; }
+
+static BOOL cd_check(const char *call)
+{
+	if (!cdCheck) return FALSE;
+	BOOL loaded = GetModuleHandleA("mcicda.dll") != NULL;
+	if (loaded && cdCheck == 1) {
+		char msg[128];
+		snprintf(msg, sizeof(msg), "wav-winmm: mcicda.dll loaded after relayed %s\n", call);
+		OutputDebugStringA(msg);
+		cdCheck = 2;
+		if (IsDebuggerPresent()) DebugBreak();
+	}
+	plr_relay(loaded);
+	return loaded;
+}
+
 MCIERROR WINAPI relay_mciSendCommandA(MCIDEVICEID a0, UINT a1, DWORD a2, DWORD a3)
 {
 	static MCIERROR(WINAPI *funcp)(MCIDEVICEID a0, UINT a1, DWORD a2, DWORD a3) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mciSendCommandA");
-	return (*funcp)(a0, a1, a2, a3);
+	MCIERROR ret = (*funcp)(a0, a1, a2, a3);
+	return cd_check("mciSendCommandA") ? MCIERR_HARDWARE : ret;
 }
 
 MCIERROR WINAPI relay_mciSendStringA(LPCSTR a0, LPSTR a1, UINT a2, HWND a3)
@@ -138,7 +341,67 @@ MCIERROR WINAPI relay_mciSendStringA(LPCSTR a0, LPSTR a1, UINT a2, HWND a3)
 	static MCIERROR(WINAPI *funcp)(LPCSTR a0, LPSTR a1, UINT a2, HWND a3) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mciSendStringA");
-	return (*funcp)(a0, a1, a2, a3);
+	MCIERROR ret = (*funcp)(a0, a1, a2, a3);
+	return cd_check("mciSendStringA") ? MCIERR_HARDWARE : ret;
+}
+
+MCIERROR WINAPI relay_mciSendCommandW(MCIDEVICEID a0, UINT a1, DWORD a2, DWORD a3)
+{
+	static MCIERROR(WINAPI *funcp)(MCIDEVICEID a0, UINT a1, DWORD a2, DWORD a3) = NULL;
+	if (funcp == NULL)
+		funcp = (void*)GetProcAddress(loadRealDLL(), "mciSendCommandW");
+	MCIERROR ret = (*funcp)(a0, a1, a2, a3);
+	return cd_check("mciSendCommandW") ? MCIERR_HARDWARE : ret;
+}
+
+MCIERROR WINAPI relay_mciSendStringW(LPCWSTR a0, LPWSTR a1, UINT a2, HWND a3)
+{
+	static MCIERROR(WINAPI *funcp)(LPCWSTR a0, LPWSTR a1, UINT a2, HWND a3) = NULL;
+	if (funcp == NULL)
+		funcp = (void*)GetProcAddress(loadRealDLL(), "mciSendStringW");
+	MCIERROR ret = (*funcp)(a0, a1, a2, a3);
+	return cd_check("mciSendStringW") ? MCIERR_HARDWARE : ret;
+}
+
+MCIDEVICEID WINAPI relay_mciGetDeviceIDA(LPCSTR a0)
+{
+	static MCIDEVICEID(WINAPI *funcp)(LPCSTR a0) = NULL;
+	if (funcp == NULL)
+		funcp = (void*)GetProcAddress(loadRealDLL(), "mciGetDeviceIDA");
+	return (*funcp)(a0);
+}
+
+MCIDEVICEID WINAPI relay_mciGetDeviceIDW(LPCWSTR a0)
+{
+	static MCIDEVICEID(WINAPI *funcp)(LPCWSTR a0) = NULL;
+	if (funcp == NULL)
+		funcp = (void*)GetProcAddress(loadRealDLL(), "mciGetDeviceIDW");
+	return (*funcp)(a0);
+}
+
+BOOL WINAPI relay_mciExecute(LPCSTR a0)
+{
+	static BOOL(WINAPI *funcp)(LPCSTR a0) = NULL;
+	if (funcp == NULL)
+		funcp = (void*)GetProcAddress(loadRealDLL(), "mciExecute");
+	BOOL ret = (*funcp)(a0);
+	return cd_check("mciExecute") ? FALSE : ret;
+}
+
+BOOL WINAPI relay_mciGetErrorStringA(MCIERROR a0, LPSTR a1, UINT a2)
+{
+	static BOOL(WINAPI *funcp)(MCIERROR a0, LPSTR a1, UINT a2) = NULL;
+	if (funcp == NULL)
+		funcp = (void*)GetProcAddress(loadRealDLL(), "mciGetErrorStringA");
+	return (*funcp)(a0, a1, a2);
+}
+
+BOOL WINAPI relay_mciGetErrorStringW(MCIERROR a0, LPWSTR a1, UINT a2)
+{
+	static BOOL(WINAPI *funcp)(MCIERROR a0, LPWSTR a1, UINT a2) = NULL;
+	if (funcp == NULL)
+		funcp = (void*)GetProcAddress(loadRealDLL(), "mciGetErrorStringW");
+	return (*funcp)(a0, a1, a2);
 }
 
 /**/
@@ -201,12 +464,189 @@ UINT WINAPI fake_mmsystemGetVersion()
 	return (*funcp)();
 }
 
+/* Sound cache: file and resource sounds are kept as WAV images and played with SND_MEMORY, WAVEVolume already applied */
+#define SOUND_ENTRIES	(64)
+
+struct snd_entry
+{
+	WCHAR path[MAX_PATH];	/* full path, empty for resources */
+	const void *res;	/* resource data */
+	DWORD size;
+	FILETIME mtime;
+	BYTE *data;		/* NULL: free slot */
+	DWORD stamp;		/* last use */
+	LONG refs;		/* PlaySound calls in flight */
+};
+
+static struct snd_entry sndCache[SOUND_ENTRIES];
+static struct snd_entry *sndCurrent = NULL;	/* handed to the last PlaySound that succeeded, may still be playing */
+static DWORD sndBudget = 0;	/* bytes, 0: disabled */
+static DWORD sndBytes = 0;
+static DWORD sndStamp = 0;
+static CRITICAL_SECTION sndCs;
+
+void stub_sound(int kb)
+{
+	if (kb <= 0) return;
+	InitializeCriticalSection(&sndCs);
+	sndBudget = kb * 1024;
+}
+
+/* Scale the PCM data chunk of a WAV image in place, other formats are left alone */
+static void snd_volume(BYTE *data, DWORD size)
+{
+	if (waveVol == 1.0 || size < 12 || memcmp(data, "RIFF", 4) || memcmp(data + 8, "WAVE", 4)) return;
+
+	int bits = 0;
+	for (DWORD pos = 12; pos + 8 <= size; ) {
+		DWORD len = *(DWORD *)(data + pos + 4);
+		if (len > size - pos - 8) len = size - pos - 8;
+		if (!memcmp(data + pos, "fmt ", 4) && len >= 16) {
+			WAVEFORMATEX *fmt = (WAVEFORMATEX *)(data + pos + 8);
+			if (fmt->wFormatTag == WAVE_FORMAT_PCM) bits = fmt->wBitsPerSample;
+		} else if (!memcmp(data + pos, "data", 4)) {
+			if (bits == 16 || bits == 8) wave_scale(data + pos + 8, data + pos + 8, len, bits, waveVol);
+			return;
+		}
+		pos += 8 + ((len + 1) & ~1u);
+	}
+}
+
+static BYTE *snd_load(LPCWSTR path, DWORD size)
+{
+	HANDLE file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+	BYTE *data = HeapAlloc(GetProcessHeap(), 0, size);
+	DWORD got = 0;
+	if (data && (!ReadFile(file, data, size, &got, NULL) || got != size)) {
+		HeapFree(GetProcessHeap(), 0, data);
+		data = NULL;
+	}
+	CloseHandle(file);
+	return data;
+}
+
+/* Make room for size bytes, never dropping a sound that may be playing. Called with sndCs held. */
+static struct snd_entry *snd_slot(DWORD size)
+{
+	for (;;) {
+		struct snd_entry *free = NULL, *lru = NULL;
+		for (int i = 0; i < SOUND_ENTRIES; i++) {
+			struct snd_entry *e = &sndCache[i];
+			if (!e->data) {
+				if (!free) free = e;
+			} else if (!e->refs && e != sndCurrent && (!lru || e->stamp - lru->stamp > 0x80000000u)) {
+				lru = e;
+			}
+		}
+		if (free && sndBytes + size <= sndBudget) return free;
+		if (!lru) return NULL;
+		HeapFree(GetProcessHeap(), 0, lru->data);
+		sndBytes -= lru->size;
+		lru->data = NULL;
+	}
+}
+
+/* Cached image for a file or resource sound, pinned until snd_done. NULL leaves the call to the system winmm. */
+static struct snd_entry *snd_get(const void *name, BOOL wide, HMODULE mod, DWORD *flags)
+{
+	if (!sndBudget || !name || (*flags & (SND_PURGE | SND_ALIAS))) return NULL;
+
+	BOOL resource = (*flags & SND_RESOURCE) == SND_RESOURCE;
+	if (!resource && (*flags & SND_MEMORY)) return NULL;
+
+	const void *res = NULL;
+	DWORD size = 0;
+	WCHAR path[MAX_PATH] = L"";
+	WIN32_FILE_ATTRIBUTE_DATA fa;
+	if (resource) {
+		HRSRC rsrc = wide ? FindResourceW(mod, name, L"WAVE") : FindResourceA(mod, name, "WAVE");
+		HGLOBAL glob = rsrc ? LoadResource(mod, rsrc) : NULL;
+		if (!glob || !(res = LockResource(glob))) return NULL;
+		size = SizeofResource(mod, rsrc);
+	} else {
+		WCHAR buf[MAX_PATH];
+		if (!wide && !MultiByteToWideChar(CP_ACP, 0, name, -1, buf, MAX_PATH)) return NULL;
+		LPCWSTR wname = wide ? name : buf;
+		/* without SND_FILENAME the name is tried as a registry alias first, which never carries an extension */
+		if (!(*flags & SND_FILENAME) && !wcschr(wname, L'.')) return NULL;
+		if (!GetFullPathNameW(wname, MAX_PATH, path, NULL) || !GetFileAttributesExW(path, GetFileExInfoStandard, &fa)) return NULL;
+		if (fa.nFileSizeHigh || (fa.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) return NULL;
+		size = fa.nFileSizeLow;
+	}
+	if (!size || size > sndBudget / 2) return NULL;
+
+	EnterCriticalSection(&sndCs);
+	struct snd_entry *e = NULL;
+	for (int i = 0; i < SOUND_ENTRIES && !e; i++) {
+		struct snd_entry *c = &sndCache[i];
+		if (c->data && (resource ? c->res == res : !c->res && !wcscmp(c->path, path))) e = &sndCache[i];
+	}
+	/* the file changed on disk */
+	if (e && !resource && (e->size != size || memcmp(&e->mtime, &fa.ftLastWriteTime, sizeof(FILETIME)))) {
+		if (e->refs || e == sndCurrent) {
+			e->path[0] = L'\0'; /* let it finish playing, it ages out */
+		} else {
+			HeapFree(GetProcessHeap(), 0, e->data);
+			sndBytes -= e->size;
+			e->data = NULL;
+		}
+		e = NULL;
+	}
+	plr_sound(e != NULL);
+
+	if (!e) {
+		BYTE *data = NULL;
+		if (resource) {
+			if ((data = HeapAlloc(GetProcessHeap(), 0, size))) memcpy(data, res, size);
+		} else {
+			data = snd_load(path, size);
+		}
+		if (data && (e = snd_slot(size))) {
+			snd_volume(data, size);
+			wcscpy(e->path, path);
+			e->res = res;
+			e->size = size;
+			if (!resource) e->mtime = fa.ftLastWriteTime;
+			e->data = data;
+			e->refs = 0;
+			sndBytes += size;
+		} else if (data) {
+			HeapFree(GetProcessHeap(), 0, data);
+		}
+	}
+	if (e) {
+		e->stamp = ++sndStamp;
+		e->refs++;
+		*flags = (*flags & ~(SND_FILENAME | SND_RESOURCE)) | SND_MEMORY;
+	}
+	LeaveCriticalSection(&sndCs);
+	return e;
+}
+
+static BOOL snd_done(struct snd_entry *e, BOOL ret, DWORD flags, unsigned int t)
+{
+	if (flags & SND_ASYNC) plr_hist(PLR_HIST_SOUND, plr_usec() - t);
+	if (!sndBudget) return ret;
+
+	EnterCriticalSection(&sndCs);
+	if (e) e->refs--;
+	/* a successful call replaced whatever was playing */
+	if (ret) sndCurrent = e;
+	LeaveCriticalSection(&sndCs);
+	return ret;
+}
+
 BOOL WINAPI fake_sndPlaySoundA(LPCSTR a0, UINT a1)
 {
 	static BOOL(WINAPI *funcp)(LPCSTR a0, UINT a1) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "sndPlaySoundA");
-	return (*funcp)(a0, a1);
+
+	unsigned int t = plr_usec();
+	DWORD flags = a1;
+	struct snd_entry *e = snd_get(a0, FALSE, NULL, &flags);
+	return snd_done(e, (*funcp)(e ? (LPCSTR)e->data : a0, flags), flags, t);
 }
 
 BOOL WINAPI fake_sndPlaySoundW(LPCWSTR a0, UINT a1)
@@ -214,7 +654,11 @@ BOOL WINAPI fake_sndPlaySoundW(LPCWSTR a0, UINT a1)
 	static BOOL(WINAPI *funcp)(LPCWSTR a0, UINT a1) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "sndPlaySoundW");
-	return (*funcp)(a0, a1);
+
+	unsigned int t = plr_usec();
+	DWORD flags = a1;
+	struct snd_entry *e = snd_get(a0, TRUE, NULL, &flags);
+	return snd_done(e, (*funcp)(e ? (LPCWSTR)e->data : a0, flags), flags, t);
 }
 
 BOOL WINAPI fake_PlaySound(LPCSTR a0, HMODULE a1, DWORD a2)
@@ -222,7 +666,10 @@ BOOL WINAPI fake_PlaySound(LPCSTR a0, HMODULE a1, DWORD a2)
 	static BOOL(WINAPI *funcp)(LPCSTR a0, HMODULE a1, DWORD a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "PlaySound");
-	return (*funcp)(a0, a1, a2);
+
+	unsigned int t = plr_usec();
+	struct snd_entry *e = snd_get(a0, FALSE, a1, &a2);
+	return snd_done(e, (*funcp)(e ? (LPCSTR)e->data : a0, a1, a2), a2, t);
 }
 
 BOOL WINAPI fake_PlaySoundA(LPCSTR a0, HMODULE a1, DWORD a2)
@@ -230,7 +677,10 @@ BOOL WINAPI fake_PlaySoundA(LPCSTR a0, HMODULE a1, DWORD a2)
 	static BOOL(WINAPI *funcp)(LPCSTR a0, HMODULE a1, DWORD a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "PlaySoundA");
-	return (*funcp)(a0, a1, a2);
+
+	unsigned int t = plr_usec();
+	struct snd_entry *e = snd_get(a0, FALSE, a1, &a2);
+	return snd_done(e, (*funcp)(e ? (LPCSTR)e->data : a0, a1, a2), a2, t);
 }
 
 BOOL WINAPI fake_PlaySoundW(LPCWSTR a0, HMODULE a1, DWORD a2)
@@ -238,7 +688,10 @@ BOOL WINAPI fake_PlaySoundW(LPCWSTR a0, HMODULE a1, DWORD a2)
 	static BOOL(WINAPI *funcp)(LPCWSTR a0, HMODULE a1, DWORD a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "PlaySoundW");
-	return (*funcp)(a0, a1, a2);
+
+	unsigned int t = plr_usec();
+	struct snd_entry *e = snd_get(a0, TRUE, a1, &a2);
+	return snd_done(e, (*funcp)(e ? (LPCWSTR)e->data : a0, a1, a2), a2, t);
 }
 
 UINT WINAPI fake_waveOutGetNumDevs()
@@ -302,7 +755,28 @@ MMRESULT WINAPI fake_waveOutClose(HWAVEOUT a0)
 	static MMRESULT(WINAPI *funcp)(HWAVEOUT a0) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "waveOutClose");
-	return (*funcp)(a0);
+
+	struct wave_ctx *ctx = wave_find(a0);
+	if (!ctx) return (*funcp)(a0);
+	if (ctx->busy) return WAVERR_STILLPLAYING;
+
+	/* Release the shadow pool while the handle is still valid */
+	for (int i = 0; i < WAVE_CLASSES; i++) {
+		while (ctx->pool[i]) {
+			struct wave_shadow *sh = ctx->pool[i];
+			ctx->pool[i] = sh->next;
+			fake_waveOutUnprepareHeader(a0, &sh->wh, sizeof(WAVEHDR));
+			HeapFree(GetProcessHeap(), 0, sh);
+		}
+	}
+
+	MMRESULT ret = (*funcp)(a0);
+	if (ret == MMSYSERR_NOERROR) {
+		ctx->hwo = NULL;
+		DeleteCriticalSection(&ctx->cs);
+		InterlockedExchange(&ctx->used, 0);
+	}
+	return ret;
 }
 
 MMRESULT WINAPI fake_waveOutPrepareHeader(HWAVEOUT a0, LPWAVEHDR a1, UINT a2)
@@ -1017,11 +1491,218 @@ DWORD WINAPI fake_timeGetTime()
 	return (*funcp)();
 }
 
+/* Timer engine: one thread and a min-heap of due times serve every timeSetEvent instead of a system timer each */
+#define TIMER_EVENTS	(256)
+#define TIMER_MAX_DELAY	(1000000)	// milliseconds, wPeriodMax of timeGetDevCaps
+#define TIMER_CATCH_UP	(1000000)	// microseconds behind up to which missed periods still fire, as the system's timers do
+
+struct timer_event
+{
+	UINT id;		/* 0: free */
+	UINT delay;		/* milliseconds */
+	UINT flags;
+	LPTIMECALLBACK callback;	/* or the event handle */
+	DWORD_PTR user;
+	ULONGLONG due;		/* microseconds */
+	int pos;		/* index in timerHeap */
+};
+
+static BOOL timerEngine = FALSE;
+static struct timer_event timerEvents[TIMER_EVENTS];
+static struct timer_event *timerHeap[TIMER_EVENTS];
+static int timerCnt = 0;
+static UINT timerNext = 0;		/* last id handed out */
+static volatile UINT timerFiring = 0;	/* id whose callback runs */
+static CRITICAL_SECTION timerCs;
+static HANDLE timerEv = NULL;
+static HANDLE timerThread = NULL;
+static DWORD timerThreadId = 0;
+static volatile BOOL timerQuit = FALSE;
+static LARGE_INTEGER timerFreq;
+
+void stub_timer(int enable)
+{
+	if (!enable || !QueryPerformanceFrequency(&timerFreq)) return;
+	InitializeCriticalSection(&timerCs);
+	timerEngine = TRUE;
+}
+
+/* Let the timer thread exit, callbacks in flight finish on their own */
+void stub_timer_close()
+{
+	if (!timerThread) return;
+	timerQuit = TRUE;
+	SetEvent(timerEv);
+}
+
+static ULONGLONG timer_now()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	return plr_ticks_usec(now.QuadPart, timerFreq.QuadPart);
+}
+
+static void timer_swap(int a, int b)
+{
+	struct timer_event *t = timerHeap[a];
+	timerHeap[a] = timerHeap[b];
+	timerHeap[b] = t;
+	timerHeap[a]->pos = a;
+	timerHeap[b]->pos = b;
+}
+
+/* Restore the heap order around an entry whose due time changed */
+static void timer_sift(int i)
+{
+	while (i > 0 && timerHeap[(i-1)/2]->due > timerHeap[i]->due) {
+		timer_swap(i, (i-1)/2);
+		i = (i-1)/2;
+	}
+	for (;;) {
+		int c = 2*i+1;
+		if (c >= timerCnt) break;
+		if (c+1 < timerCnt && timerHeap[c+1]->due < timerHeap[c]->due) c++;
+		if (timerHeap[c]->due >= timerHeap[i]->due) break;
+		timer_swap(i, c);
+		i = c;
+	}
+}
+
+static void timer_remove(struct timer_event *t)
+{
+	int i = t->pos;
+	if (--timerCnt == i) return;
+	timerHeap[i] = timerHeap[timerCnt];
+	timerHeap[i]->pos = i;
+	timer_sift(i);
+}
+
+static DWORD WINAPI timer_main(void *unused)
+{
+	BOOL period = FALSE;
+	while (!timerQuit) {
+		DWORD wait = INFINITE;
+		struct timer_event fire = {0};
+		EnterCriticalSection(&timerCs);
+		if (timerCnt) {
+			struct timer_event *t = timerHeap[0];
+			ULONGLONG now = timer_now();
+			if (t->due <= now) {
+				plr_hist(PLR_HIST_TIMER, (unsigned int)(now - t->due));
+				fire = *t;
+				timerFiring = t->id;
+				if (t->flags & TIME_PERIODIC) {
+					/* The next period counts from this due time so callbacks do not drift, late wakes catch up on the
+					 * periods they missed unless the thread was held off far longer, e.g. while the machine slept */
+					t->due += (ULONGLONG)t->delay * 1000;
+					if (t->due + TIMER_CATCH_UP <= now) t->due = now + (ULONGLONG)t->delay * 1000;
+					timer_sift(0);
+				} else {
+					timer_remove(t);
+					t->id = 0;
+				}
+			} else {
+				wait = (DWORD)((t->due - now + 999) / 1000);
+			}
+		}
+		BOOL active = timerCnt || fire.id;
+		LeaveCriticalSection(&timerCs);
+
+		/* One 1 ms period for all timers, held only while any exists */
+		if (active != period) {
+			if (active) timeBeginPeriod(1);
+			else timeEndPeriod(1);
+			period = active;
+		}
+
+		if (fire.id) {
+			if (fire.flags & TIME_CALLBACK_EVENT_SET) SetEvent((HANDLE)fire.callback);
+			else if (fire.flags & TIME_CALLBACK_EVENT_PULSE) PulseEvent((HANDLE)fire.callback);
+			else fire.callback(fire.id, 0, fire.user, 0, 0);
+			timerFiring = 0;
+		} else {
+			WaitForSingleObject(timerEv, wait);
+		}
+	}
+	if (period) timeEndPeriod(1);
+	return 0;
+}
+
+/* Start the timer thread on first use, never from DllMain */
+static BOOL timer_start()
+{
+	EnterCriticalSection(&timerCs);
+	if (!timerThread && !timerQuit) {
+		timerEv = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (timerEv) timerThread = CreateThread(NULL, 0, timer_main, NULL, 0, &timerThreadId);
+		if (timerThread) {
+			SetThreadPriority(timerThread, THREAD_PRIORITY_TIME_CRITICAL);
+		} else if (timerEv) {
+			CloseHandle(timerEv);
+			timerEv = NULL;
+		}
+	}
+	LeaveCriticalSection(&timerCs);
+	return timerThread != NULL;
+}
+
+static MMRESULT timer_set(UINT delay, LPTIMECALLBACK callback, DWORD_PTR user, UINT flags)
+{
+	struct timer_event *t = NULL;
+	if (!delay || delay > TIMER_MAX_DELAY || !callback) return 0;
+
+	EnterCriticalSection(&timerCs);
+	for (int i = 0; i < TIMER_EVENTS && !t; i++) {
+		if (!timerEvents[i].id) t = &timerEvents[i];
+	}
+	if (t) {
+		do t->id = ++timerNext; while (!t->id);
+		t->delay = delay;
+		t->flags = flags;
+		t->callback = callback;
+		t->user = user;
+		t->due = timer_now() + (ULONGLONG)delay * 1000;
+		t->pos = timerCnt;
+		timerHeap[timerCnt++] = t;
+		timer_sift(t->pos);
+	}
+	LeaveCriticalSection(&timerCs);
+
+	if (!t) return 0;
+	SetEvent(timerEv);
+	return t->id;
+}
+
+static MMRESULT timer_kill(UINT id)
+{
+	UINT flags = 0;
+	BOOL found = FALSE;
+	EnterCriticalSection(&timerCs);
+	for (int i = 0; i < TIMER_EVENTS && !found; i++) {
+		struct timer_event *t = &timerEvents[i];
+		if (id && t->id == id) {
+			flags = t->flags;
+			timer_remove(t);
+			t->id = 0;
+			found = TRUE;
+		}
+	}
+	LeaveCriticalSection(&timerCs);
+	if (!found) return MMSYSERR_INVALPARAM;
+
+	/* A synchronous kill returns once the callback in progress is done, unless it comes from that callback */
+	if ((flags & TIME_KILL_SYNCHRONOUS) && GetCurrentThreadId() != timerThreadId) {
+		while (timerFiring == id) Sleep(1);
+	}
+	return MMSYSERR_NOERROR;
+}
+
 MMRESULT WINAPI fake_timeSetEvent(UINT a0, UINT a1, LPTIMECALLBACK a2, DWORD a3, UINT a4)
 {
 	static MMRESULT(WINAPI *funcp)(UINT a0, UINT a1, LPTIMECALLBACK a2, DWORD a3, UINT a4) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "timeSetEvent");
+	if (timerEngine && timer_start()) return timer_set(a0, a2, a3, a4);
 	return (*funcp)(a0, a1, a2, a3, a4);
 }
 
@@ -1030,6 +1711,7 @@ MMRESULT WINAPI fake_timeKillEvent(UINT a0)
 	static MMRESULT(WINAPI *funcp)(UINT a0) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "timeKillEvent");
+	if (timerEngine && timerThread) return timer_kill(a0);
 	return (*funcp)(a0);
 }
 
@@ -1057,6 +1739,45 @@ MMRESULT WINAPI fake_timeEndPeriod(UINT a0)
 	return (*funcp)(a0);
 }
 
+/* Joystick ids that reported no device are answered from memory until the re-probe interval passes */
+#define JOY_IDS		(16)
+#define JOY_POS		(0)	// joyGetPos, joyGetPosEx
+#define JOY_CAPS	(1)	// joyGetDevCaps
+
+struct joy_miss
+{
+	volatile DWORD tick;	/* when the system winmm was last asked */
+	volatile MMRESULT err;	/* 0: not cached */
+};
+
+static DWORD joyProbe = 0;	/* milliseconds, 0: disabled */
+static struct joy_miss joyMiss[2][JOY_IDS];
+
+void stub_joyprobe(int ms) { joyProbe = ms > 0 ? ms : 0; }
+
+static MMRESULT joy_cached(int kind, UINT id)
+{
+	if (!joyProbe || id >= JOY_IDS) return JOYERR_NOERROR;
+	struct joy_miss *m = &joyMiss[kind][id];
+	MMRESULT err = m->err;
+	if (err && GetTickCount() - m->tick < joyProbe) return err;
+	return JOYERR_NOERROR;
+}
+
+/* Connected devices are never cached, so they keep polling at full rate */
+static MMRESULT joy_note(int kind, UINT id, MMRESULT ret)
+{
+	if (!joyProbe || id >= JOY_IDS) return ret;
+	struct joy_miss *m = &joyMiss[kind][id];
+	if (ret == JOYERR_UNPLUGGED || ret == MMSYSERR_NODRIVER) {
+		m->tick = GetTickCount();
+		m->err = ret;
+	} else {
+		m->err = 0;
+	}
+	return ret;
+}
+
 UINT WINAPI fake_joyGetNumDevs()
 {
 	static UINT(WINAPI *funcp)() = NULL;
@@ -1070,7 +1791,9 @@ MMRESULT WINAPI fake_joyGetDevCapsA(UINT a0, LPJOYCAPSA a1, UINT a2)
 	static MMRESULT(WINAPI *funcp)(UINT a0, LPJOYCAPSA a1, UINT a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "joyGetDevCapsA");
-	return (*funcp)(a0, a1, a2);
+	MMRESULT ret = joy_cached(JOY_CAPS, a0);
+	if (ret) return ret;
+	return joy_note(JOY_CAPS, a0, (*funcp)(a0, a1, a2));
 }
 
 MMRESULT WINAPI fake_joyGetDevCapsW(UINT a0, LPJOYCAPSW a1, UINT a2)
@@ -1078,7 +1801,9 @@ MMRESULT WINAPI fake_joyGetDevCapsW(UINT a0, LPJOYCAPSW a1, UINT a2)
 	static MMRESULT(WINAPI *funcp)(UINT a0, LPJOYCAPSW a1, UINT a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "joyGetDevCapsW");
-	return (*funcp)(a0, a1, a2);
+	MMRESULT ret = joy_cached(JOY_CAPS, a0);
+	if (ret) return ret;
+	return joy_note(JOY_CAPS, a0, (*funcp)(a0, a1, a2));
 }
 
 MMRESULT WINAPI fake_joyGetPos(UINT a0, LPJOYINFO a1)
@@ -1086,7 +1811,9 @@ MMRESULT WINAPI fake_joyGetPos(UINT a0, LPJOYINFO a1)
 	static MMRESULT(WINAPI *funcp)(UINT a0, LPJOYINFO a1) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "joyGetPos");
-	return (*funcp)(a0, a1);
+	MMRESULT ret = joy_cached(JOY_POS, a0);
+	if (ret) return ret;
+	return joy_note(JOY_POS, a0, (*funcp)(a0, a1));
 }
 
 MMRESULT WINAPI fake_joyGetPosEx(UINT a0, LPJOYINFOEX a1)
@@ -1094,7 +1821,9 @@ MMRESULT WINAPI fake_joyGetPosEx(UINT a0, LPJOYINFOEX a1)
 	static MMRESULT(WINAPI *funcp)(UINT a0, LPJOYINFOEX a1) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "joyGetPosEx");
-	return (*funcp)(a0, a1);
+	MMRESULT ret = joy_cached(JOY_POS, a0);
+	if (ret) return ret;
+	return joy_note(JOY_POS, a0, (*funcp)(a0, a1));
 }
 
 MMRESULT WINAPI fake_joyGetThreshold(UINT a0, LPUINT a1)
@@ -1161,11 +1890,187 @@ LPMMIOPROC WINAPI fake_mmioInstallIOProcW(FOURCC a0, LPMMIOPROC a1, DWORD a2)
 	return (*funcp)(a0, a1, a2);
 }
 
+/* Mapped mmio: read-only opens of plain files are served from a mapped view instead of buffered file reads */
+#define MMIO_HANDLES	(64)
+
+struct mmio_map
+{
+	volatile LONG used;
+	BYTE *data;		/* the whole file */
+	LONG size;
+	LONG pos;
+	DWORD flags;		/* mmioOpen flags */
+	BOOL buffered;		/* the view is exposed as the I/O buffer */
+};
+
+static BOOL mmioMap = FALSE;
+static struct mmio_map mmioMaps[MMIO_HANDLES];
+
+void stub_mmio(int enable) { mmioMap = enable != 0; }
+
+/* The handle is the slot address, anything else belongs to the system winmm */
+static struct mmio_map *mmio_find(HMMIO h)
+{
+	DWORD_PTR off = (DWORD_PTR)h - (DWORD_PTR)mmioMaps;
+	if (!mmioMap || off >= sizeof(mmioMaps) || off % sizeof(struct mmio_map)) return NULL;
+	struct mmio_map *m = &mmioMaps[off / sizeof(struct mmio_map)];
+	return m->used ? m : NULL;
+}
+
+/* A view faults when its file goes away, so only files on fixed disks are mapped, not removable or network ones */
+static BOOL mmio_fixed(const void *name, BOOL wide)
+{
+	if (wide) {
+		WCHAR root[MAX_PATH];
+		return GetVolumePathNameW(name, root, MAX_PATH) && GetDriveTypeW(root) == DRIVE_FIXED;
+	}
+	char root[MAX_PATH];
+	return GetVolumePathNameA(name, root, MAX_PATH) && GetDriveTypeA(root) == DRIVE_FIXED;
+}
+
+/* NULL leaves the open to the system winmm */
+static HMMIO mmio_open(const void *name, BOOL wide, LPMMIOINFO info, DWORD flags)
+{
+	if (!mmioMap || !name) return NULL;
+	if ((flags & MMIO_RWMODE) != MMIO_READ || (flags & (MMIO_CREATE | MMIO_PARSE | MMIO_EXIST | MMIO_GETTEMP | MMIO_DELETE))) return NULL;
+	if (info && (info->pIOProc || (info->fccIOProc && info->fccIOProc != FOURCC_DOS) || info->pchBuffer)) return NULL;
+	if (wide ? wcschr(name, L'+') != NULL : strchr(name, '+') != NULL) return NULL; /* compound file element */
+	if (!mmio_fixed(name, wide)) return NULL;
+
+	DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE;
+	switch (flags & MMIO_SHAREMODE) {
+		case MMIO_EXCLUSIVE: share = 0; break;
+		case MMIO_DENYWRITE: share = FILE_SHARE_READ; break;
+		case MMIO_DENYREAD: share = FILE_SHARE_WRITE; break;
+	}
+
+	HANDLE file = wide ? CreateFileW(name, GENERIC_READ, share, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)
+	                   : CreateFileA(name, GENERIC_READ, share, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+
+	DWORD high = 0;
+	DWORD size = GetFileSize(file, &high);
+	BYTE *data = NULL;
+	/* empty files cannot be mapped, 2GB and up do not fit mmioSeek */
+	if (size != INVALID_FILE_SIZE && size && size < 0x80000000u && !high) {
+		HANDLE map = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map) {
+			data = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(map);
+		}
+	}
+	CloseHandle(file);
+	if (!data) return NULL;
+
+	struct mmio_map *m = NULL;
+	for (int i = 0; i < MMIO_HANDLES && !m; i++) {
+		if (InterlockedCompareExchange(&mmioMaps[i].used, 1, 0) == 0) m = &mmioMaps[i];
+	}
+	if (!m) {
+		UnmapViewOfFile(data);
+		return NULL;
+	}
+
+	m->data = data;
+	m->size = size;
+	m->pos = 0;
+	m->flags = flags;
+	m->buffered = (flags & MMIO_ALLOCBUF) || (info && info->cchBuffer);
+	if (info) {
+		info->wErrorRet = 0;
+		info->hmmio = (HMMIO)m;
+	}
+	return (HMMIO)m;
+}
+
+static void mmio_info(struct mmio_map *m, LPMMIOINFO info)
+{
+	memset(info, 0, sizeof(MMIOINFO));
+	info->dwFlags = m->flags;
+	info->fccIOProc = FOURCC_DOS;
+	info->hmmio = (HMMIO)m;
+	if (m->buffered) {
+		LONG pos = m->pos < m->size ? m->pos : m->size;
+		info->cchBuffer = m->size;
+		info->pchBuffer = (HPSTR)m->data;
+		info->pchNext = (HPSTR)m->data + pos;
+		info->pchEndRead = (HPSTR)m->data + m->size;
+		info->pchEndWrite = (HPSTR)m->data + m->size;
+		info->lDiskOffset = m->size;
+	} else {
+		info->lBufOffset = m->pos;
+		info->lDiskOffset = m->pos;
+	}
+}
+
+/* Take the position back from a direct buffer access */
+static void mmio_sync(struct mmio_map *m, LPCMMIOINFO info)
+{
+	if (m->buffered && info && info->pchNext >= (HPSTR)m->data && info->pchNext <= (HPSTR)m->data + m->size)
+		m->pos = info->pchNext - (HPSTR)m->data;
+}
+
+static LONG mmio_seek(struct mmio_map *m, LONG off, int origin)
+{
+	LONG pos;
+	switch (origin) {
+		case SEEK_SET: pos = off; break;
+		case SEEK_CUR: pos = m->pos + off; break;
+		case SEEK_END: pos = m->size + off; break;
+		default: return -1;
+	}
+	if (pos < 0) return -1;
+	return m->pos = pos;
+}
+
+static MMRESULT mmio_descend(struct mmio_map *m, LPMMCKINFO ck, const MMCKINFO *parent, UINT flags)
+{
+	LONG start = m->pos;
+	LONG end = m->size;
+	if (parent) {
+		LONG pend = parent->dwDataOffset + parent->cksize;
+		if (pend < end) end = pend;
+	}
+
+	FOURCC ckid = 0, fccType = 0;
+	if (flags & MMIO_FINDCHUNK) ckid = ck->ckid;
+	else if (flags & MMIO_FINDRIFF) { ckid = FOURCC_RIFF; fccType = ck->fccType; }
+	else if (flags & MMIO_FINDLIST) { ckid = FOURCC_LIST; fccType = ck->fccType; }
+
+	for (LONG pos = m->pos; ; ) {
+		if (pos < 0 || pos > end - 8) {
+			m->pos = start;
+			return MMIOERR_CHUNKNOTFOUND;
+		}
+		FOURCC id = *(FOURCC *)(m->data + pos);
+		DWORD size = *(DWORD *)(m->data + pos + 4);
+		FOURCC type = 0;
+		BOOL form = id == FOURCC_RIFF || id == FOURCC_LIST;
+		if (form && pos + 12 <= m->size) type = *(FOURCC *)(m->data + pos + 8);
+
+		if (!ckid || (id == ckid && (!fccType || type == fccType))) {
+			ck->ckid = id;
+			ck->cksize = size;
+			ck->dwDataOffset = pos + 8;
+			ck->fccType = form ? type : 0;
+			ck->dwFlags = 0;
+			m->pos = pos + (form ? 12 : 8);
+			return MMSYSERR_NOERROR;
+		}
+		DWORD skip = (size + 1) & ~1u;
+		if (skip > (DWORD)(end - pos - 8)) pos = -1; /* runs past the parent */
+		else pos += 8 + skip;
+	}
+}
+
 HMMIO WINAPI fake_mmioOpenA(LPSTR a0, LPMMIOINFO a1, DWORD a2)
 {
 	static HMMIO(WINAPI *funcp)(LPSTR a0, LPMMIOINFO a1, DWORD a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioOpenA");
+
+	HMMIO h = mmio_open(a0, FALSE, a1, a2);
+	if (h) return h;
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1174,6 +2079,9 @@ HMMIO WINAPI fake_mmioOpenW(LPWSTR a0, LPMMIOINFO a1, DWORD a2)
 	static HMMIO(WINAPI *funcp)(LPWSTR a0, LPMMIOINFO a1, DWORD a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioOpenW");
+
+	HMMIO h = mmio_open(a0, TRUE, a1, a2);
+	if (h) return h;
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1198,6 +2106,13 @@ MMRESULT WINAPI fake_mmioClose(HMMIO a0, UINT a1)
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, UINT a1) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioClose");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) {
+		UnmapViewOfFile(m->data);
+		m->data = NULL;
+		InterlockedExchange(&m->used, 0);
+		return MMSYSERR_NOERROR;
+	}
 	return (*funcp)(a0, a1);
 }
 
@@ -1206,6 +2121,15 @@ LONG WINAPI fake_mmioRead(HMMIO a0, HPSTR a1, LONG a2)
 	static LONG(WINAPI *funcp)(HMMIO a0, HPSTR a1, LONG a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioRead");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) {
+		if (a2 < 0) return -1;
+		LONG left = m->pos < m->size ? m->size - m->pos : 0;
+		if (a2 > left) a2 = left;
+		memcpy(a1, m->data + m->pos, a2);
+		m->pos += a2;
+		return a2;
+	}
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1214,6 +2138,7 @@ LONG WINAPI fake_mmioWrite(HMMIO a0, LPCSTR a1, LONG a2)
 	static LONG(WINAPI *funcp)(HMMIO a0, LPCSTR a1, LONG a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioWrite");
+	if (mmio_find(a0)) return -1;
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1222,6 +2147,8 @@ LONG WINAPI fake_mmioSeek(HMMIO a0, LONG a1, int a2)
 	static LONG(WINAPI *funcp)(HMMIO a0, LONG a1, int a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioSeek");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) return mmio_seek(m, a1, a2);
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1230,6 +2157,11 @@ MMRESULT WINAPI fake_mmioGetInfo(HMMIO a0, LPMMIOINFO a1, UINT a2)
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, LPMMIOINFO a1, UINT a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioGetInfo");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) {
+		mmio_info(m, a1);
+		return MMSYSERR_NOERROR;
+	}
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1238,6 +2170,11 @@ MMRESULT WINAPI fake_mmioSetInfo(HMMIO a0, LPCMMIOINFO a1, UINT a2)
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, LPCMMIOINFO a1, UINT a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioSetInfo");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) {
+		mmio_sync(m, a1);
+		return MMSYSERR_NOERROR;
+	}
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1246,6 +2183,12 @@ MMRESULT WINAPI fake_mmioSetBuffer(HMMIO a0, LPSTR a1, LONG a2, UINT a3)
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, LPSTR a1, LONG a2, UINT a3) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioSetBuffer");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) {
+		/* the view stays the buffer, only whether it is exposed changes */
+		m->buffered = a2 != 0;
+		return MMSYSERR_NOERROR;
+	}
 	return (*funcp)(a0, a1, a2, a3);
 }
 
@@ -1254,6 +2197,7 @@ MMRESULT WINAPI fake_mmioFlush(HMMIO a0, UINT a1)
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, UINT a1) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioFlush");
+	if (mmio_find(a0)) return MMSYSERR_NOERROR;
 	return (*funcp)(a0, a1);
 }
 
@@ -1262,6 +2206,15 @@ MMRESULT WINAPI fake_mmioAdvance(HMMIO a0, LPMMIOINFO a1, UINT a2)
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, LPMMIOINFO a1, UINT a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioAdvance");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) {
+		if (!m->buffered) return MMIOERR_UNBUFFERED;
+		if (a2 & MMIO_WRITE) return MMIOERR_CANNOTWRITE;
+		/* the whole file is already in the buffer, the next read hits its end */
+		mmio_sync(m, a1);
+		if (a1) mmio_info(m, a1);
+		return MMSYSERR_NOERROR;
+	}
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1270,6 +2223,7 @@ LRESULT WINAPI fake_mmioSendMessage(HMMIO a0, UINT a1, LPARAM a2, LPARAM a3)
 	static LRESULT(WINAPI *funcp)(HMMIO a0, UINT a1, LPARAM a2, LPARAM a3) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioSendMessage");
+	if (mmio_find(a0)) return 0; /* the DOS IOProc ignores custom messages */
 	return (*funcp)(a0, a1, a2, a3);
 }
 
@@ -1278,6 +2232,8 @@ MMRESULT WINAPI fake_mmioDescend(HMMIO a0, LPMMCKINFO a1, const MMCKINFO* a2, UI
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, LPMMCKINFO a1, const MMCKINFO* a2, UINT a3) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioDescend");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) return a1 ? mmio_descend(m, a1, a2, a3) : MMSYSERR_INVALPARAM;
 	return (*funcp)(a0, a1, a2, a3);
 }
 
@@ -1286,6 +2242,12 @@ MMRESULT WINAPI fake_mmioAscend(HMMIO a0, LPMMCKINFO a1, UINT a2)
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, LPMMCKINFO a1, UINT a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioAscend");
+	struct mmio_map *m = mmio_find(a0);
+	if (m) {
+		if (!a1) return MMSYSERR_INVALPARAM;
+		m->pos = a1->dwDataOffset + ((a1->cksize + 1) & ~1u);
+		return MMSYSERR_NOERROR;
+	}
 	return (*funcp)(a0, a1, a2);
 }
 
@@ -1294,41 +2256,10 @@ MMRESULT WINAPI fake_mmioCreateChunk(HMMIO a0, LPMMCKINFO a1, UINT a2)
 	static MMRESULT(WINAPI *funcp)(HMMIO a0, LPMMCKINFO a1, UINT a2) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "mmioCreateChunk");
+	if (mmio_find(a0)) return MMIOERR_CANNOTWRITE;
 	return (*funcp)(a0, a1, a2);
 }
 
-MCIERROR WINAPI fake_mciSendCommandW(MCIDEVICEID a0, UINT a1, DWORD a2, DWORD a3)
-{
-	static MCIERROR(WINAPI *funcp)(MCIDEVICEID a0, UINT a1, DWORD a2, DWORD a3) = NULL;
-	if (funcp == NULL)
-		funcp = (void*)GetProcAddress(loadRealDLL(), "mciSendCommandW");
-	return (*funcp)(a0, a1, a2, a3);
-}
-
-MCIERROR WINAPI fake_mciSendStringW(LPCWSTR a0, LPWSTR a1, UINT a2, HWND a3)
-{
-	static MCIERROR(WINAPI *funcp)(LPCWSTR a0, LPWSTR a1, UINT a2, HWND a3) = NULL;
-	if (funcp == NULL)
-		funcp = (void*)GetProcAddress(loadRealDLL(), "mciSendStringW");
-	return (*funcp)(a0, a1, a2, a3);
-}
-
-MCIDEVICEID WINAPI fake_mciGetDeviceIDA(LPCSTR a0)
-{
-	static MCIDEVICEID(WINAPI *funcp)(LPCSTR a0) = NULL;
-	if (funcp == NULL)
-		funcp = (void*)GetProcAddress(loadRealDLL(), "mciGetDeviceIDA");
-	return (*funcp)(a0);
-}
-
-MCIDEVICEID WINAPI fake_mciGetDeviceIDW(LPCWSTR a0)
-{
-	static MCIDEVICEID(WINAPI *funcp)(LPCWSTR a0) = NULL;
-	if (funcp == NULL)
-		funcp = (void*)GetProcAddress(loadRealDLL(), "mciGetDeviceIDW");
-	return (*funcp)(a0);
-}
-
 MCIDEVICEID WINAPI fake_mciGetDeviceIDFromElementIDA(DWORD a0, LPCSTR a1)
 {
 	static MCIDEVICEID(WINAPI *funcp)(DWORD a0, LPCSTR a1) = NULL;
@@ -1345,22 +2276,6 @@ MCIDEVICEID WINAPI fake_mciGetDeviceIDFromElementIDW(DWORD a0, LPCWSTR a1)
 	return (*funcp)(a0, a1);
 }
 
-BOOL WINAPI fake_mciGetErrorStringA(MCIERROR a0, LPSTR a1, UINT a2)
-{
-	static BOOL(WINAPI *funcp)(MCIERROR a0, LPSTR a1, UINT a2) = NULL;
-	if (funcp == NULL)
-		funcp = (void*)GetProcAddress(loadRealDLL(), "mciGetErrorStringA");
-	return (*funcp)(a0, a1, a2);
-}
-
-BOOL WINAPI fake_mciGetErrorStringW(MCIERROR a0, LPWSTR a1, UINT a2)
-{
-	static BOOL(WINAPI *funcp)(MCIERROR a0, LPWSTR a1, UINT a2) = NULL;
-	if (funcp == NULL)
-		funcp = (void*)GetProcAddress(loadRealDLL(), "mciGetErrorStringW");
-	return (*funcp)(a0, a1, a2);
-}
-
 BOOL WINAPI fake_mciSetYieldProc(MCIDEVICEID a0, YIELDPROC a1, DWORD a2)
 {
 	static BOOL(WINAPI *funcp)(MCIDEVICEID a0, YIELDPROC a1, DWORD a2) = NULL;
@@ -1385,14 +2300,6 @@ YIELDPROC WINAPI fake_mciGetYieldProc(MCIDEVICEID a0, PDWORD a1)
 	return (*funcp)(a0, a1);
 }
 
-BOOL WINAPI fake_mciExecute(LPCSTR a0)
-{
-	static BOOL(WINAPI *funcp)(LPCSTR a0) = NULL;
-	if (funcp == NULL)
-		funcp = (void*)GetProcAddress(loadRealDLL(), "mciExecute");
-	return (*funcp)(a0);
-}
-
 BOOL WINAPI fake_DriverCallback(DWORD a0, DWORD a1, HDRVR a2, DWORD a3, DWORD a4, DWORD a5, DWORD a6)
 {
 	static BOOL(WINAPI *funcp)(DWORD a0, DWORD a1, HDRVR a2, DWORD a3, DWORD a4, DWORD a5, DWORD a6) = NULL;
@@ -1414,6 +2321,9 @@ MMRESULT WINAPI fake_joyConfigChanged(DWORD a0)
 	static MMRESULT (WINAPI *funcp)(DWORD a0) = NULL;
 	if (funcp == NULL)
 		funcp = (void*)GetProcAddress(loadRealDLL(), "joyConfigChanged");
+
+	/* devices may have been plugged in or configured */
+	memset(joyMiss, 0, sizeof(joyMiss));
 	return (*funcp)(a0);
 }
 
@@ -0,0 +1,155 @@
+/* Cache: the CPU the pump of a cdaudio stream takes reading its track from memory with DiscCache and from the file
+ * without it, each mode in a process of its own. Plays one track for the measured seconds a round and reports the CPU
+ * time a second of playback costs, the median of the rounds, and the file system calls the stream made meanwhile. The
+ * CPU includes the host's own waveOut threads, which stand in for the driver. Fails when the track played from memory
+ * was not a cache hit or still called the file system, or when detach left a handle or heap block behind: closing the
+ * cache waits for the prefetch thread and frees what it loaded.
+ *
+ *   cache [-s seconds measured] [-r rounds, the median counts] [-c DiscCache MB]
+ */
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "host.h"
+#include "player.h"
+
+#define ROUNDS_MAX	(100)
+
+struct result
+{
+	unsigned long long cpu;		/* usec per second of playback */
+	long files;			/* file system calls while measured */
+	long hits;			/* plays of a resident track */
+	long handles;			/* left open by detach */
+	long blocks;			/* heap blocks and bytes detach left allocated */
+	long long bytes;
+};
+
+static MCIERROR send(const char *cmd)
+{
+	MCIERROR err = fake_mciSendStringA(cmd, NULL, 0, NULL);
+	if (err) fprintf(stderr, "%s: error %u\n", cmd, (unsigned int)err);
+	return err;
+}
+
+static long hits(void)
+{
+	char buf[2048];
+	plr_stats(buf, sizeof(buf), TRUE);
+	const char *s = strstr(buf, "cache_hits=");
+	return s ? atol(s + 11) : 0;
+}
+
+/* Plays the track until it starts from memory, the prefetch thread loads it on real time */
+static bool resident(void)
+{
+	for (int i = 0; i < 500; i++) {
+		long h = hits();
+		send("play cdaudio from 2");
+		send("stop cdaudio");
+		if (hits() > h) return true;
+		usleep(10000);
+	}
+	return false;
+}
+
+/* One mode in a child process, the globals of wav-winmm.c only start out clean once */
+static void run(const char *mb, int seconds, int rounds, struct result *r)
+{
+	int fds[2];
+	memset(r, 0, sizeof(*r));
+	r->hits = -1;
+	if (pipe(fds)) return;
+	pid_t pid = fork();
+	if (pid == 0) {
+		struct host_use before, after;
+		host_ini("DiscCache", mb);
+		host_use(&before);
+		host_attach();
+		send("set cdaudio time format tmsf");
+		if (atoi(mb) && !resident()) fprintf(stderr, "DiscCache %s: the track never became resident\n", mb);
+
+		unsigned long long v[ROUNDS_MAX];
+		long h = hits(), files = host_files;
+		send("play cdaudio from 2");
+		host_sleep(1000000); /* past the open and the first reads */
+		for (int i = 0; i < rounds; i++) {
+			v[i] = host_cpu();
+			host_sleep(seconds * 1000000ULL);
+			v[i] = (host_cpu() - v[i]) / seconds;
+		}
+		send("stop cdaudio");
+		r->cpu = host_pct(v, rounds, 50);
+		r->files = host_files - files;
+		r->hits = hits() - h;
+		host_detach();
+
+		host_use(&after);
+		r->handles = after.handles - before.handles;
+		r->blocks = after.blocks - before.blocks;
+		r->bytes = after.bytes - before.bytes;
+		write(fds[1], r, sizeof(*r));
+		_exit(0); /* the parent owns the game folder */
+	}
+	close(fds[1]);
+	if (pid < 0 || read(fds[0], r, sizeof(*r)) != sizeof(*r)) r->hits = -1;
+	close(fds[0]);
+	if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char **argv)
+{
+	int seconds = 5, rounds = 5, c, failed = 0;
+	const char *mb = "64";
+	while ((c = getopt(argc, argv, "s:r:c:")) != -1) {
+		switch (c) {
+			case 's': seconds = atoi(optarg); break;
+			case 'r': rounds = atoi(optarg); break;
+			case 'c': mb = optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-s seconds] [-r rounds] [-c MB]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (seconds < 1 || seconds > 60) seconds = 5;
+	if (rounds < 1 || rounds > ROUNDS_MAX) rounds = 5;
+	if (atoi(mb) < 1) mb = "64";
+
+	host_init("cache");
+	host_mkdir("Music");
+	host_wav("Music/Track02.wav", (seconds * rounds + 2) * 1000, 44100, 2, 1);
+
+	printf("%d rounds of %d s of one 44.1 kHz stereo track, DiscCache %s MB\n", rounds, seconds, mb);
+	printf("%-8s %14s %12s %8s\n", "", "CPU us per s", "file calls", "hits");
+	struct result mem, file;
+	run(mb, seconds, rounds, &mem);
+	run("0", seconds, rounds, &file);
+	printf("%-8s %14llu %12ld %8ld\n", "memory", mem.cpu, mem.files, mem.hits);
+	printf("%-8s %14llu %12ld %8ld\n", "file", file.cpu, file.files, file.hits);
+
+	if (mem.hits != 1) {
+		fprintf(stderr, "memory: %ld cache hits, the play should have been one\n", mem.hits);
+		failed++;
+	}
+	if (mem.files) {
+		fprintf(stderr, "memory: %ld file system calls while playing from memory\n", mem.files);
+		failed++;
+	}
+	if (file.hits < 0) {
+		fprintf(stderr, "file: the run did not finish\n");
+		failed++;
+	}
+	/* The notify dispatcher's event outlives detach in both modes */
+	if (mem.handles > file.handles) {
+		fprintf(stderr, "memory: detach left %ld handles open, %ld without the cache\n", mem.handles, file.handles);
+		failed++;
+	}
+	if (mem.blocks || mem.bytes || file.blocks || file.bytes) {
+		fprintf(stderr, "detach left %ld heap blocks of %lld bytes from memory, %ld of %lld bytes from the file\n",
+			mem.blocks, mem.bytes, file.blocks, file.bytes);
+		failed++;
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+/* Depth: how AdaptiveDepth settles under late buffer completions. Plays a long CD track once per amount of jitter, each in
+ * a fresh process, starting from the widest depth, and samples the depth the stats report as it plays. Prints the depth
+ * over time, how often it grew and narrowed, the second of playback it last changed and the underruns on the way.
+ * Fails on an underrun.
+ *
+ *   depth [-s seconds played] [-d AdaptiveDepth ms] [-m AdaptiveDepthMin ms] [jitter us]...
+ */
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "host.h"
+
+#define LEVELS_MAX	(16)
+#define MARKS		(8)
+
+static const int marks[MARKS] = {1, 2, 5, 10, 30, 60, 120, 240}; /* seconds the depth is shown at */
+
+struct run
+{
+	long depth[MARKS];
+	long last, grows, shrinks, underruns;
+	unsigned long long settled; /* usec into playback the depth last changed */
+};
+
+static long field(const char *stats, const char *key)
+{
+	const char *s = strstr(stats, key);
+	return s ? atol(s + strlen(key)) : -1;
+}
+
+/* One track in a child process, the globals of wav-winmm.c only start out clean once */
+static bool play(unsigned long long jitter, int seconds, struct run *r)
+{
+	int fds[2];
+	if (pipe(fds)) return false;
+	pid_t pid = fork();
+	if (pid == 0) {
+		char stats[1024];
+		struct run out = {{0}};
+		host_jitter = jitter;
+		host_attach();
+		fake_mciSendStringA("set cdaudio time format tmsf", NULL, 0, NULL);
+		fake_mciSendStringA("play cdaudio from 2", NULL, 0, NULL);
+		unsigned long long t0 = host_now(), changed = t0;
+		long prev = -1;
+		for (int s = 1, m = 0; s <= seconds; s++) {
+			host_sleep(1000000);
+			fake_mciSendStringA("status cdaudio stats", stats, sizeof(stats), NULL);
+			out.last = field(stats, "depth_ms=");
+			if (prev >= 0 && out.last != prev) changed = host_now();
+			prev = out.last;
+			while (m < MARKS && marks[m] <= s) out.depth[m++] = out.last;
+		}
+		out.grows = field(stats, "depth_grows=");
+		out.shrinks = field(stats, "depth_shrinks=");
+		out.underruns = field(stats, "underruns=");
+		out.settled = changed - t0;
+		fake_mciSendStringA("stop cdaudio", NULL, 0, NULL);
+		host_detach();
+		write(fds[1], &out, sizeof(out));
+		_exit(0); /* the parent owns the game folder */
+	}
+	close(fds[1]);
+	bool ok = pid > 0 && read(fds[0], r, sizeof(*r)) == sizeof(*r);
+	close(fds[0]);
+	if (pid > 0) waitpid(pid, NULL, 0);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned long long jitters[LEVELS_MAX] = {0, 20000, 150000, 700000};
+	int seconds = 240, levels = 4, max = 2000, c, failed = 0;
+	static char arg[16]; /* the ini keeps pointing at it */
+
+	while ((c = getopt(argc, argv, "s:d:m:")) != -1) {
+		switch (c) {
+			case 's': seconds = atoi(optarg); break;
+			case 'd': max = atoi(optarg); host_ini("AdaptiveDepth", optarg); break;
+			case 'm': host_ini("AdaptiveDepthMin", optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-s seconds] [-d ms] [-m ms] [jitter us]...\n", argv[0]);
+				return 2;
+		}
+	}
+	if (seconds < 1) seconds = 240;
+	if (optind < argc) {
+		for (levels = 0; optind < argc && levels < LEVELS_MAX; levels++) jitters[levels] = strtoull(argv[optind++], NULL, 10);
+	}
+	snprintf(arg, sizeof(arg), "%d", max);
+	host_ini("AdaptiveDepth", arg);
+
+	host_init("depth");
+	host_mkdir("Music");
+	host_wav("Music/Track02.wav", (seconds + 5) * 1000, 44100, 2, 1);
+
+	printf("AdaptiveDepth %d ms, %d s played\n", max, seconds);
+	printf("%-10s", "jitter ms");
+	for (int m = 0; m < MARKS && marks[m] <= seconds; m++) printf(" %5ds", marks[m]);
+	printf(" %8s %8s %9s %10s\n", "grows", "shrinks", "underruns", "settled s");
+	for (int l = 0; l < levels; l++) {
+		struct run r;
+		if (!play(jitters[l], seconds, &r)) {
+			fprintf(stderr, "jitter %llu us: no result\n", jitters[l]);
+			failed++;
+			continue;
+		}
+		printf("%-10llu", jitters[l] / 1000);
+		for (int m = 0; m < MARKS && marks[m] <= seconds; m++) printf(" %6ld", r.depth[m]);
+		printf(" %8ld %8ld %9ld %10llu\n", r.grows, r.shrinks, r.underruns, r.settled / 1000000);
+		if (r.underruns) {
+			fprintf(stderr, "jitter %llu us: %ld underruns\n", jitters[l], r.underruns);
+			failed++;
+		}
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
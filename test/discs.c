@@ -0,0 +1,126 @@
+/* Discs: a game with a folder per disc, Music\Disc1 and Music\Disc2 with tracks of their own. Checks the TOC each disc
+ * answers with, the number of tracks and the length of every track, and its identity through "info cdaudio identity"
+ * and MCI_INFO_MEDIA_IDENTITY, then swaps discs with "set cdaudio door open" and "closed" and checks the next disc the
+ * same way. Fails when a disc answers with another disc's TOC or identity, when two discs share an identity, or when a
+ * swap calls the file system: every disc is indexed at startup.
+ *
+ *   discs [-s swaps]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+#define DISCS	(2)
+#define TRACKS_MAX	(8)
+
+static const unsigned int lengths[DISCS][TRACKS_MAX] = {
+	{4000, 5000, 6000},
+	{2000, 3000, 7000, 9000, 11000},
+};
+static char identity[DISCS][32];
+
+static MCIERROR send(const char *cmd, char *ret, UINT len)
+{
+	if (ret) ret[0] = '\0';
+	MCIERROR err = fake_mciSendStringA(cmd, ret, len, NULL);
+	if (err) fprintf(stderr, "%s: error %u\n", cmd, (unsigned int)err);
+	return err;
+}
+
+/* The disc in the drive answers with disc n's TOC and an identity no other disc has, both calls agreeing on it */
+static int check(MCIDEVICEID id, int n)
+{
+	char cmd[64], ret[64];
+	int tracks = 0, failed = 0;
+	while (tracks < TRACKS_MAX && lengths[n][tracks]) tracks++;
+
+	if (send("status cdaudio number of tracks", ret, sizeof(ret)) || atoi(ret) != tracks) {
+		fprintf(stderr, "disc %d: %s tracks, %d expected\n", n + 1, ret, tracks);
+		failed++;
+	}
+	for (int t = 1; t <= tracks; t++) {
+		snprintf(cmd, sizeof(cmd), "status cdaudio length track %d", t);
+		/* CD frames are 1/75 s */
+		if (send(cmd, ret, sizeof(ret)) || abs(atoi(ret) - (int)lengths[n][t-1]) > 1000 / 75) {
+			fprintf(stderr, "disc %d track %d: %s ms, %u expected\n", n + 1, t, ret, lengths[n][t-1]);
+			failed++;
+		}
+	}
+
+	char info[32] = "";
+	MCI_INFO_PARMS parms = {0, info, sizeof(info)};
+	MCIERROR err = fake_mciSendCommandA(id, MCI_INFO, MCI_INFO_MEDIA_IDENTITY, (DWORD_PTR)&parms);
+	if (send("info cdaudio identity", ret, sizeof(ret)) || err || strlen(ret) != 16 || strcmp(ret, info)) {
+		fprintf(stderr, "disc %d: identity \"%s\", MCI_INFO_MEDIA_IDENTITY \"%s\", error %u\n", n + 1, ret, info,
+			(unsigned int)err);
+		failed++;
+	} else if (!identity[n][0]) {
+		snprintf(identity[n], sizeof(identity[n]), "%s", ret);
+		for (int i = 0; i < DISCS; i++) {
+			if (i != n && !strcmp(identity[i], ret)) {
+				fprintf(stderr, "discs %d and %d: both %s\n", i + 1, n + 1, ret);
+				failed++;
+			}
+		}
+	} else if (strcmp(identity[n], ret)) {
+		fprintf(stderr, "disc %d: %s, %s before\n", n + 1, ret, identity[n]);
+		failed++;
+	}
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	int swaps = 4, c, failed = 0;
+	while ((c = getopt(argc, argv, "s:")) != -1) {
+		switch (c) {
+			case 's': swaps = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-s swaps]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (swaps < 1 || swaps > 100) swaps = 4;
+
+	host_init("discs");
+	host_mkdir("Music");
+	for (int n = 0; n < DISCS; n++) {
+		char name[64];
+		snprintf(name, sizeof(name), "Music/Disc%d", n + 1);
+		host_mkdir(name);
+		for (int t = 0; t < TRACKS_MAX && lengths[n][t]; t++) {
+			snprintf(name, sizeof(name), "Music/Disc%d/Track%02d.wav", n + 1, t + 1);
+			host_wav(name, lengths[n][t], 44100, 2, n * 100 + t);
+		}
+	}
+	host_attach();
+
+	MCI_OPEN_PARMS op = {0};
+	op.lpstrDeviceType = "cdaudio";
+	if (fake_mciSendCommandA(0, MCI_OPEN, MCI_OPEN_TYPE, (DWORD_PTR)&op)) {
+		fprintf(stderr, "MCI_OPEN cdaudio failed\n");
+		return 1;
+	}
+	send("set cdaudio time format milliseconds", NULL, 0);
+	failed += check(op.wDeviceID, 0);
+
+	LONG files = host_files;
+	for (int s = 1; s <= swaps; s++) {
+		send("set cdaudio door open", NULL, 0);
+		send("set cdaudio door closed", NULL, 0);
+		failed += check(op.wDeviceID, s % DISCS);
+	}
+	if (host_files != files) {
+		fprintf(stderr, "%d swaps: %ld file system calls\n", swaps, (long)(host_files - files));
+		failed++;
+	}
+
+	fake_mciSendCommandA(op.wDeviceID, MCI_CLOSE, 0, 0);
+	host_detach();
+
+	printf("%d discs, %d swaps\n", DISCS, swaps);
+	for (int n = 0; n < DISCS; n++) printf("disc %d: %s\n", n + 1, identity[n]);
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
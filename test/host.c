@@ -0,0 +1,1883 @@
+/*
+ * This file is part of wav-winmm, a fork of ogg-winmm.
+ *
+ * wav-winmm is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2,
+ * as published by the Free Software Foundation.
+ *
+ * wav-winmm is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Host build: the Win32 calls wav-winmm makes and the system winmm behind it, see host.h.
+ *
+ * The virtual clock: every wait goes through block(), which counts the threads that can still run. When the last one
+ * blocks, time jumps to the earliest timeout or delayed completion and wakes whoever it is due for. Everything takes
+ * no time at all in between, so what a test measures is what the code asked for: buffer depths, timeouts, sleeps.
+ * Built with -DHOST_REAL the same calls run on real time and per-object locks instead, for ThreadSanitizer. */
+
+#define _GNU_SOURCE
+#include <windows.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <malloc.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "host.h"
+
+#undef fopen
+
+BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved);
+
+#define WAVE_QUEUE	(64)
+#define NOTES		(4096)
+#define VIEWS		(128)
+#define INIS		(64)
+#define TICK_BASE	(100000000ULL)	// GetTickCount starts a day and some into the uptime
+
+LONGLONG host_qpc_freq = 10000000;
+LONGLONG host_qpc_base = 0;
+unsigned long long host_latency = 0;
+unsigned long long host_jitter = 0;
+unsigned long long host_wake_late = 0;
+unsigned long long host_open_cost = 0;
+void (*host_sink)(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long heard) = NULL;
+unsigned long long host_silence = 0;
+unsigned long long host_midi_cost = 0;
+void (*host_midi)(DWORD msg, unsigned long long heard) = NULL;
+volatile LONG host_relays = 0;
+BOOL host_mcicda = FALSE;
+unsigned long long host_joy_cost = 0;
+volatile LONG host_joy_calls = 0;
+UINT host_joys = 0;
+UINT host_drive = DRIVE_FIXED;
+volatile LONG host_files = 0;
+unsigned long long host_read_cost = 0;
+volatile LONG host_sounds = 0;
+bool host_thread_fail = false;
+
+static char game[MAX_PATH];
+static const char *ini[INIS][2];
+static int ini_cnt = 0;
+static volatile LONG use_handles = 0, use_threads = 0, use_waves = 0, use_midis = 0, use_views = 0, use_blocks = 0;
+static volatile long long use_bytes = 0;
+static struct host_note notes[NOTES];
+static int note_cnt = 0;
+static pthread_mutex_t note_m = PTHREAD_MUTEX_INITIALIZER;
+static __thread DWORD tid = 0;
+static volatile LONG tids = 0;
+static volatile LONG pthreads = 1; /* running, with the test's own */
+static unsigned long long wall0 = 0;
+
+/* Handles: one header, then what the kind needs */
+enum { O_EVENT = 1, O_THREAD, O_CS, O_WAVE, O_FILE, O_MAP, O_FIND, O_MODULE, O_MIDI };
+
+struct obj
+{
+	int kind;
+	bool counted;		/* a handle wav-winmm made, see host_use */
+#ifdef HOST_REAL
+	pthread_mutex_t m;
+	pthread_cond_t c;
+#endif
+};
+
+struct event
+{
+	struct obj o;
+	bool manual;
+	bool state;
+};
+
+struct thread
+{
+	struct obj o;
+	LPTHREAD_START_ROUTINE fn;
+	void *arg;
+	bool done;
+	bool closed;
+};
+
+struct cs
+{
+	struct obj o;
+	DWORD owner;
+	int count;
+#ifdef HOST_REAL
+	pthread_mutex_t lock;
+#endif
+};
+
+struct file
+{
+	struct obj o;
+	int fd;
+};
+
+struct find
+{
+	struct obj o;
+	DIR *dir;
+	char pattern[MAX_PATH];
+};
+
+static unsigned long long mono(clockid_t id)
+{
+	struct timespec ts;
+	clock_gettime(id, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+unsigned long long host_wall(void) { return mono(CLOCK_MONOTONIC); }
+unsigned long long host_cpu(void) { return mono(CLOCK_PROCESS_CPUTIME_ID); }
+
+static DWORD self(void)
+{
+	if (!tid) tid = InterlockedIncrement(&tids);
+	return tid;
+}
+
+static void *obj_new(int kind, size_t size, bool counted)
+{
+	struct obj *o = calloc(1, size);
+	o->kind = kind;
+	o->counted = counted;
+#ifdef HOST_REAL
+	/* Wait deadlines are on the monotonic clock of host_wall */
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_mutex_init(&o->m, NULL);
+	pthread_cond_init(&o->c, &attr);
+	pthread_condattr_destroy(&attr);
+#endif
+	if (counted) InterlockedIncrement(&use_handles);
+	return o;
+}
+
+static void obj_free(struct obj *o)
+{
+#ifdef HOST_REAL
+	pthread_mutex_destroy(&o->m);
+	pthread_cond_destroy(&o->c);
+#endif
+	free(o);
+}
+
+#ifndef HOST_REAL
+
+/* The virtual clock and the scheduler, everything below runs under vm */
+static pthread_mutex_t vm = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long vnow = 0;
+static int runnable = 0;
+
+struct waiter
+{
+	pthread_cond_t cond;
+	struct obj *obj;	/* NULL: sleeping */
+	unsigned long long due;	/* HOST_FOREVER: no timeout */
+	DWORD tid;
+	int state;		/* 0: waiting, 1: signaled, 2: timed out */
+	struct waiter *prev, *next;
+};
+static struct waiter *wait_head = NULL, *wait_tail = NULL;
+
+/* SetEvent due later, the late buffer completions of host_jitter */
+struct late
+{
+	unsigned long long due;
+	struct event *ev;
+	struct late *next;
+};
+static struct late *lates = NULL;
+
+static void lock(void) { pthread_mutex_lock(&vm); }
+static void unlock(void) { pthread_mutex_unlock(&vm); }
+static unsigned long long now(void) { return vnow; }
+
+static void wake(struct waiter *w, int state)
+{
+	if (w->prev) w->prev->next = w->next;
+	else wait_head = w->next;
+	if (w->next) w->next->prev = w->prev;
+	else wait_tail = w->prev;
+	w->state = state;
+	runnable++;
+	pthread_cond_signal(&w->cond);
+}
+
+/* Wake the first waiter of o, or all of them */
+static int wake_obj(struct obj *o, bool all)
+{
+	int n = 0;
+	for (struct waiter *w = wait_head, *next; w; w = next) {
+		next = w->next;
+		if (w->obj != o) continue;
+		wake(w, 1);
+		n++;
+		if (!all) break;
+	}
+	return n;
+}
+
+static void ev_signal(struct event *e)
+{
+	if (e->manual) {
+		e->state = true;
+		wake_obj(&e->o, true);
+	} else if (!wake_obj(&e->o, false)) {
+		e->state = true;
+	}
+}
+
+static void deadlock(void)
+{
+	fprintf(stderr, "host: every thread waits forever at %llu us\n", vnow);
+	for (struct waiter *w = wait_head; w; w = w->next) {
+		fprintf(stderr, "host:   thread %u on %s\n", w->tid, !w->obj ? "sleep" : w->obj->kind == O_EVENT ? "event" :
+			w->obj->kind == O_THREAD ? "thread" : w->obj->kind == O_CS ? "critical section" : w->obj->kind == O_WAVE ? "waveOut" : "object");
+	}
+	abort();
+}
+
+/* Nothing can run: move time to the next thing due */
+static void advance(void)
+{
+	while (!runnable) {
+		unsigned long long due = HOST_FOREVER;
+		for (struct waiter *w = wait_head; w; w = w->next) {
+			if (w->due < due) due = w->due;
+		}
+		for (struct late *l = lates; l; l = l->next) {
+			if (l->due < due) due = l->due;
+		}
+		if (due == HOST_FOREVER) deadlock();
+		if (due > vnow) vnow = due;
+
+		for (struct late **pl = &lates; *pl; ) {
+			struct late *l = *pl;
+			if (l->due > vnow) {
+				pl = &l->next;
+				continue;
+			}
+			*pl = l->next;
+			ev_signal(l->ev);
+			free(l);
+		}
+		for (struct waiter *w = wait_head, *next; w; w = next) {
+			next = w->next;
+			if (w->due <= vnow) wake(w, 2);
+		}
+	}
+}
+
+/* Wait for o to be signaled or time to reach due, returns 1 or 2 like waiter.state */
+static int block(struct obj *o, unsigned long long due)
+{
+	struct waiter w = {.obj = o, .due = due, .tid = self()};
+	pthread_cond_init(&w.cond, NULL);
+	w.prev = wait_tail;
+	if (wait_tail) wait_tail->next = &w;
+	else wait_head = &w;
+	wait_tail = &w;
+
+	runnable--;
+	if (!runnable) advance();
+	while (!w.state) pthread_cond_wait(&w.cond, &vm);
+	pthread_cond_destroy(&w.cond);
+	return w.state;
+}
+
+/* Timeout of a wait of the code under test, a timed out one returns up to host_wake_late past it */
+static unsigned long long timeout(DWORD ms)
+{
+	if (ms == INFINITE) return HOST_FOREVER;
+	return vnow + ms * 1000ULL + (host_wake_late ? (unsigned long long)(drand48() * host_wake_late) : 0);
+}
+
+static void late_signal(struct event *e, unsigned long long delay)
+{
+	struct late *l = malloc(sizeof(*l));
+	l->due = vnow + delay;
+	l->ev = e;
+	l->next = lates;
+	lates = l;
+}
+
+static void *thread_main(void *arg)
+{
+	struct thread *t = arg;
+	self();
+	t->fn(t->arg);
+	InterlockedDecrement(&pthreads); /* before anyone can see it done, the task is gone soon after */
+	lock();
+	t->done = true;
+	wake_obj(&t->o, true);
+	if (t->o.counted) InterlockedDecrement(&use_threads);
+	bool gone = t->closed;
+	runnable--;
+	if (!runnable && wait_head) advance();
+	unlock();
+	if (gone) obj_free(&t->o);
+	return NULL;
+}
+
+static struct thread *thread_new(LPTHREAD_START_ROUTINE fn, void *arg, bool counted)
+{
+	pthread_t th;
+	pthread_attr_t attr;
+	struct thread *t = obj_new(O_THREAD, sizeof(struct thread), counted);
+	t->fn = fn;
+	t->arg = arg;
+	if (counted) InterlockedIncrement(&use_threads);
+	InterlockedIncrement(&pthreads);
+	lock();
+	runnable++;
+	unlock();
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&th, &attr, thread_main, t)) abort();
+	pthread_attr_destroy(&attr);
+	return t;
+}
+
+static DWORD wait_obj(struct obj *o, DWORD ms)
+{
+	DWORD ret = WAIT_OBJECT_0;
+	lock();
+	if (o->kind == O_EVENT) {
+		struct event *e = (struct event *)o;
+		if (e->state) {
+			if (!e->manual) e->state = false;
+		} else if (!ms || block(o, timeout(ms)) == 2) {
+			ret = WAIT_TIMEOUT;
+		}
+	} else if (o->kind == O_THREAD) {
+		if (!((struct thread *)o)->done && (!ms || block(o, timeout(ms)) == 2)) ret = WAIT_TIMEOUT;
+	}
+	unlock();
+	return ret;
+}
+
+void host_sleep(unsigned long long usec)
+{
+	lock();
+	block(NULL, vnow + usec);
+	unlock();
+}
+
+void Sleep(DWORD ms)
+{
+	if (!ms) {
+		sched_yield();
+		return;
+	}
+	lock();
+	block(NULL, timeout(ms));
+	unlock();
+}
+
+BOOL SetEvent(HANDLE h)
+{
+	lock();
+	ev_signal(h);
+	unlock();
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE h)
+{
+	lock();
+	((struct event *)h)->state = false;
+	unlock();
+	return TRUE;
+}
+
+BOOL PulseEvent(HANDLE h)
+{
+	lock();
+	wake_obj(h, ((struct event *)h)->manual);
+	((struct event *)h)->state = false;
+	unlock();
+	return TRUE;
+}
+
+void EnterCriticalSection(LPCRITICAL_SECTION p)
+{
+	struct cs *cs = p->a;
+	if (!cs) {
+		fprintf(stderr, "host: critical section %p used before InitializeCriticalSection\n", (void *)p);
+		abort();
+	}
+	lock();
+	if (!cs->owner || cs->owner == self()) {
+		cs->owner = self();
+		cs->count++;
+	} else {
+		block(&cs->o, HOST_FOREVER); /* LeaveCriticalSection handed it over */
+	}
+	unlock();
+}
+
+BOOL TryEnterCriticalSection(LPCRITICAL_SECTION p)
+{
+	struct cs *cs = p->a;
+	BOOL ok = FALSE;
+	lock();
+	if (!cs->owner || cs->owner == self()) {
+		cs->owner = self();
+		cs->count++;
+		ok = TRUE;
+	}
+	unlock();
+	return ok;
+}
+
+void LeaveCriticalSection(LPCRITICAL_SECTION p)
+{
+	struct cs *cs = p->a;
+	lock();
+	if (!--cs->count) {
+		cs->owner = 0;
+		for (struct waiter *w = wait_head; w; w = w->next) {
+			if (w->obj != &cs->o) continue;
+			cs->owner = w->tid;
+			cs->count = 1;
+			wake(w, 1);
+			break;
+		}
+	}
+	unlock();
+}
+
+void host_init_clock(void)
+{
+	lock();
+	runnable = 1; /* the test's own thread */
+	unlock();
+}
+
+#else /* HOST_REAL */
+
+/* Real time: per-object locks, so ThreadSanitizer sees the synchronization wav-winmm does and nothing more */
+static unsigned long long now(void) { return host_wall() - wall0; }
+
+static void deadline(struct timespec *ts, unsigned long long due)
+{
+	unsigned long long at = due + wall0;
+	ts->tv_sec = at / 1000000;
+	ts->tv_nsec = at % 1000000 * 1000;
+}
+
+static void *thread_main(void *arg)
+{
+	struct thread *t = arg;
+	self();
+	t->fn(t->arg);
+	InterlockedDecrement(&pthreads); /* before anyone can see it done, the task is gone soon after */
+	pthread_mutex_lock(&t->o.m);
+	t->done = true;
+	pthread_cond_broadcast(&t->o.c);
+	bool gone = t->closed, counted = t->o.counted; /* once done is seen, CloseHandle may free it */
+	pthread_mutex_unlock(&t->o.m);
+	if (counted) InterlockedDecrement(&use_threads);
+	if (gone) obj_free(&t->o);
+	return NULL;
+}
+
+static struct thread *thread_new(LPTHREAD_START_ROUTINE fn, void *arg, bool counted)
+{
+	pthread_t th;
+	pthread_attr_t attr;
+	struct thread *t = obj_new(O_THREAD, sizeof(struct thread), counted);
+	t->fn = fn;
+	t->arg = arg;
+	if (counted) InterlockedIncrement(&use_threads);
+	InterlockedIncrement(&pthreads);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&th, &attr, thread_main, t)) abort();
+	pthread_attr_destroy(&attr);
+	return t;
+}
+
+static DWORD wait_obj(struct obj *o, DWORD ms)
+{
+	struct timespec ts;
+	DWORD ret = WAIT_OBJECT_0;
+	deadline(&ts, now() + (ms == INFINITE ? 0 : ms * 1000ULL));
+	pthread_mutex_lock(&o->m);
+	for (;;) {
+		bool set = o->kind == O_EVENT ? ((struct event *)o)->state : ((struct thread *)o)->done;
+		if (set) {
+			if (o->kind == O_EVENT && !((struct event *)o)->manual) ((struct event *)o)->state = false;
+			break;
+		}
+		if (!ms || (ms != INFINITE && pthread_cond_timedwait(&o->c, &o->m, &ts) == ETIMEDOUT)) {
+			ret = WAIT_TIMEOUT;
+			break;
+		}
+		if (ms == INFINITE) pthread_cond_wait(&o->c, &o->m);
+	}
+	pthread_mutex_unlock(&o->m);
+	return ret;
+}
+
+void host_sleep(unsigned long long usec)
+{
+	usleep(usec);
+}
+
+void Sleep(DWORD ms)
+{
+	if (!ms) sched_yield();
+	else usleep(ms * 1000);
+}
+
+BOOL SetEvent(HANDLE h)
+{
+	struct event *e = h;
+	pthread_mutex_lock(&e->o.m);
+	e->state = true;
+	if (e->manual) pthread_cond_broadcast(&e->o.c);
+	else pthread_cond_signal(&e->o.c);
+	pthread_mutex_unlock(&e->o.m);
+	return TRUE;
+}
+
+BOOL ResetEvent(HANDLE h)
+{
+	struct event *e = h;
+	pthread_mutex_lock(&e->o.m);
+	e->state = false;
+	pthread_mutex_unlock(&e->o.m);
+	return TRUE;
+}
+
+BOOL PulseEvent(HANDLE h)
+{
+	SetEvent(h);
+	usleep(100);
+	return ResetEvent(h);
+}
+
+struct late
+{
+	struct event *ev;
+	unsigned long long delay;
+};
+
+static void *late_main(void *arg)
+{
+	struct late *l = arg;
+	usleep(l->delay);
+	SetEvent(l->ev);
+	free(l);
+	return NULL;
+}
+
+static void late_signal(struct event *e, unsigned long long delay)
+{
+	pthread_t th;
+	struct late *l = malloc(sizeof(*l));
+	l->ev = e;
+	l->delay = delay;
+	pthread_create(&th, NULL, late_main, l);
+	pthread_detach(th);
+}
+
+void EnterCriticalSection(LPCRITICAL_SECTION p)
+{
+	pthread_mutex_lock(&((struct cs *)p->a)->lock);
+}
+
+BOOL TryEnterCriticalSection(LPCRITICAL_SECTION p)
+{
+	return pthread_mutex_trylock(&((struct cs *)p->a)->lock) == 0;
+}
+
+void LeaveCriticalSection(LPCRITICAL_SECTION p)
+{
+	pthread_mutex_unlock(&((struct cs *)p->a)->lock);
+}
+
+void host_init_clock(void)
+{
+}
+
+#endif /* HOST_REAL */
+
+unsigned long long host_now(void)
+{
+#ifndef HOST_REAL
+	lock();
+	unsigned long long t = now();
+	unlock();
+	return t;
+#else
+	return now();
+#endif
+}
+
+void InitializeCriticalSection(LPCRITICAL_SECTION p)
+{
+	struct cs *cs = obj_new(O_CS, sizeof(struct cs), false);
+#ifdef HOST_REAL
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&cs->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif
+	memset(p, 0, sizeof(*p));
+	p->a = cs;
+}
+
+void DeleteCriticalSection(LPCRITICAL_SECTION p)
+{
+	struct cs *cs = p->a;
+	if (!cs) return;
+#ifdef HOST_REAL
+	pthread_mutex_destroy(&cs->lock);
+#endif
+	obj_free(&cs->o);
+	p->a = NULL;
+}
+
+HANDLE CreateEvent(void *attr, BOOL manual, BOOL init, LPCSTR name)
+{
+	struct event *e = obj_new(O_EVENT, sizeof(struct event), true);
+	e->manual = manual;
+	e->state = init;
+	return e;
+}
+
+HANDLE CreateEventA(void *attr, BOOL manual, BOOL init, LPCSTR name) { return CreateEvent(attr, manual, init, name); }
+
+HANDLE CreateThread(void *attr, SIZE_T stack, LPTHREAD_START_ROUTINE fn, LPVOID arg, DWORD flags, LPDWORD id)
+{
+	if (host_thread_fail) return NULL;
+	struct thread *t = thread_new(fn, arg, true);
+	if (id) *id = 1;
+	return t;
+}
+
+BOOL SetThreadPriority(HANDLE h, int priority) { return TRUE; }
+DWORD GetCurrentThreadId(void) { return self(); }
+
+DWORD WaitForSingleObject(HANDLE h, DWORD ms)
+{
+	return wait_obj(h, ms);
+}
+
+DWORD WaitForMultipleObjects(DWORD n, const HANDLE *h, BOOL all, DWORD ms)
+{
+	if (!all) {
+		fprintf(stderr, "host: WaitForMultipleObjects for any object is not served\n");
+		abort();
+	}
+	for (DWORD i = 0; i < n; i++) {
+		if (wait_obj(h[i], ms) == WAIT_TIMEOUT) return WAIT_TIMEOUT;
+	}
+	return WAIT_OBJECT_0;
+}
+
+BOOL CloseHandle(HANDLE h)
+{
+	struct obj *o = h;
+	if (!o || h == INVALID_HANDLE_VALUE) return FALSE;
+	if (o->counted) InterlockedDecrement(&use_handles);
+	switch (o->kind) {
+		case O_THREAD:
+			{
+				struct thread *t = h;
+				bool gone;
+#ifndef HOST_REAL
+				lock();
+				t->closed = true;
+				gone = t->done;
+				unlock();
+#else
+				pthread_mutex_lock(&t->o.m);
+				t->closed = true;
+				gone = t->done;
+				pthread_mutex_unlock(&t->o.m);
+#endif
+				if (gone) obj_free(o);
+			}
+			return TRUE;
+#ifndef HOST_REAL
+		case O_EVENT:
+			/* A completion due late must not signal it once it is gone */
+			lock();
+			for (struct late **pl = &lates; *pl; ) {
+				struct late *l = *pl;
+				if (l->ev != h) {
+					pl = &l->next;
+					continue;
+				}
+				*pl = l->next;
+				free(l);
+			}
+			unlock();
+			break;
+#endif
+		case O_FILE:
+		case O_MAP:
+			close(((struct file *)h)->fd);
+			break;
+		case O_FIND:
+			closedir(((struct find *)h)->dir);
+			break;
+	}
+	obj_free(o);
+	return TRUE;
+}
+
+/* Clocks */
+static unsigned long long split(unsigned long long t, unsigned long long mul, unsigned long long div)
+{
+	return t / div * mul + t % div * mul / div;
+}
+
+DWORD GetTickCount(void) { return (DWORD)(TICK_BASE + host_now() / 1000); }
+DWORD timeGetTime(void) { return GetTickCount(); }
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER *f)
+{
+	f->QuadPart = host_qpc_freq;
+	return TRUE;
+}
+
+BOOL QueryPerformanceCounter(LARGE_INTEGER *c)
+{
+	c->QuadPart = host_qpc_base + split(host_now(), host_qpc_freq, 1000000);
+	return TRUE;
+}
+
+MMRESULT timeBeginPeriod(UINT p) { return TIMERR_NOERROR; }
+MMRESULT timeEndPeriod(UINT p) { return TIMERR_NOERROR; }
+
+LONG InterlockedIncrement(volatile LONG *p) { return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST); }
+LONG InterlockedDecrement(volatile LONG *p) { return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST); }
+LONG InterlockedExchange(volatile LONG *p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+LONG InterlockedExchangeAdd(volatile LONG *p, LONG v) { return __atomic_fetch_add(p, v, __ATOMIC_SEQ_CST); }
+
+LONG InterlockedCompareExchange(volatile LONG *p, LONG x, LONG c)
+{
+	__atomic_compare_exchange_n(p, &c, x, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return c;
+}
+
+PVOID InterlockedExchangePointer(PVOID volatile *p, PVOID v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+
+PVOID InterlockedCompareExchangePointer(PVOID volatile *p, PVOID x, PVOID c)
+{
+	__atomic_compare_exchange_n(p, &c, x, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return c;
+}
+
+/* Memory, counted */
+struct block
+{
+	size_t size;
+	size_t pad;
+};
+
+static void *mem_alloc(size_t n, bool zero)
+{
+	struct block *b = zero ? calloc(1, sizeof(*b) + n) : malloc(sizeof(*b) + n);
+	if (!b) return NULL;
+	b->size = n;
+	InterlockedIncrement(&use_blocks);
+	__atomic_add_fetch(&use_bytes, n, __ATOMIC_SEQ_CST);
+	return b + 1;
+}
+
+static void mem_free(void *p)
+{
+	if (!p) return;
+	struct block *b = (struct block *)p - 1;
+	InterlockedDecrement(&use_blocks);
+	__atomic_sub_fetch(&use_bytes, b->size, __ATOMIC_SEQ_CST);
+	free(b);
+}
+
+HANDLE GetProcessHeap(void) { return (HANDLE)1; }
+LPVOID HeapAlloc(HANDLE h, DWORD flags, SIZE_T n) { return mem_alloc(n, flags & HEAP_ZERO_MEMORY); }
+BOOL HeapFree(HANDLE h, DWORD flags, LPVOID p) { mem_free(p); return TRUE; }
+
+LPVOID HeapReAlloc(HANDLE h, DWORD flags, LPVOID p, SIZE_T n)
+{
+	struct block *b = (struct block *)p - 1;
+	void *q = mem_alloc(n, flags & HEAP_ZERO_MEMORY);
+	if (!q) return NULL;
+	memcpy(q, p, b->size < n ? b->size : n);
+	mem_free(p);
+	return q;
+}
+
+LPVOID VirtualAlloc(LPVOID at, SIZE_T n, DWORD type, DWORD protect) { return mem_alloc(n, true); }
+BOOL VirtualFree(LPVOID p, SIZE_T n, DWORD type) { mem_free(p); return TRUE; }
+
+SIZE_T VirtualQuery(LPCVOID p, MEMORY_BASIC_INFORMATION *mbi, SIZE_T n)
+{
+	/* wav-winmm and the game are one image here, every address counts as a module of its own so calls into the stubs
+	 * come from the game */
+	memset(mbi, 0, n);
+	mbi->AllocationBase = (PVOID)p;
+	return n;
+}
+
+/* Files: game paths come with backslashes */
+static void unix_path(char *dst, const char *src, size_t len)
+{
+	size_t i = 0;
+	for (; src[i] && i < len-1; i++) dst[i] = src[i] == '\\' ? '/' : src[i];
+	dst[i] = '\0';
+}
+
+static void narrow(char *dst, LPCWSTR src, size_t len)
+{
+	size_t i = 0;
+	for (; src[i] && i < len-1; i++) dst[i] = src[i] == '\\' ? '/' : (char)src[i];
+	dst[i] = '\0';
+}
+
+FILE *host_fopen(const char *path, const char *mode)
+{
+	char p[MAX_PATH];
+	InterlockedIncrement(&host_files);
+	unix_path(p, path, sizeof(p));
+	return fopen(p, mode);
+}
+
+static DWORD attributes(const char *p)
+{
+	struct stat st;
+	InterlockedIncrement(&host_files);
+	if (stat(p, &st)) return INVALID_FILE_ATTRIBUTES;
+	return S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+}
+
+DWORD GetFileAttributes(LPCSTR path)
+{
+	char p[MAX_PATH];
+	unix_path(p, path, sizeof(p));
+	return attributes(p);
+}
+
+DWORD GetFileAttributesA(LPCSTR path) { return GetFileAttributes(path); }
+
+static BOOL attributes_ex(const char *p, WIN32_FILE_ATTRIBUTE_DATA *d)
+{
+	struct stat st;
+	InterlockedIncrement(&host_files);
+	if (stat(p, &st)) return FALSE;
+	memset(d, 0, sizeof(*d));
+	d->dwFileAttributes = S_ISDIR(st.st_mode) ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+	d->nFileSizeLow = (DWORD)st.st_size;
+	d->nFileSizeHigh = (DWORD)((unsigned long long)st.st_size >> 32);
+	d->ftLastWriteTime.dwLowDateTime = (DWORD)st.st_mtim.tv_nsec;
+	d->ftLastWriteTime.dwHighDateTime = (DWORD)st.st_mtim.tv_sec;
+	return TRUE;
+}
+
+BOOL GetFileAttributesEx(LPCSTR path, int level, LPVOID out)
+{
+	char p[MAX_PATH];
+	unix_path(p, path, sizeof(p));
+	return attributes_ex(p, out);
+}
+
+BOOL GetFileAttributesExA(LPCSTR path, int level, LPVOID out) { return GetFileAttributesEx(path, level, out); }
+
+BOOL GetFileAttributesExW(LPCWSTR path, int level, LPVOID out)
+{
+	char p[MAX_PATH];
+	narrow(p, path, sizeof(p));
+	return attributes_ex(p, out);
+}
+
+DWORD GetFullPathNameA(LPCSTR name, DWORD len, LPSTR buf, LPSTR *part)
+{
+	char cwd[MAX_PATH] = "";
+	if (name[0] != '/' && name[0] != '\\' && !(name[0] && name[1] == ':') && !getcwd(cwd, sizeof(cwd))) return 0;
+	int n = snprintf(buf, len, "%s%s%s", cwd, cwd[0] ? "/" : "", name);
+	return n < len ? n : 0;
+}
+
+DWORD GetFullPathName(LPCSTR name, DWORD len, LPSTR buf, LPSTR *part) { return GetFullPathNameA(name, len, buf, part); }
+
+DWORD GetFullPathNameW(LPCWSTR name, DWORD len, LPWSTR buf, LPWSTR *part)
+{
+	char p[MAX_PATH], full[MAX_PATH];
+	narrow(p, name, sizeof(p));
+	DWORD n = GetFullPathNameA(p, sizeof(full), full, NULL);
+	if (!n || n >= len) return 0;
+	for (DWORD i = 0; i <= n; i++) buf[i] = (unsigned char)full[i];
+	return n;
+}
+
+static HANDLE file_open(const char *p)
+{
+	InterlockedIncrement(&host_files);
+	int fd = open(p, O_RDONLY);
+	if (fd < 0) return INVALID_HANDLE_VALUE;
+	struct file *f = obj_new(O_FILE, sizeof(struct file), true);
+	f->fd = fd;
+	return f;
+}
+
+HANDLE CreateFileA(LPCSTR path, DWORD access, DWORD share, void *sec, DWORD disp, DWORD attr, HANDLE tmpl)
+{
+	char p[MAX_PATH];
+	unix_path(p, path, sizeof(p));
+	return file_open(p);
+}
+
+HANDLE CreateFile(LPCSTR path, DWORD access, DWORD share, void *sec, DWORD disp, DWORD attr, HANDLE tmpl)
+{
+	return CreateFileA(path, access, share, sec, disp, attr, tmpl);
+}
+
+HANDLE CreateFileW(LPCWSTR path, DWORD access, DWORD share, void *sec, DWORD disp, DWORD attr, HANDLE tmpl)
+{
+	char p[MAX_PATH];
+	narrow(p, path, sizeof(p));
+	return file_open(p);
+}
+
+/* Every path is on one volume, of the type host_drive says */
+BOOL GetVolumePathNameA(LPCSTR path, LPSTR root, DWORD len)
+{
+	if (!path || !root || len < 4) return FALSE;
+	strcpy(root, "C:\\");
+	return TRUE;
+}
+
+BOOL GetVolumePathNameW(LPCWSTR path, LPWSTR root, DWORD len)
+{
+	if (!path || !root || len < 4) return FALSE;
+	wcscpy(root, L"C:\\");
+	return TRUE;
+}
+
+UINT GetDriveTypeA(LPCSTR root) { return host_drive; }
+UINT GetDriveTypeW(LPCWSTR root) { return host_drive; }
+
+DWORD GetFileSize(HANDLE h, LPDWORD high)
+{
+	struct stat st;
+	if (fstat(((struct file *)h)->fd, &st)) return INVALID_FILE_SIZE;
+	if (high) *high = (DWORD)((unsigned long long)st.st_size >> 32);
+	return (DWORD)st.st_size;
+}
+
+BOOL ReadFile(HANDLE h, LPVOID buf, DWORD len, LPDWORD got, void *overlapped)
+{
+	InterlockedIncrement(&host_files);
+	if (host_read_cost) host_sleep(host_read_cost);
+	ssize_t n = read(((struct file *)h)->fd, buf, len);
+	if (got) *got = n > 0 ? n : 0;
+	return n >= 0;
+}
+
+HANDLE CreateFileMapping(HANDLE h, void *sec, DWORD protect, DWORD high, DWORD low, LPCSTR name)
+{
+	struct file *m = obj_new(O_MAP, sizeof(struct file), true);
+	m->fd = dup(((struct file *)h)->fd);
+	return m;
+}
+
+HANDLE CreateFileMappingA(HANDLE h, void *sec, DWORD protect, DWORD high, DWORD low, LPCSTR name)
+{
+	return CreateFileMapping(h, sec, protect, high, low, name);
+}
+
+static struct { void *at; size_t len; } views[VIEWS];
+static pthread_mutex_t view_m = PTHREAD_MUTEX_INITIALIZER;
+
+LPVOID MapViewOfFile(HANDLE h, DWORD access, DWORD high, DWORD low, SIZE_T n)
+{
+	struct stat st;
+	int fd = ((struct file *)h)->fd;
+	if (fstat(fd, &st) || !st.st_size) return NULL;
+	void *at = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (at == MAP_FAILED) return NULL;
+	pthread_mutex_lock(&view_m);
+	for (int i = 0; i < VIEWS; i++) {
+		if (views[i].at) continue;
+		views[i].at = at;
+		views[i].len = st.st_size;
+		break;
+	}
+	pthread_mutex_unlock(&view_m);
+	InterlockedIncrement(&use_views);
+	return at;
+}
+
+BOOL UnmapViewOfFile(LPCVOID at)
+{
+	BOOL ok = FALSE;
+	pthread_mutex_lock(&view_m);
+	for (int i = 0; i < VIEWS; i++) {
+		if (views[i].at != at) continue;
+		munmap(views[i].at, views[i].len);
+		views[i].at = NULL;
+		ok = TRUE;
+		break;
+	}
+	pthread_mutex_unlock(&view_m);
+	if (ok) InterlockedDecrement(&use_views);
+	return ok;
+}
+
+BOOL FindNextFile(HANDLE h, WIN32_FIND_DATA *fd)
+{
+	struct find *f = h;
+	struct dirent *e;
+	while ((e = readdir(f->dir))) {
+		if (fnmatch(f->pattern, e->d_name, FNM_CASEFOLD)) continue;
+		memset(fd, 0, sizeof(*fd));
+		snprintf(fd->cFileName, sizeof(fd->cFileName), "%s", e->d_name);
+		fd->dwFileAttributes = e->d_type == DT_DIR ? FILE_ATTRIBUTE_DIRECTORY : FILE_ATTRIBUTE_NORMAL;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+HANDLE FindFirstFile(LPCSTR path, WIN32_FIND_DATA *fd)
+{
+	char p[MAX_PATH];
+	InterlockedIncrement(&host_files);
+	unix_path(p, path, sizeof(p));
+	char *slash = strrchr(p, '/');
+	if (!slash) return INVALID_HANDLE_VALUE;
+	*slash = '\0';
+	DIR *dir = opendir(p);
+	if (!dir) return INVALID_HANDLE_VALUE;
+	struct find *f = obj_new(O_FIND, sizeof(struct find), true);
+	f->dir = dir;
+	snprintf(f->pattern, sizeof(f->pattern), "%s", slash + 1);
+	if (!FindNextFile(f, fd)) {
+		CloseHandle(f);
+		return INVALID_HANDLE_VALUE;
+	}
+	return f;
+}
+
+BOOL FindClose(HANDLE h) { return CloseHandle(h); }
+
+/* The module and its ini */
+DWORD GetModuleFileName(HMODULE h, LPSTR buf, DWORD len)
+{
+	return snprintf(buf, len, "%s\\winmm.dll", game);
+}
+
+DWORD GetModuleFileNameA(HMODULE h, LPSTR buf, DWORD len) { return GetModuleFileName(h, buf, len); }
+
+HMODULE GetModuleHandleA(LPCSTR name)
+{
+	return name && strcasecmp(name, "mcicda.dll") == 0 && host_mcicda ? (HMODULE)2 : NULL;
+}
+
+HMODULE GetModuleHandle(LPCSTR name) { return GetModuleHandleA(name); }
+
+static const char *ini_get(const char *key)
+{
+	for (int i = 0; i < ini_cnt; i++) {
+		if (strcasecmp(ini[i][0], key) == 0) return ini[i][1];
+	}
+	return NULL;
+}
+
+void host_ini(const char *key, const char *value)
+{
+	for (int i = 0; i < ini_cnt; i++) {
+		if (strcasecmp(ini[i][0], key) == 0) {
+			ini[i][1] = value;
+			return;
+		}
+	}
+	if (ini_cnt == INIS) abort();
+	ini[ini_cnt][0] = key;
+	ini[ini_cnt++][1] = value;
+}
+
+DWORD GetPrivateProfileString(LPCSTR sec, LPCSTR key, LPCSTR def, LPSTR buf, DWORD len, LPCSTR file)
+{
+	const char *v = ini_get(key);
+	return snprintf(buf, len, "%s", v ? v : def);
+}
+
+UINT GetPrivateProfileInt(LPCSTR sec, LPCSTR key, int def, LPCSTR file)
+{
+	const char *v = ini_get(key);
+	return v ? atoi(v) : def;
+}
+
+UINT GetSystemDirectory(LPSTR buf, UINT len) { return snprintf(buf, len, "C:\\Windows\\system32"); }
+
+void OutputDebugStringA(LPCSTR s) { fprintf(stderr, "%s", s); }
+BOOL IsDebuggerPresent(void) { return FALSE; }
+void DebugBreak(void) { abort(); }
+
+HRSRC FindResourceA(HMODULE h, LPCSTR name, LPCSTR type) { return NULL; }
+HRSRC FindResourceW(HMODULE h, LPCWSTR name, LPCWSTR type) { return NULL; }
+HGLOBAL LoadResource(HMODULE h, HRSRC r) { return NULL; }
+LPVOID LockResource(HGLOBAL g) { return NULL; }
+DWORD SizeofResource(HMODULE h, HRSRC r) { return 0; }
+
+int WideCharToMultiByte(UINT cp, DWORD flags, LPCWSTR w, int n, LPSTR a, int len, LPCSTR def, BOOL *used)
+{
+	if (used) *used = FALSE;
+	for (int i = 0; i < len; i++) {
+		a[i] = w[i] > 0x7F ? '?' : (char)w[i];
+		if (w[i] > 0x7F && used) *used = TRUE;
+		if (!w[i]) return i + 1;
+	}
+	return 0;
+}
+
+int MultiByteToWideChar(UINT cp, DWORD flags, LPCSTR a, int n, LPWSTR w, int len)
+{
+	for (int i = 0; i < len; i++) {
+		w[i] = (unsigned char)a[i];
+		if (!a[i]) return i + 1;
+	}
+	return 0;
+}
+
+/* Window messages: only MCI notifications are kept */
+static void note(UINT msg, WPARAM wp, LPARAM lp)
+{
+	if (msg != MM_MCINOTIFY) return;
+	unsigned long long at = host_now();
+	pthread_mutex_lock(&note_m);
+	if (note_cnt < NOTES) {
+		notes[note_cnt].at = at;
+		notes[note_cnt].status = wp;
+		notes[note_cnt].id = lp;
+		note_cnt++;
+	}
+	pthread_mutex_unlock(&note_m);
+}
+
+BOOL SendNotifyMessageA(HWND w, UINT msg, WPARAM wp, LPARAM lp) { note(msg, wp, lp); return TRUE; }
+BOOL PostMessage(HWND w, UINT msg, WPARAM wp, LPARAM lp) { note(msg, wp, lp); return TRUE; }
+BOOL PostMessageA(HWND w, UINT msg, WPARAM wp, LPARAM lp) { note(msg, wp, lp); return TRUE; }
+BOOL PostThreadMessage(DWORD id, UINT msg, WPARAM wp, LPARAM lp) { return TRUE; }
+BOOL PostThreadMessageA(DWORD id, UINT msg, WPARAM wp, LPARAM lp) { return TRUE; }
+
+int host_notes(struct host_note *out, int max)
+{
+	pthread_mutex_lock(&note_m);
+	int n = note_cnt < max ? note_cnt : max;
+	memcpy(out, notes, n * sizeof(*out));
+	pthread_mutex_unlock(&note_m);
+	return n;
+}
+
+void host_notes_clear(void)
+{
+	pthread_mutex_lock(&note_m);
+	note_cnt = 0;
+	pthread_mutex_unlock(&note_m);
+}
+
+/* waveOut: each device plays its queue on a thread of its own, in real time of the clock */
+struct wave
+{
+	struct obj o;		/* waited on by its thread for queue changes */
+	WAVEFORMATEX fmt;
+	DWORD_PTR cb;
+	DWORD_PTR inst;
+	DWORD type;
+	WAVEHDR *q[WAVE_QUEUE];
+	int n;
+	bool paused;
+	bool closing;
+	bool run;		/* q[0] is playing since seg */
+	unsigned long long seg;
+	DWORD off;		/* bytes of q[0] played before seg */
+	DWORD played;		/* bytes played since open or reset, wraps like the driver's */
+	struct thread *th;
+};
+
+#ifndef HOST_REAL
+#define wave_lock(d)		lock()
+#define wave_unlock(d)		unlock()
+#define wave_kick(d)		wake_obj(&(d)->o, true)
+#define wave_wait(d, due)	block(&(d)->o, due)
+#define wave_signal(e)		ev_signal(e)
+#else
+#define wave_lock(d)		pthread_mutex_lock(&(d)->o.m)
+#define wave_unlock(d)		pthread_mutex_unlock(&(d)->o.m)
+#define wave_kick(d)		pthread_cond_broadcast(&(d)->o.c)
+#define wave_signal(e)		SetEvent(e)
+static void wave_wait(struct wave *d, unsigned long long due)
+{
+	struct timespec ts;
+	if (due == HOST_FOREVER) {
+		pthread_cond_wait(&d->o.c, &d->o.m);
+		return;
+	}
+	deadline(&ts, due);
+	pthread_cond_timedwait(&d->o.c, &d->o.m, &ts);
+}
+#endif
+
+static unsigned long long wave_usec(struct wave *d, DWORD bytes)
+{
+	return ((unsigned long long)bytes * 1000000 + d->fmt.nAvgBytesPerSec - 1) / d->fmt.nAvgBytesPerSec;
+}
+
+/* Bytes of q[0] played by now */
+static DWORD wave_part(struct wave *d)
+{
+	if (!d->run) return 0;
+	DWORD left = d->q[0]->dwBufferLength - d->off;
+	unsigned long long bytes = (now() - d->seg) * d->fmt.nAvgBytesPerSec / 1000000 / d->fmt.nBlockAlign * d->fmt.nBlockAlign;
+	return bytes < left ? (DWORD)bytes : left;
+}
+
+/* q[0] stops playing part of the way in, hand what was heard to the sink */
+static void wave_hold(struct wave *d)
+{
+	if (!d->run) return;
+	DWORD part = wave_part(d);
+	if (host_sink && part) host_sink(&d->fmt, d->q[0]->lpData + d->off, part, d->seg + host_latency);
+	d->off += part;
+	d->played += part;
+	d->run = false;
+}
+
+/* Call with the device locked, function callbacks run unlocked */
+static void wave_done(struct wave *d, WAVEHDR *h)
+{
+	h->dwFlags = (h->dwFlags & ~WHDR_INQUEUE) | WHDR_DONE;
+	switch (d->type & CALLBACK_TYPEMASK) {
+		case CALLBACK_EVENT:
+			if (host_jitter) late_signal((struct event *)d->cb, (unsigned long long)(drand48() * host_jitter));
+			else wave_signal((HANDLE)d->cb);
+			break;
+		case CALLBACK_FUNCTION:
+			wave_unlock(d);
+			((LPDRVCALLBACK)d->cb)((HANDLE)d, WOM_DONE, d->inst, (DWORD_PTR)h, 0);
+			wave_lock(d);
+			break;
+	}
+}
+
+static DWORD WINAPI wave_main(void *arg)
+{
+	struct wave *d = arg;
+	wave_lock(d);
+	while (!d->closing) {
+		if (d->paused || !d->n) {
+			wave_wait(d, HOST_FOREVER);
+			continue;
+		}
+		WAVEHDR *h = d->q[0];
+		if (!d->run) {
+			d->run = true;
+			d->seg = now();
+		}
+		unsigned long long due = d->seg + wave_usec(d, h->dwBufferLength - d->off);
+		if (now() < due) {
+			wave_wait(d, due);
+			continue;
+		}
+		DWORD left = h->dwBufferLength - d->off;
+		if (host_sink && left) host_sink(&d->fmt, h->lpData + d->off, left, d->seg + host_latency);
+		d->played += left;
+		d->off = 0;
+		d->seg = due;
+		memmove(d->q, d->q + 1, --d->n * sizeof(*d->q));
+		if (!d->n) d->run = false;
+		wave_done(d, h);
+	}
+	wave_unlock(d);
+	return 0;
+}
+
+MMRESULT waveOutOpen(LPHWAVEOUT ph, UINT id, LPCWAVEFORMATEX fmt, DWORD_PTR cb, DWORD_PTR inst, DWORD type)
+{
+	if (!fmt || fmt->wFormatTag != WAVE_FORMAT_PCM || !fmt->nBlockAlign || !fmt->nAvgBytesPerSec) return 32; /* WAVERR_BADFORMAT */
+	if (type & WAVE_FORMAT_QUERY) return MMSYSERR_NOERROR;
+	if (host_open_cost) host_sleep(host_open_cost);
+
+	struct wave *d = obj_new(O_WAVE, sizeof(struct wave), false);
+	d->fmt = *fmt;
+	d->cb = cb;
+	d->inst = inst;
+	d->type = type;
+	d->th = thread_new(wave_main, d, false);
+	*ph = (HWAVEOUT)d;
+	InterlockedIncrement(&use_waves);
+
+	if ((type & CALLBACK_TYPEMASK) == CALLBACK_EVENT) SetEvent((HANDLE)cb);
+	else if ((type & CALLBACK_TYPEMASK) == CALLBACK_FUNCTION) ((LPDRVCALLBACK)cb)((HANDLE)d, WOM_OPEN, inst, 0, 0);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT waveOutClose(HWAVEOUT h)
+{
+	struct wave *d = (struct wave *)h;
+	wave_lock(d);
+	if (d->n) {
+		wave_unlock(d);
+		return WAVERR_STILLPLAYING;
+	}
+	d->closing = true;
+	wave_kick(d);
+	wave_unlock(d);
+	wait_obj(&d->th->o, INFINITE);
+	CloseHandle(d->th);
+	if ((d->type & CALLBACK_TYPEMASK) == CALLBACK_FUNCTION) ((LPDRVCALLBACK)d->cb)((HANDLE)d, WOM_CLOSE, d->inst, 0, 0);
+	obj_free(&d->o);
+	InterlockedDecrement(&use_waves);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT waveOutPrepareHeader(HWAVEOUT h, LPWAVEHDR hdr, UINT len)
+{
+	hdr->dwFlags |= WHDR_PREPARED;
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT waveOutUnprepareHeader(HWAVEOUT h, LPWAVEHDR hdr, UINT len)
+{
+	if (hdr->dwFlags & WHDR_INQUEUE) return WAVERR_STILLPLAYING;
+	hdr->dwFlags &= ~WHDR_PREPARED;
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT waveOutWrite(HWAVEOUT h, LPWAVEHDR hdr, UINT len)
+{
+	struct wave *d = (struct wave *)h;
+	if (!(hdr->dwFlags & WHDR_PREPARED)) return 34; /* WAVERR_UNPREPARED */
+	wave_lock(d);
+	if (d->n == WAVE_QUEUE) {
+		wave_unlock(d);
+		return MMSYSERR_NOMEM;
+	}
+	hdr->dwFlags = (hdr->dwFlags & ~WHDR_DONE) | WHDR_INQUEUE;
+	d->q[d->n++] = hdr;
+	wave_kick(d);
+	wave_unlock(d);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT waveOutPause(HWAVEOUT h)
+{
+	struct wave *d = (struct wave *)h;
+	wave_lock(d);
+	wave_hold(d);
+	if (!d->paused) __atomic_store_n(&host_silence, now() + host_latency, __ATOMIC_RELAXED);
+	d->paused = true;
+	wave_kick(d);
+	wave_unlock(d);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT waveOutRestart(HWAVEOUT h)
+{
+	struct wave *d = (struct wave *)h;
+	wave_lock(d);
+	d->paused = false;
+	wave_kick(d);
+	wave_unlock(d);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT waveOutReset(HWAVEOUT h)
+{
+	struct wave *d = (struct wave *)h;
+	wave_lock(d);
+	wave_hold(d);
+	__atomic_store_n(&host_silence, now() + host_latency, __ATOMIC_RELAXED);
+	while (d->n) {
+		WAVEHDR *hdr = d->q[0];
+		memmove(d->q, d->q + 1, --d->n * sizeof(*d->q));
+		wave_done(d, hdr);
+	}
+	d->off = 0;
+	d->played = 0;
+	d->paused = false;
+	wave_kick(d);
+	wave_unlock(d);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT waveOutGetPosition(HWAVEOUT h, LPMMTIME t, UINT len)
+{
+	struct wave *d = (struct wave *)h;
+	wave_lock(d);
+	DWORD bytes = d->played + wave_part(d);
+	wave_unlock(d);
+	if (t->wType == TIME_BYTES) {
+		t->u.cb = bytes;
+	} else if (t->wType == TIME_SAMPLES) {
+		t->u.sample = bytes / d->fmt.nBlockAlign;
+	} else {
+		t->wType = TIME_MS;
+		t->u.ms = (DWORD)((unsigned long long)bytes * 1000 / d->fmt.nAvgBytesPerSec);
+	}
+	return MMSYSERR_NOERROR;
+}
+
+static UINT WINAPI sys_one(void) { return 1; }
+
+/* MIDI output: messages are heard when they are sent */
+MMRESULT midiOutOpen(LPHMIDIOUT ph, UINT id, DWORD_PTR cb, DWORD_PTR inst, DWORD flags)
+{
+	if (host_midi_cost) host_sleep(host_midi_cost);
+	*ph = (HMIDIOUT)obj_new(O_MIDI, sizeof(struct obj), false);
+	InterlockedIncrement(&use_midis);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT midiOutClose(HMIDIOUT h)
+{
+	obj_free((struct obj *)h);
+	InterlockedDecrement(&use_midis);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT midiOutShortMsg(HMIDIOUT h, DWORD msg)
+{
+	if (host_midi) host_midi(msg, host_now() + host_latency);
+	return MMSYSERR_NOERROR;
+}
+
+MMRESULT midiOutReset(HMIDIOUT h) { return MMSYSERR_NOERROR; }
+
+/* The system MCI: answers nothing, loads its CD audio driver for anything naming cdaudio */
+static MCIERROR WINAPI sys_mciSendCommandA(MCIDEVICEID id, UINT msg, DWORD_PTR flags, DWORD_PTR parms)
+{
+	InterlockedIncrement(&host_relays);
+	return MCIERR_UNRECOGNIZED_COMMAND;
+}
+
+static MCIERROR WINAPI sys_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT len, HWND cb)
+{
+	InterlockedIncrement(&host_relays);
+	if (cmd && strstr(cmd, "cdaudio")) host_mcicda = TRUE;
+	if (ret && len) ret[0] = '\0';
+	return MCIERR_UNRECOGNIZED_COMMAND;
+}
+
+static MCIERROR WINAPI sys_mciSendStringW(LPCWSTR cmd, LPWSTR ret, UINT len, HWND cb)
+{
+	InterlockedIncrement(&host_relays);
+	if (cmd && wcsstr(cmd, L"cdaudio")) host_mcicda = TRUE;
+	if (ret && len) ret[0] = 0;
+	return MCIERR_UNRECOGNIZED_COMMAND;
+}
+
+static MCIDEVICEID WINAPI sys_mciGetDeviceID(const void *name) { return 0; }
+static BOOL WINAPI sys_mciExecute(LPCSTR cmd) { InterlockedIncrement(&host_relays); return FALSE; }
+
+/* Like the system's, codes past the MCI ones are the drivers' and unknown here */
+static BOOL WINAPI sys_mciGetErrorStringA(MCIERROR err, LPSTR text, UINT len)
+{
+	if (!text || !len || err >= MCIERR_CUSTOM_DRIVER_BASE) return FALSE;
+	snprintf(text, len, "system MCI error %u", err);
+	return TRUE;
+}
+
+static BOOL WINAPI sys_mciGetErrorStringW(MCIERROR err, LPWSTR text, UINT len)
+{
+	char buf[64];
+	if (!text || !len || err >= MCIERR_CUSTOM_DRIVER_BASE) return FALSE;
+	snprintf(buf, sizeof(buf), "system MCI error %u", err);
+	MultiByteToWideChar(CP_ACP, 0, buf, -1, text, len);
+	text[len-1] = 0;
+	return TRUE;
+}
+
+/* System timers: a thread each, like the multimedia timer of old */
+struct systimer
+{
+	UINT id;
+	UINT delay;
+	LPTIMECALLBACK cb;
+	DWORD_PTR user;
+	UINT flags;
+	HANDLE kill;
+	HANDLE th;
+	struct systimer *next;
+};
+static struct systimer *systimers = NULL;
+static UINT systimer_ids = 0;
+static pthread_mutex_t systimer_m = PTHREAD_MUTEX_INITIALIZER;
+
+static DWORD WINAPI systimer_main(void *arg)
+{
+	struct systimer *t = arg;
+	unsigned long long due = host_now() + t->delay * 1000ULL;
+	for (;;) {
+		unsigned long long at = host_now();
+		DWORD ms = due > at ? (DWORD)((due - at + 999) / 1000) : 0;
+		if (ms && wait_obj(t->kill, ms) == WAIT_OBJECT_0) break;
+		if (!ms && wait_obj(t->kill, 0) == WAIT_OBJECT_0) break;
+		if (t->flags & TIME_CALLBACK_EVENT_SET) SetEvent((HANDLE)t->cb);
+		else if (t->flags & TIME_CALLBACK_EVENT_PULSE) PulseEvent((HANDLE)t->cb);
+		else t->cb(t->id, 0, t->user, 0, 0);
+		if (!(t->flags & TIME_PERIODIC)) break;
+		due += t->delay * 1000ULL;
+	}
+	return 0;
+}
+
+static MMRESULT WINAPI sys_timeSetEvent(UINT delay, UINT res, LPTIMECALLBACK cb, DWORD_PTR user, UINT flags)
+{
+	struct systimer *t = calloc(1, sizeof(*t));
+	t->delay = delay ? delay : 1;
+	t->cb = cb;
+	t->user = user;
+	t->flags = flags;
+	t->kill = obj_new(O_EVENT, sizeof(struct event), false);
+	((struct event *)t->kill)->manual = true;
+	pthread_mutex_lock(&systimer_m);
+	t->id = ++systimer_ids;
+	t->next = systimers;
+	systimers = t;
+	pthread_mutex_unlock(&systimer_m);
+	t->th = thread_new(systimer_main, t, false);
+	return t->id;
+}
+
+static MMRESULT WINAPI sys_timeKillEvent(UINT id)
+{
+	struct systimer *t = NULL;
+	pthread_mutex_lock(&systimer_m);
+	for (struct systimer **pt = &systimers; *pt; pt = &(*pt)->next) {
+		if ((*pt)->id != id) continue;
+		t = *pt;
+		*pt = t->next;
+		break;
+	}
+	pthread_mutex_unlock(&systimer_m);
+	if (!t) return MMSYSERR_INVALPARAM;
+	SetEvent(t->kill);
+	wait_obj(t->th, INFINITE);
+	obj_free(t->th);
+	obj_free(t->kill);
+	free(t);
+	return TIMERR_NOERROR;
+}
+
+/* Joysticks behind a slow driver */
+static MMRESULT WINAPI sys_joyGetPosEx(UINT id, LPJOYINFOEX info)
+{
+	InterlockedIncrement(&host_joy_calls);
+	if (host_joy_cost) host_sleep(host_joy_cost);
+	if (id >= host_joys) return JOYERR_UNPLUGGED;
+	if (info) info->dwXpos = info->dwYpos = 32767;
+	return JOYERR_NOERROR;
+}
+
+static MMRESULT WINAPI sys_joyGetPos(UINT id, LPJOYINFO info)
+{
+	InterlockedIncrement(&host_joy_calls);
+	if (host_joy_cost) host_sleep(host_joy_cost);
+	if (id >= host_joys) return JOYERR_UNPLUGGED;
+	if (info) info->wXpos = info->wYpos = 32767;
+	return JOYERR_NOERROR;
+}
+
+/* mmio with buffered file reads */
+static HMMIO WINAPI sys_mmioOpenA(LPSTR name, LPMMIOINFO info, DWORD flags)
+{
+	FILE *f = name ? host_fopen(name, "rb") : NULL;
+	if (f) InterlockedIncrement(&use_handles);
+	return (HMMIO)f;
+}
+
+static MMRESULT WINAPI sys_mmioClose(HMMIO h, UINT flags)
+{
+	fclose((FILE *)h);
+	InterlockedDecrement(&use_handles);
+	return MMSYSERR_NOERROR;
+}
+
+static LONG WINAPI sys_mmioRead(HMMIO h, HPSTR buf, LONG len)
+{
+	return (LONG)fread(buf, 1, len, (FILE *)h);
+}
+
+static LONG WINAPI sys_mmioSeek(HMMIO h, LONG off, int origin)
+{
+	if (fseek((FILE *)h, off, origin)) return -1;
+	return (LONG)ftell((FILE *)h);
+}
+
+/* PlaySound reads a file sound whole on every call, a sound in memory only has its header checked */
+static BOOL sound(const char *path, const void *mem, DWORD flags)
+{
+	InterlockedIncrement(&host_sounds);
+	if (!path) return TRUE; /* stops what plays */
+	if ((flags & SND_RESOURCE) == SND_RESOURCE) return FALSE;
+	if (flags & SND_MEMORY) return !memcmp(mem, "RIFF", 4);
+	FILE *f = host_fopen(path, "rb");
+	if (!f) return FALSE;
+	char buf[4096];
+	while (fread(buf, 1, sizeof(buf), f) == sizeof(buf));
+	fclose(f);
+	if (host_read_cost) host_sleep(host_read_cost);
+	return TRUE;
+}
+
+static BOOL WINAPI sys_PlaySoundA(LPCSTR name, HMODULE mod, DWORD flags)
+{
+	return sound(name, name, flags);
+}
+
+static BOOL WINAPI sys_PlaySoundW(LPCWSTR name, HMODULE mod, DWORD flags)
+{
+	char p[MAX_PATH];
+	if (name && !(flags & SND_MEMORY)) narrow(p, name, sizeof(p));
+	return sound(name ? p : NULL, name, flags);
+}
+
+static BOOL WINAPI sys_sndPlaySoundA(LPCSTR name, UINT flags) { return sys_PlaySoundA(name, NULL, flags); }
+static BOOL WINAPI sys_sndPlaySoundW(LPCWSTR name, UINT flags) { return sys_PlaySoundW(name, NULL, flags); }
+
+/* Everything else the system winmm exports answers 0 */
+static volatile LONG sys_others = 0;
+static DWORD_PTR WINAPI sys_other(void)
+{
+	InterlockedIncrement(&sys_others);
+	return 0;
+}
+
+static const struct { const char *name; void *fn; } sys_exports[] = {
+	{"waveOutOpen", waveOutOpen}, {"waveOutClose", waveOutClose}, {"waveOutReset", waveOutReset},
+	{"waveOutPause", waveOutPause}, {"waveOutRestart", waveOutRestart}, {"waveOutWrite", waveOutWrite},
+	{"waveOutPrepareHeader", waveOutPrepareHeader}, {"waveOutUnprepareHeader", waveOutUnprepareHeader},
+	{"waveOutGetPosition", waveOutGetPosition}, {"waveOutGetNumDevs", sys_one},
+	{"midiOutOpen", midiOutOpen}, {"midiOutClose", midiOutClose}, {"midiOutShortMsg", midiOutShortMsg},
+	{"midiOutReset", midiOutReset}, {"midiOutGetNumDevs", sys_one},
+	{"timeGetTime", timeGetTime}, {"timeBeginPeriod", timeBeginPeriod}, {"timeEndPeriod", timeEndPeriod},
+	{"timeSetEvent", sys_timeSetEvent}, {"timeKillEvent", sys_timeKillEvent},
+	{"mciSendCommandA", sys_mciSendCommandA}, {"mciSendCommandW", sys_mciSendCommandA},
+	{"mciSendStringA", sys_mciSendStringA}, {"mciSendStringW", sys_mciSendStringW},
+	{"mciGetDeviceIDA", sys_mciGetDeviceID}, {"mciGetDeviceIDW", sys_mciGetDeviceID}, {"mciExecute", sys_mciExecute},
+	{"mciGetErrorStringA", sys_mciGetErrorStringA}, {"mciGetErrorStringW", sys_mciGetErrorStringW},
+	{"joyGetPosEx", sys_joyGetPosEx}, {"joyGetPos", sys_joyGetPos},
+	{"mmioOpenA", sys_mmioOpenA}, {"mmioClose", sys_mmioClose}, {"mmioRead", sys_mmioRead}, {"mmioSeek", sys_mmioSeek},
+	{"PlaySound", sys_PlaySoundA}, {"PlaySoundA", sys_PlaySoundA}, {"PlaySoundW", sys_PlaySoundW},
+	{"sndPlaySoundA", sys_sndPlaySoundA}, {"sndPlaySoundW", sys_sndPlaySoundW},
+};
+
+HMODULE LoadLibrary(LPCSTR path)
+{
+	return obj_new(O_MODULE, sizeof(struct obj), true);
+}
+
+BOOL FreeLibrary(HMODULE h) { return CloseHandle(h); }
+
+void *GetProcAddress(HMODULE h, LPCSTR name)
+{
+	if (!h) return NULL;
+	for (int i = 0; i < sizeof(sys_exports) / sizeof(sys_exports[0]); i++) {
+		if (strcmp(sys_exports[i].name, name) == 0) return sys_exports[i].fn;
+	}
+	return sys_other;
+}
+
+/* Usage */
+static long entries(const char *dir)
+{
+	long n = 0;
+	DIR *d = opendir(dir);
+	if (!d) return -1;
+	for (struct dirent *e; (e = readdir(d)); ) {
+		if (e->d_name[0] != '.') n++;
+	}
+	closedir(d);
+	return n;
+}
+
+void host_use(struct host_use *u)
+{
+	u->handles = use_handles;
+	u->threads = use_threads;
+	u->waves = use_waves;
+	u->midis = use_midis;
+	u->views = use_views;
+	u->blocks = use_blocks;
+	u->bytes = use_bytes;
+	u->arena = mallinfo2().uordblks;
+	u->fds = entries("/proc/self/fd") - 1; /* the listing's own */
+	/* Threads that returned may take a moment to be gone */
+	for (int i = 0; (u->tasks = entries("/proc/self/task")) > pthreads && i < 1000; i++) usleep(100);
+}
+
+int host_growth(const char *when, const struct host_use *a, const struct host_use *b)
+{
+	int grew = 0;
+#define GREW(field, slack) \
+	if (b->field > a->field + (slack)) { \
+		fprintf(stderr, "%s: %s grew from %lld to %lld\n", when, #field, (long long)a->field, (long long)b->field); \
+		grew++; \
+	}
+	GREW(handles, 0)
+	GREW(threads, 0)
+	GREW(waves, 0)
+	GREW(midis, 0)
+	GREW(views, 0)
+	GREW(blocks, 0)
+	GREW(bytes, 0)
+	GREW(arena, 1 << 20) /* the C library keeps freed chunks around */
+	GREW(fds, 0)
+	GREW(tasks, 0)
+#undef GREW
+	return grew;
+}
+
+static int cmp_ull(const void *a, const void *b)
+{
+	unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+	return x < y ? -1 : x > y;
+}
+
+unsigned long long host_pct(unsigned long long *v, int n, int pct)
+{
+	if (n <= 0) return 0;
+	qsort(v, n, sizeof(*v), cmp_ull);
+	int i = (n * pct + 99) / 100 - 1;
+	return v[i < 0 ? 0 : i >= n ? n-1 : i];
+}
+
+/* The game folder */
+static int rm_entry(const char *p, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(p);
+}
+
+static void cleanup(void)
+{
+	if (game[0] && !getenv("HOST_KEEP")) nftw(game, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+void host_init(const char *name)
+{
+	char tmpl[MAX_PATH];
+	const char *tmp = getenv("TMPDIR");
+	snprintf(tmpl, sizeof(tmpl), "%s/wav-winmm-%s-XXXXXX", tmp && tmp[0] ? tmp : "/tmp", name);
+	if (!mkdtemp(tmpl)) {
+		perror("host: mkdtemp");
+		exit(2);
+	}
+	snprintf(game, sizeof(game), "%s", tmpl);
+	atexit(cleanup);
+	wall0 = host_wall();
+	srand48(1);
+	self();
+	host_init_clock();
+}
+
+const char *host_path(const char *rel)
+{
+	static char buf[8][MAX_PATH];
+	static volatile LONG next = 0;
+	char *p = buf[InterlockedIncrement(&next) % 8];
+	if (snprintf(p, MAX_PATH, "%s/%s", game, rel) >= MAX_PATH) {
+		fprintf(stderr, "%s/%s: path too long\n", game, rel);
+		exit(2);
+	}
+	return p;
+}
+
+void host_mkdir(const char *rel)
+{
+	mkdir(host_path(rel), 0755);
+}
+
+void host_wav(const char *rel, unsigned int ms, unsigned int rate, int channels, unsigned int seed)
+{
+	unsigned int frames = (unsigned long long)rate * ms / 1000, len = frames * channels * 2;
+	unsigned char header[44] = "RIFF\0\0\0\0WAVEfmt \x10\0\0\0\x01\0";
+	unsigned int riff = len + 36, avg = rate * channels * 2;
+	unsigned short ch = channels, align = channels * 2, bits = 16;
+	memcpy(header+4, &riff, 4);
+	memcpy(header+22, &ch, 2);
+	memcpy(header+24, &rate, 4);
+	memcpy(header+28, &avg, 4);
+	memcpy(header+32, &align, 2);
+	memcpy(header+34, &bits, 2);
+	memcpy(header+36, "data", 4);
+	memcpy(header+40, &len, 4);
+
+	FILE *f = fopen(host_path(rel), "wb");
+	if (!f) {
+		perror(rel);
+		exit(2);
+	}
+	fwrite(header, 1, 44, f);
+	short *pcm = malloc(len ? len : 2);
+	for (unsigned int n = 0, i = 0; n < frames; n++) {
+		for (int c = 0; c < channels; c++) pcm[i++] = (short)((n * 7 + c * 1000 + seed) % 20000) - 10000;
+	}
+	fwrite(pcm, 1, len, f);
+	free(pcm);
+	fclose(f);
+}
+
+static void be32(unsigned char *p, unsigned int v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+void host_mid(const char *rel, int notes)
+{
+	unsigned char header[22] = "MThd\0\0\0\x06\0\0\0\x01\x01\xE0MTrk";
+	unsigned char *track = malloc(notes * 9 + 4), *t = track;
+	for (int i = 0; i < notes; i++) {
+		unsigned char key = 60 + i % 12;
+		*t++ = 0; *t++ = 0x90; *t++ = key; *t++ = 100;			/* on at once */
+		*t++ = 0x83; *t++ = 0x60; *t++ = 0x80; *t++ = key; *t++ = 0;	/* off 480 ticks later */
+	}
+	*t++ = 0; *t++ = 0xFF; *t++ = 0x2F; *t++ = 0;
+	be32(header+18, t - track);
+
+	FILE *f = fopen(host_path(rel), "wb");
+	if (!f) {
+		perror(rel);
+		exit(2);
+	}
+	fwrite(header, 1, sizeof(header), f);
+	fwrite(track, 1, t - track, f);
+	free(track);
+	fclose(f);
+}
+
+void host_attach(void)
+{
+	DllMain(NULL, DLL_PROCESS_ATTACH, NULL);
+}
+
+void host_detach(void)
+{
+	DllMain(NULL, DLL_PROCESS_DETACH, NULL);
+}
@@ -0,0 +1,127 @@
+/*
+ * Host build of wav-winmm for the tests and benchmarks in this folder.
+ *
+ * host.c serves the Win32 calls of wav-winmm.c, player.c, sequencer.c and stubs.c on Linux, and stands in for the
+ * system winmm behind loadRealDLL. Time is virtual: GetTickCount, QueryPerformanceCounter, Sleep and wait timeouts
+ * read one clock, and it only moves on when every thread waits. Sessions run as fast as the code does, the same way
+ * every time, and a thread that waits forever with no other thread left to wake it is reported and aborts.
+ *
+ * The waveOut devices play to a sink that stamps every sample with the virtual time it is heard.
+ */
+
+#ifndef HOST_H
+#define HOST_H
+#include <stdbool.h>
+#include <windows.h>
+
+#define HOST_FOREVER	(~0ULL)
+
+/* Start the clock and make an empty game folder, call first */
+void host_init(const char *name);
+/* Unix path of a file in the game folder, in a rotating static buffer */
+const char *host_path(const char *rel);
+void host_mkdir(const char *rel);
+/* Write a 16-bit PCM WAV into the game folder. Sample n of channel c is (n * 7 + c * 1000 + seed) % 20000 - 10000. */
+void host_wav(const char *rel, unsigned int ms, unsigned int rate, int channels, unsigned int seed);
+/* Write a Standard MIDI File into the game folder: one track of notes quarter notes at 120 bpm, 500 ms each */
+void host_mid(const char *rel, int notes);
+/* winmm.ini entries, before host_attach */
+void host_ini(const char *key, const char *value);
+void host_attach(void);
+void host_detach(void);
+
+/* Virtual time in microseconds, and real time for measuring what the code costs */
+unsigned long long host_now(void);
+void host_sleep(unsigned long long usec);
+unsigned long long host_wall(void);
+unsigned long long host_cpu(void);
+/* Counter frequency and start value of QueryPerformanceCounter, set before host_attach */
+extern LONGLONG host_qpc_freq;
+extern LONGLONG host_qpc_base;
+/* CreateThread fails while set */
+extern bool host_thread_fail;
+
+/* Sink: called with every stretch of PCM a waveOut device played, stamped with when its first frame is heard */
+extern unsigned long long host_latency;		/* usec from a sample leaving the device to being heard */
+extern unsigned long long host_jitter;		/* usec a buffer completion may reach the player late, uniformly */
+extern unsigned long long host_wake_late;	/* usec a timed wait or Sleep may return late, uniformly */
+extern unsigned long long host_open_cost;	/* usec waveOutOpen takes */
+extern void (*host_sink)(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long heard);
+/* Virtual time the most recent waveOutReset or waveOutPause silenced a device, as heard */
+extern unsigned long long host_silence;
+
+/* MIDI output: every short message with the time it is heard */
+extern unsigned long long host_midi_cost;	/* usec midiOutOpen takes */
+extern void (*host_midi)(DWORD msg, unsigned long long heard);
+
+/* The system winmm: calls not served by wav-winmm end up here */
+extern volatile LONG host_relays;		/* MCI calls that reached it */
+extern BOOL host_mcicda;			/* its CD audio driver counts as loaded */
+extern unsigned long long host_joy_cost;	/* usec joyGetPos and joyGetPosEx take */
+extern volatile LONG host_joy_calls;		/* and how often they were called */
+extern UINT host_joys;				/* joysticks plugged in */
+extern UINT host_drive;				/* GetDriveType of every volume, DRIVE_FIXED by default */
+extern volatile LONG host_files;		/* file system calls: opens, reads, attribute lookups and listings */
+extern unsigned long long host_read_cost;	/* usec a ReadFile or the read of a sound file by PlaySound takes */
+extern volatile LONG host_sounds;		/* PlaySound and sndPlaySound calls */
+
+/* MCI notifications sent to windows */
+struct host_note
+{
+	unsigned long long at;
+	WPARAM status;
+	LPARAM id;
+};
+int host_notes(struct host_note *notes, int max);
+void host_notes_clear(void);
+
+/* Everything a session may leave behind */
+struct host_use
+{
+	long handles;		/* events, threads, files, mappings, find handles and modules */
+	long threads;		/* threads started with CreateThread that did not exit */
+	long waves;		/* waveOut devices open */
+	long midis;		/* MIDI outputs open */
+	long views;		/* mapped views */
+	long blocks;		/* HeapAlloc and VirtualAlloc blocks */
+	long long bytes;	/* and their bytes */
+	long long arena;	/* malloc arena in use */
+	long fds;		/* open file descriptors */
+	long tasks;		/* threads of the process */
+};
+void host_use(struct host_use *u);
+/* Print what grew from a to b, returns how many counters did */
+int host_growth(const char *when, const struct host_use *a, const struct host_use *b);
+
+/* Percentiles of a sample set, sorts it */
+unsigned long long host_pct(unsigned long long *v, int n, int pct);
+
+/* The exports under test */
+MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam);
+MCIERROR WINAPI fake_mciSendCommandW(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam);
+MCIERROR WINAPI fake_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT cchReturn, HANDLE hwndCallback);
+MCIERROR WINAPI fake_mciSendStringW(LPCWSTR cmd, LPWSTR ret, UINT cchReturn, HANDLE hwndCallback);
+MCIDEVICEID WINAPI fake_mciGetDeviceIDA(LPCSTR name);
+BOOL WINAPI fake_mciGetErrorStringA(MCIERROR err, LPSTR text, UINT len);
+BOOL WINAPI fake_mciGetErrorStringW(MCIERROR err, LPWSTR text, UINT len);
+UINT WINAPI fake_auxGetNumDevs();
+MMRESULT WINAPI fake_auxGetDevCapsA(UINT_PTR uDeviceID, LPAUXCAPS lpCaps, UINT cbCaps);
+MMRESULT WINAPI fake_auxGetVolume(UINT uDeviceID, LPDWORD lpdwVolume);
+MMRESULT WINAPI fake_auxSetVolume(UINT uDeviceID, DWORD dwVolume);
+MMRESULT WINAPI fake_timeSetEvent(UINT a0, UINT a1, LPTIMECALLBACK a2, DWORD a3, UINT a4);
+MMRESULT WINAPI fake_timeKillEvent(UINT a0);
+MMRESULT WINAPI fake_waveOutOpen(LPHWAVEOUT a0, UINT a1, LPCWAVEFORMATEX a2, DWORD_PTR a3, DWORD_PTR a4, DWORD a5);
+MMRESULT WINAPI fake_waveOutClose(HWAVEOUT a0);
+MMRESULT WINAPI fake_waveOutPrepareHeader(HWAVEOUT a0, LPWAVEHDR a1, UINT a2);
+MMRESULT WINAPI fake_waveOutUnprepareHeader(HWAVEOUT a0, LPWAVEHDR a1, UINT a2);
+MMRESULT WINAPI fake_waveOutWrite(HWAVEOUT a0, LPWAVEHDR a1, UINT a2);
+MMRESULT WINAPI fake_joyGetPosEx(UINT a0, LPJOYINFOEX a1);
+HMMIO WINAPI fake_mmioOpenA(LPSTR a0, LPMMIOINFO a1, DWORD a2);
+LONG WINAPI fake_mmioRead(HMMIO a0, HPSTR a1, LONG a2);
+LONG WINAPI fake_mmioSeek(HMMIO a0, LONG a1, int a2);
+MMRESULT WINAPI fake_mmioClose(HMMIO a0, UINT a1);
+BOOL WINAPI fake_sndPlaySoundA(LPCSTR a0, UINT a1);
+BOOL WINAPI fake_PlaySoundA(LPCSTR a0, HMODULE a1, DWORD a2);
+BOOL WINAPI fake_PlaySoundW(LPCWSTR a0, HMODULE a1, DWORD a2);
+
+#endif
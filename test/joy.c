@@ -0,0 +1,91 @@
+/* Joy: a game that polls all 16 joystick ids every frame, behind a driver that takes a millisecond to answer each, with
+ * one joystick plugged in. Reports the frames per second the polling leaves room for and how often the driver was
+ * asked, with every poll passed to the system winmm and with JoyProbe. Fails when JoyProbe answers for the plugged
+ * joystick, or does not notice a joystick plugged in once its interval passed.
+ *
+ *   joy [-f frames] [-c driver cost us] [-p JoyProbe ms]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+#include "stub.h"
+
+#define IDS	(16)
+
+struct result
+{
+	double fps;		/* frames per second of virtual time the polls allow */
+	double ns;		/* real nanoseconds a poll takes */
+	LONG calls;		/* the driver was asked */
+	int plugged;		/* polls of id 0 that found it */
+};
+
+static struct result frames(int n)
+{
+	struct result r = {0};
+	JOYINFOEX info = {sizeof(info), JOY_RETURNALL};
+	LONG calls = host_joy_calls;
+	unsigned long long t = host_now(), wall = host_wall();
+	for (int f = 0; f < n; f++) {
+		for (UINT id = 0; id < IDS; id++) {
+			if (fake_joyGetPosEx(id, &info) == JOYERR_NOERROR && !id) r.plugged++;
+		}
+	}
+	t = host_now() - t;
+	wall = host_wall() - wall;
+	r.fps = t ? n * 1e6 / t : 0;
+	r.ns = wall * 1000.0 / n / IDS;
+	r.calls = host_joy_calls - calls;
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	int n = 1000, probe = 2000, c, failed = 0;
+	while ((c = getopt(argc, argv, "f:c:p:")) != -1) {
+		switch (c) {
+			case 'f': n = atoi(optarg); break;
+			case 'c': host_joy_cost = strtoull(optarg, NULL, 10); break;
+			case 'p': probe = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-f frames] [-c us] [-p ms]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (n < 1) n = 1000;
+	if (probe < 1) probe = 2000;
+	if (!host_joy_cost) host_joy_cost = 1000;
+
+	host_init("joy");
+	host_attach();
+	host_joys = 1;
+
+	printf("%d frames polling %d joystick ids, the driver takes %llu us, JoyProbe %d ms\n", n, IDS, host_joy_cost, probe);
+	printf("%-10s %12s %12s %12s\n", "", "frames/s", "ns per poll", "driver calls");
+	for (int on = 0; on < 2; on++) {
+		stub_joyprobe(on ? probe : 0);
+		struct result r = frames(n);
+		printf("%-10s %12.1f %12.0f %12ld\n", on ? "JoyProbe" : "relayed", r.fps, r.ns, (long)r.calls);
+		if (r.plugged != n) {
+			fprintf(stderr, "%s: the plugged joystick answered %d of %d polls\n", on ? "JoyProbe" : "relayed", r.plugged, n);
+			failed++;
+		}
+	}
+
+	/* Plugged in meanwhile: found once the interval passed, not before */
+	JOYINFOEX info = {sizeof(info), JOY_RETURNALL};
+	host_joys = 2;
+	MMRESULT before = fake_joyGetPosEx(1, &info);
+	host_sleep(probe * 1000ULL);
+	MMRESULT after = fake_joyGetPosEx(1, &info);
+	if (before != JOYERR_UNPLUGGED || after != JOYERR_NOERROR) {
+		fprintf(stderr, "joystick 1 plugged in: %u before the interval, %u after\n", before, after);
+		failed++;
+	}
+	stub_joyprobe(0);
+
+	host_detach();
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
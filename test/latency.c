@@ -0,0 +1,224 @@
+/* Latency: how long CD audio commands take to be heard, end to end through fake_mciSendCommandA and
+ * fake_mciSendStringA, with the waveOut sink stamping every sample with when it is heard.
+ *
+ *   PLAY	PLAY from a track start to its first sample
+ *   STOP	STOP to silence
+ *   PAUSE	PAUSE to silence
+ *   RESUME	RESUME to the next sample
+ *   seek	PLAY from another track while playing to that track's first sample, the player stops and reopens
+ *   cue	PLAY from later in the track playing to the sample there, the player seeks in the open file
+ *   volume	auxSetVolume to the first sample at the new volume
+ *
+ *   latency [-n runs] [-l sink latency us] [-j completion jitter us] [-o waveOutOpen us] [-d AdaptiveDepth ms]
+ *           [-m AdaptiveDepthMin ms] [-h HeadCache] [-c DiscCache MB] [-f CDDAPath]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+#define RUNS_MAX	(10000)
+#define TRACKS		(4)
+
+enum { L_PLAY, L_STOP, L_PAUSE, L_RESUME, L_SEEK, L_CUE, L_VOLUME, L_CNT };
+static const char *names[L_CNT] = {"PLAY", "STOP", "PAUSE", "RESUME", "seek", "cue", "volume"};
+static unsigned long long *lat[L_CNT];
+static int cnt[L_CNT], missed[L_CNT];
+
+/* What the sink watches for since a command. A stretch of PCM reaches the sink once it played or was cut off, so a
+ * watch stays on until the STOP ending the run has flushed everything. */
+enum { W_TRACK, W_ANY, W_GAIN };
+struct watch
+{
+	int kind;
+	bool on;
+	unsigned long long from;
+	unsigned long long at;
+	short first;
+};
+static struct watch watches[L_CNT];
+
+#define CUE_S		(3)		/* seconds into every track of its cue point */
+
+/* The first frame of every track and the frame at its cue point are markers outside the range of the rest */
+static short marker(int track)
+{
+	return 30000 + track;
+}
+
+static short cue_marker(int track)
+{
+	return 31000 + track;
+}
+
+static void mark(const char *rel, unsigned int frame_at, short value)
+{
+	short frame[2] = {value, -value};
+	FILE *f = fopen(host_path(rel), "r+b");
+	fseek(f, 44 + frame_at * sizeof(frame), SEEK_SET);
+	fwrite(frame, sizeof(frame), 1, f);
+	fclose(f);
+}
+
+/* Called with the clock held, must not call back into host.c */
+static void sink(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long heard)
+{
+	const short *s = (const short *)pcm;
+	unsigned int frames = bytes / fmt->nBlockAlign, ch = fmt->nChannels;
+	if (fmt->nSamplesPerSec != 44100 || !frames) return;
+	for (int i = 0; i < L_CNT; i++) {
+		struct watch *w = &watches[i];
+		if (!w->on || w->at) continue;
+		switch (w->kind) {
+			case W_TRACK:
+				for (unsigned int n = 0; n < frames; n++) {
+					unsigned long long at = heard + (unsigned long long)n * 1000000 / fmt->nSamplesPerSec;
+					if (s[n * ch] != w->first || at < w->from) continue;
+					w->at = at;
+					break;
+				}
+				break;
+			case W_ANY:
+				if (heard >= w->from) w->at = heard;
+				break;
+			case W_GAIN:
+				/* Full volume steps by 7 from frame to frame, anything else was scaled */
+				for (unsigned int n = 1; n < frames; n++) {
+					int step = s[n * ch] - s[(n-1) * ch];
+					if (s[n * ch] > 10000 || s[(n-1) * ch] > 10000) continue; /* a marker */
+					unsigned long long at = heard + (unsigned long long)n * 1000000 / fmt->nSamplesPerSec;
+					if (step == 7 || step == 7 - 20000 || at < w->from) continue;
+					w->at = at;
+					break;
+				}
+				break;
+		}
+	}
+}
+
+static void record(int what, unsigned long long from, unsigned long long at)
+{
+	if (at < from || cnt[what] == RUNS_MAX) missed[what]++;
+	else lat[what][cnt[what]++] = at - from;
+}
+
+static void watch(int what, int kind, short first)
+{
+	struct watch *w = &watches[what];
+	w->kind = kind;
+	w->first = first;
+	w->at = 0;
+	w->from = host_now();
+	w->on = true;
+}
+
+/* After the STOP, everything heard went through the sink */
+static void watch_end(void)
+{
+	for (int i = 0; i < L_CNT; i++) {
+		if (!watches[i].on) continue;
+		watches[i].on = false;
+		record(i, watches[i].from, watches[i].at);
+	}
+}
+
+/* STOP returns before the player thread let go of the device, the sink hears when it did */
+static void silence(int what, MCIERROR (*cmd)(void), unsigned long long settle)
+{
+	unsigned long long t = host_now(), before = host_silence;
+	cmd();
+	host_sleep(settle);
+	record(what, t, host_silence != before ? host_silence : 0);
+}
+
+static MCIERROR cd_stop(void) { return fake_mciSendStringA("stop cdaudio", NULL, 0, NULL); }
+static MCIERROR cd_pause(void) { return fake_mciSendCommandA(0, MCI_PAUSE, 0, 0); }
+
+int main(int argc, char **argv)
+{
+	int runs = 200, c;
+	const char *folder = "Music";
+	char music[MAX_PATH];
+
+	host_latency = 20000;
+	while ((c = getopt(argc, argv, "n:l:j:o:d:m:h:c:f:")) != -1) {
+		switch (c) {
+			case 'n': runs = atoi(optarg); break;
+			case 'l': host_latency = strtoull(optarg, NULL, 10); break;
+			case 'j': host_jitter = strtoull(optarg, NULL, 10); break;
+			case 'o': host_open_cost = strtoull(optarg, NULL, 10); break;
+			case 'd': host_ini("AdaptiveDepth", optarg); break;
+			case 'm': host_ini("AdaptiveDepthMin", optarg); break;
+			case 'h': host_ini("HeadCache", optarg); break;
+			case 'c': host_ini("DiscCache", optarg); break;
+			case 'f': folder = optarg; host_ini("CDDAPath", optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-l us] [-j us] [-o us] [-d ms] [-m ms] [-h tracks] [-c MB] [-f folder]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (runs > RUNS_MAX) runs = RUNS_MAX;
+	for (int i = 0; i < L_CNT; i++) lat[i] = calloc(RUNS_MAX, sizeof(**lat));
+
+	host_init("latency");
+	host_mkdir(folder);
+	for (int t = 2; t < 2 + TRACKS; t++) {
+		snprintf(music, sizeof(music), "%s/Track%02d.wav", folder, t);
+		host_wav(music, 6000, 44100, 2, t * 1000);
+		mark(music, 0, marker(t));
+		mark(music, CUE_S * 44100, cue_marker(t));
+	}
+	host_sink = sink;
+	host_attach();
+	fake_mciSendStringA("set cdaudio time format tmsf", NULL, 0, NULL);
+	fake_auxSetVolume(0, 0xFFFFFFFF);
+
+	unsigned long long wall = host_wall();
+	for (int r = 0; r < runs; r++) {
+		int t = 2 + r % TRACKS, t2 = 2 + (r + 1) % TRACKS;
+		char cmd[64];
+
+		MCI_PLAY_PARMS play = {0};
+		play.dwFrom = MCI_MAKE_TMSF(t, 0, 0, 0);
+		watch(L_PLAY, W_TRACK, marker(t));
+		fake_mciSendCommandA(0, MCI_PLAY, MCI_FROM, (DWORD_PTR)&play);
+		host_sleep(300000 + r % 7 * 10000);
+
+		watch(L_VOLUME, W_GAIN, 0);
+		fake_auxSetVolume(0, 0x80008000);
+		host_sleep(250000);
+		fake_auxSetVolume(0, 0xFFFFFFFF);
+		host_sleep(100000);
+
+		silence(L_PAUSE, cd_pause, 100000 + r % 5 * 10000);
+		watch(L_RESUME, W_ANY, 0);
+		if (r & 1) fake_mciSendStringA("resume cdaudio", NULL, 0, NULL);
+		else fake_mciSendCommandA(0, MCI_RESUME, 0, 0);
+		host_sleep(200000);
+
+		/* About a second into the track, its cue point is not queued yet */
+		play.dwFrom = MCI_MAKE_TMSF(t, 0, CUE_S, 0);
+		watch(L_CUE, W_TRACK, cue_marker(t));
+		fake_mciSendCommandA(0, MCI_PLAY, MCI_FROM, (DWORD_PTR)&play);
+		host_sleep(300000);
+
+		snprintf(cmd, sizeof(cmd), "play cdaudio from %d", t2);
+		watch(L_SEEK, W_TRACK, marker(t2));
+		fake_mciSendStringA(cmd, NULL, 0, NULL);
+		host_sleep(300000);
+
+		silence(L_STOP, cd_stop, 100000);
+		watch_end();
+	}
+	wall = host_wall() - wall;
+	host_detach();
+
+	printf("%d runs, sink latency %llu us, completion jitter %llu us, waveOutOpen %llu us, %llu ms of real time\n",
+		runs, host_latency, host_jitter, host_open_cost, wall / 1000);
+	printf("%-8s %8s %8s %8s %8s\n", "", "p50 ms", "p95 ms", "p99 ms", "missed");
+	for (int i = 0; i < L_CNT; i++) {
+		printf("%-8s %8.3f %8.3f %8.3f %8d\n", names[i], host_pct(lat[i], cnt[i], 50) / 1000.0, host_pct(lat[i], cnt[i], 95) / 1000.0,
+			host_pct(lat[i], cnt[i], 99) / 1000.0, missed[i]);
+	}
+	return 0;
+}
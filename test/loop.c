@@ -0,0 +1,187 @@
+/* Loop: a game looping music the way many do, playing a range of one track with notify and playing the same range
+ * again as soon as MCI_NOTIFY_SUCCESSFUL arrives, with GaplessLoop on. Captures what is heard twice, rendered offline to
+ * RenderFile and through waveOut with the time every sample is heard, and checks that the loops follow each other
+ * sample by sample: every captured frame is the frame of the range that comes next, none missing or repeated, and no
+ * silence between the end of a loop and the start of the next. After the last loop only the start GaplessLoop queued
+ * may follow. Fails when a loop point has a gap or repeats data, or when a loop was not notified. Without GaplessLoop
+ * the waveOut capture reports the gap the game's re-PLAY costs.
+ *
+ *   loop [-n loops] [-g GaplessLoop ms] [-o waveOutOpen us] [-d AdaptiveDepth ms] [-j completion jitter us]
+ */
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "host.h"
+
+#define FROM		(30)		/* CD frames into the track, 400 ms */
+#define TO		(105)		/* 1400 ms, the range is 44100 frames */
+#define RATE		(44100)
+#define PERIOD		((TO - FROM) * RATE / 75)
+#define LOOPS_MAX	(50)
+#define CAP_MAX		((LOOPS_MAX + 2) * PERIOD)
+
+struct result
+{
+	int loops;			/* notifies the game got */
+	unsigned int frames;		/* captured */
+	unsigned int bad;		/* frames that are not the next frame of the range, and the first of them */
+	unsigned int first_bad;
+	unsigned long long gap;		/* longest silence between two heard stretches, usec */
+};
+
+static short cap[CAP_MAX * 2];
+static volatile unsigned int cap_len; /* frames */
+static unsigned long long cap_end, cap_gap;
+
+/* Called with the clock held, must not call back into host.c */
+static void sink(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long heard)
+{
+	unsigned int frames = bytes / fmt->nBlockAlign;
+	if (fmt->nSamplesPerSec != RATE || !frames) return;
+	/* Sample times are rounded to usec */
+	if (cap_len && heard > cap_end + 1 && heard - cap_end > cap_gap) cap_gap = heard - cap_end;
+	cap_end = heard + (unsigned long long)frames * 1000000 / RATE;
+	if (cap_len + frames > CAP_MAX) frames = CAP_MAX - cap_len;
+	memcpy(cap + cap_len * 2, pcm, frames * 4);
+	cap_len += frames;
+}
+
+/* Frame n of the track as host_wav wrote it, left channel */
+static short track(unsigned int n)
+{
+	return (short)((n * 7 + 1) % 20000) - 10000;
+}
+
+/* The captured frames are the range over and over from its start */
+static void check(struct result *r, const short *pcm, unsigned int frames)
+{
+	r->frames = frames;
+	for (unsigned int i = 0; i < frames; i++) {
+		if (pcm[i * 2] == track(FROM * RATE / 75 + i % PERIOD)) continue;
+		if (!r->bad++) r->first_bad = i;
+	}
+}
+
+static MCIERROR cmd(UINT msg, DWORD_PTR flags, void *parms)
+{
+	return fake_mciSendCommandA(0, msg, flags, (DWORD_PTR)parms);
+}
+
+/* Plays the range with notify, and again on every notify until loops were played */
+static int session(int loops)
+{
+	MCI_SET_PARMS set = {0, MCI_FORMAT_TMSF};
+	cmd(MCI_SET, MCI_SET_TIME_FORMAT, &set);
+	MCI_PLAY_PARMS play = {1, MCI_MAKE_TMSF(2, 0, FROM / 75, FROM % 75), MCI_MAKE_TMSF(2, 0, TO / 75, TO % 75)};
+	int notified = 0;
+	host_notes_clear();
+	cmd(MCI_PLAY, MCI_FROM | MCI_TO | MCI_NOTIFY, &play);
+	for (unsigned long long waited = 0; notified < loops && waited < 5000000; waited += 1000) {
+		struct host_note notes[4];
+		int n = host_notes(notes, 4);
+		if (n) {
+			host_notes_clear();
+			for (int i = 0; i < n; i++) {
+				if (notes[i].status == MCI_NOTIFY_SUCCESSFUL) notified++;
+			}
+			if (notified < loops) cmd(MCI_PLAY, MCI_FROM | MCI_TO | MCI_NOTIFY, &play);
+			waited = 0;
+			continue;
+		}
+		host_sleep(1000);
+	}
+	host_sleep(1000000);
+	cmd(MCI_STOP, 0, NULL);
+	return notified;
+}
+
+/* One capture in a child process, the globals of wav-winmm.c only start out clean once */
+static void run(bool render, int loops, struct result *r)
+{
+	int fds[2];
+	memset(r, 0, sizeof(*r));
+	r->loops = -1;
+	if (pipe(fds)) return;
+	pid_t pid = fork();
+	if (pid == 0) {
+		if (render) host_ini("RenderFile", "loop.wav");
+		else host_sink = sink;
+		host_attach();
+		r->loops = session(loops);
+		host_detach();
+		if (render) {
+			FILE *f = fopen(host_path("loop.wav"), "rb");
+			unsigned int len = 0;
+			if (f && fseek(f, 40, SEEK_SET) == 0 && fread(&len, 4, 1, f) == 1) {
+				if (len / 4 > CAP_MAX) len = CAP_MAX * 4;
+				cap_len = fread(cap, 1, len, f) / 4;
+			}
+			if (f) fclose(f);
+		}
+		check(r, cap, cap_len);
+		r->gap = cap_gap;
+		write(fds[1], r, sizeof(*r));
+		_exit(0); /* the parent owns the game folder */
+	}
+	close(fds[1]);
+	if (pid < 0 || read(fds[0], r, sizeof(*r)) != sizeof(*r)) r->loops = -1;
+	close(fds[0]);
+	if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char **argv)
+{
+	int loops = 8, c, failed = 0;
+	const char *gapless = "200";
+	while ((c = getopt(argc, argv, "n:g:o:d:j:")) != -1) {
+		switch (c) {
+			case 'n': loops = atoi(optarg); break;
+			case 'g': gapless = optarg; break;
+			case 'o': host_open_cost = strtoull(optarg, NULL, 10); break;
+			case 'd': host_ini("AdaptiveDepth", optarg); break;
+			case 'j': host_jitter = strtoull(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n loops] [-g ms] [-o us] [-d ms] [-j us]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (loops < 1 || loops > LOOPS_MAX) loops = 8;
+
+	host_init("loop");
+	host_mkdir("Music");
+	host_wav("Music/Track02.wav", 3000, RATE, 2, 1);
+	host_ini("GaplessLoop", gapless);
+
+	printf("%d loops of %d ms, GaplessLoop %s, waveOutOpen %llu us, completion jitter %llu us\n", loops,
+		(TO - FROM) * 1000 / 75, gapless, host_open_cost, host_jitter);
+	printf("%-8s %8s %8s %8s %10s\n", "", "notified", "loops", "off", "gap ms");
+	for (int render = 1; render >= 0; render--) {
+		struct result r;
+		const char *name = render ? "render" : "waveOut";
+		run(render, loops, &r);
+		printf("%-8s %8d %8.2f %8u %10.3f\n", name, r.loops, (double)r.frames / PERIOD, r.bad, r.gap / 1000.0);
+		if (!atoi(gapless)) continue;
+		if (r.loops != loops) {
+			fprintf(stderr, "%s: %d of %d loops notified\n", name, r.loops, loops);
+			failed++;
+		}
+		/* Rendering continues a PLAY where the render is, nothing is queued ahead */
+		unsigned int lead = render ? 0 : atoi(gapless) * RATE / 1000 + RATE / 75;
+		if (r.frames < loops * PERIOD || r.frames > loops * PERIOD + lead) {
+			fprintf(stderr, "%s: %u frames captured, %d loops are %u\n", name, r.frames, loops, loops * PERIOD);
+			failed++;
+		}
+		if (r.bad) {
+			fprintf(stderr, "%s: %u frames off the loop, the first %u frames into loop %u\n", name, r.bad,
+				r.first_bad % PERIOD, r.first_bad / PERIOD + 1);
+			failed++;
+		}
+		if (r.gap) {
+			fprintf(stderr, "%s: %.3f ms of silence between loops\n", name, r.gap / 1000.0);
+			failed++;
+		}
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
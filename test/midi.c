@@ -0,0 +1,127 @@
+/* Midi: how long a game's music takes from "open" of a sequencer file to its first note, and how evenly the notes
+ * follow, on the in-process sequencer with a stand-in MIDI output that stamps every message with when it is heard.
+ * Opens and plays songs the way games do, more often than there are songs, so the first open of each parses the file
+ * and the rest find it parsed.
+ *
+ *   open	open of a song not parsed yet and play from its start, to its first note
+ *   reopen	open of a song parsed before and play from its start, to its first note
+ *   jitter	how far each note is heard from its time in the song, counted from the first note
+ *
+ * Reports virtual latency, the real time the open and play calls took and the jitter of the notes. Every timed wait of
+ * the scheduling thread returns up to the wake lateness past its timeout, 1 ms by default as the scheduler tick after
+ * timeBeginPeriod(1). Fails when a note was not heard.
+ *
+ *   midi [-n runs] [-f songs] [-o midiOutOpen us] [-w wake lateness us]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+#define RUNS_MAX	(1000)
+#define SONGS_MAX	(8)
+#define NOTES		(8)		/* heard each run */
+#define NOTE_US		(500000)	/* apart, see host_mid */
+
+enum { K_OPEN, K_REOPEN, K_CNT };
+static const char *names[K_CNT] = {"open", "reopen"};
+static unsigned long long lat[K_CNT][RUNS_MAX], call[K_CNT][RUNS_MAX], jitter[RUNS_MAX * NOTES];
+static int cnt[K_CNT], jitters;
+
+static volatile bool watch;
+static unsigned long long ons[NOTES];
+static volatile int heard;
+
+static void sink(DWORD msg, unsigned long long at)
+{
+	/* Note on with a velocity */
+	if (!watch || (msg & 0xF0) != 0x90 || !(msg >> 16 & 0x7F)) return;
+	if (heard < NOTES) ons[heard] = at;
+	heard++;
+}
+
+static MCIERROR send(const char *fmt, const char *arg)
+{
+	char cmd[MAX_PATH + 64];
+	snprintf(cmd, sizeof(cmd), fmt, arg);
+	return fake_mciSendStringA(cmd, NULL, 0, NULL);
+}
+
+/* Opens and plays a song, records how long until its first note and how far the notes after it were off */
+static int measure(int kind, const char *path)
+{
+	heard = 0;
+	watch = true;
+	unsigned long long from = host_now(), wall = host_wall();
+	send("open %s type sequencer alias m", path);
+	send("play m from 0", NULL);
+	wall = host_wall() - wall;
+	host_sleep(NOTES * (unsigned long long)NOTE_US);
+	watch = false;
+	send("stop m", NULL);
+	send("close m", NULL);
+
+	if (heard < NOTES) {
+		fprintf(stderr, "%s of %s: heard %d of %d notes\n", names[kind], path, heard, NOTES);
+		return 1;
+	}
+	if (cnt[kind] < RUNS_MAX) {
+		call[kind][cnt[kind]] = wall;
+		lat[kind][cnt[kind]++] = ons[0] - from;
+	}
+	for (int i = 1; i < NOTES; i++) {
+		unsigned long long due = ons[0] + i * (unsigned long long)NOTE_US;
+		jitter[jitters++] = ons[i] > due ? ons[i] - due : due - ons[i];
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int runs = 40, songs = 4, c, failed = 0;
+	host_wake_late = 1000;
+	while ((c = getopt(argc, argv, "n:f:o:w:")) != -1) {
+		switch (c) {
+			case 'n': runs = atoi(optarg); break;
+			case 'f': songs = atoi(optarg); break;
+			case 'o': host_midi_cost = strtoull(optarg, NULL, 10); break;
+			case 'w': host_wake_late = strtoull(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-f songs] [-o us] [-w us]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (runs < 1 || runs > RUNS_MAX) runs = 40;
+	if (songs < 1 || songs > SONGS_MAX) songs = 4;
+
+	host_init("midi");
+	for (int i = 0; i < songs; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "song%d.mid", i);
+		host_mid(name, 200 + i * 50);
+	}
+	host_ini("MidiSequencer", "1");
+	host_midi = sink;
+	host_attach();
+
+	for (int r = 0; r < runs; r++) {
+		char name[32];
+		snprintf(name, sizeof(name), "song%d.mid", r % songs);
+		failed += measure(r < songs ? K_OPEN : K_REOPEN, host_path(name));
+		host_sleep(100000);
+	}
+	host_detach();
+
+	printf("%d runs over %d songs, midiOutOpen %llu us, waits wake up to %llu us late\n", runs, songs, host_midi_cost,
+		host_wake_late);
+	printf("%-8s %10s %10s %10s %12s %12s\n", "", "p50 ms", "p95 ms", "p99 ms", "call p50 us", "call p99 us");
+	for (int k = 0; k < K_CNT; k++) {
+		printf("%-8s %10.3f %10.3f %10.3f %12llu %12llu\n", names[k], host_pct(lat[k], cnt[k], 50) / 1000.0,
+			host_pct(lat[k], cnt[k], 95) / 1000.0, host_pct(lat[k], cnt[k], 99) / 1000.0, host_pct(call[k], cnt[k], 50),
+			host_pct(call[k], cnt[k], 99));
+	}
+	printf("%-8s %10.3f %10.3f %10.3f\n", "jitter", host_pct(jitter, jitters, 50) / 1000.0,
+		host_pct(jitter, jitters, 95) / 1000.0, host_pct(jitter, jitters, 99) / 1000.0);
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,102 @@
+/* Mmio: small reads through mmioRead of an 8 MB file, from the system winmm's buffered file reads and from MmioMapping's
+ * mapped view, in real time. Both have to read the same bytes. A file on a drive that is not fixed has to go to the
+ * system winmm even with MmioMapping on, as its view would fault once the medium or the share went away.
+ *
+ *   mmio [-r rounds, the median counts] [-m MB]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+#include "stub.h"
+
+#define ROUNDS_MAX	(100)
+
+static const LONG sizes[] = {4, 64, 2048};
+
+/* Reads the file in pieces of len, returns the usec it took, and the sum of its bytes unless sum is NULL */
+static unsigned long long pass(const char *path, LONG len, unsigned int *sum)
+{
+	static char buf[4096];
+	unsigned long long t = host_wall();
+	HMMIO h = fake_mmioOpenA((LPSTR)path, NULL, MMIO_READ);
+	if (!h) return 0;
+	if (sum) *sum = 0;
+	for (LONG n; (n = fake_mmioRead(h, buf, len)) > 0; ) {
+		for (LONG i = 0; sum && i < n; i++) *sum = *sum * 31 + (unsigned char)buf[i];
+	}
+	fake_mmioClose(h, 0);
+	return host_wall() - t;
+}
+
+/* Whether an open of the file got a mapped view rather than going to the system winmm */
+static bool mapped(const char *path)
+{
+	struct host_use a, b;
+	host_use(&a);
+	HMMIO h = fake_mmioOpenA((LPSTR)path, NULL, MMIO_READ);
+	host_use(&b);
+	if (h) fake_mmioClose(h, 0);
+	return b.views > a.views;
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = 5, mb = 8, c, failed = 0;
+	static unsigned long long v[ROUNDS_MAX];
+
+	while ((c = getopt(argc, argv, "r:m:")) != -1) {
+		switch (c) {
+			case 'r': rounds = atoi(optarg); break;
+			case 'm': mb = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-r rounds] [-m MB]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (rounds < 1 || rounds > ROUNDS_MAX) rounds = 5;
+	if (mb < 1 || mb > 1024) mb = 8;
+
+	host_init("mmio");
+	host_wav("big.wav", (unsigned long long)mb * 1048576 * 1000 / 176400, 44100, 2, 1);
+	host_ini("MmioMapping", "1");
+	host_attach();
+	const char *path = host_path("big.wav");
+
+	printf("%d MB, %d rounds\n", mb, rounds);
+	printf("%-8s %14s %14s %8s\n", "bytes", "system MB/s", "mapped MB/s", "speedup");
+	for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		double rate[2];
+		unsigned int sum[2] = {0};
+		for (int m = 0; m < 2; m++) {
+			stub_mmio(m);
+			pass(path, sizes[s], &sum[m]);
+			for (int r = 0; r < rounds; r++) v[r] = pass(path, sizes[s], NULL);
+			unsigned long long us = host_pct(v, rounds, 50);
+			rate[m] = us ? mb * 1e6 / us : 0;
+		}
+		if (sum[0] != sum[1]) {
+			fprintf(stderr, "%ld byte reads: the mapped view read other bytes\n", (long)sizes[s]);
+			failed++;
+		}
+		printf("%-8ld %14.1f %14.1f %7.1fx\n", (long)sizes[s], rate[0], rate[1], rate[0] ? rate[1] / rate[0] : 0);
+	}
+
+	static const struct { UINT type; const char *name; bool map; } drives[] = {
+		{DRIVE_FIXED, "a fixed", true}, {DRIVE_REMOVABLE, "a removable", false}, {DRIVE_REMOTE, "a network", false},
+		{DRIVE_CDROM, "an optical", false},
+	};
+	stub_mmio(1);
+	for (int d = 0; d < sizeof(drives) / sizeof(drives[0]); d++) {
+		host_drive = drives[d].type;
+		if (mapped(path) != drives[d].map) {
+			fprintf(stderr, "file on %s drive %s\n", drives[d].name, drives[d].map ? "not mapped" : "mapped");
+			failed++;
+		}
+	}
+	host_drive = DRIVE_FIXED;
+
+	host_detach();
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
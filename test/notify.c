@@ -0,0 +1,116 @@
+/* Notify: MCI_NOTIFY_SUCCESSFUL of a PLAY has to arrive when the last sample of the range plays. Plays CD ranges of
+ * many lengths, so the last buffer ends at many offsets, some of them paused on the way or right before their end,
+ * some played again the moment they notify, the way games loop music. Fails when a notify is more than a CD frame off
+ * the last sample, or a paused or replayed range lost audio.
+ *
+ *   notify [-d AdaptiveDepth ms] [-j completion jitter us] [-n ranges]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+#define FRAME		(1000000 / 75)	/* usec */
+#define RANGES_MAX	(1000)
+
+enum { K_PLAIN, K_PAUSE, K_TAIL, K_AGAIN, K_CNT };
+static const char *names[K_CNT] = {"plain", "paused", "tail", "again"};
+
+static unsigned long long end, played; /* last sample heard, and how much was */
+
+/* Called with the clock held, must not call back into host.c */
+static void sink(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long heard)
+{
+	if (fmt->nSamplesPerSec != 44100) return;
+	unsigned long long us = (unsigned long long)bytes / fmt->nBlockAlign * 1000000 / fmt->nSamplesPerSec;
+	if (heard + us > end) end = heard + us;
+	played += us;
+}
+
+static MCIERROR cmd(UINT msg, DWORD_PTR flags, void *parms)
+{
+	return fake_mciSendCommandA(0, msg, flags, (DWORD_PTR)parms);
+}
+
+int main(int argc, char **argv)
+{
+	int ranges = 90, c, failed = 0;
+	static unsigned long long err[K_CNT][RANGES_MAX];
+	int cnt[K_CNT] = {0};
+
+	while ((c = getopt(argc, argv, "d:j:n:")) != -1) {
+		switch (c) {
+			case 'd': host_ini("AdaptiveDepth", optarg); break;
+			case 'j': host_jitter = strtoull(optarg, NULL, 10); break;
+			case 'n': ranges = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-d ms] [-j us] [-n ranges]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (ranges > RANGES_MAX) ranges = RANGES_MAX;
+
+	host_init("notify");
+	host_mkdir("Music");
+	host_wav("Music/Track02.wav", 10000, 44100, 2, 1);
+	host_sink = sink;
+	host_attach();
+	MCI_SET_PARMS set = {0, MCI_FORMAT_TMSF};
+	cmd(MCI_SET, MCI_SET_TIME_FORMAT, &set);
+
+	for (int i = 0; i < ranges; i++) {
+		int kind = i % K_CNT, frames = 22 + i * 7 % 420; /* 0.3 s to 5.9 s */
+		unsigned long long len = (unsigned long long)frames * FRAME, hold = 1500000; /* longer than a buffer drain times out */
+		struct host_note notes[4], note = {0};
+
+		host_notes_clear();
+		end = played = 0;
+		MCI_PLAY_PARMS play = {0};
+		play.dwCallback = 1;
+		play.dwFrom = MCI_MAKE_TMSF(2, 0, 0, 0);
+		play.dwTo = MCI_MAKE_TMSF(2, 0, frames / 75, frames % 75);
+		cmd(MCI_PLAY, MCI_FROM | MCI_TO | MCI_NOTIFY, &play);
+		if (kind == K_AGAIN) {
+			/* The first play may still be letting go of its device when the second comes in, the second is measured */
+			for (unsigned long long t = 0; !host_notes(notes, 4) && t < len + 1000000; t += 100) host_sleep(100);
+			host_notes_clear();
+			end = played = 0;
+			cmd(MCI_PLAY, MCI_FROM | MCI_TO | MCI_NOTIFY, &play);
+		} else if (kind != K_PLAIN) {
+			/* Halfway, or after the last buffer was queued and the player thread waits for it to play */
+			host_sleep(kind == K_PAUSE ? len / 2 : len - 2 * FRAME);
+			cmd(MCI_PAUSE, 0, NULL);
+			host_sleep(hold);
+			cmd(MCI_RESUME, 0, NULL);
+		}
+		host_sleep(len + 1000000);
+
+		int n = host_notes(notes, 4);
+		if (n) note = notes[0];
+		long long off = n ? (long long)(note.at - end) : 0;
+		if (n != 1 || note.status != MCI_NOTIFY_SUCCESSFUL) {
+			fprintf(stderr, "%s range of %d frames: %d notifications, status %d\n", names[kind], frames, n, n ? (int)note.status : 0);
+			failed++;
+		} else if (off > FRAME || off < -FRAME) {
+			fprintf(stderr, "%s range of %d frames: notify %lld us off the last sample\n", names[kind], frames, off);
+			failed++;
+		}
+		if (played + FRAME < len) {
+			fprintf(stderr, "%s range of %d frames: %llu of %llu us played\n", names[kind], frames, played, len);
+			failed++;
+		}
+		err[kind][cnt[kind]++] = off < 0 ? -off : off;
+		fake_mciSendStringA("stop cdaudio", NULL, 0, NULL);
+		host_sleep(100000);
+	}
+	host_detach();
+
+	printf("%d ranges, completion jitter %llu us\n", ranges, host_jitter);
+	printf("%-8s %8s %8s %8s\n", "", "p50 ms", "p99 ms", "max ms");
+	for (int k = 0; k < K_CNT; k++) {
+		printf("%-8s %8.3f %8.3f %8.3f\n", names[k], host_pct(err[k], cnt[k], 50) / 1000.0, host_pct(err[k], cnt[k], 99) / 1000.0,
+			host_pct(err[k], cnt[k], 100) / 1000.0);
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+/* Render: a scripted CD session rendered offline with RenderFile, compared sample by sample with a golden WAV. The
+ * session plays short ranges, crosses a track boundary, seeks, changes the volume between ranges and pauses a range
+ * wherever the render happens to be, which must not change a sample. Reports how much faster than realtime the session
+ * rendered and exits non-zero when the render differs from the golden file.
+ *
+ *   render [-g] [golden WAV, render-golden.wav by default]
+ *
+ * -g writes the golden file from this render instead, after a change meant to alter the output.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+struct wav
+{
+	unsigned char header[44];
+	short *pcm;
+	unsigned int len; /* bytes */
+};
+
+static bool wav_read(const char *path, struct wav *w)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) return false;
+	bool ok = fread(w->header, 1, 44, f) == 44 && memcmp(w->header, "RIFF", 4) == 0;
+	if (ok) {
+		memcpy(&w->len, w->header + 40, 4);
+		w->pcm = malloc(w->len ? w->len : 2);
+		ok = fread(w->pcm, 1, w->len, f) == w->len;
+	}
+	fclose(f);
+	return ok;
+}
+
+static bool wav_write(const char *path, const struct wav *w)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) return false;
+	bool ok = fwrite(w->header, 1, 44, f) == 44 && fwrite(w->pcm, 1, w->len, f) == w->len;
+	return fclose(f) == 0 && ok;
+}
+
+static MCIERROR cmd(UINT msg, DWORD_PTR flags, void *parms)
+{
+	return fake_mciSendCommandA(0, msg, flags, (DWORD_PTR)parms);
+}
+
+/* The clock only moves on once the render is through the range and the player waits again */
+static void play(DWORD from, DWORD to)
+{
+	MCI_PLAY_PARMS parms = {0, from, to};
+	cmd(MCI_PLAY, (from ? MCI_FROM : 0) | MCI_TO, &parms);
+	host_sleep(100000);
+}
+
+int main(int argc, char **argv)
+{
+	bool golden = false;
+	int c;
+	while ((c = getopt(argc, argv, "g")) != -1) {
+		if (c != 'g') {
+			fprintf(stderr, "usage: %s [-g] [golden.wav]\n", argv[0]);
+			return 2;
+		}
+		golden = true;
+	}
+	const char *path = optind < argc ? argv[optind] : "render-golden.wav";
+
+	host_init("render");
+	host_mkdir("Music");
+	for (int t = 2; t <= 5; t++) {
+		char name[32];
+		snprintf(name, sizeof(name), "Music/Track%02d.wav", t);
+		host_wav(name, 3000, 44100, 2, t * 1000);
+	}
+	host_ini("RenderFile", "render.wav");
+	host_attach();
+
+	unsigned long long wall = host_wall();
+	MCI_SET_PARMS set = {0, MCI_FORMAT_TMSF};
+	cmd(MCI_SET, MCI_SET_TIME_FORMAT, &set);
+	fake_auxSetVolume(0, 0xFFFFFFFF);
+
+	/* A short range, then one across the end of track 2 */
+	play(MCI_MAKE_TMSF(2, 0, 0, 0), MCI_MAKE_TMSF(2, 0, 0, 15));
+	play(MCI_MAKE_TMSF(2, 0, 2, 60), MCI_MAKE_TMSF(3, 0, 0, 20));
+
+	/* Half volume ramps in at the start of the next range, then left and right apart */
+	fake_auxSetVolume(0, 0x80008000);
+	play(MCI_MAKE_TMSF(3, 0, 1, 0), MCI_MAKE_TMSF(3, 0, 1, 20));
+	fake_auxSetVolume(0, 0x4000FFFF);
+
+	/* Seek, then play on from there */
+	MCI_SEEK_PARMS seek = {0, MCI_MAKE_TMSF(4, 0, 0, 30)};
+	cmd(MCI_SEEK, MCI_TO, &seek);
+	play(0, MCI_MAKE_TMSF(4, 0, 0, 50));
+
+	/* Pauses land wherever the render is, its clock stands still meanwhile */
+	fake_auxSetVolume(0, 0xFFFFFFFF);
+	MCI_PLAY_PARMS parms = {0, MCI_MAKE_TMSF(5, 0, 0, 0), MCI_MAKE_TMSF(5, 0, 0, 40)};
+	cmd(MCI_PLAY, MCI_FROM | MCI_TO, &parms);
+	for (int i = 0; i < 5; i++) {
+		cmd(MCI_PAUSE, 0, NULL);
+		cmd(MCI_RESUME, 0, NULL);
+	}
+	host_sleep(100000);
+
+	wall = host_wall() - wall;
+	host_detach();
+
+	struct wav out, gold;
+	if (!wav_read(host_path("render.wav"), &out)) {
+		fprintf(stderr, "no render\n");
+		return 1;
+	}
+	unsigned int rate, align = 4;
+	memcpy(&rate, out.header + 24, 4);
+	double secs = (double)out.len / align / (rate ? rate : 1);
+	/* Real time of the whole session, the render_x of the stats counts virtual time here */
+	printf("rendered %.2f s in %.1f ms: %.0fx realtime\n", secs, wall / 1000.0, secs * 1e6 / (wall ? wall : 1));
+
+	if (golden) {
+		if (!wav_write(path, &out)) {
+			perror(path);
+			return 1;
+		}
+		printf("wrote %s\n", path);
+		return 0;
+	}
+	if (!wav_read(path, &gold)) {
+		fprintf(stderr, "cannot read %s\n", path);
+		return 1;
+	}
+
+	int failed = 0;
+	if (memcmp(out.header, gold.header, 44)) {
+		fprintf(stderr, "header differs from %s\n", path);
+		failed++;
+	}
+	unsigned int n = (out.len < gold.len ? out.len : gold.len) / 2, diff = 0, first = 0, max = 0;
+	for (unsigned int i = 0; i < n; i++) {
+		int d = abs(out.pcm[i] - gold.pcm[i]);
+		if (!d) continue;
+		if (!diff++) first = i;
+		if (d > max) max = d;
+	}
+	if (diff) {
+		fprintf(stderr, "%u samples differ from %s, the first at %.3f s, by up to %u\n", diff, path,
+			(double)first / 2 / (rate ? rate : 1), max);
+		failed++;
+	}
+	if (out.len != gold.len) {
+		fprintf(stderr, "%.3f s rendered, %s has %.3f s\n", secs, path, (double)gold.len / align / (rate ? rate : 1));
+		failed++;
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,462 @@
+/* Replay: drives the front-end with a call trace captured with TraceFile, e.g. a game's session, on the virtual clock.
+ * Every thread of the trace gets one of its own, making its calls at their recorded times divided by the speed. The CD
+ * tracks and the files the trace opens are made up: tracks of the given length, and WAVs and songs named as the files
+ * were. Reports per call how long it took on the machine the trace is from, on the virtual clock and in real time, and
+ * how long after each PLAY sound was heard next. Exits non-zero when a call returned another error than in the trace.
+ * game.trace is a short session of CD music, sound effects and a song to start from.
+ *
+ *   replay [-x speed] [-t tracks] [-s track seconds] [-i key=value]... [-o trace of the replay] trace
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+#define CALLS_MAX	(200000)
+#define THREADS_MAX	(64)
+#define KINDS_MAX	(32)
+#define IDS_MAX		(64)
+#define LINE_MAX	(16384)
+#define NOTES_MAX	(4096)
+
+struct call
+{
+	unsigned long long t;		/* usec since the trace started */
+	int line, thread;
+	char kind;			/* C command, S string, N D G V aux */
+	unsigned int id, msg, flags, a, b, err, r, d;
+	char *type, *element, *alias, *cmd; /* NULL for none */
+	unsigned int got;		/* what the replay returned */
+	unsigned long long virt, real;	/* what it took */
+};
+
+static struct call *calls;
+static int ncalls, nthreads;
+static double speed = 1.0;
+static unsigned long long start;
+
+/* Device ids the trace got from MCI_OPEN and the ones the replay did */
+static MCIDEVICEID ids[IDS_MAX][2];
+static int nids;
+static CRITICAL_SECTION ids_cs;
+
+/* Time from each PLAY to the next sound heard */
+static unsigned long long *heard;
+static int nheard, missed;
+static unsigned long long watch_from, watch_at;
+static CRITICAL_SECTION watch_cs;
+
+/* Called with the clock held, must not call back into host.c */
+static void sink(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long at)
+{
+	unsigned long long from = __atomic_load_n(&watch_from, __ATOMIC_ACQUIRE);
+	if (from && at >= from && !__atomic_load_n(&watch_at, __ATOMIC_RELAXED)) __atomic_store_n(&watch_at, at, __ATOMIC_RELAXED);
+}
+
+static void watch_end(void)
+{
+	unsigned long long from = __atomic_load_n(&watch_from, __ATOMIC_RELAXED), at = __atomic_load_n(&watch_at, __ATOMIC_RELAXED);
+	if (!from) return;
+	if (at) heard[nheard++] = at - from;
+	else missed++;
+	__atomic_store_n(&watch_from, 0, __ATOMIC_RELEASE);
+}
+
+static void played(void)
+{
+	EnterCriticalSection(&watch_cs);
+	watch_end();
+	__atomic_store_n(&watch_at, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&watch_from, host_now(), __ATOMIC_RELEASE);
+	LeaveCriticalSection(&watch_cs);
+}
+
+static MCIDEVICEID device(MCIDEVICEID id)
+{
+	EnterCriticalSection(&ids_cs);
+	for (int i = 0; i < nids; i++) {
+		if (ids[i][0] == id) {
+			id = ids[i][1];
+			break;
+		}
+	}
+	LeaveCriticalSection(&ids_cs);
+	return id;
+}
+
+static void device_map(MCIDEVICEID traced, MCIDEVICEID id)
+{
+	EnterCriticalSection(&ids_cs);
+	int i = 0;
+	while (i < nids && ids[i][0] != traced) i++;
+	if (i < IDS_MAX) {
+		ids[i][0] = traced;
+		ids[i][1] = id;
+		if (i == nids) nids++;
+	}
+	LeaveCriticalSection(&ids_cs);
+}
+
+/* A string field of the trace, see trace_esc in wav-winmm.c */
+static char *unesc(const char *s)
+{
+	if (strcmp(s, "-") == 0) return NULL;
+	char *d = malloc(strlen(s) + 1), *o = d;
+	for (; *s; s++) {
+		if (s[0] == '\\' && s[1] == '\\') {
+			*o++ = '\\';
+			s++;
+		} else if (s[0] == '\\' && s[1] == 'x' && isxdigit((unsigned char)s[2]) && isxdigit((unsigned char)s[3])) {
+			char hex[3] = {s[2], s[3], 0};
+			*o++ = (char)strtol(hex, NULL, 16);
+			s += 3;
+		} else {
+			*o++ = *s;
+		}
+	}
+	*o = '\0';
+	return d;
+}
+
+/* A made-up WAV or song for a file the trace opens, in the game folder under its own name. NULL when name is no such file. */
+static char *media(const char *name, size_t len)
+{
+	char base[MAX_PATH];
+	size_t b = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (name[i] == '\\' || name[i] == '/' || name[i] == ':') b = i + 1;
+	}
+	if (len - b < 5 || len - b >= sizeof(base)) return NULL;
+	snprintf(base, sizeof(base), "%.*s", (int)(len - b), name + b);
+	const char *ext = base + strlen(base) - 4;
+	bool wav = strcasecmp(ext, ".wav") == 0, mid = strcasecmp(ext, ".mid") == 0 || strcasecmp(ext, ".rmi") == 0;
+	if (!wav && !mid) return NULL;
+	if (access(host_path(base), F_OK) != 0) {
+		if (wav) host_wav(base, 5000, 22050, 1, 1);
+		else host_mid(base, 20);
+	}
+	return strdup(host_path(base));
+}
+
+/* "open <file> ..." with the file made up, the device type prefix and the rest kept */
+static char *open_string(char *cmd)
+{
+	char *s = cmd + 5, *end, *path;
+	bool quoted = *s == '"';
+	if (quoted) s++;
+	end = quoted ? strchr(s, '"') : s + strcspn(s, " ");
+	if (!end) return cmd;
+	char *bang = memchr(s, '!', end - s);
+	char *file = bang ? bang + 1 : s;
+	if (!(path = media(file, end - file))) return cmd;
+
+	size_t len = strlen(cmd) + strlen(path) + 8;
+	char *out = malloc(len);
+	snprintf(out, len, "open \"%.*s%s\"%s", (int)(file - s), s, path, end + quoted);
+	free(path);
+	free(cmd);
+	return out;
+}
+
+static void load(const char *file)
+{
+	static char line[LINE_MAX], s1[LINE_MAX], s2[LINE_MAX], s3[LINE_MAX];
+	static unsigned long thread_ids[THREADS_MAX];
+	static unsigned long long last[THREADS_MAX];
+	FILE *f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		exit(2);
+	}
+	calls = calloc(CALLS_MAX, sizeof(*calls));
+	for (int n = 1; ncalls < CALLS_MAX && fgets(line, sizeof(line), f); n++) {
+		struct call c = {0};
+		unsigned int t;
+		unsigned long thread;
+		int th = 0;
+
+		if (strncmp(line, "# wav-winmm trace ", 18) == 0 && atoi(line + 18) != 2) {
+			fprintf(stderr, "%s: trace version %d, only 2 can be replayed\n", file, atoi(line + 18));
+			exit(2);
+		}
+		if (sscanf(line, "%u %lu %c", &t, &thread, &c.kind) != 3) continue;
+		if (c.kind == 'X') break;
+		while (th < nthreads && thread_ids[th] != thread) th++;
+		if (th == THREADS_MAX) continue;
+		if (th == nthreads) thread_ids[nthreads++] = thread;
+
+		bool ok = false;
+		switch (c.kind) {
+			case 'C':
+				ok = sscanf(line, "%*u %*u C %X %X %X %X %X %s %s %s = %u %u %u", &c.id, &c.msg, &c.flags, &c.a, &c.b,
+					s1, s2, s3, &c.err, &c.r, &c.d) == 11;
+				if (!ok) break;
+				c.type = unesc(s1);
+				c.element = unesc(s2);
+				c.alias = unesc(s3);
+				if (c.msg == MCI_OPEN && c.element && !(c.flags & MCI_OPEN_ELEMENT_ID)) {
+					char *path = media(c.element, strlen(c.element));
+					if (path) {
+						free(c.element);
+						c.element = path;
+					}
+				}
+				break;
+			case 'S':
+				ok = sscanf(line, "%*u %*u S %u %u %s -> %s", &c.err, &c.d, s1, s2) == 4 && (c.cmd = unesc(s1));
+				if (ok && strncasecmp(c.cmd, "open ", 5) == 0) c.cmd = open_string(c.cmd);
+				break;
+			case 'N':
+				ok = true;
+				break;
+			case 'D':
+				ok = sscanf(line, "%*u %*u D %X", &c.id) == 1;
+				break;
+			case 'G':
+			case 'V':
+				ok = sscanf(line, "%*u %*u %*c %X %X", &c.id, &c.a) == 2;
+				break;
+		}
+		if (!ok) {
+			fprintf(stderr, "%s:%d: skipped\n", file, n);
+			continue;
+		}
+		/* The stamps wrap after 71 minutes, a thread's calls come in order */
+		c.t = (last[th] & ~0xFFFFFFFFULL) | t;
+		if (c.t < last[th]) c.t += 1ULL << 32;
+		last[th] = c.t;
+		c.line = n;
+		c.thread = th;
+		calls[ncalls++] = c;
+	}
+	fclose(f);
+}
+
+static unsigned int command(struct call *c)
+{
+	union {
+		MCI_GENERIC_PARMS generic;
+		MCI_OPEN_PARMS open;
+		MCI_PLAY_PARMS play;
+		MCI_SEEK_PARMS seek;
+		MCI_SET_PARMS set;
+		MCI_STATUS_PARMS status;
+		MCI_INFO_PARMS info;
+		MCI_SYSINFO_PARMSA sysinfo;
+		MCI_GETDEVCAPS_PARMS caps;
+	} p;
+	char ret[256] = "";
+	memset(&p, 0, sizeof(p));
+	p.generic.dwCallback = 1;
+	switch (c->msg) {
+		case MCI_OPEN:
+			p.open.lpstrDeviceType = (c->flags & MCI_OPEN_TYPE_ID) ? (LPCSTR)(DWORD_PTR)c->a : c->type;
+			p.open.lpstrElementName = (c->flags & MCI_OPEN_ELEMENT_ID) ? (LPCSTR)(DWORD_PTR)c->b : c->element;
+			p.open.lpstrAlias = c->alias;
+			break;
+		case MCI_PLAY:
+			p.play.dwFrom = c->a;
+			p.play.dwTo = c->b;
+			break;
+		case MCI_SEEK:
+			p.seek.dwTo = c->a;
+			break;
+		case MCI_SET:
+			p.set.dwTimeFormat = c->a;
+			break;
+		case MCI_STATUS:
+			p.status.dwItem = c->a;
+			p.status.dwTrack = c->b;
+			break;
+		case MCI_GETDEVCAPS:
+			p.caps.dwItem = c->a;
+			break;
+		case MCI_INFO:
+			p.info.lpstrReturn = ret;
+			p.info.dwRetSize = sizeof(ret);
+			break;
+		case MCI_SYSINFO:
+			p.sysinfo.lpstrReturn = ret;
+			p.sysinfo.dwRetSize = sizeof(ret);
+			p.sysinfo.dwNumber = c->a;
+			p.sysinfo.wDeviceType = c->b;
+			break;
+	}
+	MCIERROR err = fake_mciSendCommandA(device(c->id), c->msg, c->flags, (DWORD_PTR)&p);
+	if (c->msg == MCI_OPEN && !err) device_map(c->r, p.open.wDeviceID);
+	if (c->msg == MCI_PLAY && !err) played();
+	return err;
+}
+
+static unsigned int string(struct call *c)
+{
+	char ret[256];
+	MCIERROR err = fake_mciSendStringA(c->cmd, ret, sizeof(ret), strstr(c->cmd, " notify") ? (HANDLE)1 : NULL);
+	if (strncasecmp(c->cmd, "play ", 5) == 0 && !err) played();
+	return err;
+}
+
+static unsigned int call(struct call *c)
+{
+	AUXCAPS caps;
+	DWORD volume;
+	switch (c->kind) {
+		case 'C': return command(c);
+		case 'S': return string(c);
+		case 'N': return fake_auxGetNumDevs() == 1 ? 0 : 1;
+		case 'D': return fake_auxGetDevCapsA(c->id, &caps, sizeof(caps));
+		case 'G': return fake_auxGetVolume(c->id, &volume);
+		case 'V': return fake_auxSetVolume(c->id, c->a);
+	}
+	return 0;
+}
+
+static DWORD WINAPI replay_main(void *arg)
+{
+	int th = (int)(DWORD_PTR)arg;
+	for (int i = 0; i < ncalls; i++) {
+		struct call *c = &calls[i];
+		if (c->thread != th) continue;
+		unsigned long long at = start + (unsigned long long)(c->t / speed), now = host_now();
+		if (at > now) host_sleep(at - now);
+		unsigned long long v = host_now(), w = host_wall();
+		c->got = call(c);
+		c->real = host_wall() - w;
+		c->virt = host_now() - v;
+	}
+	return 0;
+}
+
+/* What a call is in the report: the message, the verb of a string or aux */
+static void kind(const struct call *c, char *name, size_t len)
+{
+	static const struct { UINT msg; const char *name; } msgs[] = {
+		{MCI_OPEN, "OPEN"}, {MCI_CLOSE, "CLOSE"}, {MCI_PLAY, "PLAY"}, {MCI_SEEK, "SEEK"}, {MCI_STOP, "STOP"},
+		{MCI_PAUSE, "PAUSE"}, {MCI_RESUME, "RESUME"}, {MCI_INFO, "INFO"}, {MCI_GETDEVCAPS, "GETDEVCAPS"},
+		{MCI_SET, "SET"}, {MCI_STATUS, "STATUS"}, {MCI_CUE, "CUE"}, {MCI_SYSINFO, "SYSINFO"},
+	};
+	if (c->kind == 'S') {
+		snprintf(name, len, "\"%.*s\"", (int)strcspn(c->cmd, " "), c->cmd);
+		for (char *p = name; *p; p++) *p = tolower((unsigned char)*p);
+		return;
+	}
+	if (c->kind != 'C') {
+		snprintf(name, len, "aux");
+		return;
+	}
+	snprintf(name, len, "0x%X", c->msg);
+	for (int i = 0; i < sizeof(msgs) / sizeof(msgs[0]); i++) {
+		if (msgs[i].msg == c->msg) snprintf(name, len, "%s", msgs[i].name);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int tracks = 8, seconds = 30, c, failed = 0;
+	const char *out = NULL;
+	char music[MAX_PATH];
+
+	host_ini("WaveAudio", "1");
+	host_ini("MidiSequencer", "1");
+	while ((c = getopt(argc, argv, "x:t:s:i:o:")) != -1) {
+		switch (c) {
+			case 'x': speed = atof(optarg); break;
+			case 't': tracks = atoi(optarg); break;
+			case 's': seconds = atoi(optarg); break;
+			case 'i':
+				{
+					char *eq = strchr(optarg, '=');
+					if (eq) {
+						*eq = '\0';
+						host_ini(optarg, eq + 1);
+					}
+				}
+				break;
+			case 'o': out = optarg; break;
+			default:
+				optind = argc;
+				break;
+		}
+	}
+	if (optind != argc - 1 || speed <= 0) {
+		fprintf(stderr, "usage: %s [-x speed] [-t tracks] [-s seconds] [-i key=value]... [-o trace] trace\n", argv[0]);
+		return 2;
+	}
+
+	host_init("replay");
+	host_mkdir("Music");
+	for (int t = 2; t < 2 + tracks; t++) {
+		snprintf(music, sizeof(music), "Music/Track%02d.wav", t);
+		host_wav(music, seconds * 1000, 44100, 2, t);
+	}
+	load(argv[optind]);
+	heard = calloc(ncalls + 1, sizeof(*heard));
+	if (out) host_ini("TraceFile", "replay.trace");
+	InitializeCriticalSection(&ids_cs);
+	InitializeCriticalSection(&watch_cs);
+	host_sink = sink;
+	host_attach();
+
+	HANDLE th[THREADS_MAX];
+	unsigned long long wall = host_wall();
+	start = host_now();
+	for (int i = 0; i < nthreads; i++) th[i] = CreateThread(NULL, 0, replay_main, (void *)(DWORD_PTR)i, 0, NULL);
+	WaitForMultipleObjects(nthreads, th, TRUE, INFINITE);
+	for (int i = 0; i < nthreads; i++) CloseHandle(th[i]);
+	host_sleep(2000000); /* for the last PLAY to be heard */
+	watch_end();
+	unsigned long long took = host_now() - start;
+	wall = host_wall() - wall;
+	static struct host_note note[NOTES_MAX];
+	int notes = host_notes(note, NOTES_MAX);
+	host_detach();
+
+	if (out) {
+		FILE *from = fopen(host_path("replay.trace"), "r"), *to = fopen(out, "w");
+		char line[LINE_MAX];
+		while (from && to && fgets(line, sizeof(line), from)) fputs(line, to);
+		if (from) fclose(from);
+		if (to) fclose(to);
+		if (!from || !to) fprintf(stderr, "cannot write %s\n", out);
+	}
+
+	for (int i = 0; i < ncalls; i++) {
+		struct call *c = &calls[i];
+		if (c->got == c->err) continue;
+		if (++failed <= 10) fprintf(stderr, "line %d: returned %u, the trace has %u\n", c->line, c->got, c->err);
+	}
+
+	printf("%d calls on %d threads, %.1f s of trace at %gx speed in %.1f s of virtual and %llu ms of real time\n",
+		ncalls, nthreads, ncalls ? calls[ncalls-1].t / 1e6 : 0.0, speed, took / 1e6, wall / 1000);
+	printf("%-14s %7s %10s %10s %10s %10s %10s %10s\n", "usec", "calls", "trace p50", "trace p99", "virt p50", "virt p99",
+		"real p50", "real p99");
+	char names[KINDS_MAX][24], name[24];
+	int nkinds = 0;
+	unsigned long long *v[3];
+	for (int k = 0; k < 3; k++) v[k] = calloc(ncalls + 1, sizeof(**v));
+	for (int i = 0; i < ncalls; i++) {
+		kind(&calls[i], name, sizeof(name));
+		int k = 0;
+		while (k < nkinds && strcmp(names[k], name)) k++;
+		if (k < nkinds || nkinds == KINDS_MAX) continue;
+		snprintf(names[nkinds++], sizeof(name), "%s", name);
+
+		int n = 0;
+		for (int j = i; j < ncalls; j++) {
+			kind(&calls[j], name, sizeof(name));
+			if (strcmp(names[k], name)) continue;
+			v[0][n] = calls[j].d;
+			v[1][n] = calls[j].virt;
+			v[2][n++] = calls[j].real;
+		}
+		printf("%-14s %7d %10llu %10llu %10llu %10llu %10llu %10llu\n", names[k], n, host_pct(v[0], n, 50), host_pct(v[0], n, 99),
+			host_pct(v[1], n, 50), host_pct(v[1], n, 99), host_pct(v[2], n, 50), host_pct(v[2], n, 99));
+	}
+	printf("PLAY to the next sound of any device: p50 %.3f ms, p99 %.3f ms, max %.3f ms, %d without sound\n", host_pct(heard, nheard, 50) / 1000.0,
+		host_pct(heard, nheard, 99) / 1000.0, host_pct(heard, nheard, 100) / 1000.0, missed);
+	printf("%d notifications\n", notes);
+	if (failed) printf("%d calls returned another error than in the trace\n", failed);
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+/* Scan: how long the first command waits for a 99-track folder to be indexed. Every round attaches a fresh process to
+ * the same folder, cold with the track files dropped from the page cache first, warm with them read just before, and
+ * times host_attach to the answer of "status cdaudio number of tracks" in real time. Then attaches once more with
+ * CreateThread failing, where the command has to answer for an empty drive rather than wait for a scan that never
+ * runs. Exits non-zero when a round counts the wrong number of tracks.
+ *
+ *   scan [-r rounds] [-c HeadCache ms]
+ *
+ * Cold rounds only drop what the file system lets go of, TMPDIR on tmpfs keeps them warm.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "host.h"
+
+#define TRACKS	(99)
+#define ROUNDS_MAX	(100)
+
+static void evict(void)
+{
+	char name[32];
+	for (int t = 1; t <= TRACKS; t++) {
+		snprintf(name, sizeof(name), "Music/Track%02d.wav", t);
+		int fd = open(host_path(name), O_RDONLY);
+		if (fd < 0) continue;
+		fdatasync(fd);
+		posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+		close(fd);
+	}
+}
+
+/* One attach in a child process, the globals of wav-winmm.c only start out clean once. Returns usec, or -1. */
+static long long attach(int tracks)
+{
+	int fds[2];
+	long long us = -1;
+	if (pipe(fds)) return -1;
+	pid_t pid = fork();
+	if (pid == 0) {
+		char ret[16] = "";
+		unsigned long long t = host_wall();
+		host_attach();
+		MCIERROR err = fake_mciSendStringA("status cdaudio number of tracks", ret, sizeof(ret), NULL);
+		t = host_wall() - t;
+		host_detach();
+		us = err ? -2 : atoi(ret) == tracks ? (long long)t : -3;
+		if (us < 0) fprintf(stderr, "number of tracks: error %u, \"%s\", %d expected\n", (unsigned int)err, ret, tracks);
+		write(fds[1], &us, sizeof(us));
+		_exit(0); /* the parent owns the game folder */
+	}
+	close(fds[1]);
+	if (pid < 0 || read(fds[0], &us, sizeof(us)) != sizeof(us)) us = -1;
+	close(fds[0]);
+	if (pid > 0) waitpid(pid, NULL, 0);
+	return us;
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = 10, c, failed = 0;
+	static unsigned long long v[2][ROUNDS_MAX];
+	int n[2] = {0};
+
+	while ((c = getopt(argc, argv, "r:c:")) != -1) {
+		switch (c) {
+			case 'r': rounds = atoi(optarg); break;
+			case 'c': host_ini("HeadCache", optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-r rounds] [-c ms]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (rounds < 1 || rounds > ROUNDS_MAX) rounds = 10;
+
+	host_init("scan");
+	host_mkdir("Music");
+	for (int t = 1; t <= TRACKS; t++) {
+		char name[32];
+		snprintf(name, sizeof(name), "Music/Track%02d.wav", t);
+		host_wav(name, 2000 + t * 10, 44100, 2, t);
+	}
+
+	for (int r = 0; r < rounds * 2; r++) {
+		int warm = r & 1;
+		if (!warm) evict();
+		long long us = attach(TRACKS);
+		if (us < 0) failed++;
+		else v[warm][n[warm]++] = us;
+	}
+
+	host_thread_fail = true;
+	if (attach(0) < 0) failed++;
+	host_thread_fail = false;
+
+	printf("%d tracks, %d rounds\n", TRACKS, rounds);
+	printf("%-8s %10s %10s %10s\n", "usec", "p50", "p99", "max");
+	for (int w = 0; w < 2; w++) {
+		printf("%-8s %10llu %10llu %10llu\n", w ? "warm" : "cold", host_pct(v[w], n[w], 50), host_pct(v[w], n[w], 99),
+			host_pct(v[w], n[w], 100));
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+/* Shadow: a game's sounds through waveOut with WAVEVolume below 100, which the stubs scale into shadow buffers of their
+ * own. Submits one looping buffer over and over, the way looping effects and cached sound banks do, 16 and 8-bit. Fails
+ * when the game's samples changed, when what was heard is not the buffer at the volume, when the game's header did not
+ * come back done, or when the pool still allocates once it warmed up. Then reports the real time a submit takes with
+ * the shadow pool and with the game's buffer scaled in place, as the stubs did before.
+ *
+ *   shadow [-n submits] [-v WAVEVolume] [-b buffer ms]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+#include "stub.h"
+
+#define RUNS_MAX	(100000)
+#define WARM		(4)		/* submits before the pool holds what it needs */
+#define LEN_MAX		(1 << 20)
+
+static char heard[LEN_MAX];
+static volatile bool capture;
+static volatile unsigned int heard_len;
+
+/* Called with the clock held, must not call back into host.c */
+static void sink(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long at)
+{
+	if (!capture) return;
+	if (heard_len + bytes <= sizeof(heard)) memcpy(heard + heard_len, pcm, bytes);
+	heard_len += bytes;
+}
+
+static HWAVEOUT open_out(int rate, int channels, int bits, HANDLE ev)
+{
+	WAVEFORMATEX fmt = {WAVE_FORMAT_PCM, channels, rate, rate * channels * bits / 8, channels * bits / 8, bits, 0};
+	HWAVEOUT hw = NULL;
+	if (fake_waveOutOpen(&hw, WAVE_MAPPER, &fmt, (DWORD_PTR)ev, 0, CALLBACK_EVENT) != MMSYSERR_NOERROR) return NULL;
+	WaitForSingleObject(ev, 0); /* WOM_OPEN */
+	return hw;
+}
+
+static bool submit(HWAVEOUT hw, HANDLE ev, WAVEHDR *h)
+{
+	if (fake_waveOutWrite(hw, h, sizeof(*h)) != MMSYSERR_NOERROR) return false;
+	while (!(h->dwFlags & WHDR_DONE)) WaitForSingleObject(ev, 1000);
+	return true;
+}
+
+/* The same buffer submitted n times, each one heard at the volume and the game's samples left as they were */
+static int repeat(int bits, int n, int vol)
+{
+	char *data = malloc(LEN_MAX), *orig = malloc(LEN_MAX);
+	unsigned int len = 22050 * bits / 8 / 10; /* 100 ms, mono */
+	float f = vol / 100.0;
+	int failed = 0;
+	for (unsigned int i = 0; i < len; i++) orig[i] = data[i] = (char)(i * 37 + 11);
+
+	HANDLE ev = CreateEvent(NULL, FALSE, FALSE, NULL);
+	HWAVEOUT hw = open_out(22050, 1, bits, ev);
+	if (!hw) {
+		fprintf(stderr, "%d-bit: waveOutOpen failed\n", bits);
+		return 1;
+	}
+	WAVEHDR h = {data, len};
+	h.dwFlags = WHDR_BEGINLOOP | WHDR_ENDLOOP;
+	h.dwLoops = 1;
+	fake_waveOutPrepareHeader(hw, &h, sizeof(h));
+
+	struct host_use a, b;
+	for (int r = 0; r < n && !failed; r++) {
+		if (r == WARM) host_use(&a);
+		heard_len = 0;
+		capture = true;
+		bool ok = submit(hw, ev, &h);
+		capture = false;
+		if (!ok || (h.dwFlags & WHDR_INQUEUE)) {
+			fprintf(stderr, "%d-bit submit %d: %s\n", bits, r, ok ? "the game's header is still queued" : "waveOutWrite failed");
+			failed++;
+		} else if (memcmp(data, orig, len)) {
+			fprintf(stderr, "%d-bit submit %d: the game's buffer changed\n", bits, r);
+			failed++;
+		} else if (heard_len != len) {
+			fprintf(stderr, "%d-bit submit %d: heard %u of %u bytes\n", bits, r, heard_len, len);
+			failed++;
+		}
+		for (unsigned int i = 0; i < len * 8 / bits && !failed; i++) {
+			/* 8-bit PCM is unsigned */
+			int got = bits == 16 ? ((short *)heard)[i] : (unsigned char)heard[i];
+			int want = bits == 16 ? (short)(((short *)orig)[i] * f) : (unsigned char)(((unsigned char)orig[i] - 128) * f + 128);
+			if (got != want) {
+				fprintf(stderr, "%d-bit submit %d: sample %u heard as %d, %d at the volume\n", bits, r, i, got, want);
+				failed++;
+			}
+		}
+	}
+	if (!failed && n > WARM) {
+		host_use(&b);
+		if (b.blocks != a.blocks || b.bytes != a.bytes) {
+			fprintf(stderr, "%d-bit: %ld heap blocks of %lld bytes allocated after the pool warmed up\n", bits,
+				b.blocks - a.blocks, b.bytes - a.bytes);
+			failed++;
+		}
+	}
+
+	fake_waveOutUnprepareHeader(hw, &h, sizeof(h));
+	fake_waveOutClose(hw);
+	CloseHandle(ev);
+	free(data);
+	free(orig);
+	return failed;
+}
+
+/* Real nanoseconds a submit of the buffer takes on average */
+static unsigned long long bench(bool in_place, int n, int vol, int ms)
+{
+	unsigned long long sum = 0;
+	unsigned int len = 44100 * 4 * ms / 1000;
+	short *data = calloc(1, len);
+	float f = vol / 100.0;
+
+	HANDLE ev = CreateEvent(NULL, FALSE, FALSE, NULL);
+	HWAVEOUT hw = open_out(44100, 2, 16, ev);
+	WAVEHDR h = {(LPSTR)data, len};
+	fake_waveOutPrepareHeader(hw, &h, sizeof(h));
+	/* In place: the stubs pass the buffer on untouched and the loop they had runs on the game's samples */
+	stub_wavevol(in_place ? 100 : vol);
+	for (int r = 0; r < n; r++) {
+		for (unsigned int i = 0; i < len / 2; i++) data[i] = (short)(i * 37 + r);
+		unsigned long long t = host_wall();
+		if (in_place) {
+			for (unsigned int i = 0, j = len / 2; i < j; i++) data[i] = data[i] * f;
+		}
+		fake_waveOutWrite(hw, &h, sizeof(h));
+		sum += host_wall() - t;
+		while (!(h.dwFlags & WHDR_DONE)) WaitForSingleObject(ev, 1000);
+	}
+	stub_wavevol(vol);
+	fake_waveOutUnprepareHeader(hw, &h, sizeof(h));
+	fake_waveOutClose(hw);
+	CloseHandle(ev);
+	free(data);
+	return sum * 1000 / n;
+}
+
+int main(int argc, char **argv)
+{
+	int n = 200, vol = 50, ms = 250, c, failed = 0;
+	static char arg[16]; /* the ini keeps pointing at it */
+	while ((c = getopt(argc, argv, "n:v:b:")) != -1) {
+		switch (c) {
+			case 'n': n = atoi(optarg); break;
+			case 'v': vol = atoi(optarg); break;
+			case 'b': ms = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-n submits] [-v WAVEVolume] [-b ms]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (n < 1 || n > RUNS_MAX) n = 200;
+	if (vol < 0 || vol > 99) vol = 50;
+	if (ms < 1 || ms > 1000) ms = 250;
+
+	host_init("shadow");
+	snprintf(arg, sizeof(arg), "%d", vol);
+	host_ini("WAVEVolume", arg);
+	host_sink = sink;
+	host_attach();
+
+	failed += repeat(16, n, vol);
+	failed += repeat(8, n, vol);
+
+	unsigned long long shadow = bench(false, n, vol, ms), in_place = bench(true, n, vol, ms);
+	unsigned int len = 44100 * 4 * ms / 1000;
+	printf("%d submits of one %d ms 44.1 kHz stereo buffer at WAVEVolume %d\n", n, ms, vol);
+	printf("%-10s %12s %10s\n", "", "ns/submit", "MB/s");
+	printf("%-10s %12llu %10.0f\n", "shadow", shadow, shadow ? len * 1000.0 / shadow : 0);
+	printf("%-10s %12llu %10.0f\n", "in place", in_place, in_place ? len * 1000.0 / in_place : 0);
+
+	host_detach();
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,338 @@
+/* Soak: randomized MCI sessions on cdaudio, waveaudio and sequencer devices, through the command and the string
+ * interface, for many rounds of virtual time. Everything is closed and stopped between rounds, then a fixed probe
+ * plays and stops the CD from the same state every time. The first two rounds warm the caches up; after them nothing
+ * may be left over that they did not leave, and the probe's PLAY and STOP may not take longer to be heard.
+ *
+ *   soak [rounds] [ops per round] [seed]
+ */
+
+#include <stdlib.h>
+#include "host.h"
+#include "stub.h"
+
+#define LAT_MAX		(1024)
+#define WARM		(2)
+#define PROBES		(5)
+
+static unsigned int seed = 1;
+static unsigned long long lat[LAT_MAX];
+static int lat_cnt = 0;
+static volatile unsigned long long lat_from = 0; /* a PLAY of the CD waits to be heard since */
+
+static unsigned int rnd(unsigned int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) % n;
+}
+
+static void sink(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long heard)
+{
+	unsigned long long from = lat_from;
+	if (fmt->nSamplesPerSec != 44100 || !from || heard < from) return;
+	lat_from = 0;
+	if (lat_cnt < LAT_MAX) lat[lat_cnt++] = heard - from;
+}
+
+static MCIERROR str(const char *cmd)
+{
+	char ret[128];
+	return fake_mciSendStringA(cmd, ret, sizeof(ret), NULL);
+}
+
+static MCIDEVICEID cd = 0;
+static bool cd_play = false;
+static bool voice[3], song;
+
+static void cd_op(void)
+{
+	MCIERROR err;
+	switch (rnd(9)) {
+		case 0:
+			if (cd) break;
+			{
+				MCI_OPEN_PARMS parms = {0};
+				parms.lpstrDeviceType = "cdaudio";
+				if (!fake_mciSendCommandA(0, MCI_OPEN, MCI_OPEN_TYPE, (DWORD_PTR)&parms)) cd = parms.wDeviceID;
+				MCI_SET_PARMS set = {0, MCI_FORMAT_TMSF};
+				if (cd) fake_mciSendCommandA(cd, MCI_SET, MCI_SET_TIME_FORMAT, (DWORD_PTR)&set);
+			}
+			break;
+		case 1:
+		case 2:
+			if (!cd) break;
+			{
+				MCI_PLAY_PARMS parms = {0};
+				parms.dwFrom = MCI_MAKE_TMSF(2 + rnd(4), 0, rnd(2), 0);
+				parms.dwTo = MCI_MAKE_TMSF(5, 0, 2, 0);
+				if (!cd_play) lat_from = host_now();
+				err = fake_mciSendCommandA(cd, MCI_PLAY, MCI_FROM | MCI_TO | (rnd(2) ? MCI_NOTIFY : 0), (DWORD_PTR)&parms);
+				if (err) lat_from = 0;
+				else cd_play = true;
+			}
+			break;
+		case 3:
+			if (cd) fake_mciSendCommandA(cd, MCI_PAUSE, 0, 0);
+			cd_play = false;
+			break;
+		case 4:
+			if (cd && !fake_mciSendCommandA(cd, MCI_RESUME, 0, 0)) cd_play = true;
+			break;
+		case 5:
+			if (cd) fake_mciSendCommandA(cd, MCI_STOP, 0, 0);
+			cd_play = false;
+			break;
+		case 6:
+			if (cd) {
+				MCI_STATUS_PARMS parms = {0};
+				parms.dwItem = rnd(2) ? MCI_STATUS_POSITION : MCI_STATUS_MODE;
+				fake_mciSendCommandA(cd, MCI_STATUS, MCI_STATUS_ITEM, (DWORD_PTR)&parms);
+			}
+			break;
+		case 7:
+			if (!cd) break;
+			{
+				MCI_SEEK_PARMS parms = {0};
+				parms.dwTo = MCI_MAKE_TMSF(2 + rnd(4), 0, 0, 0);
+				fake_mciSendCommandA(cd, MCI_SEEK, MCI_TO, (DWORD_PTR)&parms);
+				cd_play = false;
+			}
+			break;
+		case 8:
+			if (cd) fake_mciSendCommandA(cd, MCI_CLOSE, 0, 0);
+			cd = 0;
+			cd_play = false;
+			break;
+	}
+}
+
+static void cd_string_op(void)
+{
+	static const char *cmds[] = {"status cdaudio mode", "status cdaudio position", "status cdaudio number of tracks",
+		"status cdaudio length track 3", "seek cdaudio to 3", "set cdaudio time format tmsf"};
+	str(cmds[rnd(sizeof(cmds) / sizeof(cmds[0]))]);
+}
+
+static void voice_op(void)
+{
+	char cmd[MAX_PATH + 64];
+	int v = rnd(3);
+	switch (rnd(5)) {
+		case 0:
+			if (voice[v]) break;
+			snprintf(cmd, sizeof(cmd), "open %s type waveaudio alias v%d", host_path(v == 2 ? "voice2.wav" : v ? "voice1.wav" : "voice0.wav"), v);
+			voice[v] = !str(cmd);
+			break;
+		case 1:
+		case 2:
+			snprintf(cmd, sizeof(cmd), "play v%d from 0%s", v, rnd(2) ? " notify" : "");
+			str(cmd);
+			break;
+		case 3:
+			snprintf(cmd, sizeof(cmd), "stop v%d", v);
+			str(cmd);
+			break;
+		case 4:
+			snprintf(cmd, sizeof(cmd), "close v%d", v);
+			str(cmd);
+			voice[v] = false;
+			break;
+	}
+}
+
+static void song_op(void)
+{
+	char cmd[MAX_PATH + 64];
+	switch (rnd(6)) {
+		case 0:
+			if (song) break;
+			snprintf(cmd, sizeof(cmd), "open %s type sequencer alias m", host_path("song.mid"));
+			song = !str(cmd);
+			break;
+		case 1:
+			str("play m from 0");
+			break;
+		case 2:
+			str("pause m");
+			break;
+		case 3:
+			str("resume m");
+			break;
+		case 4:
+			str("stop m");
+			break;
+		case 5:
+			str("close m");
+			song = false;
+			break;
+	}
+}
+
+/* A song opened through the wide entry point is played in-process, and settings the sequencer has not fail */
+static int song_conform(void)
+{
+	WCHAR element[MAX_PATH];
+	int failed = 0;
+	mbstowcs(element, host_path("song.mid"), MAX_PATH);
+	MCI_OPEN_PARMSW open = {0, 0, NULL, element, L"w"};
+	LONG relays = host_relays;
+	MCIERROR err = fake_mciSendCommandW(0, MCI_OPEN, MCI_OPEN_ELEMENT | MCI_OPEN_ALIAS, (DWORD_PTR)&open);
+	if (err || host_relays != relays) {
+		fprintf(stderr, "wide open of song.mid: error %u, %ld relayed\n", (unsigned)err, (long)(host_relays - relays));
+		return 1;
+	}
+	MCI_SET_PARMS set = {0, MCI_FORMAT_MILLISECONDS};
+	if ((err = fake_mciSendCommandA(open.wDeviceID, MCI_SET, MCI_SEQ_SET_TEMPO, (DWORD_PTR)&set)) != MCIERR_UNSUPPORTED_FUNCTION) {
+		fprintf(stderr, "MCI_SET tempo: error %u\n", (unsigned)err);
+		failed++;
+	}
+	if (!str("set w tempo 120")) {
+		fprintf(stderr, "\"set w tempo 120\" succeeded\n");
+		failed++;
+	}
+	if ((err = str("set w time format milliseconds"))) {
+		fprintf(stderr, "\"set w time format milliseconds\": error %u\n", (unsigned)err);
+		failed++;
+	}
+	str("close w");
+	return failed;
+}
+
+/* Error texts come from the system, DriverCheck fails a relayed call that loaded its CD audio driver */
+static int driver_conform(void)
+{
+	char text[128] = "";
+	int failed = 0;
+	if (!fake_mciGetErrorStringA(MCIERR_OUTOFRANGE, text, sizeof(text)) || strncmp(text, "system ", 7)) {
+		fprintf(stderr, "error text of MCIERR_OUTOFRANGE not the system's: \"%s\"\n", text);
+		failed++;
+	}
+	if (fake_mciGetErrorStringA(MCIERR_CUSTOM_DRIVER_BASE, text, sizeof(text))) {
+		fprintf(stderr, "error text of an unknown code: \"%s\"\n", text);
+		failed++;
+	}
+	MCIERROR err = relay_mciSendStringA("status cdaudio mode", NULL, 0, NULL);
+	host_mcicda = FALSE;
+	if (err != MCIERR_HARDWARE) {
+		fprintf(stderr, "relayed call that loaded mcicda.dll: error %u\n", (unsigned)err);
+		failed++;
+	}
+	return failed;
+}
+
+/* PLAY to first sample heard and STOP to silence, microseconds */
+static void probe(unsigned long long *play, unsigned long long *stop)
+{
+	*play = *stop = 0;
+	for (int i = 0; i < PROBES; i++) {
+		int n = lat_cnt;
+		lat_from = host_now();
+		str("play cdaudio from 2 to 4");
+		host_sleep(500000);
+		unsigned long long t = host_now();
+		str("stop cdaudio");
+		if (lat_cnt > n) *play += lat[--lat_cnt];
+		lat_from = 0;
+		*stop += host_silence > t ? host_silence - t : 0;
+		host_sleep(100000);
+	}
+	*play /= PROBES;
+	*stop /= PROBES;
+}
+
+static void use_max(struct host_use *a, const struct host_use *b)
+{
+#define MAX(field) if (b->field > a->field) a->field = b->field;
+	MAX(handles) MAX(threads) MAX(waves) MAX(midis) MAX(views) MAX(blocks) MAX(bytes) MAX(arena) MAX(fds) MAX(tasks)
+#undef MAX
+}
+
+/* Close and stop whatever the round left, and let the devices settle */
+static void quiesce(void)
+{
+	if (cd) fake_mciSendCommandA(cd, MCI_CLOSE, 0, 0);
+	cd = 0;
+	cd_play = false;
+	lat_from = 0;
+	str("stop cdaudio");
+	str("close all");
+	for (int v = 0; v < 3; v++) voice[v] = false;
+	song = false;
+	host_sleep(2000000);
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 8;
+	int ops = argc > 2 ? atoi(argv[2]) : 400;
+	seed = argc > 3 ? atoi(argv[3]) : 1;
+	struct host_use base, use;
+	unsigned long long play0 = 0, stop0 = 0;
+	int failed = 0;
+
+	host_init("soak");
+	host_mkdir("Music");
+	for (int i = 2; i <= 5; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "Music/Track%02d.wav", i);
+		host_wav(name, 3500, 44100, 2, i); /* one length: the disc cache holds the same bytes whichever tracks it keeps */
+	}
+	host_wav("voice0.wav", 700, 22050, 1, 10);
+	host_wav("voice1.wav", 1300, 22050, 1, 11);
+	host_wav("voice2.wav", 250, 11025, 1, 12);
+	host_mid("song.mid", 6);
+	host_ini("WaveAudio", "1");
+	host_ini("MidiSequencer", "1");
+	host_ini("HeadCache", "4");
+	host_ini("DiscCache", "2");
+	host_ini("DriverCheck", "1");
+	host_sink = sink;
+	host_latency = 20000;
+	host_qpc_base = 30LL * 86400 * host_qpc_freq; /* a month of uptime, counter * 1000000 overflows after 10 days */
+	host_attach();
+	str("set cdaudio time format tmsf");
+	failed += song_conform();
+	failed += driver_conform();
+
+	for (int r = 0; r < rounds; r++) {
+		unsigned long long t0 = host_wall();
+		lat_cnt = 0;
+		for (int i = 0; i < ops; i++) {
+			switch (rnd(10)) {
+				case 0: case 1: case 2: case 3: cd_op(); break;
+				case 4: cd_string_op(); break;
+				case 5: case 6: case 7: voice_op(); break;
+				case 8: song_op(); break;
+				case 9: fake_auxSetVolume(0, rnd(0x10000) * 0x10001); break;
+			}
+			host_sleep(rnd(400) * 1000ULL);
+		}
+		quiesce();
+		host_use(&use);
+
+		unsigned long long r50 = host_pct(lat, lat_cnt, 50), r99 = host_pct(lat, lat_cnt, 99), play, stop;
+		probe(&play, &stop);
+		quiesce();
+		printf("round %d: %d plays heard after p50 %llu.%03llu ms, p99 %llu.%03llu ms; probe PLAY %llu.%03llu ms, STOP %llu.%03llu ms; "
+			"%ld handles, %ld threads, %ld blocks, %ld fds, %lld KB arena; %llu ms\n", r, lat_cnt, r50 / 1000, r50 % 1000, r99 / 1000,
+			r99 % 1000, play / 1000, play % 1000, stop / 1000, stop % 1000, use.handles, use.threads, use.blocks, use.fds,
+			use.arena / 1024, (host_wall() - t0) / 1000);
+		if (r < WARM) {
+			if (!r) base = use;
+			else use_max(&base, &use);
+			if (play > play0) play0 = play;
+			if (stop > stop0) stop0 = stop;
+			continue;
+		}
+		char when[32];
+		snprintf(when, sizeof(when), "round %d", r);
+		failed += host_growth(when, &base, &use);
+		if (play > play0 + 1000 || stop > stop0 + 1000) {
+			fprintf(stderr, "%s: probe PLAY grew from %llu to %llu us, STOP from %llu to %llu us\n", when, play0, play, stop0, stop);
+			failed++;
+		}
+	}
+
+	host_detach();
+	printf("%s after %d rounds of %d operations, %llu s of virtual time\n", failed ? "FAILED" : "ok", rounds, ops, host_now() / 1000000);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+/* Sounds: a game's effects through PlaySound and sndPlaySound, a few sounds played over and over in the mix games use,
+ * with SoundCache and without it, each in a process of its own. Without the cache every call has the system winmm read
+ * the file again, taking the read cost each time, with it only the first call of a sound does. Reports the hit rate of the cache, the virtual latency of a call,
+ * which includes the reads, and the real time the calls took. Fails when a call did not play its sound or did not
+ * reach the system winmm, or when a sound was read more than once while the cache holds every sound.
+ *
+ *   sounds [-n calls] [-f sounds] [-k SoundCache KB] [-c file read us]
+ */
+
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "host.h"
+#include "player.h"
+
+#define CALLS_MAX	(100000)
+#define SOUNDS_MAX	(32)
+
+struct result
+{
+	int calls, failed;		/* calls made and calls that returned FALSE */
+	long hits, misses, sounds;	/* cache hits and misses, calls that reached the system winmm */
+	long files;			/* file system calls */
+	unsigned long long lat[3];	/* virtual usec, p50 p95 p99 */
+	unsigned long long call[2];	/* real usec, p50 p99 */
+	unsigned long long mean;	/* real nsec */
+};
+
+static unsigned long long lat[CALLS_MAX], call[CALLS_MAX];
+static char paths[SOUNDS_MAX][MAX_PATH];
+static WCHAR wpaths[SOUNDS_MAX][MAX_PATH];
+
+static long stats(const char *key)
+{
+	char buf[2048];
+	plr_stats(buf, sizeof(buf), TRUE);
+	const char *s = strstr(buf, key);
+	return s ? atol(s + strlen(key)) : 0;
+}
+
+/* The first sounds come up most, the way a game's footsteps and gunshots do */
+static int pick(unsigned int *seed, int sounds)
+{
+	*seed = *seed * 1103515245 + 12345;
+	int a = (*seed >> 16) % sounds;
+	*seed = *seed * 1103515245 + 12345;
+	int b = (*seed >> 16) % sounds;
+	return a < b ? a : b;
+}
+
+/* One mode in a child process, the globals of wav-winmm.c only start out clean once */
+static void run(const char *kb, int calls, int sounds, struct result *r)
+{
+	int fds[2];
+	memset(r, 0, sizeof(*r));
+	r->calls = -1;
+	if (pipe(fds)) return;
+	pid_t pid = fork();
+	if (pid == 0) {
+		host_ini("SoundCache", kb);
+		host_attach();
+		unsigned int seed = 1;
+		long files = host_files, sys = host_sounds;
+		for (int i = 0; i < calls; i++) {
+			int s = pick(&seed, sounds);
+			unsigned long long from = host_now(), wall = host_wall();
+			BOOL ok;
+			/* The three ways games name a sound file */
+			switch (i % 3) {
+				case 0: ok = fake_PlaySoundA(paths[s], NULL, SND_FILENAME | SND_ASYNC | SND_NODEFAULT); break;
+				case 1: ok = fake_sndPlaySoundA(paths[s], SND_ASYNC | SND_NODEFAULT); break;
+				default: ok = fake_PlaySoundW(wpaths[s], NULL, SND_FILENAME | SND_ASYNC | SND_NODEFAULT); break;
+			}
+			call[i] = host_wall() - wall;
+			r->mean += call[i];
+			lat[i] = host_now() - from;
+			if (!ok) r->failed++;
+			host_sleep(50000);
+		}
+		r->files = host_files - files;
+		r->sounds = host_sounds - sys;
+		r->hits = stats("sound_hits=");
+		r->misses = stats("sound_misses=");
+		host_detach();
+
+		r->calls = calls;
+		r->mean = r->mean * 1000 / calls;
+		r->lat[0] = host_pct(lat, calls, 50);
+		r->lat[1] = host_pct(lat, calls, 95);
+		r->lat[2] = host_pct(lat, calls, 99);
+		r->call[0] = host_pct(call, calls, 50);
+		r->call[1] = host_pct(call, calls, 99);
+		write(fds[1], r, sizeof(*r));
+		_exit(0); /* the parent owns the game folder */
+	}
+	close(fds[1]);
+	if (pid < 0 || read(fds[0], r, sizeof(*r)) != sizeof(*r)) r->calls = -1;
+	close(fds[0]);
+	if (pid > 0) waitpid(pid, NULL, 0);
+}
+
+int main(int argc, char **argv)
+{
+	int calls = 3000, sounds = 12, c, failed = 0;
+	const char *kb = "1024";
+	host_read_cost = 2000;
+	while ((c = getopt(argc, argv, "n:f:k:c:")) != -1) {
+		switch (c) {
+			case 'n': calls = atoi(optarg); break;
+			case 'f': sounds = atoi(optarg); break;
+			case 'k': kb = optarg; break;
+			case 'c': host_read_cost = strtoull(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n calls] [-f sounds] [-k KB] [-c us]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (calls < 1 || calls > CALLS_MAX) calls = 3000;
+	if (sounds < 1 || sounds > SOUNDS_MAX) sounds = 12;
+	if (atoi(kb) < 1) kb = "1024";
+
+	host_init("sounds");
+	unsigned long long total = 0;
+	for (int i = 0; i < sounds; i++) {
+		char name[32];
+		unsigned int ms = 100 + i * 50;
+		snprintf(name, sizeof(name), "sfx%02d.wav", i);
+		host_wav(name, ms, 22050, 1, i);
+		snprintf(paths[i], sizeof(paths[i]), "%s", host_path(name));
+		for (int j = 0; j < MAX_PATH && (j == 0 || paths[i][j-1]); j++) wpaths[i][j] = (unsigned char)paths[i][j];
+		total += 44 + ms * 22050ULL * 2 / 1000;
+	}
+
+	printf("%d calls over %d sounds of %llu KB, SoundCache %s KB, a file read takes %llu us\n", calls, sounds, total >> 10,
+		kb, host_read_cost);
+	printf("%-8s %8s %10s %10s %10s %12s %12s %12s %12s\n", "", "hit %", "p50 us", "p95 us", "p99 us", "call p50 us",
+		"call p99 us", "call mean ns", "file calls");
+	struct result res[2];
+	const char *modes[2] = {"cache", "system"};
+	run(kb, calls, sounds, &res[0]);
+	run("0", calls, sounds, &res[1]);
+	for (int m = 0; m < 2; m++) {
+		struct result *r = &res[m];
+		if (r->calls < 0) {
+			fprintf(stderr, "%s: the run did not finish\n", modes[m]);
+			failed++;
+			continue;
+		}
+		printf("%-8s %8.1f %10llu %10llu %10llu %12llu %12llu %12llu %12ld\n", modes[m],
+			r->hits + r->misses ? r->hits * 100.0 / (r->hits + r->misses) : 0, r->lat[0], r->lat[1], r->lat[2],
+			r->call[0], r->call[1], r->mean, r->files);
+		if (r->failed) {
+			fprintf(stderr, "%s: %d of %d calls returned FALSE\n", modes[m], r->failed, calls);
+			failed++;
+		}
+		if (r->sounds != calls) {
+			fprintf(stderr, "%s: %ld of %d calls reached the system winmm\n", modes[m], r->sounds, calls);
+			failed++;
+		}
+	}
+	/* Every sound fits, each is read once */
+	if (total <= (unsigned long long)atoi(kb) << 10 && res[0].calls > 0 && res[0].misses > sounds) {
+		fprintf(stderr, "cache: %ld misses, %d sounds\n", res[0].misses, sounds);
+		failed++;
+	}
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+/* Storm: threads sending PLAY, PAUSE, RESUME, STOP and status to the same devices at once, a CD and a waveaudio file,
+ * as a game's UI and game threads do. Reports commands per second of real time. After every storm the devices are
+ * checked: paused must be silent and playing must be heard, and mode changes must still take. Exits non-zero when
+ * they do not.
+ *
+ *   storm [rounds] [threads] [commands per thread]
+ */
+
+#include <stdlib.h>
+#include "host.h"
+
+static volatile LONG heard[2]; /* stretches of PCM of the CD and of the file */
+static const char *names[2] = {"cdaudio", "v"};
+
+/* Called with the clock held, must not call back into host.c */
+static void sink(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long at)
+{
+	InterlockedIncrement(&heard[fmt->nSamplesPerSec == 44100 ? 0 : 1]);
+}
+
+static unsigned int rnd(unsigned int *seed, unsigned int n)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return (*seed >> 8) % n;
+}
+
+static int per_thread = 500;
+static volatile LONG sent = 0;
+static unsigned long long status_ns = 0;
+static volatile LONG status_cnt = 0;
+
+static DWORD WINAPI storm_main(void *arg)
+{
+	unsigned int seed = (unsigned int)(DWORD_PTR)arg;
+	char cmd[64], ret[32];
+	for (int i = 0; i < per_thread; i++) {
+		const char *dev = names[rnd(&seed, 2)];
+		switch (rnd(&seed, 8)) {
+			case 0: snprintf(cmd, sizeof(cmd), "play %s", dev); break;
+			case 1: snprintf(cmd, sizeof(cmd), "play %s from %d", dev, dev == names[0] ? 2 + rnd(&seed, 3) : rnd(&seed, 1000)); break;
+			case 2: case 3: snprintf(cmd, sizeof(cmd), "pause %s", dev); break;
+			case 4: case 5: snprintf(cmd, sizeof(cmd), "resume %s", dev); break;
+			case 6: snprintf(cmd, sizeof(cmd), "stop %s", dev); break;
+			case 7: snprintf(cmd, sizeof(cmd), "status %s mode", dev); break;
+		}
+		unsigned long long t = host_wall();
+		fake_mciSendStringA(cmd, ret, sizeof(ret), NULL);
+		if (cmd[1] == 't' && cmd[2] == 'a') {
+			__atomic_add_fetch(&status_ns, (host_wall() - t) * 1000, __ATOMIC_RELAXED);
+			InterlockedIncrement(&status_cnt);
+		}
+		InterlockedIncrement(&sent);
+		if (rnd(&seed, 4) == 0) host_sleep(rnd(&seed, 3000));
+	}
+	return 0;
+}
+
+static int mode(int d, char *ret, size_t len)
+{
+	char cmd[64];
+	snprintf(cmd, sizeof(cmd), "status %s mode", names[d]);
+	fake_mciSendStringA(cmd, ret, len, NULL);
+	return ret[0];
+}
+
+static int send(const char *verb, int d)
+{
+	char cmd[64];
+	snprintf(cmd, sizeof(cmd), "%s %s", verb, names[d]);
+	return fake_mciSendStringA(cmd, NULL, 0, NULL);
+}
+
+/* Whatever the storm left, the device must sound like its mode says and still follow commands */
+static int check(int round, int d)
+{
+	char m[32];
+	int failed = 0;
+	for (int step = 0; step < 4; step++) {
+		mode(d, m, sizeof(m));
+		if (strcmp(m, "playing") && strcmp(m, "paused")) {
+			send("play", d);
+			mode(d, m, sizeof(m));
+		}
+		LONG before = __atomic_load_n(&heard[d], __ATOMIC_RELAXED);
+		host_sleep(2500000);
+		char after[32];
+		mode(d, after, sizeof(after));
+		/* The sink hears a buffer once it is done, or cut off by the PAUSE that ends a playing window */
+		send(strcmp(after, "paused") == 0 ? "resume" : "pause", d);
+		LONG now = __atomic_load_n(&heard[d], __ATOMIC_RELAXED);
+		if (strcmp(m, "paused") == 0 && now != before) {
+			fprintf(stderr, "round %d: %s is paused but was heard\n", round, names[d]);
+			failed++;
+		}
+		if (strcmp(m, "playing") == 0 && strcmp(after, "playing") == 0 && now == before) {
+			fprintf(stderr, "round %d: %s is playing but was not heard\n", round, names[d]);
+			failed++;
+		}
+	}
+	send("stop", d);
+	host_sleep(100000); /* the CD stops on its player thread */
+	mode(d, m, sizeof(m));
+	if (strcmp(m, "stopped")) {
+		fprintf(stderr, "round %d: %s is %s after stop\n", round, names[d], m);
+		failed++;
+	}
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	int rounds = argc > 1 ? atoi(argv[1]) : 10;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+	per_thread = argc > 3 ? atoi(argv[3]) : 500;
+	HANDLE th[64];
+	int failed = 0;
+	char cmd[MAX_PATH + 64];
+
+	if (threads > 64) threads = 64;
+	host_init("storm");
+	host_mkdir("Music");
+	for (int t = 2; t <= 4; t++) {
+		snprintf(cmd, sizeof(cmd), "Music/Track%02d.wav", t);
+		host_wav(cmd, 30000, 44100, 2, t);
+	}
+	host_wav("voice.wav", 30000, 22050, 1, 1);
+	host_ini("WaveAudio", "1");
+	host_sink = sink;
+	host_attach();
+	snprintf(cmd, sizeof(cmd), "open %s type waveaudio alias v", host_path("voice.wav"));
+	if (fake_mciSendStringA(cmd, NULL, 0, NULL)) {
+		fprintf(stderr, "cannot open %s\n", host_path("voice.wav"));
+		return 1;
+	}
+
+	unsigned long long wall = 0, cpu = 0;
+	for (int r = 0; r < rounds; r++) {
+		unsigned long long w = host_wall(), c = host_cpu();
+		for (int i = 0; i < threads; i++) th[i] = CreateThread(NULL, 0, storm_main, (void *)(DWORD_PTR)(r * 1000 + i + 1), 0, NULL);
+		WaitForMultipleObjects(threads, th, TRUE, INFINITE);
+		for (int i = 0; i < threads; i++) CloseHandle(th[i]);
+		wall += host_wall() - w;
+		cpu += host_cpu() - c;
+		failed += check(r, 0) + check(r, 1);
+	}
+	fake_mciSendStringA("close v", NULL, 0, NULL);
+	host_detach();
+
+	printf("%d rounds of %d threads x %d commands: %ld commands, %.0f per second, %.1f us CPU each, status %.2f us each\n",
+		rounds, threads, per_thread, (long)sent, sent * 1e6 / (wall ? wall : 1), (double)cpu / (sent ? sent : 1),
+		status_cnt ? status_ns / 1000.0 / status_cnt : 0.0);
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+/* Streams: CPU and memory per active stream. Plays 1 to 8 streams at once, the four cdaudio devices opened under
+ * aliases of their own and then waveaudio files of the same format, and reports the CPU time a second of playback
+ * costs with each, how much the last stream added, and the heap the streams hold. The CPU includes the host's own
+ * waveOut threads, which stand in for the driver.
+ *
+ *   streams [-s seconds measured] [-r rounds, the median counts] [-d AdaptiveDepth ms]
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+#define CDS	(4)
+#define WAVES	(4)
+
+static void send(const char *fmt, ...)
+{
+	char cmd[MAX_PATH + 64];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(cmd, sizeof(cmd), fmt, ap);
+	va_end(ap);
+	MCIERROR err = fake_mciSendStringA(cmd, NULL, 0, NULL);
+	if (err) fprintf(stderr, "%s: error %u\n", cmd, (unsigned int)err);
+}
+
+static void play(int i)
+{
+	if (i < CDS) send("play c%d from %d", i, i + 2);
+	else send("play w%d from 0", i - CDS);
+}
+
+static void stop(int i)
+{
+	if (i < CDS) send("stop c%d", i);
+	else send("stop w%d", i - CDS);
+}
+
+int main(int argc, char **argv)
+{
+	int seconds = 10, rounds = 5, c;
+	char cmd[MAX_PATH + 64];
+
+	while ((c = getopt(argc, argv, "s:r:d:")) != -1) {
+		switch (c) {
+			case 's': seconds = atoi(optarg); break;
+			case 'r': rounds = atoi(optarg); break;
+			case 'd': host_ini("AdaptiveDepth", optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-s seconds] [-r rounds] [-d ms]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (rounds < 1 || rounds > 100) rounds = 5;
+
+	host_init("streams");
+	host_mkdir("Music");
+	for (int i = 0; i < CDS; i++) {
+		snprintf(cmd, sizeof(cmd), "Music/Track%02d.wav", i + 2);
+		host_wav(cmd, (seconds * rounds + 2) * 1000, 44100, 2, i);
+	}
+	for (int i = 0; i < WAVES; i++) {
+		snprintf(cmd, sizeof(cmd), "stream%d.wav", i);
+		host_wav(cmd, (seconds * rounds + 2) * 1000, 44100, 2, 10 + i);
+	}
+	host_ini("WaveAudio", "1");
+	host_attach();
+
+	struct host_use idle, use;
+	host_use(&idle);
+	for (int i = 0; i < CDS; i++) {
+		send("open cdaudio alias c%d", i);
+		send("set c%d time format tmsf", i);
+	}
+	for (int i = 0; i < WAVES; i++) {
+		snprintf(cmd, sizeof(cmd), "stream%d.wav", i);
+		send("open %s type waveaudio alias w%d", host_path(cmd), i);
+	}
+
+	printf("%-8s %16s %16s %10s\n", "streams", "CPU us per s", "last stream", "heap KB");
+	unsigned long long prev = 0;
+	for (int n = 1; n <= CDS + WAVES; n++) {
+		for (int i = 0; i < n; i++) play(i);
+		host_sleep(1000000); /* past the opens and the first reads */
+		unsigned long long v[100];
+		for (int r = 0; r < rounds; r++) {
+			v[r] = host_cpu();
+			host_sleep(seconds * 1000000ULL);
+			v[r] = (host_cpu() - v[r]) / seconds;
+		}
+		unsigned long long cpu = host_pct(v, rounds, 50);
+		host_use(&use);
+		for (int i = 0; i < n; i++) stop(i);
+		host_sleep(500000);
+
+		printf("%-8d %16llu %16lld %10lld\n", n, cpu, n > 1 ? (long long)(cpu - prev) : (long long)cpu,
+			(use.bytes - idle.bytes) >> 10);
+		prev = cpu;
+	}
+
+	for (int i = 0; i < CDS; i++) send("close c%d", i);
+	for (int i = 0; i < WAVES; i++) send("close w%d", i);
+	host_detach();
+	return 0;
+}
@@ -0,0 +1,142 @@
+/* Strings: mciSendStringW has to answer like mciSendStringA. Sends the same commands through both, with no return buffer,
+ * with ones shorter than the answer, of the usual size and longer than 256 characters, and fails on any other error or
+ * text.
+ * Then polls the position of a playing CD the way games do, through both, and reports the real time a call takes.
+ *
+ *   strings [-n polls per batch] [-b batches, the median counts]
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+#define BATCHES_MAX	(100)
+#define RET_MAX		(2048)
+
+static const char *cmds[] = {
+	"status cdaudio mode",
+	"status cdaudio number of tracks",
+	"status cdaudio length track 3",
+	"status cdaudio position",
+	"status cdaudio media present",
+	"status cdaudio time format",
+	"capability cdaudio can eject",
+	"info cdaudio product",
+	"info w file",
+	"status w length",
+	"set cdaudio time format milliseconds",
+	"play cdaudio from 99999999",
+	"status nodevice mode",
+};
+
+static const UINT lens[] = {0, 4, 128, RET_MAX};
+
+static MCIERROR send_w(const char *cmd, char *ret, UINT len)
+{
+	static WCHAR cmdW[1000], retW[RET_MAX];
+	mbstowcs(cmdW, cmd, 1000);
+	if (!ret) return fake_mciSendStringW(cmdW, NULL, 0, NULL);
+	for (UINT i = 0; i < len; i++) retW[i] = L'#';
+	MCIERROR err = fake_mciSendStringW(cmdW, retW, len, NULL);
+	/* Everything answered is ASCII */
+	for (UINT i = 0; i < len; i++) {
+		ret[i] = retW[i] < 0x80 ? (char)retW[i] : '?';
+		if (!retW[i]) break;
+	}
+	return err;
+}
+
+static int conform(const char *cmd, UINT len)
+{
+	static char a[RET_MAX], w[RET_MAX];
+	if (!len) {
+		MCIERROR ea = fake_mciSendStringA(cmd, NULL, 0, NULL), ew = send_w(cmd, NULL, 0);
+		if (ea == ew) return 0;
+		fprintf(stderr, "\"%s\" without a buffer: A error %u, W error %u\n", cmd, (unsigned)ea, (unsigned)ew);
+		return 1;
+	}
+	memset(a, '#', len);
+	memset(w, '#', len);
+	MCIERROR ea = fake_mciSendStringA(cmd, a, len, NULL);
+	MCIERROR ew = send_w(cmd, w, len);
+	a[len-1] = w[len-1] = '\0';
+	if (ea != ew || (!ea && strcmp(a, w))) {
+		fprintf(stderr, "\"%s\" into %u: A error %u \"%s\", W error %u \"%s\"\n", cmd, len, (unsigned)ea, a, (unsigned)ew, w);
+		return 1;
+	}
+	return 0;
+}
+
+/* Real nanoseconds a poll takes, the median of the batches */
+static unsigned long long poll(bool wide, UINT len, int polls, int batches)
+{
+	static unsigned long long v[BATCHES_MAX];
+	static char ret[RET_MAX];
+	static WCHAR retW[RET_MAX], cmdW[] = L"status cdaudio position";
+	for (int b = 0; b < batches; b++) {
+		unsigned long long t = host_wall();
+		for (int i = 0; i < polls; i++) {
+			if (wide) fake_mciSendStringW(cmdW, retW, len, NULL);
+			else fake_mciSendStringA("status cdaudio position", ret, len, NULL);
+		}
+		v[b] = (host_wall() - t) * 1000 / polls;
+	}
+	return host_pct(v, batches, 50);
+}
+
+int main(int argc, char **argv)
+{
+	int polls = 20000, batches = 5, c, failed = 0;
+	while ((c = getopt(argc, argv, "n:b:")) != -1) {
+		switch (c) {
+			case 'n': polls = atoi(optarg); break;
+			case 'b': batches = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-n polls] [-b batches]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (polls < 1) polls = 20000;
+	if (batches < 1 || batches > BATCHES_MAX) batches = 5;
+
+	host_init("strings");
+	host_mkdir("Music");
+	for (int t = 2; t <= 4; t++) {
+		char name[32];
+		snprintf(name, sizeof(name), "Music/Track%02d.wav", t);
+		host_wav(name, 5000, 44100, 2, t);
+	}
+	host_wav("voice.wav", 1500, 22050, 1, 1);
+	host_ini("WaveAudio", "1");
+	host_attach();
+
+	char cmd[MAX_PATH + 64];
+	snprintf(cmd, sizeof(cmd), "open %s type waveaudio alias w", host_path("voice.wav"));
+	fake_mciSendStringA(cmd, NULL, 0, NULL);
+	for (int i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+		for (int l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) failed += conform(cmds[i], lens[l]);
+	}
+
+	/* An answer longer than 256 characters has to reach a wide caller whole */
+	static char a[RET_MAX], w[RET_MAX];
+	fake_mciSendStringA("status cdaudio stats", a, RET_MAX, NULL);
+	send_w("status cdaudio stats", w, RET_MAX);
+	if (strlen(a) < 256 || strlen(w) < strlen(a) || strncmp(a, w, 40)) {
+		fprintf(stderr, "stats: A answered %u characters, W %u\n", (unsigned)strlen(a), (unsigned)strlen(w));
+		failed++;
+	}
+	fake_mciSendStringA("close w", NULL, 0, NULL);
+
+	fake_mciSendStringA("play cdaudio from 2", NULL, 0, NULL);
+	host_sleep(200000);
+	printf("%d polls of \"status cdaudio position\" while playing, %d batches\n", polls, batches);
+	printf("%-8s %10s %10s\n", "ns", "A", "W");
+	for (int l = 2; l < sizeof(lens) / sizeof(lens[0]); l++) {
+		printf("%-8u %10llu %10llu\n", lens[l], poll(false, lens[l], polls, batches), poll(true, lens[l], polls, batches));
+	}
+	fake_mciSendStringA("stop cdaudio", NULL, 0, NULL);
+
+	host_detach();
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
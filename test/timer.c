@@ -0,0 +1,113 @@
+/* Timer: 100 periodic timers of 2 to 16 ms at once, from the system winmm's timer per call and from TimerEngine's one
+ * thread. Reports how late the callbacks run past their due times, counted from when each timer was set so drift shows
+ * too, the periods the timers missed, and the CPU time a second of them costs. Fails when a timer fired more than one
+ * period off its count, or fell behind by more than the wake lateness.
+ *
+ *   timer [-n timers] [-s seconds] [-w wake lateness us]
+ *
+ * The host build's clock is virtual. Every timed wait of the timer threads returns up to the wake lateness past its
+ * timeout, uniformly, 1 ms by default as the scheduler tick after timeBeginPeriod(1). "make timer-real" builds
+ * timer-real on real time, for the jitter the machine adds. It only reports, a busy machine misses periods, and the host
+ * does not raise the priority of the engine's thread as Windows does.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+#include "stub.h"
+
+#define TIMERS_MAX	(256)
+#define SAMPLES_MAX	(4000000)
+
+struct timer
+{
+	UINT id;
+	unsigned int period;	/* ms */
+	unsigned long long t0;	/* usec it was set */
+	volatile LONG fired;
+};
+
+static struct timer timers[TIMERS_MAX];
+static unsigned long long late[SAMPLES_MAX];
+static volatile LONG late_cnt = 0;
+
+static void CALLBACK tick(UINT id, UINT msg, DWORD_PTR user, DWORD_PTR dw1, DWORD_PTR dw2)
+{
+	struct timer *t = &timers[user];
+	unsigned long long now = host_now(), due = t->t0 + (unsigned long long)(t->fired + 1) * t->period * 1000;
+	InterlockedIncrement(&t->fired);
+	LONG i = InterlockedIncrement(&late_cnt) - 1;
+	if (i < SAMPLES_MAX) late[i] = now > due ? now - due : 0;
+}
+
+static int run(int engine, int n, int seconds)
+{
+	int failed = 0;
+	stub_timer(engine);
+	late_cnt = 0;
+	for (int i = 0; i < n; i++) {
+		struct timer *t = &timers[i];
+		t->period = 2 + i % 15;
+		t->fired = 0;
+		t->t0 = host_now();
+		t->id = fake_timeSetEvent(t->period, 1, tick, i, TIME_PERIODIC | TIME_CALLBACK_FUNCTION);
+		if (!t->id) failed++;
+	}
+	unsigned long long cpu = host_cpu(), t0 = host_now();
+	host_sleep(seconds * 1000000ULL + 500); /* between due times, not on the ones the periods share */
+	cpu = host_cpu() - cpu;
+	for (int i = 0; i < n; i++) {
+		if (timers[i].id) fake_timeKillEvent(timers[i].id);
+	}
+	unsigned long long span = host_now() - t0;
+
+	long long missed = 0;
+	for (int i = 0; i < n; i++) {
+		struct timer *t = &timers[i];
+		long long want = (long long)(host_now() - t->t0) / 1000 / t->period;
+		if (want > t->fired) missed += want - t->fired;
+#ifndef HOST_REAL
+		/* A late wake may leave the periods of its lateness unfired yet */
+		long long slack = 1 + host_wake_late / 1000 / t->period;
+		if (t->fired + slack < want || t->fired > want + 1) {
+			fprintf(stderr, "%s: %u ms timer fired %ld times in %lld periods\n", engine ? "engine" : "system", t->period,
+				(long)t->fired, want);
+			failed++;
+		}
+#endif
+	}
+	LONG cnt = late_cnt < SAMPLES_MAX ? late_cnt : SAMPLES_MAX;
+	unsigned long long p50 = host_pct(late, cnt, 50), p99 = host_pct(late, cnt, 99), max = host_pct(late, cnt, 100);
+	printf("%-8s %10ld %10lld %10llu %10llu %10llu %12llu\n", engine ? "engine" : "system", (long)cnt, missed, p50, p99, max,
+		span ? cpu * 1000000 / span : 0);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	int n = 100, seconds = 5, c, failed = 0;
+	host_wake_late = 1000;
+	while ((c = getopt(argc, argv, "n:s:w:")) != -1) {
+		switch (c) {
+			case 'n': n = atoi(optarg); break;
+			case 's': seconds = atoi(optarg); break;
+			case 'w': host_wake_late = strtoull(optarg, NULL, 10); break;
+			default:
+				fprintf(stderr, "usage: %s [-n timers] [-s seconds] [-w us]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (n < 1 || n > TIMERS_MAX) n = 100;
+	if (seconds < 1) seconds = 5;
+
+	host_init("timer");
+	host_attach();
+	printf("%d periodic timers of 2 to 16 ms for %d s, waits wake up to %llu us late\n", n, seconds, host_wake_late);
+	printf("%-8s %10s %10s %10s %10s %10s %12s\n", "", "callbacks", "missed", "p50 us", "p99 us", "max us", "CPU us per s");
+	failed += run(0, n, seconds);
+	failed += run(1, n, seconds);
+	stub_timer(0);
+	host_detach();
+	printf("%s\n", failed ? "FAILED" : "ok");
+	return failed ? 1 : 0;
+}
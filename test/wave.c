@@ -0,0 +1,124 @@
+/* Wave: how long a game's sound effect takes from "open" to its first sample heard on the in-process waveaudio device.
+ * Plays short clips the way games do, each opened, played and closed again, more different files than there are
+ * devices, so some opens find their file's stream still open from its last close and the rest open a new one.
+ *
+ *   open	open and play of a file with no stream kept, to its first sample
+ *   reopen	open and play of a file closed a moment ago, to its first sample
+ *   replay	play from the start while the clip still plays, to its first sample
+ *
+ * Reports virtual latency and the real time the open and play calls took. Fails when a play was not heard.
+ *
+ *   wave [-n runs] [-l sink latency us] [-o waveOutOpen us] [-f files]
+ */
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "host.h"
+
+#define RUNS_MAX	(10000)
+#define FILES_MAX	(32)
+
+enum { K_OPEN, K_REOPEN, K_REPLAY, K_CNT };
+static const char *names[K_CNT] = {"open", "reopen", "replay"};
+static unsigned long long lat[K_CNT][RUNS_MAX], call[K_CNT][RUNS_MAX];
+static int cnt[K_CNT], missed;
+
+static volatile bool watch;
+static volatile unsigned long long from, first; /* a play waits to be heard since, and was heard at */
+
+/* Called with the clock held, must not call back into host.c */
+static void sink(const WAVEFORMATEX *fmt, const char *pcm, unsigned int bytes, unsigned long long heard)
+{
+	if (fmt->nSamplesPerSec == 22050 && watch && !first && heard >= from) first = heard + 1;
+}
+
+static MCIERROR send(const char *fmt, ...)
+{
+	char cmd[MAX_PATH + 64];
+	va_list ap;
+	va_start(ap, fmt);
+	vsnprintf(cmd, sizeof(cmd), fmt, ap);
+	va_end(ap);
+	return fake_mciSendStringA(cmd, NULL, 0, NULL);
+}
+
+/* Runs the commands that start a clip and records how long until it was heard. PCM reaches the sink once it played or
+ * was cut off, so the clip is stopped before looking. */
+static void measure(int kind, const char *path, bool open)
+{
+	first = 0;
+	from = host_now();
+	watch = true;
+	unsigned long long wall = host_wall();
+	if (open) send("open %s type waveaudio alias w", path);
+	send("play w from 0");
+	wall = host_wall() - wall;
+	host_sleep(300000);
+	send("stop w");
+	host_sleep(50000);
+	if (!first) {
+		fprintf(stderr, "%s of %s: not heard\n", names[kind], path);
+		missed++;
+	} else if (cnt[kind] < RUNS_MAX) {
+		call[kind][cnt[kind]] = wall;
+		lat[kind][cnt[kind]++] = first - 1 - from;
+	}
+	watch = false;
+}
+
+int main(int argc, char **argv)
+{
+	int runs = 200, files = 8, c;
+	host_latency = 20000;
+	while ((c = getopt(argc, argv, "n:l:o:f:")) != -1) {
+		switch (c) {
+			case 'n': runs = atoi(optarg); break;
+			case 'l': host_latency = strtoull(optarg, NULL, 10); break;
+			case 'o': host_open_cost = strtoull(optarg, NULL, 10); break;
+			case 'f': files = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-n runs] [-l us] [-o us] [-f files]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (runs < 1 || runs > RUNS_MAX) runs = 200;
+	if (files < 1 || files > FILES_MAX) files = 8;
+
+	host_init("wave");
+	for (int i = 0; i < files; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "sfx%02d.wav", i);
+		host_wav(name, 600 + i * 50, 22050, 1, i);
+	}
+	host_ini("WaveAudio", "1");
+	host_sink = sink;
+	host_attach();
+
+	/* Files cycle through more than the devices keep, so a file's stream is gone when its turn comes again */
+	for (int r = 0; r < runs; r++) {
+		char name[32];
+		snprintf(name, sizeof(name), "sfx%02d.wav", r % files);
+		const char *path = host_path(name);
+		bool kept = files <= 4 && r >= files;
+		measure(kept ? K_REOPEN : K_OPEN, path, true);
+		send("close w");
+		measure(K_REOPEN, path, true);
+		send("play w from 0");
+		host_sleep(200000);
+		measure(K_REPLAY, path, false);
+		send("close w");
+		host_sleep(100000);
+	}
+	host_detach();
+
+	printf("%d runs over %d files, sink latency %llu us, waveOutOpen %llu us\n", runs, files, host_latency, host_open_cost);
+	printf("%-8s %10s %10s %10s %12s %12s\n", "", "p50 ms", "p95 ms", "p99 ms", "call p50 us", "call p99 us");
+	for (int k = 0; k < K_CNT; k++) {
+		printf("%-8s %10.3f %10.3f %10.3f %12llu %12llu\n", names[k], host_pct(lat[k], cnt[k], 50) / 1000.0,
+			host_pct(lat[k], cnt[k], 95) / 1000.0, host_pct(lat[k], cnt[k], 99) / 1000.0, host_pct(call[k], cnt[k], 50),
+			host_pct(call[k], cnt[k], 99));
+	}
+	printf("%s\n", missed ? "FAILED" : "ok");
+	return missed ? 1 : 0;
+}
@@ -0,0 +1,397 @@
+/* The Win32 and winmm declarations wav-winmm uses, for the host build in test/. Served by host.c. */
+#ifndef HOST_WINDOWS_H
+#define HOST_WINDOWS_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <wchar.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#define WINAPI
+#define CALLBACK
+#define stricmp strcasecmp
+#define strnicmp strncasecmp
+typedef int BOOL; typedef unsigned char BYTE; typedef unsigned short WORD; typedef unsigned int DWORD;
+typedef int LONG; typedef unsigned int ULONG; typedef unsigned int UINT; typedef char CHAR; typedef wchar_t WCHAR;
+typedef long long LONGLONG; typedef unsigned long long ULONGLONG; typedef unsigned long long DWORD64;
+typedef uintptr_t DWORD_PTR, UINT_PTR, ULONG_PTR, WPARAM, SIZE_T; typedef intptr_t LONG_PTR, LPARAM, LRESULT, INT_PTR;
+typedef void VOID, *PVOID, *LPVOID; typedef const void *LPCVOID;
+typedef void *HANDLE; typedef HANDLE HINSTANCE, HMODULE, HWND, HDRVR, HMIDI, HMIDIIN, HMIDIOUT, HMIDISTRM, HMIXER, HMIXEROBJ, HMMIO, HTASK, HWAVEIN, HWAVEOUT, HGLOBAL, HRSRC;
+typedef char *LPSTR, *HPSTR; typedef const char *LPCSTR; typedef WCHAR *LPWSTR; typedef const WCHAR *LPCWSTR;
+typedef DWORD *LPDWORD, *PDWORD; typedef UINT *LPUINT, *PUINT; typedef WORD *LPWORD; typedef BYTE *LPBYTE; typedef LONG *PLONG;
+typedef volatile LONG *PVLONG;
+typedef UINT MMRESULT; typedef DWORD MCIERROR; typedef UINT MCIDEVICEID; typedef DWORD FOURCC;
+typedef HANDLE *LPHWAVEOUT, *LPHWAVEIN, *LPHMIDIIN, *LPHMIDIOUT, *LPHMIDISTRM, *LPHMIXER;
+typedef UINT (CALLBACK *YIELDPROC)(MCIDEVICEID, DWORD);
+typedef void (CALLBACK *LPTIMECALLBACK)(UINT, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR);
+typedef LRESULT (CALLBACK *LPMMIOPROC)(LPSTR, UINT, LPARAM, LPARAM);
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+typedef union { struct { DWORD LowPart; LONG HighPart; }; LONGLONG QuadPart; } LARGE_INTEGER;
+typedef struct { DWORD dwLowDateTime, dwHighDateTime; } FILETIME;
+typedef struct { DWORD dwFileAttributes; FILETIME ftCreationTime, ftLastAccessTime, ftLastWriteTime; DWORD nFileSizeHigh, nFileSizeLow, r0, r1; CHAR cFileName[260]; CHAR cAlternateFileName[14]; } WIN32_FIND_DATAA, WIN32_FIND_DATA;
+typedef struct { DWORD dwFileAttributes; FILETIME ftCreationTime, ftLastAccessTime, ftLastWriteTime; DWORD nFileSizeHigh, nFileSizeLow; } WIN32_FILE_ATTRIBUTE_DATA;
+typedef struct { void *a; LONG b; LONG c; HANDLE d; HANDLE e; ULONG_PTR f; } CRITICAL_SECTION, *LPCRITICAL_SECTION;
+typedef struct { PVOID BaseAddress, AllocationBase; DWORD AllocationProtect; SIZE_T RegionSize; DWORD State, Protect, Type; } MEMORY_BASIC_INFORMATION;
+typedef struct { WORD wFormatTag, nChannels; DWORD nSamplesPerSec, nAvgBytesPerSec; WORD nBlockAlign, wBitsPerSample, cbSize; } WAVEFORMATEX, *LPWAVEFORMATEX;
+typedef const WAVEFORMATEX *LPCWAVEFORMATEX;
+typedef struct wavehdr_tag { LPSTR lpData; DWORD dwBufferLength, dwBytesRecorded; DWORD_PTR dwUser; DWORD dwFlags, dwLoops; struct wavehdr_tag *lpNext; DWORD_PTR reserved; } WAVEHDR, *LPWAVEHDR, *PWAVEHDR;
+typedef struct midihdr_tag { LPSTR lpData; DWORD dwBufferLength, dwBytesRecorded; DWORD_PTR dwUser; DWORD dwFlags; struct midihdr_tag *lpNext; DWORD_PTR reserved; DWORD dwOffset; DWORD_PTR dwReserved[8]; } MIDIHDR, *LPMIDIHDR;
+typedef struct { DWORD dwDeltaTime, dwStreamID, dwEvent, dwParms[1]; } MIDIEVENT;
+typedef struct { UINT wType; union { DWORD ms, sample, cb, ticks; struct { BYTE hour, min, sec, frame, fps, dummy, pad[2]; } smpte; struct { DWORD songptrpos; } midi; } u; } MMTIME, *LPMMTIME;
+typedef struct { UINT wPeriodMin, wPeriodMax; } TIMECAPS, *LPTIMECAPS;
+typedef struct { WORD wMid, wPid; UINT vDriverVersion; CHAR szPname[32]; WORD wTechnology, wReserved1; DWORD dwSupport; } AUXCAPSA, AUXCAPS, *LPAUXCAPSA, *LPAUXCAPS;
+typedef struct { WORD wMid, wPid; UINT vDriverVersion; WCHAR szPname[32]; WORD wTechnology, wReserved1; DWORD dwSupport; } AUXCAPSW, *LPAUXCAPSW;
+typedef struct { WORD wMid; } WAVEOUTCAPSA, *LPWAVEOUTCAPSA, WAVEOUTCAPSW, *LPWAVEOUTCAPSW, WAVEINCAPSA, *LPWAVEINCAPSA, WAVEINCAPSW, *LPWAVEINCAPSW,
+	MIDIOUTCAPSA, *LPMIDIOUTCAPSA, MIDIOUTCAPSW, *LPMIDIOUTCAPSW, MIDIINCAPSA, *LPMIDIINCAPSA, MIDIINCAPSW, *LPMIDIINCAPSW,
+	MIXERCAPSA, *LPMIXERCAPSA, MIXERCAPSW, *LPMIXERCAPSW, MIXERLINEA, *LPMIXERLINEA, MIXERLINEW, *LPMIXERLINEW,
+	MIXERLINECONTROLSA, *LPMIXERLINECONTROLSA, MIXERLINECONTROLSW, *LPMIXERLINECONTROLSW, MIXERCONTROLDETAILS, *LPMIXERCONTROLDETAILS,
+	JOYCAPSA, *LPJOYCAPSA, JOYCAPSW, *LPJOYCAPSW;
+typedef struct { UINT wXpos, wYpos, wZpos, wButtons; } JOYINFO, *LPJOYINFO;
+typedef struct { DWORD dwSize, dwFlags, dwXpos, dwYpos, dwZpos, dwRpos, dwUpos, dwVpos, dwButtons, dwButtonNumber, dwPOV, dwReserved1, dwReserved2; } JOYINFOEX, *LPJOYINFOEX;
+typedef struct { DWORD dwFlags; FOURCC fccIOProc; LPMMIOPROC pIOProc; UINT wErrorRet; HTASK htask; LONG cchBuffer; HPSTR pchBuffer, pchNext, pchEndRead, pchEndWrite; LONG lBufOffset, lDiskOffset; DWORD adwInfo[3]; DWORD dwReserved1, dwReserved2; HMMIO hmmio; } MMIOINFO, *LPMMIOINFO;
+typedef const MMIOINFO *LPCMMIOINFO;
+typedef struct { FOURCC ckid; DWORD cksize; FOURCC fccType; DWORD dwDataOffset, dwFlags; } MMCKINFO, *LPMMCKINFO;
+typedef struct { DWORD_PTR dwCallback; MCIDEVICEID wDeviceID; LPCSTR lpstrDeviceType, lpstrElementName, lpstrAlias; } MCI_OPEN_PARMSA, MCI_OPEN_PARMS, *LPMCI_OPEN_PARMSA, *LPMCI_OPEN_PARMS;
+typedef struct { DWORD_PTR dwCallback; MCIDEVICEID wDeviceID; LPCWSTR lpstrDeviceType, lpstrElementName, lpstrAlias; } MCI_OPEN_PARMSW, *LPMCI_OPEN_PARMSW;
+typedef struct { DWORD_PTR dwCallback; DWORD dwFrom, dwTo; } MCI_PLAY_PARMS, *LPMCI_PLAY_PARMS;
+typedef struct { DWORD_PTR dwCallback; DWORD dwTo; } MCI_SEEK_PARMS, *LPMCI_SEEK_PARMS;
+typedef struct { DWORD_PTR dwCallback; DWORD dwTimeFormat, dwAudio; } MCI_SET_PARMS, *LPMCI_SET_PARMS;
+typedef struct { DWORD_PTR dwCallback; DWORD_PTR dwReturn; DWORD dwItem, dwTrack; } MCI_STATUS_PARMS, *LPMCI_STATUS_PARMS;
+typedef struct { DWORD_PTR dwCallback; LPSTR lpstrReturn; DWORD dwRetSize; } MCI_INFO_PARMSA, MCI_INFO_PARMS, *LPMCI_INFO_PARMSA, *LPMCI_INFO_PARMS;
+typedef struct { DWORD_PTR dwCallback; LPWSTR lpstrReturn; DWORD dwRetSize; } MCI_INFO_PARMSW, *LPMCI_INFO_PARMSW;
+typedef struct { DWORD_PTR dwCallback; DWORD dwReturn, dwItem; } MCI_GETDEVCAPS_PARMS, *LPMCI_GETDEVCAPS_PARMS;
+typedef struct { DWORD_PTR dwCallback; LPSTR lpstrReturn; DWORD dwRetSize, dwNumber; UINT wDeviceType; } MCI_SYSINFO_PARMSA, *LPMCI_SYSINFO_PARMSA;
+typedef struct { DWORD_PTR dwCallback; LPWSTR lpstrReturn; DWORD dwRetSize, dwNumber; UINT wDeviceType; } MCI_SYSINFO_PARMSW, *LPMCI_SYSINFO_PARMSW;
+typedef struct { DWORD_PTR dwCallback; } MCI_GENERIC_PARMS, *LPMCI_GENERIC_PARMS;
+typedef struct { DWORD_PTR dwCallback; DWORD dwItem, dwValue, dwOver; LPSTR lpstrAlgorithm, lpstrQuality; } MCI_DGV_SETAUDIO_PARMSA;
+typedef void (CALLBACK *LPDRVCALLBACK)(HANDLE, UINT, DWORD_PTR, DWORD_PTR, DWORD_PTR);
+typedef struct { void *a; void *b; } SLIST_HEADER;
+
+#define TRUE 1
+#define FALSE 0
+#define MAX_PATH 260
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define INVALID_HANDLE_VALUE ((HANDLE)(LONG_PTR)-1)
+#define INVALID_FILE_ATTRIBUTES ((DWORD)-1)
+#define FILE_ATTRIBUTE_DIRECTORY 0x10
+#define DLL_PROCESS_ATTACH 1
+#define DLL_PROCESS_DETACH 0
+#define LOWORD(l) ((WORD)((DWORD_PTR)(l) & 0xffff))
+#define HIWORD(l) ((WORD)((DWORD_PTR)(l) >> 16))
+#define MAKELONG(a,b) ((LONG)(((WORD)(a)) | ((DWORD)((WORD)(b))) << 16))
+#define THREAD_PRIORITY_TIME_CRITICAL 15
+#define THREAD_PRIORITY_HIGHEST 2
+#define CP_ACP 0
+#define GENERIC_READ 0x80000000
+#define FILE_SHARE_READ 1
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define PAGE_READONLY 2
+#define FILE_MAP_READ 4
+#define HEAP_ZERO_MEMORY 8
+#define MEM_COMMIT 0x1000
+#define MEM_RESERVE 0x2000
+#define MEM_RELEASE 0x8000
+#define PAGE_READWRITE 4
+#define GetFileExInfoStandard 0
+#define WM_USER 0x400
+#define RT_RCDATA ((LPCSTR)10)
+
+#define WAVE_MAPPER ((UINT)-1)
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_QUERY 1
+#define WHDR_DONE 1
+#define WHDR_PREPARED 2
+#define WHDR_BEGINLOOP 4
+#define WHDR_ENDLOOP 8
+#define WHDR_INQUEUE 16
+#define CALLBACK_TYPEMASK 0x00070000
+#define CALLBACK_NULL 0
+#define CALLBACK_WINDOW 0x00010000
+#define CALLBACK_TASK 0x00020000
+#define CALLBACK_THREAD CALLBACK_TASK
+#define CALLBACK_FUNCTION 0x00030000
+#define CALLBACK_EVENT 0x00050000
+#define WOM_OPEN 0x3BB
+#define WOM_CLOSE 0x3BC
+#define WOM_DONE 0x3BD
+#define MM_WOM_OPEN WOM_OPEN
+#define MM_WOM_CLOSE WOM_CLOSE
+#define MM_WOM_DONE WOM_DONE
+#define MMSYSERR_NOERROR 0
+#define WAVERR_STILLPLAYING 33
+#define MMSYSERR_ERROR 1
+#define MMSYSERR_BADDEVICEID 2
+#define MMSYSERR_INVALHANDLE 5
+#define MMSYSERR_NODRIVER 6
+#define MMSYSERR_NOMEM 7
+#define MMSYSERR_INVALPARAM 11
+#define MMSYSERR_NOTSUPPORTED 8
+#define JOYERR_NOERROR 0
+#define JOYERR_PARMS 165
+#define JOYERR_UNPLUGGED 167
+#define JOY_RETURNALL 0xFF
+#define TIMERR_NOERROR 0
+#define TIMERR_NOCANDO 97
+#define TIME_ONESHOT 0
+#define TIME_PERIODIC 1
+#define TIME_CALLBACK_FUNCTION 0
+#define TIME_CALLBACK_EVENT_SET 0x10
+#define TIME_CALLBACK_EVENT_PULSE 0x20
+#define TIME_KILL_SYNCHRONOUS 0x100
+#define MMIO_READ 0
+#define MMIO_WRITE 1
+#define MMIO_READWRITE 2
+#define MMIO_ALLOCBUF 0x10000
+#define MMIO_PARSE 0x100
+#define MMIO_EXIST 0x4000
+#define MMIO_GETTEMP 0x20000
+#define MMIO_DELETE 0x200
+#define MMIO_CREATE 0x1000
+#define MMIO_FINDCHUNK 0x10
+#define MMIO_FINDRIFF 0x20
+#define MMIO_FINDLIST 0x40
+#define MMIO_DIRTY 0x10000000
+#define MMIO_RWMODE 3
+#define MMIOERR_CHUNKNOTFOUND 265
+#define MMIOERR_CANNOTSEEK 267
+#define MMIOERR_CANNOTREAD 268
+#define SEEK_SET_ 0
+#define mmioFOURCC(a,b,c,d) ((DWORD)(BYTE)(a) | ((DWORD)(BYTE)(b) << 8) | ((DWORD)(BYTE)(c) << 16) | ((DWORD)(BYTE)(d) << 24))
+#define FOURCC_RIFF mmioFOURCC('R','I','F','F')
+#define FOURCC_LIST mmioFOURCC('L','I','S','T')
+#define FOURCC_DOS mmioFOURCC('D','O','S',' ')
+#define FOURCC_MEM mmioFOURCC('M','E','M',' ')
+#define SND_SYNC 0
+#define SND_ASYNC 1
+#define SND_NODEFAULT 2
+#define SND_MEMORY 4
+#define SND_LOOP 8
+#define SND_NOSTOP 0x10
+#define SND_NOWAIT 0x2000
+#define SND_ALIAS 0x10000
+#define SND_ALIAS_ID 0x110000
+#define SND_FILENAME 0x20000
+#define SND_RESOURCE 0x40004
+#define SND_PURGE 0x40
+#define SND_APPLICATION 0x80
+#define MEVT_F_LONG 0x80000000
+#define MEVT_SHORTMSG 0
+#define MEVT_EVENTTYPE(x) ((BYTE)(((x)>>24)&0xFF))
+#define MEVT_EVENTPARM(x) ((DWORD)((x)&0x00FFFFFF))
+#define MM_MCINOTIFY 0x3B9
+#define MCI_OPEN 0x803
+#define MCI_CLOSE 0x804
+#define MCI_PLAY 0x806
+#define MCI_SEEK 0x807
+#define MCI_STOP 0x808
+#define MCI_PAUSE 0x809
+#define MCI_INFO 0x80A
+#define MCI_GETDEVCAPS 0x80B
+#define MCI_SET 0x80D
+#define MCI_STATUS 0x814
+#define MCI_CUE 0x830
+#define MCI_SYSINFO 0x810
+#define MCI_BREAK 0x811
+#define MCI_RESUME 0x855
+#define MCI_DELETE 0x856
+#define MCI_NOTIFY 1
+#define MCI_WAIT 2
+#define MCI_FROM 4
+#define MCI_TO 8
+#define MCI_TRACK 0x10
+#define MCI_OPEN_SHAREABLE 0x100
+#define MCI_OPEN_ELEMENT 0x200
+#define MCI_OPEN_ALIAS 0x400
+#define MCI_OPEN_ELEMENT_ID 0x800
+#define MCI_OPEN_TYPE_ID 0x1000
+#define MCI_OPEN_TYPE 0x2000
+#define MCI_SEEK_TO_START 0x100
+#define MCI_SEEK_TO_END 0x200
+#define MCI_STATUS_ITEM 0x100
+#define MCI_STATUS_START 0x200
+#define MCI_STATUS_LENGTH 1
+#define MCI_STATUS_POSITION 2
+#define MCI_STATUS_NUMBER_OF_TRACKS 3
+#define MCI_STATUS_MODE 4
+#define MCI_STATUS_MEDIA_PRESENT 5
+#define MCI_STATUS_TIME_FORMAT 6
+#define MCI_STATUS_READY 7
+#define MCI_STATUS_CURRENT_TRACK 8
+#define MCI_CDA_STATUS_TYPE_TRACK 0x4001
+#define MCI_CDA_TRACK_AUDIO 1088
+#define MCI_CDA_TRACK_OTHER 1089
+#define MCI_INFO_PRODUCT 0x100
+#define MCI_INFO_FILE 0x200
+#define MCI_INFO_MEDIA_IDENTITY 0x800
+#define MCI_GETDEVCAPS_ITEM 0x100
+#define MCI_GETDEVCAPS_CAN_RECORD 1
+#define MCI_GETDEVCAPS_HAS_AUDIO 2
+#define MCI_GETDEVCAPS_HAS_VIDEO 3
+#define MCI_GETDEVCAPS_DEVICE_TYPE 4
+#define MCI_GETDEVCAPS_USES_FILES 5
+#define MCI_GETDEVCAPS_COMPOUND_DEVICE 6
+#define MCI_GETDEVCAPS_CAN_EJECT 7
+#define MCI_GETDEVCAPS_CAN_PLAY 8
+#define MCI_GETDEVCAPS_CAN_SAVE 9
+#define MCI_SET_DOOR_OPEN 0x100
+#define MCI_SET_DOOR_CLOSED 0x200
+#define MCI_SET_TIME_FORMAT 0x400
+#define MCI_SET_AUDIO 0x800
+#define MCI_SEQ_SET_TEMPO 0x10000
+#define MCI_SYSINFO_QUANTITY 0x100
+#define MCI_SYSINFO_OPEN 0x200
+#define MCI_SYSINFO_NAME 0x400
+#define MCI_MODE_NOT_READY 524
+#define MCI_MODE_STOP 525
+#define MCI_MODE_PLAY 526
+#define MCI_MODE_RECORD 527
+#define MCI_MODE_SEEK 528
+#define MCI_MODE_PAUSE 529
+#define MCI_MODE_OPEN 530
+#define MCI_FORMAT_MILLISECONDS 0
+#define MCI_FORMAT_HMS 1
+#define MCI_FORMAT_MSF 2
+#define MCI_FORMAT_FRAMES 3
+#define MCI_FORMAT_SMPTE_24 4
+#define MCI_FORMAT_BYTES 8
+#define MCI_FORMAT_SAMPLES 9
+#define MCI_FORMAT_TMSF 10
+#define MCI_DEVTYPE_CD_AUDIO 516
+#define MCI_DEVTYPE_WAVEFORM_AUDIO 522
+#define MCI_DEVTYPE_SEQUENCER 523
+#define MCI_NOTIFY_SUCCESSFUL 1
+#define MCI_NOTIFY_SUPERSEDED 2
+#define MCI_NOTIFY_ABORTED 4
+#define MCI_NOTIFY_FAILURE 8
+#define MCIERR_BASE 256
+#define MCIERR_INVALID_DEVICE_ID (MCIERR_BASE+1)
+#define MCIERR_UNRECOGNIZED_COMMAND (MCIERR_BASE+5)
+#define MCIERR_HARDWARE (MCIERR_BASE+6)
+#define MCIERR_INVALID_DEVICE_NAME (MCIERR_BASE+7)
+#define MCIERR_OUT_OF_MEMORY (MCIERR_BASE+8)
+#define MCIERR_DEVICE_OPEN (MCIERR_BASE+9)
+#define MCIERR_CANNOT_LOAD_DRIVER (MCIERR_BASE+10)
+#define MCIERR_DEVICE_NOT_READY (MCIERR_BASE+20)
+#define MCIERR_MISSING_COMMAND_STRING (MCIERR_BASE+11)
+#define MCIERR_PARAM_OVERFLOW (MCIERR_BASE+12)
+#define MCIERR_MISSING_STRING_ARGUMENT (MCIERR_BASE+13)
+#define MCIERR_BAD_INTEGER (MCIERR_BASE+14)
+#define MCIERR_UNSUPPORTED_FUNCTION (MCIERR_BASE+18)
+#define MCIERR_FILE_NOT_FOUND (MCIERR_BASE+19)
+#define MCIERR_OUTOFRANGE (MCIERR_BASE+26)
+#define MCIERR_UNRECOGNIZED_KEYWORD (MCIERR_BASE+3)
+#define MCIERR_MISSING_DEVICE_NAME (MCIERR_BASE+36)
+#define MCIERR_INVALID_FILE (MCIERR_BASE+40)
+#define MCIERR_MEDIA_NOT_READY (MCIERR_BASE+34)
+#define MCIERR_DUPLICATE_ALIAS (MCIERR_BASE+33)
+#define MCIERR_NO_WINDOW (MCIERR_BASE+90)
+#define MCIERR_CUSTOM_DRIVER_BASE (MCIERR_BASE+256)
+#define MCI_MAKE_MSF(m,s,f) ((DWORD)(((BYTE)(m) | ((WORD)(s)<<8)) | (((DWORD)(BYTE)(f))<<16)))
+#define MCI_MAKE_TMSF(t,m,s,f) ((DWORD)(((BYTE)(t) | ((WORD)(m)<<8)) | (((DWORD)(BYTE)(s) | ((WORD)(f)<<8))<<16)))
+#define MCI_MSF_MINUTE(msf) ((BYTE)(msf))
+#define MCI_MSF_SECOND(msf) ((BYTE)(((WORD)(msf)) >> 8))
+#define MCI_MSF_FRAME(msf) ((BYTE)((msf)>>16))
+#define MCI_TMSF_TRACK(t) ((BYTE)(t))
+#define MCI_TMSF_MINUTE(t) ((BYTE)(((WORD)(t)) >> 8))
+#define MCI_TMSF_SECOND(t) ((BYTE)((t)>>16))
+#define MCI_TMSF_FRAME(t) ((BYTE)((t)>>24))
+#define AUXCAPS_CDAUDIO 1
+#define AUXCAPS_VOLUME 1
+#define AUXCAPS_LRVOLUME 2
+#define MIDI_MAPPER ((UINT)-1)
+#define MOM_DONE 0x3C9
+
+#define DECL(ret, name, ...) ret name(__VA_ARGS__);
+DECL(HANDLE, CreateEvent, void*, BOOL, BOOL, LPCSTR)
+DECL(HANDLE, CreateEventA, void*, BOOL, BOOL, LPCSTR)
+DECL(BOOL, SetEvent, HANDLE) DECL(BOOL, ResetEvent, HANDLE) DECL(BOOL, PulseEvent, HANDLE)
+DECL(BOOL, CloseHandle, HANDLE)
+DECL(DWORD, WaitForSingleObject, HANDLE, DWORD)
+DECL(DWORD, WaitForMultipleObjects, DWORD, const HANDLE*, BOOL, DWORD)
+DECL(HANDLE, CreateThread, void*, SIZE_T, LPTHREAD_START_ROUTINE, LPVOID, DWORD, LPDWORD)
+DECL(BOOL, SetThreadPriority, HANDLE, int)
+DECL(void, Sleep, DWORD)
+DECL(DWORD, GetTickCount, void)
+DECL(BOOL, QueryPerformanceCounter, LARGE_INTEGER*) DECL(BOOL, QueryPerformanceFrequency, LARGE_INTEGER*)
+DECL(LONG, InterlockedIncrement, volatile LONG*) DECL(LONG, InterlockedDecrement, volatile LONG*)
+DECL(LONG, InterlockedExchange, volatile LONG*, LONG) DECL(LONG, InterlockedExchangeAdd, volatile LONG*, LONG)
+DECL(LONG, InterlockedCompareExchange, volatile LONG*, LONG, LONG)
+DECL(PVOID, InterlockedExchangePointer, PVOID volatile*, PVOID)
+DECL(PVOID, InterlockedCompareExchangePointer, PVOID volatile*, PVOID, PVOID)
+DECL(void, InitializeCriticalSection, LPCRITICAL_SECTION) DECL(void, DeleteCriticalSection, LPCRITICAL_SECTION)
+DECL(void, EnterCriticalSection, LPCRITICAL_SECTION) DECL(void, LeaveCriticalSection, LPCRITICAL_SECTION)
+DECL(BOOL, TryEnterCriticalSection, LPCRITICAL_SECTION)
+DECL(DWORD, GetModuleFileName, HMODULE, LPSTR, DWORD) DECL(DWORD, GetModuleFileNameA, HMODULE, LPSTR, DWORD)
+DECL(HMODULE, GetModuleHandle, LPCSTR) DECL(HMODULE, GetModuleHandleA, LPCSTR)
+DECL(DWORD, GetPrivateProfileString, LPCSTR, LPCSTR, LPCSTR, LPSTR, DWORD, LPCSTR)
+DECL(UINT, GetPrivateProfileInt, LPCSTR, LPCSTR, int, LPCSTR)
+DECL(DWORD, GetFileAttributes, LPCSTR) DECL(DWORD, GetFileAttributesA, LPCSTR)
+DECL(BOOL, GetFileAttributesEx, LPCSTR, int, LPVOID) DECL(BOOL, GetFileAttributesExA, LPCSTR, int, LPVOID)
+DECL(HANDLE, FindFirstFile, LPCSTR, WIN32_FIND_DATA*) DECL(BOOL, FindNextFile, HANDLE, WIN32_FIND_DATA*) DECL(BOOL, FindClose, HANDLE)
+DECL(HANDLE, CreateFile, LPCSTR, DWORD, DWORD, void*, DWORD, DWORD, HANDLE) DECL(HANDLE, CreateFileA, LPCSTR, DWORD, DWORD, void*, DWORD, DWORD, HANDLE)
+DECL(DWORD, GetFileSize, HANDLE, LPDWORD)
+DECL(HANDLE, CreateFileMapping, HANDLE, void*, DWORD, DWORD, DWORD, LPCSTR) DECL(HANDLE, CreateFileMappingA, HANDLE, void*, DWORD, DWORD, DWORD, LPCSTR)
+DECL(LPVOID, MapViewOfFile, HANDLE, DWORD, DWORD, DWORD, SIZE_T) DECL(BOOL, UnmapViewOfFile, LPCVOID)
+#define MCI_WAVE_STATUS_FORMATTAG 0x4001
+#define MCIERR_BAD_TIME_FORMAT 293
+#define MCI_WAVE_STATUS_CHANNELS 0x4002
+#define MCI_WAVE_STATUS_SAMPLESPERSEC 0x4003
+#define MCI_WAVE_STATUS_AVGBYTESPERSEC 0x4004
+#define MCI_WAVE_STATUS_BLOCKALIGN 0x4005
+#define MCI_WAVE_STATUS_BITSPERSAMPLE 0x4006
+#define MMIO_SHAREMODE 0x70
+#define MMIO_EXCLUSIVE 0x10
+#define MMIO_DENYWRITE 0x20
+#define MMIO_DENYREAD 0x30
+#define MMIO_DENYNONE 0x40
+#define MMIOERR_CANNOTWRITE 269
+#define MMIOERR_UNBUFFERED 272
+#define FILE_SHARE_WRITE 2
+#define INVALID_FILE_SIZE ((DWORD)0xFFFFFFFF)
+DECL(HANDLE, CreateFileW, LPCWSTR, DWORD, DWORD, void*, DWORD, DWORD, HANDLE)
+DECL(UINT, GetSystemDirectory, LPSTR, UINT)
+DECL(HMODULE, LoadLibrary, LPCSTR) DECL(BOOL, FreeLibrary, HMODULE)
+DECL(void*, GetProcAddress, HMODULE, LPCSTR)
+DECL(SIZE_T, VirtualQuery, LPCVOID, MEMORY_BASIC_INFORMATION*, SIZE_T)
+DECL(LPVOID, VirtualAlloc, LPVOID, SIZE_T, DWORD, DWORD) DECL(BOOL, VirtualFree, LPVOID, SIZE_T, DWORD)
+DECL(HANDLE, GetProcessHeap, void) DECL(LPVOID, HeapAlloc, HANDLE, DWORD, SIZE_T) DECL(BOOL, HeapFree, HANDLE, DWORD, LPVOID) DECL(LPVOID, HeapReAlloc, HANDLE, DWORD, LPVOID, SIZE_T)
+DECL(BOOL, PostMessage, HWND, UINT, WPARAM, LPARAM) DECL(BOOL, PostMessageA, HWND, UINT, WPARAM, LPARAM)
+DECL(BOOL, PostThreadMessage, DWORD, UINT, WPARAM, LPARAM) DECL(BOOL, PostThreadMessageA, DWORD, UINT, WPARAM, LPARAM)
+DECL(BOOL, SendNotifyMessageA, HWND, UINT, WPARAM, LPARAM)
+DECL(int, WideCharToMultiByte, UINT, DWORD, LPCWSTR, int, LPSTR, int, LPCSTR, BOOL*)
+DECL(BOOL, GetFileAttributesExW, LPCWSTR, int, LPVOID)
+DECL(DWORD, GetFullPathNameW, LPCWSTR, DWORD, LPWSTR, LPWSTR*)
+DECL(BOOL, ReadFile, HANDLE, LPVOID, DWORD, LPDWORD, void*)
+DECL(DWORD, GetFullPathNameA, LPCSTR, DWORD, LPSTR, LPSTR*) DECL(DWORD, GetFullPathName, LPCSTR, DWORD, LPSTR, LPSTR*)
+DECL(int, MultiByteToWideChar, UINT, DWORD, LPCSTR, int, LPWSTR, int)
+DECL(HRSRC, FindResourceA, HMODULE, LPCSTR, LPCSTR) DECL(HRSRC, FindResourceW, HMODULE, LPCWSTR, LPCWSTR)
+DECL(HGLOBAL, LoadResource, HMODULE, HRSRC) DECL(LPVOID, LockResource, HGLOBAL) DECL(DWORD, SizeofResource, HMODULE, HRSRC)
+DECL(DWORD, GetCurrentThreadId, void)
+DECL(void, OutputDebugStringA, LPCSTR) DECL(BOOL, IsDebuggerPresent, void) DECL(void, DebugBreak, void)
+DECL(MMRESULT, waveOutOpen, LPHWAVEOUT, UINT, LPCWAVEFORMATEX, DWORD_PTR, DWORD_PTR, DWORD)
+DECL(MMRESULT, waveOutClose, HWAVEOUT) DECL(MMRESULT, waveOutReset, HWAVEOUT) DECL(MMRESULT, waveOutPause, HWAVEOUT) DECL(MMRESULT, waveOutRestart, HWAVEOUT)
+DECL(MMRESULT, waveOutPrepareHeader, HWAVEOUT, LPWAVEHDR, UINT) DECL(MMRESULT, waveOutUnprepareHeader, HWAVEOUT, LPWAVEHDR, UINT)
+DECL(MMRESULT, waveOutWrite, HWAVEOUT, LPWAVEHDR, UINT)
+DECL(MMRESULT, waveOutGetPosition, HWAVEOUT, LPMMTIME, UINT)
+DECL(MMRESULT, midiOutShortMsg, HMIDIOUT, DWORD) DECL(MMRESULT, midiOutOpen, LPHMIDIOUT, UINT, DWORD_PTR, DWORD_PTR, DWORD)
+DECL(MMRESULT, midiOutClose, HMIDIOUT) DECL(MMRESULT, midiOutReset, HMIDIOUT)
+DECL(MMRESULT, timeBeginPeriod, UINT) DECL(MMRESULT, timeEndPeriod, UINT) DECL(DWORD, timeGetTime, void)
+#define TIME_MS 1
+#define TIME_SAMPLES 2
+#define TIME_BYTES 4
+#define DRIVE_UNKNOWN 0
+#define DRIVE_REMOVABLE 2
+#define DRIVE_FIXED 3
+#define DRIVE_REMOTE 4
+#define DRIVE_CDROM 5
+DECL(BOOL, GetVolumePathNameA, LPCSTR, LPSTR, DWORD) DECL(BOOL, GetVolumePathNameW, LPCWSTR, LPWSTR, DWORD)
+DECL(UINT, GetDriveTypeA, LPCSTR) DECL(UINT, GetDriveTypeW, LPCWSTR)
+
+/* Paths come with backslashes */
+FILE *host_fopen(const char *path, const char *mode);
+#define fopen host_fopen
+#endif
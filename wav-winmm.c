@@ -16,12 +16,21 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <stdbool.h>
 #include "player.h"
 #include "stub.h"
+#include "sequencer.h"
 
 #define MAGIC_DEVICEID 0xCDDA
 #define MEDIA_IDENTITY "CDDA7777CDDA7777"
 #define MAX_TRACKS 99
+#define MAX_DISCS 8 // DiscN folders under the music folder, each one a disc of its own
+#define SCAN_WORKERS 4
+#define MAX_DEVICES 4 // cdaudio devices open at once, each plays its own stream
+#define WAVE_DEVICES 4 // waveaudio files open at once, closed ones stay ready for the next open of the same file
+#define SEQ_DEVICES 2 // sequencer files open at once, they share the one MIDI output
+#define ALL_DEVICES (MAX_DEVICES + WAVE_DEVICES + SEQ_DEVICES)
 
 //#define _DEBUG
 
@@ -32,12 +41,27 @@ FILE *fh = NULL;
 #define dprintf(...)
 #endif
 
+/* Call trace capture, one line per call: "<usec> <thread> <kind> ...", see trace_esc for the string fields */
+#define tprintf(...) do { if (ft) { EnterCriticalSection(&trace_cs); fprintf(ft, __VA_ARGS__); LeaveCriticalSection(&trace_cs); } } while (0)
+FILE *ft = NULL;
+CRITICAL_SECTION trace_cs;
+unsigned int trace_t0 = 0;
+
 struct track_info
 {
 	char path[MAX_PATH];    /* full path to WAV */
 	unsigned int position;  /* milliseconds */
 	unsigned int length;    /* milliseconds */
-	DWORD tick;           /* clock tick at play start */
+};
+
+/* An indexed disc: its TOC is built once at startup, loading it into the drive only switches pointers */
+struct disc_info
+{
+	struct track_info tracks[MAX_TRACKS+1]; // Track 0 is reserved.
+	int first;
+	int last;
+	int num;
+	char identity[17];      /* MCI_INFO_MEDIA_IDENTITY, 16 hexadecimal digits */
 };
 
 struct play_info
@@ -48,84 +72,732 @@ struct play_info
 	unsigned int to; /* milliseconds; 0 track beginning, -1: track end */
 };
 
-struct track_info tracks[MAX_TRACKS+1]; // Track 0 is reserved.
-struct play_info info = {0};
+/* An opened cdaudio, waveaudio or sequencer device. Device 0 also answers commands sent without opening. */
+struct device_info
+{
+	MCIDEVICEID id;         /* MAGIC_DEVICEID + slot */
+	bool open;
+	char alias[100];
+	struct player *plr;
+	HANDLE thread;
+	HANDLE event;
+	HWND window;
+	struct play_info info;
+	struct play_info range; /* normalized info being played, guarded by play_cs */
+	int loop;               /* gapless loop state, guarded by play_cs. 1: range start queued behind its end; 2: end played, waiting for the re-PLAY */
+	int mode;
+	int command;
+	int notify;
+	bool notify_set;        /* MCI_NOTIFY_SUCCESSFUL scheduled for notify_due, guarded by play_cs */
+	DWORD notify_due;
+	bool notify_held;       /* taken off the dispatcher by PAUSE, due notify_left after RESUME, guarded by play_cs */
+	DWORD notify_left;
+	HWND notify_wnd;
+	int current;
+	DWORD tick;             /* clock tick at play start of the current track */
+	int time_format;
+	bool wave;              /* waveaudio device, plays info.from..info.to milliseconds of file */
+	bool seq;               /* sequencer device, plays song from the in-process sequencer */
+	struct seq_song *song;
+	char file[MAX_PATH];
+	WAVEFORMATEX fmt;
+	unsigned int length;    /* milliseconds */
+	unsigned int position;  /* milliseconds, where PLAY without FROM starts */
+	DWORD paused;           /* clock tick of the pause */
+	DWORD used;             /* LRU stamp of a closed waveaudio device, guarded by play_cs */
+	CRITICAL_SECTION cs;    /* one caller at a time changes the device, status reads never wait on it */
+};
+
+struct disc_info discs[MAX_DISCS];
+struct track_info *tracks = discs[0].tracks; // TOC of the disc in the drive
+struct device_info devices[ALL_DEVICES];
+CRITICAL_SECTION play_cs;
 
 DWORD thread = 0; // Needed for Win95/98 compatibility
-HANDLE player = NULL;
-HANDLE event = NULL;
-HWND window = NULL;
+HANDLE scan_ev = NULL;
+volatile bool scanned = false;
+DWORD wave_stamp = 0;
+volatile LONG scan_next = 0;
+LONG scan_cnt = 0;
+struct track_info *scan_list[MAX_DISCS*MAX_TRACKS];
 const char alias_def[] = "cdaudio";
-char alias_s[100] = "cdaudio";
 char path[MAX_PATH];
 char cddaPath[MAX_PATH];
+char statsName[MAX_PATH];
+char statsPath[MAX_PATH];
+char traceName[MAX_PATH];
+char renderName[MAX_PATH];
 
-int mode = MCI_MODE_STOP;
-int command = 0;
-int notify = 0;
-int current  = 0;
+HANDLE notify_ev = NULL;
+volatile bool notify_quit = false;
 int firstTrack = 0;
 int lastTrack = 0;
 int numTracks = 0;
-int time_format = MCI_FORMAT_MSF;
+int numDiscs = 0;
+int discLoaded = 0; // disc in the drive, firstTrack..numTracks and tracks describe it
+volatile bool doorOpen = false;
+DWORD doorTick = 0;
 
 DWORD auxVol = -1; // HWORD: Right, LWORD: Left
 int cddaVol = 100;
 int midiVol = 100;
 int waveVol = 100;
+int headCache = 0; // milliseconds of every track kept resident
+int discCache = 0; // megabytes of whole tracks kept resident
+int gaplessLoop = 0; // milliseconds of a notified range's start queued behind its end until it is played again
+int timerEngine = 0; // serve timeSetEvent from our own timer thread
+int mmioMapping = 0; // serve read-only mmio files from a mapped view
+int soundCache = 0; // kilobytes of PlaySound WAV images kept resident
+int joyProbe = 0; // milliseconds a missing joystick is not asked for again
+int waveAudio = 0; // play waveaudio files in-process instead of through the system MCI
+int midiSequencer = 0; // play sequencer files in-process instead of through the system MCI
+int depthMin = 200; // bounds of the adaptive buffer depth in milliseconds
+int depthMax = 0;
+int driverCheck = 0; // count MCI calls passed on and whether the system CD audio driver got loaded
+int discStart = 1; // disc in the drive when the game starts
+int discSwap = 0; // milliseconds after the door opens that it closes by itself with the next disc
+
+#define MCI_RELAY ((MCIERROR)-1) // mci_string: not ours, pass the command on as the caller got it
+#define MCI_RET_MAX 1024 // longest answer of our handlers, "status cdaudio stats" with every counter on
+
+DWORD WINAPI scan_main(void *unused)
+{
+	for (LONG i; (i = InterlockedIncrement(&scan_next) - 1) < scan_cnt; ) {
+		struct track_info *t = scan_list[i];
+		t->length = headCache ? plr_head_load(i, t->path) : plr_length(t->path);
+	}
+	return 0;
+}
+
+/* List the Track*.wav files of one disc folder for the worker pool, returns how many */
+static int scan_list_disc(struct disc_info *d, const char *folder)
+{
+	char pattern[MAX_PATH];
+	WIN32_FIND_DATA fd;
+	int n, listed = scan_cnt;
+
+	/* Tracks whose path does not fit are not listed */
+	HANDLE hf = snprintf(pattern, MAX_PATH, "%s\\Track*.wav", folder) < MAX_PATH ? FindFirstFile(pattern, &fd) : INVALID_HANDLE_VALUE;
+	if (hf != INVALID_HANDLE_VALUE) {
+		do {
+			char tail[8];
+			if (strlen(fd.cFileName) == 11 && sscanf(fd.cFileName+5, "%2d%7s", &n, tail) == 2 &&
+			    isdigit(fd.cFileName[5]) && isdigit(fd.cFileName[6]) && stricmp(tail, ".wav") == 0 &&
+			    n >= 1 && n <= MAX_TRACKS && !d->tracks[n].path[0]) {
+				if (snprintf(d->tracks[n].path, MAX_PATH, "%s\\Track%02d.wav", folder, n) < MAX_PATH) scan_list[scan_cnt++] = &d->tracks[n];
+				else d->tracks[n].path[0] = '\0';
+			}
+		} while (FindNextFile(hf, &fd));
+		FindClose(hf);
+	}
+	return scan_cnt - listed;
+}
+
+/* Lay out the TOC of a scanned disc, same contiguity rules as probing Track01..Track99 one by one */
+static void scan_toc(struct disc_info *d)
+{
+	unsigned int position = 0;
+	for (int i = 1; i <= MAX_TRACKS; i++) {
+		d->tracks[i].position = position;
+
+		if (d->tracks[i].length) {
+			dprintf("Track %02u: %02u:%02u:%03u @ %u ms\n", i, d->tracks[i].length / 60000, d->tracks[i].length / 1000 % 60, d->tracks[i].length % 1000, d->tracks[i].position);
+			if (!d->first) d->first = i;
+			d->last = i;
+			d->num++;
+			position += d->tracks[i].length;
+		} else {
+			d->tracks[i].path[0] = '\0';
+		}
+
+		if (d->num && !d->tracks[i].length) {
+			while (++i <= MAX_TRACKS) {
+				d->tracks[i].path[0] = '\0';
+				d->tracks[i].position = 0;
+				d->tracks[i].length = 0;
+			}
+		}
+	}
+}
+
+/* Put an indexed disc in the drive, nothing is read from disk */
+static void disc_load(int n)
+{
+	EnterCriticalSection(&play_cs);
+	discLoaded = n;
+	tracks = discs[n].tracks;
+	firstTrack = discs[n].first;
+	lastTrack = discs[n].last;
+	numTracks = discs[n].num;
+	LeaveCriticalSection(&play_cs);
+	dprintf("Disc %d loaded, %s\n", n + 1, discs[n].identity);
+}
+
+/* Index the music folder, or each of its DiscN folders, with one directory listing and parse the headers on a small worker pool */
+void scan_tracks()
+{
+	static char folders[MAX_DISCS][MAX_PATH];
+	char pattern[MAX_PATH];
+	WIN32_FIND_DATA fd;
+	HANDLE workers[SCAN_WORKERS];
+	DWORD id;
+	int n, cnt = 0;
+
+	memset(discs, 0, sizeof(discs));
+	memset(folders, 0, sizeof(folders));
+
+	/* Multi-disc games keep a folder per disc, e.g. Music\Disc1 and Music\Disc2 */
+	HANDLE hf = INVALID_HANDLE_VALUE;
+	if (snprintf(pattern, MAX_PATH, "%s\\Disc*", path) < MAX_PATH) hf = FindFirstFile(pattern, &fd);
+	if (hf != INVALID_HANDLE_VALUE) {
+		do {
+			char tail;
+			if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && sscanf(fd.cFileName+4, "%d%c", &n, &tail) == 1 &&
+			    n >= 1 && n <= MAX_DISCS) {
+				/* Disc1 and Disc01 are the same disc, the first one listed is used */
+				if (folders[n-1][0]) {
+					dprintf("Disc folder %s ignored, %s is disc %d already\n", fd.cFileName, folders[n-1], n);
+					continue;
+				}
+				/* A path cut short is no folder */
+				if (snprintf(folders[n-1], MAX_PATH, "%s\\%s", path, fd.cFileName) >= MAX_PATH) folders[n-1][0] = '\0';
+			}
+		} while (FindNextFile(hf, &fd));
+		FindClose(hf);
+	}
+	/* Folders without tracks are left out, the rest are discs in folder order. Without any, the tracks are in the folder itself. */
+	for (n = 0; n < MAX_DISCS; n++) {
+		if (folders[n][0] && scan_list_disc(&discs[numDiscs], folders[n])) numDiscs++;
+	}
+	bool split = numDiscs > 0;
+	if (!split && scan_list_disc(&discs[0], path)) numDiscs++;
+
+	if (headCache) plr_head_init(headCache, scan_cnt);
+	for (n = cnt = 0; n < SCAN_WORKERS && n < scan_cnt; n++) {
+		workers[cnt] = CreateThread(NULL, 0, scan_main, NULL, 0, &id);
+		if (workers[cnt]) cnt++;
+	}
+	scan_main(NULL);
+	if (cnt) WaitForMultipleObjects(cnt, workers, TRUE, INFINITE);
+	while (cnt) CloseHandle(workers[--cnt]);
+
+	for (n = 0; n < numDiscs; n++) {
+		struct disc_info *d = &discs[n];
+		scan_toc(d);
+		if (!split) {
+			strcpy(d->identity, MEDIA_IDENTITY);
+		} else {
+			/* A disc folder answers with an identity of its own, derived from its TOC like a pressed disc's */
+			DWORD h = n + 1;
+			for (int i = d->first; i <= d->last; i++) h = h * 31 + d->tracks[i].length;
+			snprintf(d->identity, sizeof(d->identity), "%08X%08X", d->tracks[d->last].position + d->tracks[d->last].length, h);
+		}
+		dprintf("Disc %d: %d tracks, %s\n", n + 1, d->num, d->identity);
+	}
+	if (numDiscs) disc_load(discStart >= 1 && discStart <= numDiscs ? discStart - 1 : 0);
+	dprintf("Emulating total of %d CD tracks.\n", numTracks);
+}
+
+/* Commands need the track list, block until the player thread has scanned it */
+static void scan_wait()
+{
+	if (!scanned && scan_ev) {
+		WaitForSingleObject(scan_ev, INFINITE);
+	}
+}
+
+/* Clamp the device's info to the emulated tracks and convert it to an inclusive [first,from]..[last,to] range */
+static void play_range(struct device_info *dev, struct play_info *r)
+{
+	r->first = dev->info.first < firstTrack ? firstTrack : dev->info.first;
+	r->last = dev->info.last > lastTrack+1 ? lastTrack+1 : dev->info.last;
+	r->from = dev->info.from;
+	r->to = dev->info.to;
+	if (r->from == -1) {r->first++; r->from = 0;}
+	if (!r->to) {r->last--; r->to = -1;} // Convert [,) to [,]
+}
+
+/* Notify dispatcher: sends MCI_NOTIFY_SUCCESSFUL when the last sample of a range plays, off the player threads */
+DWORD WINAPI notify_main(void *unused)
+{
+	while (!notify_quit) {
+		DWORD wait = INFINITE;
+		HWND wnd = NULL;
+		MCIDEVICEID id = 0;
+		EnterCriticalSection(&play_cs);
+		for (int i = 0; i < ALL_DEVICES && !id; i++) {
+			struct device_info *dev = &devices[i];
+			if (!dev->notify_set) continue;
+			int left = (int)(dev->notify_due - plr_clock(dev->plr));
+			if (left <= 0) {
+				dev->notify_set = false;
+				wnd = dev->notify_wnd;
+				id = dev->id;
+			} else if (left < wait) {
+				wait = left;
+			}
+		}
+		LeaveCriticalSection(&play_cs);
+
+		if (id) {
+			SendNotifyMessageA(wnd, MM_MCINOTIFY, MCI_NOTIFY_SUCCESSFUL, id);
+			dprintf("[Notify] Send MCI_NOTIFY_SUCCESSFUL message\n");
+		} else if (wait != INFINITE) {
+			timeBeginPeriod(1); // Default timer resolution is coarser than a CD frame
+			WaitForSingleObject(notify_ev, wait);
+			timeEndPeriod(1);
+		} else {
+			WaitForSingleObject(notify_ev, INFINITE);
+		}
+	}
+	return 0;
+}
 
-DWORD WINAPI player_main(void *unused)
+/* PAUSE stops the range from running out, keep how much of it is left until RESUME. Call under play_cs. */
+static void notify_hold(struct device_info *dev)
 {
-	while (WaitForSingleObject(event, INFINITE) == 0) {
-		int first = info.first < firstTrack ? firstTrack : info.first;
-		int last = info.last > lastTrack+1 ? lastTrack+1 : info.last;
-		unsigned int from = info.from, to = info.to;
-		if (from == -1) {first++; from = 0;}
-		if (!to) {last--; to = -1;} // Convert [,) to [,]
-		current = first;
-		dprintf("[Thread] From %d (%d ms) to %d (%d ms)\n", first, from, last, to);
+	if (!dev->notify_set) return;
+	int left = (int)(dev->notify_due - plr_clock(dev->plr));
+	dev->notify_set = false;
+	dev->notify_held = true;
+	dev->notify_left = left > 0 ? left : 0;
+}
+
+/* RESUME: the held notify is due when the rest of the range has played. Call under play_cs. */
+static void notify_release(struct device_info *dev)
+{
+	if (!dev->notify_held) return;
+	dev->notify_held = false;
+	dev->notify_set = true;
+	dev->notify_due = plr_clock(dev->plr) + dev->notify_left;
+	SetEvent(notify_ev);
+}
+
+/* Hand the device's pending notify request to the dispatcher, due at the given plr_clock tick */
+static void notify_post(struct device_info *dev, DWORD due)
+{
+	EnterCriticalSection(&play_cs);
+	bool post = dev->notify && notify_ev;
+	if (post) {
+		dev->notify = 0;
+		dev->notify_set = true;
+		dev->notify_due = due;
+		dev->notify_wnd = dev->window;
+		if (dev->mode == MCI_MODE_PAUSE) notify_hold(dev); /* the range ran out of buffers to submit while paused */
+	}
+	LeaveCriticalSection(&play_cs);
+
+	if (post) {
+		SetEvent(notify_ev);
+	} else if (dev->notify) {
+		dev->notify = 0;
+		SendNotifyMessageA(dev->window, MM_MCINOTIFY, MCI_NOTIFY_SUCCESSFUL, dev->id);
+		dprintf("[Thread] Send MCI_NOTIFY_SUCCESSFUL message\n");
+	}
+}
+
+/* Drop a scheduled notify whose range was stopped or superseded */
+static void notify_cancel(struct device_info *dev)
+{
+	EnterCriticalSection(&play_cs);
+	dev->notify_set = false;
+	dev->notify_held = false;
+	LeaveCriticalSection(&play_cs);
+}
+
+/* The drive door: opening it stops every cdaudio device like an eject does, closing it loads the next indexed disc */
+static void disc_door(bool open)
+{
+	if (open) {
+		for (int i = 0; i < MAX_DEVICES; i++) {
+			struct device_info *dev = &devices[i];
+			if (!dev->plr) continue;
+			dev->command = MCI_STOP;
+			plr_stop(dev->plr);
+			notify_cancel(dev);
+		}
+		EnterCriticalSection(&play_cs);
+		if (!doorOpen) doorTick = GetTickCount();
+		doorOpen = true;
+		LeaveCriticalSection(&play_cs);
+		return;
+	}
+
+	EnterCriticalSection(&play_cs);
+	if (doorOpen && numDiscs) disc_load((discLoaded + 1) % numDiscs);
+	doorOpen = false;
+	LeaveCriticalSection(&play_cs);
+}
+
+/* Whether the drive has no disc, DiscSwap closes the door by itself once the player had time to change discs */
+static bool disc_out(void)
+{
+	if (doorOpen && discSwap && GetTickCount() - doorTick >= (DWORD)discSwap) disc_door(false);
+	return doorOpen;
+}
+
+/* Disc cache prefetch order: the disc from the given track on, then the tracks before it */
+static void cache_prefetch(int first)
+{
+	const char *want[MAX_TRACKS];
+	int n = 0;
+	if (first < firstTrack || first > lastTrack) first = firstTrack;
+	for (int i = first; i <= lastTrack; i++) want[n++] = tracks[i].path;
+	for (int i = firstTrack; i < first; i++) want[n++] = tracks[i].path;
+	plr_cache_prefetch(want, n);
+}
+
+/* Start the notify dispatcher, once for all devices */
+static void notify_start(void)
+{
+	EnterCriticalSection(&play_cs);
+	if (!notify_ev && (notify_ev = CreateEvent(NULL, 0, 0, NULL))) {
+		DWORD id;
+		HANDLE th = CreateThread(NULL, 0, notify_main, NULL, 0, &id);
+		if (th) {
+			CloseHandle(th);
+		} else {
+			CloseHandle(notify_ev);
+			notify_ev = NULL;
+		}
+	}
+	LeaveCriticalSection(&play_cs);
+}
+
+/* Player thread of a device, the one of device 0 also scans the disc and starts the shared helpers */
+DWORD WINAPI player_main(void *arg)
+{
+	struct device_info *dev = arg;
+
+	if (dev == devices) {
+		scan_tracks();
+		if (!numTracks) {
+			CloseHandle(dev->event);
+			dev->event = NULL;
+		}
+		scanned = true;
+		SetEvent(scan_ev);
+		if (!dev->event) return 0;
+
+		if (discCache) {
+			plr_cache_init(discCache);
+			cache_prefetch(firstTrack);
+		}
+
+		notify_start();
+	}
+
+	while (WaitForSingleObject(dev->event, INFINITE) == 0) {
+		EnterCriticalSection(&play_cs);
+		play_range(dev, &dev->range);
+		dev->current = dev->range.first;
+		LeaveCriticalSection(&play_cs);
+		dprintf("[Thread] %s: From %d (%d ms) to %d (%d ms)\n", dev->alias, dev->range.first, dev->range.from, dev->range.last, dev->range.to);
+		if (discCache && dev->command == MCI_PLAY) cache_prefetch(dev->range.first);
+
+		bool posted = false; // the end of the range was handed to the dispatcher
+		while (dev->command == MCI_PLAY) {
+			/* range may be retargeted by PLAY FROM while the current track plays */
+			EnterCriticalSection(&play_cs);
+			int current = dev->current;
+			int last = dev->range.last;
+			unsigned int from = current == dev->range.first ? dev->range.from : 0;
+			unsigned int to = current == dev->range.last ? dev->range.to : -1;
+			if (current <= last) dev->tick = plr_clock(dev->plr) - from;
+			if (current <= last && dev->mode != MCI_MODE_PAUSE) dev->mode = MCI_MODE_PLAY;
+			LeaveCriticalSection(&play_cs);
+			if (current > last) break;
 
-		while (command == MCI_PLAY && current <= last) {
 			dprintf("[Thread] Current track %s\n", tracks[current].path);
-			tracks[current].tick = GetTickCount();
-			mode = MCI_MODE_PLAY;
-			plr_play(tracks[current].path, current == first ? from : 0, current == last ? to : -1);
+#ifdef _DEBUG
+			if (discCache) {
+				char stats[512];
+				plr_stats(stats, sizeof(stats), FALSE);
+				dprintf("[Thread] %s\n", stats);
+			}
+#endif
+			if (!plr_play(dev->plr, tracks[current].path, from, to)) {
+				dev->current++; // Skip unreadable track instead of retrying it forever
+				continue;
+			}
+			/* A PAUSE taken before the track was open had no device to pause yet */
+			EnterCriticalSection(&play_cs);
+			if (dev->mode == MCI_MODE_PAUSE) plr_pause(dev->plr);
+			LeaveCriticalSection(&play_cs);
 
-			while (command == MCI_PLAY) {
-				int more = plr_pump();
+			while (dev->command == MCI_PLAY) {
+				int more = plr_pump(dev->plr);
 				if (more == 0) {
-					current++;
+					/* Games loop music by replaying the range on notify, keep the device fed with its start meanwhile */
+					EnterCriticalSection(&play_cs);
+					bool again = gaplessLoop && dev->notify && dev->range.first == dev->range.last && dev->current == dev->range.last;
+					if (again) {
+						dev->loop = 1;
+						plr_loop(dev->plr, dev->range.from, dev->range.to, gaplessLoop);
+					} else if (dev->loop == 2) {
+						dprintf("[Thread] Loop not replayed, stopping\n");
+					}
+					LeaveCriticalSection(&play_cs);
+					if (again) continue;
+					/* The range ends with the last submitted sample, the dispatcher sends the notify when it plays */
+					if (dev->current == last) {
+						notify_post(dev, plr_clock(dev->plr) + plr_remaining(dev->plr));
+						posted = true;
+					}
+					dev->current++;
 					break;
+				} else if (more == 2) {
+					/* End of the range is audible, the start is already playing behind it */
+					EnterCriticalSection(&play_cs);
+					dev->tick = plr_clock(dev->plr) - dev->range.from;
+					dev->loop = 2;
+					LeaveCriticalSection(&play_cs);
+					notify_post(dev, plr_clock(dev->plr));
+					posted = true;
 				} else if (more < 0) {
 					break;
 				}
 			}
 
-			plr_reset(command == MCI_PLAY);
+			EnterCriticalSection(&play_cs);
+			dev->loop = 0;
+			LeaveCriticalSection(&play_cs);
+			plr_reset(dev->plr, dev->command == MCI_PLAY);
 		}
 
-		/* Sending notify successful message:*/
-		if (command == MCI_PLAY && notify) {
-			notify = 0;
-			SendNotifyMessageA(window, MM_MCINOTIFY, MCI_NOTIFY_SUCCESSFUL, MAGIC_DEVICEID);
-			dprintf("[Thread] Send MCI_NOTIFY_SUCCESSFUL message\n");
+		/* Sending notify successful message if the range ended without audio, e.g. unreadable tracks. Once the end was
+		   posted, a notify request here is the next PLAY's, stopping this thread to replay the range. */
+		if (dev->command == MCI_PLAY && dev->notify && !posted) notify_post(dev, plr_clock(dev->plr));
+
+		/* A PAUSE racing the end of the range must not leave the device paused with no thread behind it */
+		EnterCriticalSection(&play_cs);
+		dev->mode = MCI_MODE_STOP;
+		LeaveCriticalSection(&play_cs);
+		if (dev->command == MCI_DELETE) break;
+	}
+
+	CloseHandle(dev->event);
+	dev->event = NULL;
+	return 0;
+}
+
+/* Position of a waveaudio device in milliseconds */
+static unsigned int wave_position(struct device_info *dev)
+{
+	unsigned int end = dev->info.to == -1 ? dev->length : dev->info.to;
+	unsigned int ms;
+	if (dev->mode == MCI_MODE_PLAY) ms = plr_clock(dev->plr) - dev->tick;
+	else if (dev->mode == MCI_MODE_PAUSE) ms = dev->paused - dev->tick;
+	else return dev->position;
+	return ms < dev->info.from ? dev->info.from : ms > end ? end : ms;
+}
+
+/* Player thread of a waveaudio device, one range of its file per PLAY */
+DWORD WINAPI wave_main(void *arg)
+{
+	struct device_info *dev = arg;
+
+	notify_start();
+	while (WaitForSingleObject(dev->event, INFINITE) == 0) {
+		if (dev->command == MCI_PLAY) {
+			dprintf("[Wave] %s: From %u ms to %d ms\n", dev->alias, dev->info.from, dev->info.to);
+			if (plr_play(dev->plr, dev->file, dev->info.from, dev->info.to)) {
+				int more = -1;
+				/* A PAUSE taken before the file was open had no device to pause yet */
+				EnterCriticalSection(&play_cs);
+				dev->tick = plr_clock(dev->plr) - dev->info.from;
+				if (dev->mode == MCI_MODE_PAUSE) {
+					dev->paused = plr_clock(dev->plr);
+					plr_pause(dev->plr);
+				}
+				LeaveCriticalSection(&play_cs);
+				while (dev->command == MCI_PLAY && (more = plr_pump(dev->plr)) > 0);
+				bool done = dev->command == MCI_PLAY && more == 0;
+				if (done) notify_post(dev, plr_clock(dev->plr) + plr_remaining(dev->plr));
+				dev->position = done ? (dev->info.to == -1 ? dev->length : dev->info.to) : wave_position(dev);
+				plr_reset(dev->plr, done);
+			} else if (dev->notify) {
+				notify_post(dev, plr_clock(dev->plr));
+			}
 		}
 
-		mode = MCI_MODE_STOP;
-		if (command == MCI_DELETE) break;
+		EnterCriticalSection(&play_cs);
+		dev->mode = MCI_MODE_STOP;
+		LeaveCriticalSection(&play_cs);
+		if (dev->command == MCI_DELETE) break;
 	}
-	
-	CloseHandle(event);
-	event = NULL;
+
+	CloseHandle(dev->event);
+	dev->event = NULL;
 	return 0;
 }
 
+/* The device an MCI id addresses, device 0 also takes the ids games use without opening it */
+static struct device_info *device_get(MCIDEVICEID id)
+{
+	if (id == MAGIC_DEVICEID || id == 0 || id == 0xFFFFFFFF) return &devices[0];
+	if (id > MAGIC_DEVICEID && id < MAGIC_DEVICEID + ALL_DEVICES && devices[id - MAGIC_DEVICEID].open) return &devices[id - MAGIC_DEVICEID];
+	return NULL;
+}
+
+/* Open cdaudio under an alias: the device already using it, else device 0 unless another alias holds it, else a new device */
+static struct device_info *device_open(const char *alias)
+{
+	struct device_info *dev = NULL;
+	if (!alias || !alias[0]) return &devices[0];
+
+	EnterCriticalSection(&play_cs);
+	for (int i = 0; i < MAX_DEVICES && !dev; i++) {
+		if (devices[i].open && stricmp(devices[i].alias, alias) == 0) dev = &devices[i];
+	}
+	if (!dev && stricmp(devices[0].alias, alias_def) == 0) {
+		dev = &devices[0];
+		snprintf(dev->alias, sizeof(dev->alias), "%s", alias);
+	}
+	for (int i = 1; i < MAX_DEVICES && !dev; i++) {
+		if (devices[i].open) continue;
+		/* The stream and thread of a closed device are kept for the next open */
+		if (!devices[i].plr) devices[i].plr = plr_new();
+		if (!devices[i].plr) break;
+		dev = &devices[i];
+		dev->open = true;
+		snprintf(dev->alias, sizeof(dev->alias), "%s", alias);
+		memset(&dev->info, 0, sizeof(dev->info));
+		dev->loop = 0;
+		dev->command = 0;
+		dev->notify = 0;
+		dev->current = 0;
+		dev->time_format = MCI_FORMAT_MSF;
+	}
+	if (dev && numDiscs && !dev->thread) {
+		DWORD id;
+		dev->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		dev->thread = CreateThread(NULL, 0, player_main, dev, 0, &id);
+		dprintf("Creating thread 0x%X for %s\n", dev->thread, dev->alias);
+	}
+	LeaveCriticalSection(&play_cs);
+	return dev;
+}
+
+/* The open device whose alias follows verb in a command string, e.g. "play cd1 from 2" */
+static struct device_info *device_find(const char *cmdbuf, const char *verb)
+{
+	char cmp_str[128];
+	for (int i = 0; i < MAX_DEVICES; i++) {
+		if (!devices[i].open) continue;
+		int n = snprintf(cmp_str, sizeof(cmp_str), "%s %s", verb, devices[i].alias);
+		const char *s = strstr(cmdbuf, cmp_str);
+		if (s && (s[n] == '\0' || s[n] == ' ')) return &devices[i];
+	}
+	/* "cdaudio" stays device 0 after it got an alias, as MAGIC_DEVICEID does */
+	int n = snprintf(cmp_str, sizeof(cmp_str), "%s %s", verb, alias_def);
+	const char *s = strstr(cmdbuf, cmp_str);
+	if (s && (s[n] == '\0' || s[n] == ' ' || s[n] == '!')) return &devices[0];
+	return NULL;
+}
+
+/* Names the system MCI would resolve to its CD audio driver: "cdaudio", "cdaudio!d:" or a drive like "d:" */
+static bool cd_name(const char *name)
+{
+	if (!name) return false;
+	if (strnicmp(name, alias_def, 7) == 0 && (name[7] == '\0' || name[7] == '!')) return true;
+	return isalpha((unsigned char)name[0]) && name[1] == ':' && (name[2] == '\0' || (name[2] == '\\' && name[3] == '\0'));
+}
+
+/* The device a name given to mciGetDeviceID or a command string addresses */
+static struct device_info *device_name(const char *name)
+{
+	struct device_info *dev = NULL;
+	EnterCriticalSection(&play_cs);
+	for (int i = 0; i < ALL_DEVICES && !dev; i++) {
+		if (devices[i].open && stricmp(devices[i].alias, name) == 0) dev = &devices[i];
+	}
+	LeaveCriticalSection(&play_cs);
+	if (!dev && cd_name(name) && name[1] != ':') dev = &devices[0];
+	return dev;
+}
+
+/* Open a file on an in-process waveaudio device: the closed device that had the same file, else an unused one, else the
+ * least recently closed. NULL with *err == 0 leaves the file to the system MCI, e.g. formats the player cannot stream. */
+static struct device_info *wave_open(const char *name, const char *alias, MCIERROR *err)
+{
+	char file[MAX_PATH];
+	struct device_info *dev = NULL, *fresh = NULL, *lru = NULL;
+
+	*err = 0;
+	if (!GetFullPathNameA(name, MAX_PATH, file, NULL)) return NULL;
+
+	EnterCriticalSection(&play_cs);
+	for (int i = 0; i < ALL_DEVICES; i++) {
+		if (devices[i].open && stricmp(devices[i].alias, alias) == 0) {
+			LeaveCriticalSection(&play_cs);
+			*err = MCIERR_DUPLICATE_ALIAS;
+			return NULL;
+		}
+	}
+	for (int i = MAX_DEVICES; i < MAX_DEVICES + WAVE_DEVICES && !dev; i++) {
+		struct device_info *d = &devices[i];
+		if (d->open) continue;
+		if (d->length && stricmp(d->file, file) == 0) dev = d;
+		else if (!d->length && !fresh) fresh = d;
+		else if (d->length && (!lru || d->used - lru->used > 0x80000000u)) lru = d;
+	}
+	bool reused = dev != NULL;
+	if (!dev) dev = fresh ? fresh : lru;
+	if (dev) dev->open = true; /* claimed while the file is probed */
+	LeaveCriticalSection(&play_cs);
+	if (!dev) return NULL;
+
+	if (!reused) {
+		snprintf(dev->file, sizeof(dev->file), "%s", file);
+		dev->length = plr_probe(file, &dev->fmt);
+	}
+
+	EnterCriticalSection(&play_cs);
+	if (dev->length && !dev->plr && (dev->plr = plr_new())) plr_gain(dev->plr, waveVol);
+	if (dev->length && dev->plr && !dev->thread) {
+		DWORD id;
+		dev->event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		dev->thread = CreateThread(NULL, 0, wave_main, dev, 0, &id);
+		dprintf("Creating thread 0x%X for %s\n", dev->thread, alias);
+	}
+	if (!dev->length || !dev->event) {
+		dev->open = false;
+		dev->length = 0;
+		dev = NULL;
+	} else {
+		snprintf(dev->alias, sizeof(dev->alias), "%s", alias);
+		dev->info.from = 0;
+		dev->info.to = -1;
+		dev->position = 0;
+		dev->command = 0;
+		dev->notify = 0;
+		dev->time_format = MCI_FORMAT_MILLISECONDS;
+	}
+	LeaveCriticalSection(&play_cs);
+	dprintf("  waveaudio %s as %s: %s\n", file, alias, dev ? (reused ? "reused" : "opened") : "passed on");
+	return dev;
+}
+
 BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 {
 	if (fdwReason == DLL_PROCESS_ATTACH) {
 #ifdef _DEBUG
 		fh = fopen("winmm.log", "w");
 #endif
+		InitializeCriticalSection(&play_cs);
+		plr_init();
+		for (int i = 0; i < ALL_DEVICES; i++) {
+			devices[i].id = MAGIC_DEVICEID + i;
+			devices[i].mode = MCI_MODE_STOP;
+			devices[i].time_format = MCI_FORMAT_MSF;
+			devices[i].wave = i >= MAX_DEVICES && i < MAX_DEVICES + WAVE_DEVICES;
+			devices[i].seq = i >= MAX_DEVICES + WAVE_DEVICES;
+			InitializeCriticalSection(&devices[i].cs);
+		}
+		devices[0].open = true;
+		strcpy(devices[0].alias, alias_def);
+		devices[0].plr = plr_new();
 		GetModuleFileName(hinstDLL, path, sizeof(path));
 
 		char *last = strrchr(path, '.');
@@ -136,51 +808,86 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 			cddaVol = GetPrivateProfileInt("WAV-WinMM", "CDDAVolume", 100, path);
 			midiVol = GetPrivateProfileInt("WAV-WinMM", "MIDIVolume", 100, path);
 			waveVol = GetPrivateProfileInt("WAV-WinMM", "WAVEVolume", 100, path);
+			headCache = GetPrivateProfileInt("WAV-WinMM", "HeadCache", 0, path);
+			discCache = GetPrivateProfileInt("WAV-WinMM", "DiscCache", 0, path);
+			gaplessLoop = GetPrivateProfileInt("WAV-WinMM", "GaplessLoop", 0, path);
+			timerEngine = GetPrivateProfileInt("WAV-WinMM", "TimerEngine", 0, path);
+			mmioMapping = GetPrivateProfileInt("WAV-WinMM", "MmioMapping", 0, path);
+			soundCache = GetPrivateProfileInt("WAV-WinMM", "SoundCache", 0, path);
+			joyProbe = GetPrivateProfileInt("WAV-WinMM", "JoyProbe", 0, path);
+			waveAudio = GetPrivateProfileInt("WAV-WinMM", "WaveAudio", 0, path);
+			midiSequencer = GetPrivateProfileInt("WAV-WinMM", "MidiSequencer", 0, path);
+			driverCheck = GetPrivateProfileInt("WAV-WinMM", "DriverCheck", 0, path);
+			depthMax = GetPrivateProfileInt("WAV-WinMM", "AdaptiveDepth", 0, path);
+			depthMin = GetPrivateProfileInt("WAV-WinMM", "AdaptiveDepthMin", 200, path);
+			discStart = GetPrivateProfileInt("WAV-WinMM", "Disc", 1, path);
+			discSwap = GetPrivateProfileInt("WAV-WinMM", "DiscSwap", 0, path);
+			GetPrivateProfileString("WAV-WinMM", "StatsFile", "", statsName, MAX_PATH, path);
+			GetPrivateProfileString("WAV-WinMM", "TraceFile", "", traceName, MAX_PATH, path);
+			GetPrivateProfileString("WAV-WinMM", "RenderFile", "", renderName, MAX_PATH, path);
 
 			if (cddaVol < 0 || cddaVol > 100 ) cddaVol = 100;
 			if (midiVol < 0 || midiVol > 100 ) midiVol = 100;
 			if (waveVol < 0 || waveVol > 100 ) waveVol = 100;
+			if (headCache < 0) headCache = 0;
+			if (discCache < 0 || discCache > 1024) discCache = 0;
+			if (gaplessLoop < 0) gaplessLoop = 0;
+			if (soundCache < 0 || soundCache > 65536) soundCache = 0;
+			if (joyProbe < 0 || joyProbe > 60000) joyProbe = 0;
+			if (depthMax < 0 || depthMax > 4000) depthMax = 0;
+			if (depthMin < 40 || depthMin > 4000) depthMin = 200;
+			if (discStart < 1 || discStart > MAX_DISCS) discStart = 1;
+			if (discSwap < 0 || discSwap > 60000) discSwap = 0;
 
 			plr_volume(cddaVol, cddaVol);
+			plr_depth(depthMin, depthMax);
 			stub_midivol(midiVol);
 			stub_wavevol(waveVol);
+			stub_timer(timerEngine);
+			stub_mmio(mmioMapping);
+			stub_sound(soundCache);
+			stub_joyprobe(joyProbe);
+			stub_cdcheck(driverCheck);
+			if (midiSequencer) seq_init(midiVol);
 		}
 
 		last = strrchr(path, '\\');
 		if (last) *last = '\0';
+		/* Files whose path does not fit are not written */
+		char tracePath[MAX_PATH], renderPath[MAX_PATH];
+		if (statsName[0] && snprintf(statsPath, MAX_PATH, "%s\\%s", path, statsName) >= MAX_PATH) statsPath[0] = '\0';
+		if (traceName[0] && snprintf(tracePath, MAX_PATH, "%s\\%s", path, traceName) < MAX_PATH) {
+			InitializeCriticalSection(&trace_cs);
+			trace_t0 = plr_usec();
+			ft = fopen(tracePath, "w");
+			tprintf("# wav-winmm trace 2\n");
+		}
+		if (renderName[0] && snprintf(renderPath, MAX_PATH, "%s\\%s", path, renderName) < MAX_PATH) {
+			plr_render(renderPath);
+			dprintf("Rendering offline to %s\n", renderPath);
+			/* A PLAY continues where the render is, a range played again follows on without a gap. The start queued ahead
+			   would be rendered before the game could play it again. */
+			gaplessLoop = 0;
+		}
 		strcat(path, "\\");
 		strcat(path, cddaPath);
 
 		DWORD fa = GetFileAttributes(path);
-		if (fa != INVALID_FILE_ATTRIBUTES && fa & FILE_ATTRIBUTE_DIRECTORY) {
+		if (fa != INVALID_FILE_ATTRIBUTES && fa & FILE_ATTRIBUTE_DIRECTORY && devices[0].plr) {
 			dprintf("WAV-winmm music directory is %s\n", path);
 
-			memset(tracks, 0, sizeof(tracks));
-			unsigned int position = 0;
-
-			for (int i = 1; i <= MAX_TRACKS; i++) {
-				snprintf(tracks[i].path, MAX_PATH, "%s\\Track%02d.wav", path, i);
-				tracks[i].position = position;
-				tracks[i].length = plr_length(tracks[i].path);
-
-				if (tracks[i].length) {
-					dprintf("Track %02u: %02u:%02u:%03u @ %u ms\n", i, tracks[i].length / 60000, tracks[i].length / 1000 % 60, tracks[i].length % 1000, tracks[i].position);
-					if (!firstTrack) firstTrack = i;
-					lastTrack = i;
-					numTracks++;
-					position += tracks[i].length;
-				} else {
-					tracks[i].path[0] = '\0';
-				}
-
-				if (numTracks && !tracks[i].length) break;
-			}
-			dprintf("Emulating total of %d CD tracks.\n", numTracks);
-
-			if (numTracks) {
-				event = CreateEvent(NULL, FALSE, FALSE, NULL);
-				player = CreateThread(NULL, 0, player_main, NULL, 0, &thread);
-				dprintf("Creating thread 0x%X\n\n", player);
+			/* Tracks are scanned by the player thread, worker threads cannot run under the loader lock */
+			scan_ev = CreateEvent(NULL, TRUE, FALSE, NULL);
+			devices[0].event = CreateEvent(NULL, FALSE, FALSE, NULL);
+			devices[0].thread = CreateThread(NULL, 0, player_main, &devices[0], 0, &thread);
+			dprintf("Creating thread 0x%X\n\n", devices[0].thread);
+			if (!devices[0].thread) {
+				/* Nothing will scan, commands answer for an empty drive instead of waiting for it */
+				dprintf("Player thread not created, no tracks emulated\n");
+				CloseHandle(devices[0].event);
+				devices[0].event = NULL;
+				scanned = true;
+				if (scan_ev) SetEvent(scan_ev);
 			}
 		}
 	} else if (fdwReason == DLL_PROCESS_DETACH) {
@@ -191,37 +898,561 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID lpvReserved)
 			fh = NULL;
 		}
 #endif
-		command = MCI_DELETE;
-		plr_stop();
-		if (event) SetEvent(event);
-		if (player) WaitForSingleObject(player, INFINITE);
+		for (int i = 0; i < ALL_DEVICES; i++) {
+			struct device_info *dev = &devices[i];
+			dev->command = MCI_DELETE;
+			if (dev->plr) plr_stop(dev->plr);
+			if (dev->event) SetEvent(dev->event);
+		}
+		for (int i = 0; i < ALL_DEVICES; i++) {
+			if (devices[i].thread) WaitForSingleObject(devices[i].thread, INFINITE);
+		}
+		if (notify_ev) {
+			notify_quit = true;
+			SetEvent(notify_ev);
+		}
+		if (scan_ev) CloseHandle(scan_ev);
+		seq_close();
+
+		if (statsPath[0]) {
+			FILE *fs = fopen(statsPath, "w");
+			if (fs) {
+				char buf[2048];
+				plr_stats(buf, sizeof(buf), TRUE);
+				fprintf(fs, "%s\n", buf);
+				fclose(fs);
+			}
+		}
+		plr_render_close();
+		for (int i = 0; i < ALL_DEVICES; i++) {
+			plr_free(devices[i].plr);
+			DeleteCriticalSection(&devices[i].cs);
+		}
+		plr_cache_close();
 
+		if (ft) {
+			tprintf("%u %lu X\n", plr_usec() - trace_t0, (unsigned long)GetCurrentThreadId());
+			fclose(ft);
+			ft = NULL;
+			DeleteCriticalSection(&trace_cs);
+		}
+
+		stub_timer_close();
 		unloadRealDLL();
 	}
 
 	return TRUE;
 }
 
+/* waveaudio positions in the device's time format from and to milliseconds */
+static DWORD wave_units(struct device_info *dev, unsigned int ms)
+{
+	if (dev->time_format == MCI_FORMAT_SAMPLES) return (ULONGLONG)ms * dev->fmt.nSamplesPerSec / 1000;
+	if (dev->time_format == MCI_FORMAT_BYTES) return (ULONGLONG)ms * dev->fmt.nSamplesPerSec / 1000 * dev->fmt.nBlockAlign;
+	return ms;
+}
+
+static unsigned int wave_ms(struct device_info *dev, DWORD units)
+{
+	if (dev->time_format == MCI_FORMAT_SAMPLES) return (ULONGLONG)units * 1000 / dev->fmt.nSamplesPerSec;
+	if (dev->time_format == MCI_FORMAT_BYTES) return (ULONGLONG)units / dev->fmt.nBlockAlign * 1000 / dev->fmt.nSamplesPerSec;
+	return units;
+}
+
+/* Stop the device's thread and keep the position it got to */
+static void wave_stop(struct device_info *dev)
+{
+	dev->command = MCI_STOP;
+	plr_stop(dev->plr);
+	notify_cancel(dev);
+	while (dev->event && dev->mode != MCI_MODE_STOP) Sleep(1);
+}
+
+/* RESUME, or PLAY without a range while paused. Checked and set under play_cs like PAUSE, so a PAUSE racing it
+ * cannot leave the device paused while it plays. Returns false when the device was not paused. */
+static bool dev_resume(struct device_info *dev)
+{
+	EnterCriticalSection(&play_cs);
+	bool paused = dev->mode == MCI_MODE_PAUSE;
+	if (paused) {
+		if (dev->seq) {
+			seq_resume(dev);
+		} else {
+			if (dev->wave) dev->tick += plr_clock(dev->plr) - dev->paused;
+			plr_resume(dev->plr);
+			notify_release(dev);
+		}
+		dev->mode = MCI_MODE_PLAY;
+	}
+	LeaveCriticalSection(&play_cs);
+	return paused;
+}
+
+/* MCI commands of an in-process waveaudio device */
+static MCIERROR wave_command(struct device_info *dev, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam)
+{
+	switch (uMsg) {
+		case MCI_CLOSE:
+			dprintf("  MCI_CLOSE\n");
+			wave_stop(dev);
+			EnterCriticalSection(&play_cs);
+			dev->open = false;
+			dev->used = ++wave_stamp;
+			LeaveCriticalSection(&play_cs);
+			break;
+		case MCI_PLAY:
+			{
+				dprintf("  MCI_PLAY\n");
+				LPMCI_PLAY_PARMS parms = (LPVOID)dwParam;
+
+				if (!(fdwCommand & (MCI_FROM | MCI_TO)) && dev_resume(dev)) break;
+
+				unsigned int from = (fdwCommand & MCI_FROM) ? wave_ms(dev, parms->dwFrom) : wave_position(dev);
+				unsigned int to = (fdwCommand & MCI_TO) ? wave_ms(dev, parms->dwTo) : -1;
+				if (from > dev->length || (to != -1 && (to > dev->length || to < from))) return MCIERR_OUTOFRANGE;
+
+				wave_stop(dev);
+				if (!(fdwCommand & MCI_NOTIFY)) dev->notify = 0; /* a superseded PLAY does not notify */
+				dev->info.from = from;
+				dev->info.to = to;
+				dev->command = MCI_PLAY;
+				dev->mode = MCI_MODE_PLAY;
+				SetEvent(dev->event);
+				if (fdwCommand & MCI_WAIT) {
+					while (dev->mode != MCI_MODE_STOP) Sleep(1);
+				}
+			}
+			break;
+		case MCI_SEEK:
+			{
+				dprintf("  MCI_SEEK\n");
+				LPMCI_SEEK_PARMS parms = (LPVOID)dwParam;
+				unsigned int to = dev->position;
+				if (fdwCommand & MCI_SEEK_TO_START) to = 0;
+				else if (fdwCommand & MCI_SEEK_TO_END) to = dev->length;
+				else if (fdwCommand & MCI_TO) to = wave_ms(dev, parms->dwTo);
+				if (to > dev->length) return MCIERR_OUTOFRANGE;
+
+				wave_stop(dev);
+				dev->position = to;
+			}
+			break;
+		case MCI_STOP:
+			dprintf("  MCI_STOP\n");
+			wave_stop(dev);
+			break;
+		case MCI_PAUSE:
+			dprintf("  MCI_PAUSE\n");
+			EnterCriticalSection(&play_cs);
+			if (dev->mode == MCI_MODE_PLAY) {
+				dev->paused = plr_clock(dev->plr);
+				plr_pause(dev->plr);
+				notify_hold(dev);
+				dev->mode = MCI_MODE_PAUSE;
+			}
+			LeaveCriticalSection(&play_cs);
+			break;
+		case MCI_RESUME:
+			dprintf("  MCI_RESUME\n");
+			dev_resume(dev);
+			break;
+		case MCI_CUE: /* nothing to prepare, the file is already parsed */
+			break;
+		case MCI_SET:
+			{
+				dprintf("  MCI_SET\n");
+				LPMCI_SET_PARMS parms = (LPVOID)dwParam;
+				if (fdwCommand & MCI_SET_TIME_FORMAT) {
+					if (parms->dwTimeFormat != MCI_FORMAT_MILLISECONDS && parms->dwTimeFormat != MCI_FORMAT_SAMPLES &&
+					    parms->dwTimeFormat != MCI_FORMAT_BYTES) return MCIERR_BAD_TIME_FORMAT;
+					dev->time_format = parms->dwTimeFormat;
+				}
+			}
+			break;
+		case MCI_INFO:
+			{
+				dprintf("  MCI_INFO\n");
+				LPMCI_INFO_PARMS parms = (LPVOID)dwParam;
+				if (fdwCommand & MCI_INFO_FILE) snprintf(parms->lpstrReturn, parms->dwRetSize, "%s", dev->file);
+				else if (fdwCommand & MCI_INFO_PRODUCT) snprintf(parms->lpstrReturn, parms->dwRetSize, "WAV-WinMM waveaudio");
+			}
+			break;
+		case MCI_GETDEVCAPS:
+			{
+				dprintf("  MCI_GETDEVCAPS\n");
+				LPMCI_GETDEVCAPS_PARMS parms = (LPVOID)dwParam;
+				switch (parms->dwItem) {
+					case MCI_GETDEVCAPS_DEVICE_TYPE:
+						parms->dwReturn = MCI_DEVTYPE_WAVEFORM_AUDIO;
+						break;
+					case MCI_GETDEVCAPS_HAS_AUDIO:
+					case MCI_GETDEVCAPS_CAN_PLAY:
+					case MCI_GETDEVCAPS_USES_FILES:
+					case MCI_GETDEVCAPS_COMPOUND_DEVICE:
+						parms->dwReturn = TRUE;
+						break;
+					default:
+						parms->dwReturn = 0;
+				}
+			}
+			break;
+		case MCI_STATUS:
+			{
+				dprintf("  MCI_STATUS\n");
+				LPMCI_STATUS_PARMS parms = (LPVOID)dwParam;
+				parms->dwReturn = 0;
+				if (!(fdwCommand & MCI_STATUS_ITEM)) break;
+
+				switch (parms->dwItem) {
+					case MCI_STATUS_LENGTH:
+						parms->dwReturn = wave_units(dev, dev->length);
+						break;
+					case MCI_STATUS_POSITION:
+						parms->dwReturn = (fdwCommand & MCI_STATUS_START) ? 0 : wave_units(dev, wave_position(dev));
+						break;
+					case MCI_STATUS_NUMBER_OF_TRACKS:
+					case MCI_STATUS_CURRENT_TRACK:
+						parms->dwReturn = 1;
+						break;
+					case MCI_STATUS_MODE:
+						parms->dwReturn = dev->mode;
+						break;
+					case MCI_STATUS_MEDIA_PRESENT:
+					case MCI_STATUS_READY:
+						parms->dwReturn = TRUE;
+						break;
+					case MCI_STATUS_TIME_FORMAT:
+						parms->dwReturn = dev->time_format;
+						break;
+					case MCI_WAVE_STATUS_FORMATTAG:
+						parms->dwReturn = dev->fmt.wFormatTag;
+						break;
+					case MCI_WAVE_STATUS_CHANNELS:
+						parms->dwReturn = dev->fmt.nChannels;
+						break;
+					case MCI_WAVE_STATUS_SAMPLESPERSEC:
+						parms->dwReturn = dev->fmt.nSamplesPerSec;
+						break;
+					case MCI_WAVE_STATUS_AVGBYTESPERSEC:
+						parms->dwReturn = dev->fmt.nAvgBytesPerSec;
+						break;
+					case MCI_WAVE_STATUS_BLOCKALIGN:
+						parms->dwReturn = dev->fmt.nBlockAlign;
+						break;
+					case MCI_WAVE_STATUS_BITSPERSAMPLE:
+						parms->dwReturn = dev->fmt.wBitsPerSample;
+						break;
+					default:
+						return MCIERR_UNSUPPORTED_FUNCTION;
+				}
+				dprintf("  dwReturn 0x%08X\n", parms->dwReturn);
+			}
+			break;
+		default: /* recording, saving and editing stay with the system MCI */
+			return MCIERR_UNSUPPORTED_FUNCTION;
+	}
+	return 0;
+}
+
+/* Whether MCI_OPEN addresses a waveaudio file: by type, or by a .wav element without one */
+static bool wave_type(DWORD_PTR fdwCommand, LPMCI_OPEN_PARMS parms)
+{
+	if (!waveAudio || !(fdwCommand & MCI_OPEN_ELEMENT) || (fdwCommand & MCI_OPEN_ELEMENT_ID) || !parms->lpstrElementName) return false;
+	if (fdwCommand & MCI_OPEN_TYPE_ID) return LOWORD(parms->lpstrDeviceType) == MCI_DEVTYPE_WAVEFORM_AUDIO;
+	if (fdwCommand & MCI_OPEN_TYPE) return stricmp(parms->lpstrDeviceType, "waveaudio") == 0;
+	size_t len = strlen(parms->lpstrElementName);
+	return len > 4 && stricmp(parms->lpstrElementName + len - 4, ".wav") == 0;
+}
+
+/* Sequencer files by extension: Standard MIDI Files and their RIFF wrapped form */
+static bool midi_file(const char *name)
+{
+	size_t len = strlen(name);
+	return len > 4 && (stricmp(name + len - 4, ".mid") == 0 || stricmp(name + len - 4, ".rmi") == 0);
+}
+
+/* Whether MCI_OPEN addresses a sequencer file: by type, or by a .mid or .rmi element without one */
+static bool midi_type(DWORD_PTR fdwCommand, LPMCI_OPEN_PARMS parms)
+{
+	if (!midiSequencer || !(fdwCommand & MCI_OPEN_ELEMENT) || (fdwCommand & MCI_OPEN_ELEMENT_ID) || !parms->lpstrElementName) return false;
+	if (fdwCommand & MCI_OPEN_TYPE_ID) return LOWORD(parms->lpstrDeviceType) == MCI_DEVTYPE_SEQUENCER;
+	if (fdwCommand & MCI_OPEN_TYPE) return stricmp(parms->lpstrDeviceType, "sequencer") == 0;
+	return midi_file(parms->lpstrElementName);
+}
+
+/* Open a file on an in-process sequencer device, its song comes parsed from the sequencer's cache when it was played
+ * before. NULL with *err == 0 leaves the file to the system MCI, e.g. format 2 files or no MIDI output. */
+static struct device_info *midi_open(const char *name, const char *alias, MCIERROR *err)
+{
+	char file[MAX_PATH];
+	struct device_info *dev = NULL;
+
+	*err = 0;
+	if (!GetFullPathNameA(name, MAX_PATH, file, NULL)) return NULL;
+
+	EnterCriticalSection(&play_cs);
+	for (int i = 0; i < ALL_DEVICES; i++) {
+		if (devices[i].open && stricmp(devices[i].alias, alias) == 0) {
+			LeaveCriticalSection(&play_cs);
+			*err = MCIERR_DUPLICATE_ALIAS;
+			return NULL;
+		}
+	}
+	for (int i = MAX_DEVICES + WAVE_DEVICES; i < ALL_DEVICES && !dev; i++) {
+		if (!devices[i].open) dev = &devices[i];
+	}
+	if (dev) dev->open = true; /* claimed while the file is parsed */
+	LeaveCriticalSection(&play_cs);
+	if (!dev) return NULL;
+
+	struct seq_song *song = seq_open(file);
+
+	EnterCriticalSection(&play_cs);
+	if (!song) {
+		dev->open = false;
+		dev = NULL;
+	} else {
+		snprintf(dev->alias, sizeof(dev->alias), "%s", alias);
+		snprintf(dev->file, sizeof(dev->file), "%s", file);
+		dev->song = song;
+		dev->length = seq_length(song);
+		dev->info.from = 0;
+		dev->info.to = -1;
+		dev->position = 0;
+		dev->mode = MCI_MODE_STOP;
+		dev->notify = 0;
+		dev->time_format = MCI_FORMAT_MILLISECONDS;
+	}
+	LeaveCriticalSection(&play_cs);
+	dprintf("  sequencer %s as %s: %s\n", file, alias, dev ? "opened" : "passed on");
+	return dev;
+}
+
+/* The sequencer is done with a device's range: played to its end, stopped, or taken over by another device */
+static void midi_done(void *arg, unsigned int ms, BOOL end)
+{
+	struct device_info *dev = arg;
+	EnterCriticalSection(&play_cs);
+	bool notify = end && dev->notify;
+	dev->notify = 0;
+	dev->position = ms;
+	dev->mode = MCI_MODE_STOP;
+	LeaveCriticalSection(&play_cs);
+
+	if (notify) {
+		SendNotifyMessageA(dev->window, MM_MCINOTIFY, MCI_NOTIFY_SUCCESSFUL, dev->id);
+		dprintf("[Sequencer] Send MCI_NOTIFY_SUCCESSFUL message\n");
+	}
+}
+
+/* Position of a sequencer device in milliseconds */
+static unsigned int midi_position(struct device_info *dev)
+{
+	unsigned int ms = seq_position(dev);
+	return ms == -1 ? dev->position : ms;
+}
+
+/* MCI commands of an in-process sequencer device */
+static MCIERROR midi_command(struct device_info *dev, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam)
+{
+	switch (uMsg) {
+		case MCI_CLOSE:
+			dprintf("  MCI_CLOSE\n");
+			seq_stop(dev);
+			seq_release(dev->song);
+			EnterCriticalSection(&play_cs);
+			dev->song = NULL;
+			dev->open = false;
+			LeaveCriticalSection(&play_cs);
+			break;
+		case MCI_PLAY:
+			{
+				dprintf("  MCI_PLAY\n");
+				LPMCI_PLAY_PARMS parms = (LPVOID)dwParam;
+
+				if (!(fdwCommand & (MCI_FROM | MCI_TO)) && dev_resume(dev)) break;
+
+				unsigned int from = (fdwCommand & MCI_FROM) ? parms->dwFrom : midi_position(dev);
+				unsigned int to = (fdwCommand & MCI_TO) ? parms->dwTo : -1;
+				if (from > dev->length || (to != -1 && (to > dev->length || to < from))) return MCIERR_OUTOFRANGE;
+
+				bool notify = dev->notify && (fdwCommand & MCI_NOTIFY);
+				seq_stop(dev);
+				dev->notify = notify; /* a superseded PLAY does not notify */
+				dev->info.from = from;
+				dev->info.to = to;
+				dev->mode = MCI_MODE_PLAY;
+				if (!seq_play(dev->song, from, to, midi_done, dev)) {
+					dev->mode = MCI_MODE_STOP;
+					dev->notify = 0;
+					return MCIERR_HARDWARE;
+				}
+				if (fdwCommand & MCI_WAIT) {
+					while (dev->mode != MCI_MODE_STOP) Sleep(1);
+				}
+			}
+			break;
+		case MCI_SEEK:
+			{
+				dprintf("  MCI_SEEK\n");
+				LPMCI_SEEK_PARMS parms = (LPVOID)dwParam;
+				unsigned int to = midi_position(dev);
+				if (fdwCommand & MCI_SEEK_TO_START) to = 0;
+				else if (fdwCommand & MCI_SEEK_TO_END) to = dev->length;
+				else if (fdwCommand & MCI_TO) to = parms->dwTo;
+				if (to > dev->length) return MCIERR_OUTOFRANGE;
+
+				seq_stop(dev);
+				dev->position = to;
+			}
+			break;
+		case MCI_STOP:
+			dprintf("  MCI_STOP\n");
+			seq_stop(dev);
+			break;
+		case MCI_PAUSE:
+			dprintf("  MCI_PAUSE\n");
+			EnterCriticalSection(&play_cs);
+			if (dev->mode == MCI_MODE_PLAY) {
+				seq_pause(dev);
+				dev->mode = MCI_MODE_PAUSE;
+			}
+			LeaveCriticalSection(&play_cs);
+			break;
+		case MCI_RESUME:
+			dprintf("  MCI_RESUME\n");
+			dev_resume(dev);
+			break;
+		case MCI_CUE: /* nothing to prepare, the song is already parsed and the output open */
+			break;
+		case MCI_SET:
+			{
+				dprintf("  MCI_SET\n");
+				LPMCI_SET_PARMS parms = (LPVOID)dwParam;
+				/* Tempo, port, sync and audio settings are not implemented by the sequencer */
+				if (fdwCommand & ~(MCI_NOTIFY | MCI_WAIT | MCI_SET_TIME_FORMAT)) return MCIERR_UNSUPPORTED_FUNCTION;
+				if ((fdwCommand & MCI_SET_TIME_FORMAT) && parms->dwTimeFormat != MCI_FORMAT_MILLISECONDS) return MCIERR_BAD_TIME_FORMAT;
+			}
+			break;
+		case MCI_INFO:
+			{
+				dprintf("  MCI_INFO\n");
+				LPMCI_INFO_PARMS parms = (LPVOID)dwParam;
+				if (fdwCommand & MCI_INFO_FILE) snprintf(parms->lpstrReturn, parms->dwRetSize, "%s", dev->file);
+				else if (fdwCommand & MCI_INFO_PRODUCT) snprintf(parms->lpstrReturn, parms->dwRetSize, "WAV-WinMM sequencer");
+			}
+			break;
+		case MCI_GETDEVCAPS:
+			{
+				dprintf("  MCI_GETDEVCAPS\n");
+				LPMCI_GETDEVCAPS_PARMS parms = (LPVOID)dwParam;
+				switch (parms->dwItem) {
+					case MCI_GETDEVCAPS_DEVICE_TYPE:
+						parms->dwReturn = MCI_DEVTYPE_SEQUENCER;
+						break;
+					case MCI_GETDEVCAPS_HAS_AUDIO:
+					case MCI_GETDEVCAPS_CAN_PLAY:
+					case MCI_GETDEVCAPS_USES_FILES:
+					case MCI_GETDEVCAPS_COMPOUND_DEVICE:
+						parms->dwReturn = TRUE;
+						break;
+					default:
+						parms->dwReturn = 0;
+				}
+			}
+			break;
+		case MCI_STATUS:
+			{
+				dprintf("  MCI_STATUS\n");
+				LPMCI_STATUS_PARMS parms = (LPVOID)dwParam;
+				parms->dwReturn = 0;
+				if (!(fdwCommand & MCI_STATUS_ITEM)) break;
+
+				switch (parms->dwItem) {
+					case MCI_STATUS_LENGTH:
+						parms->dwReturn = dev->length;
+						break;
+					case MCI_STATUS_POSITION:
+						parms->dwReturn = (fdwCommand & MCI_STATUS_START) ? 0 : midi_position(dev);
+						break;
+					case MCI_STATUS_NUMBER_OF_TRACKS:
+					case MCI_STATUS_CURRENT_TRACK:
+						parms->dwReturn = 1;
+						break;
+					case MCI_STATUS_MODE:
+						parms->dwReturn = dev->mode;
+						break;
+					case MCI_STATUS_MEDIA_PRESENT:
+					case MCI_STATUS_READY:
+						parms->dwReturn = TRUE;
+						break;
+					case MCI_STATUS_TIME_FORMAT:
+						parms->dwReturn = MCI_FORMAT_MILLISECONDS;
+						break;
+					default:
+						return MCIERR_UNSUPPORTED_FUNCTION;
+				}
+				dprintf("  dwReturn 0x%08X\n", parms->dwReturn);
+			}
+			break;
+		default: /* e.g. MCI_LOAD, MCI_SAVE or MCI_RECORD, the sequencer only plays */
+			return MCIERR_UNSUPPORTED_FUNCTION;
+	}
+	return 0;
+}
+
+/* Is an MCI_OPEN for the CD audio device, e.g. by type id, "cdaudio", "cdaudio!d:" or the element "d:" alone */
+static bool cd_open(DWORD_PTR fdwCommand, LPMCI_OPEN_PARMS parms)
+{
+	if (fdwCommand & MCI_OPEN_TYPE_ID) return LOWORD(parms->lpstrDeviceType) == MCI_DEVTYPE_CD_AUDIO;
+	if (fdwCommand & MCI_OPEN_TYPE) return cd_name(parms->lpstrDeviceType) && parms->lpstrDeviceType[1] != ':';
+	return (fdwCommand & MCI_OPEN_ELEMENT) && !(fdwCommand & MCI_OPEN_ELEMENT_ID) && cd_name(parms->lpstrElementName);
+}
+
 /* MCI commands */
 /* https://docs.microsoft.com/windows/win32/multimedia/multimedia-commands */
-MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam)
+static MCIERROR mci_dispatch(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam)
 {
-	char cmdbuf[1024];
+	struct device_info *dev = device_get(IDDevice);
 	dprintf("mciSendCommandA(IDDevice=%p, uMsg=%p, fdwCommand=%p, dwParam=%p) @ %04X\n", IDDevice, uMsg, fdwCommand, dwParam, GetTickCount());
 
-	if (fdwCommand & MCI_NOTIFY) {
+	if ((fdwCommand & MCI_NOTIFY) && dev) {
 		dprintf("  MCI_NOTIFY\n");
-		notify = 1; /* storing the notify request */
-		window = *(HWND*)dwParam;
+		dev->notify = 1; /* storing the notify request */
+		dev->window = *(HWND*)dwParam;
 	}
 	if (fdwCommand & MCI_WAIT) {
 		dprintf("  MCI_WAIT\n");
 	}
 
+	if (dev && dev->wave) return wave_command(dev, uMsg, fdwCommand, dwParam);
+	if (dev && dev->seq) return midi_command(dev, uMsg, fdwCommand, dwParam);
+
 	if (uMsg == MCI_OPEN) {
 		dprintf("  MCI_OPEN\n");
 		LPMCI_OPEN_PARMS parms = (LPVOID)dwParam;
 
+		if (wave_type(fdwCommand, parms)) {
+			MCIERROR err;
+			dev = wave_open(parms->lpstrElementName, (fdwCommand & MCI_OPEN_ALIAS) ? parms->lpstrAlias : parms->lpstrElementName, &err);
+			if (dev) {
+				parms->wDeviceID = dev->id;
+				return 0;
+			}
+			if (err) return err;
+			return relay_mciSendCommandA(IDDevice, uMsg, fdwCommand, dwParam);
+		}
+		if (midi_type(fdwCommand, parms)) {
+			MCIERROR err;
+			dev = midi_open(parms->lpstrElementName, (fdwCommand & MCI_OPEN_ALIAS) ? parms->lpstrAlias : parms->lpstrElementName, &err);
+			if (dev) {
+				parms->wDeviceID = dev->id;
+				return 0;
+			}
+			if (err) return err;
+			return relay_mciSendCommandA(IDDevice, uMsg, fdwCommand, dwParam);
+		}
+
 		if (fdwCommand & MCI_OPEN_ALIAS) {
 			dprintf("    MCI_OPEN_ALIAS\n");
 			dprintf("        -> %s\n", parms->lpstrAlias);
@@ -233,34 +1464,34 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 
 		if (fdwCommand & MCI_OPEN_TYPE_ID) {
 			dprintf("    MCI_OPEN_TYPE_ID\n");
-
-			if (LOWORD(parms->lpstrDeviceType) == MCI_DEVTYPE_CD_AUDIO) {
-				dprintf("  Returning magic device id for MCI_DEVTYPE_CD_AUDIO\n");
-				parms->wDeviceID = MAGIC_DEVICEID;
-				return 0;
-			}
-			else return relay_mciSendCommandA(IDDevice, uMsg, fdwCommand, dwParam);
-		}
-
-		if (fdwCommand & MCI_OPEN_TYPE && !(fdwCommand & MCI_OPEN_TYPE_ID)) {
+		} else if (fdwCommand & MCI_OPEN_TYPE) {
 			dprintf("    MCI_OPEN_TYPE\n");
 			dprintf("        -> %s\n", parms->lpstrDeviceType);
+		}
 
-			if (stricmp(parms->lpstrDeviceType, alias_def) == 0) {
-				dprintf("  Returning magic device id for MCI_DEVTYPE_CD_AUDIO\n");
-				parms->wDeviceID = MAGIC_DEVICEID;
-				return 0;
-			}
-			else return relay_mciSendCommandA(IDDevice, uMsg, fdwCommand, dwParam);
+		/* Every form that names the CD audio device stays here, the system MCI would load its driver and touch the drive */
+		if (cd_open(fdwCommand, parms)) {
+			dev = device_open((fdwCommand & MCI_OPEN_ALIAS) ? parms->lpstrAlias : NULL);
+			if (!dev) return MCIERR_OUT_OF_MEMORY;
+			dprintf("  Returning magic device id 0x%X for MCI_DEVTYPE_CD_AUDIO\n", dev->id);
+			parms->wDeviceID = dev->id;
+			return 0;
 		}
 		return relay_mciSendCommandA(IDDevice, uMsg, fdwCommand, dwParam);
-	} else if (IDDevice == MAGIC_DEVICEID || IDDevice == 0 || IDDevice == 0xFFFFFFFF) {
+	} else if (dev) {
 		switch (uMsg) {
 			case MCI_CLOSE:
 				{
 					dprintf("  MCI_CLOSE\n");
-					command = MCI_STOP;
-					plr_stop();
+					dev->command = MCI_STOP;
+					plr_stop(dev->plr);
+					notify_cancel(dev);
+					/* Device 0 stays usable under its default name, other devices are gone until opened again */
+					if (dev != devices) while (dev->event && dev->mode != MCI_MODE_STOP) Sleep(1);
+					EnterCriticalSection(&play_cs);
+					if (dev == devices) strcpy(dev->alias, alias_def);
+					else dev->open = false;
+					LeaveCriticalSection(&play_cs);
 					/* NOTE: MCI_CLOSE does stop the music in Vista+ but the original behaviour did not
 					   it only closed the handle to the opened device. You could still send MCI commands
 					   to a default cdaudio device but if you had used an alias you needed to re-open it.
@@ -271,19 +1502,24 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 				{
 					dprintf("  MCI_PLAY\n");
 
-					// Treat PLAY as RESUME when in PAUSE.
-					if ((mode == MCI_MODE_PAUSE) && !(fdwCommand & MCI_FROM)) {
-						mode = MCI_MODE_PLAY;
-						plr_resume();
-						break;
+					if (disc_out()) {
+						dev->notify = 0;
+						return MCIERR_DEVICE_NOT_READY;
 					}
 
+					// Treat PLAY as RESUME when in PAUSE.
+					if (!(fdwCommand & MCI_FROM) && dev_resume(dev)) break;
+
 					LPMCI_PLAY_PARMS parms = (LPVOID)dwParam;
+					notify_cancel(dev);
+
+					/* The player thread may still be reading the range of the last PLAY, hand it the new one whole */
+					struct play_info info = dev->info;
 
 					if (fdwCommand & MCI_FROM) {
 						dprintf("    dwFrom: 0x%08X\n", parms->dwFrom);
 
-						if (time_format == MCI_FORMAT_TMSF) {
+						if (dev->time_format == MCI_FORMAT_TMSF) {
 							info.first = MCI_TMSF_TRACK(parms->dwFrom);
 							info.from = MCI_TMSF_MINUTE(parms->dwFrom) * 60000 + MCI_TMSF_SECOND(parms->dwFrom) * 1000 + MCI_TMSF_FRAME(parms->dwFrom) * 1000 / 75; // 1 second consists of 75 frames
 
@@ -292,7 +1528,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 							dprintf("      SECOND %d\n", MCI_TMSF_SECOND(parms->dwFrom));
 							dprintf("      FRAME  %d\n", MCI_TMSF_FRAME(parms->dwFrom));
 						} else { /* MSF or millisecond */
-							if (time_format == MCI_FORMAT_MSF) {
+							if (dev->time_format == MCI_FORMAT_MSF) {
 								parms->dwFrom = MCI_MSF_MINUTE(parms->dwFrom) * 60000 + MCI_MSF_SECOND(parms->dwFrom) * 1000 + MCI_MSF_FRAME(parms->dwFrom) * 1000 / 75;  
 							}
 							info.first = 0;
@@ -305,8 +1541,11 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 							}
 							/* If no match is found do not play */
 							if (info.first == 0) {
-								command = MCI_STOP;
-								plr_stop();
+								dev->command = MCI_STOP;
+								plr_stop(dev->plr);
+								EnterCriticalSection(&play_cs);
+								dev->info = info;
+								LeaveCriticalSection(&play_cs);
 								return 0;
 							}
 							dprintf("      mapped dwFrom to track %d (%d ms)\n", info.first, info.from);
@@ -318,7 +1557,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 					if (fdwCommand & MCI_TO) {
 						dprintf("    dwTo:   0x%08X\n", parms->dwTo);
 
-						if (time_format == MCI_FORMAT_TMSF) {
+						if (dev->time_format == MCI_FORMAT_TMSF) {
 							info.last = MCI_TMSF_TRACK(parms->dwTo);
 							info.to = MCI_TMSF_MINUTE(parms->dwTo) * 60000 + MCI_TMSF_SECOND(parms->dwTo) * 1000 + MCI_TMSF_FRAME(parms->dwTo) * 1000 / 75;
 
@@ -327,7 +1566,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 							dprintf("      SECOND %d\n", MCI_TMSF_SECOND(parms->dwTo));
 							dprintf("      FRAME  %d\n", MCI_TMSF_FRAME(parms->dwTo));
 						} else { /* MSF or millisecond */
-							if (time_format == MCI_FORMAT_MSF) {
+							if (dev->time_format == MCI_FORMAT_MSF) {
 								parms->dwTo = MCI_MSF_MINUTE(parms->dwTo) * 60000 + MCI_MSF_SECOND(parms->dwTo) * 1000 + MCI_MSF_FRAME(parms->dwTo) * 1000 / 75;  
 							}
 							info.last = lastTrack;
@@ -343,23 +1582,67 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 						}
 					}
 
-					if (event) {
-						if (mode != MCI_MODE_STOP) {
-							command = MCI_STOP;
-							plr_stop();
-							while (mode != MCI_MODE_STOP) Sleep(1);
+					EnterCriticalSection(&play_cs);
+					dev->info = info;
+					LeaveCriticalSection(&play_cs);
+
+					/* The looped range played again right after its notify: its start is already playing */
+					if (dev->event && (fdwCommand & MCI_FROM) && dev->command == MCI_PLAY) {
+						struct play_info r;
+						bool kept = false;
+						EnterCriticalSection(&play_cs);
+						play_range(dev, &r);
+						if (dev->loop == 2 && r.first == dev->range.first && r.from == dev->range.from && r.last == dev->range.last && r.to == dev->range.to) {
+							dev->loop = 0;
+							plr_extend(dev->plr);
+							kept = true;
+						}
+						LeaveCriticalSection(&play_cs);
+						if (kept) {
+							dprintf("  Loop track %d kept playing\n", dev->current);
+							break;
+						}
+					}
+
+					/* PLAY FROM inside the playing track: move the stream in place instead of restarting the device */
+					if (dev->event && (fdwCommand & MCI_FROM) && dev->command == MCI_PLAY && dev->mode != MCI_MODE_STOP &&
+					    !((fdwCommand & MCI_TO) && (dev->info.first == dev->info.last) && (dev->info.from + 15 >= dev->info.to))) {
+						struct play_info r;
+						bool moved = false;
+						EnterCriticalSection(&play_cs);
+						play_range(dev, &r);
+						if (r.first == dev->current && r.first <= r.last &&
+						    plr_seek(dev->plr, tracks[dev->current].path, r.from, r.first == r.last ? r.to : -1)) {
+							dev->range = r;
+							dev->loop = 0;
+							dev->tick = plr_clock(dev->plr) - r.from;
+							dev->mode = MCI_MODE_PLAY;
+							moved = true;
+						}
+						LeaveCriticalSection(&play_cs);
+						if (moved) {
+							dprintf("  Retarget track %d to %u ms\n", dev->current, r.from);
+							break;
+						}
+					}
+
+					if (dev->event) {
+						if (dev->mode != MCI_MODE_STOP) {
+							dev->command = MCI_STOP;
+							plr_stop(dev->plr);
+							while (dev->mode != MCI_MODE_STOP) Sleep(1);
 						}
 						// If play time is less than 15ms (1 frame = 1000/75 ms), do not play.
-						if ((fdwCommand & MCI_FROM) && (fdwCommand & MCI_TO) && (info.first == info.last) && (info.from + 15 >= info.to)) {
-							if (notify) {
-								notify = 0;
-								SendNotifyMessageA(window, MM_MCINOTIFY, MCI_NOTIFY_SUCCESSFUL, MAGIC_DEVICEID);
+						if ((fdwCommand & MCI_FROM) && (fdwCommand & MCI_TO) && (dev->info.first == dev->info.last) && (dev->info.from + 15 >= dev->info.to)) {
+							if (dev->notify) {
+								dev->notify = 0;
+								SendNotifyMessageA(dev->window, MM_MCINOTIFY, MCI_NOTIFY_SUCCESSFUL, dev->id);
 								dprintf("(FROM == TO) Send message but no play\n");
 							}
 						} else {
-							command = MCI_PLAY;
-							mode = MCI_MODE_PLAY;
-							SetEvent(event);
+							dev->command = MCI_PLAY;
+							dev->mode = MCI_MODE_PLAY;
+							SetEvent(dev->event);
 						}
 					}
 				}
@@ -367,8 +1650,11 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 			case MCI_SEEK:
 				{
 					dprintf("  MCI_SEEK\n");
-					command = MCI_STOP;
-					plr_stop();
+					if (disc_out()) return MCIERR_DEVICE_NOT_READY;
+					dev->command = MCI_STOP;
+					plr_stop(dev->plr);
+					notify_cancel(dev);
+					struct play_info info = dev->info;
 
 					if (fdwCommand & MCI_SEEK_TO_START) {
 						dprintf("    MCI_SEEK_TO_START\n");
@@ -381,7 +1667,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 					} else if (fdwCommand & MCI_TO) {
 						dprintf("    MCI_TO\n");
 						LPMCI_SEEK_PARMS parms = (LPVOID)dwParam;
-						if (time_format == MCI_FORMAT_TMSF) {
+						if (dev->time_format == MCI_FORMAT_TMSF) {
 							info.first = MCI_TMSF_TRACK(parms->dwTo);
 							info.from = MCI_TMSF_MINUTE(parms->dwTo) * 60000 + MCI_TMSF_SECOND(parms->dwTo) * 1000 + MCI_TMSF_FRAME(parms->dwTo) * 1000 / 75;
 
@@ -390,7 +1676,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 							dprintf("      SECOND %d\n", MCI_TMSF_SECOND(parms->dwTo));
 							dprintf("      FRAME  %d\n", MCI_TMSF_FRAME(parms->dwTo));
 						} else { /* MSF or millisecond */
-							if (time_format == MCI_FORMAT_MSF) {
+							if (dev->time_format == MCI_FORMAT_MSF) {
 								parms->dwTo = MCI_MSF_MINUTE(parms->dwTo) * 60000 + MCI_MSF_SECOND(parms->dwTo) * 1000 + MCI_MSF_FRAME(parms->dwTo) * 1000 / 75;  
 							}
 							info.first = lastTrack;
@@ -407,22 +1693,29 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 					}
 					info.last = lastTrack;
 					info.to = -1;
+					EnterCriticalSection(&play_cs);
+					dev->info = info;
+					LeaveCriticalSection(&play_cs);
 				}
 				break;
 			case MCI_STOP:
 				{
 					dprintf("  MCI_STOP\n");
-					command = MCI_STOP;
-					plr_stop(); /* Make STOP command instant. */
+					dev->command = MCI_STOP;
+					plr_stop(dev->plr); /* Make STOP command instant. */
+					notify_cancel(dev);
 				}
 				break;
 			case MCI_PAUSE:
 				{
 					dprintf("  MCI_PAUSE\n");
-					if (mode == MCI_MODE_PLAY) {
-						plr_pause();
-						mode = MCI_MODE_PAUSE;
+					EnterCriticalSection(&play_cs);
+					if (dev->mode == MCI_MODE_PLAY) {
+						plr_pause(dev->plr);
+						notify_hold(dev);
+						dev->mode = MCI_MODE_PAUSE;
 					}
+					LeaveCriticalSection(&play_cs);
 				}
 				break;
 			case MCI_INFO: /* Handling of MCI_INFO */
@@ -432,10 +1725,12 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 
 					if (fdwCommand & MCI_INFO_PRODUCT) {
 						dprintf("    MCI_INFO_PRODUCT\n");
-						strncpy((char*)parms->lpstrReturn, alias_s, parms->dwRetSize); /* name */
+						strncpy((char*)parms->lpstrReturn, dev->alias, parms->dwRetSize); /* name */
 					} else if (fdwCommand & MCI_INFO_MEDIA_IDENTITY) {
 						dprintf("    MCI_INFO_MEDIA_IDENTITY\n");
-						memcpy((LPVOID)(parms->lpstrReturn), MEDIA_IDENTITY, parms->dwRetSize); /* 16 hexadecimal digits */
+						if (disc_out()) return MCIERR_DEVICE_NOT_READY;
+						const char *identity = discs[discLoaded].identity;
+						memcpy((LPVOID)(parms->lpstrReturn), identity, parms->dwRetSize < sizeof(discs->identity) ? parms->dwRetSize : sizeof(discs->identity)); /* 16 hexadecimal digits */
 					}
 				}
 				break;
@@ -468,7 +1763,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 
 					if (fdwCommand & MCI_SET_TIME_FORMAT) {
 						dprintf("    MCI_SET_TIME_FORMAT\n");
-						time_format = parms->dwTimeFormat;
+						dev->time_format = parms->dwTimeFormat;
 
 						if (parms->dwTimeFormat == MCI_FORMAT_MILLISECONDS) {
 							dprintf("      MCI_FORMAT_MILLISECONDS\n");
@@ -486,6 +1781,14 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 							dprintf("      MCI_FORMAT_FRAMES\n");
 						}
 					}
+
+					if (fdwCommand & MCI_SET_DOOR_OPEN) {
+						dprintf("    MCI_SET_DOOR_OPEN\n");
+						disc_door(true);
+					} else if (fdwCommand & MCI_SET_DOOR_CLOSED) {
+						dprintf("    MCI_SET_DOOR_CLOSED\n");
+						disc_door(false);
+					}
 				}
 				break;
 			case MCI_SYSINFO: /* Handling of MCI_SYSINFO (Heavy Gear, Battlezone2, Interstate 76) */
@@ -495,7 +1798,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 
 					if (fdwCommand & MCI_SYSINFO_NAME) {
 						dprintf("    MCI_SYSINFO_NAME\n");
-						strncpy((char*)parms->lpstrReturn, alias_s, parms->dwRetSize); /* name */
+						strncpy((char*)parms->lpstrReturn, dev->alias, parms->dwRetSize); /* name */
 					} else if (fdwCommand & MCI_SYSINFO_QUANTITY) {
 						dprintf("    MCI_SYSINFO_QUANTITY\n");
 						*(DWORD*)parms->lpstrReturn = 1; /* quantity = 1 */
@@ -530,7 +1833,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 									parms->dwTrack = lastTrack;
 									ms = tracks[lastTrack].position + tracks[lastTrack].length;
 								}
-								if (time_format == MCI_FORMAT_MILLISECONDS) {
+								if (dev->time_format == MCI_FORMAT_MILLISECONDS) {
 									parms->dwReturn = ms;
 								} else { // WTF! MCI_FORMAT_MSF and MCI_FORMAT_TMSF both return in MSF
 									parms->dwReturn = MCI_MAKE_MSF(ms/60000, ms/1000%60, ms%1000*75/1000);
@@ -546,14 +1849,17 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 									parms->dwReturn = 0;
 									ms = 0;
 								} else { /* Playing position */
-									parms->dwTrack = current;
-									parms->dwReturn = tracks[parms->dwTrack].position; // as milliseconds
+									/* The player thread moves current and tick together under play_cs */
+									EnterCriticalSection(&play_cs);
+									parms->dwTrack = dev->current;
 									// FIXME: fix position for pause
-									ms = mode == MCI_MODE_PLAY ? GetTickCount() - tracks[parms->dwTrack].tick : 0;
+									ms = dev->mode == MCI_MODE_PLAY ? plr_clock(dev->plr) - dev->tick : 0;
+									LeaveCriticalSection(&play_cs);
+									parms->dwReturn = tracks[parms->dwTrack].position; // as milliseconds
 								}
-								if (time_format == MCI_FORMAT_MILLISECONDS) {
+								if (dev->time_format == MCI_FORMAT_MILLISECONDS) {
 									parms->dwReturn += ms;
-								} else if (time_format == MCI_FORMAT_MSF) {
+								} else if (dev->time_format == MCI_FORMAT_MSF) {
 									ms += parms->dwReturn;
 									parms->dwReturn = MCI_MAKE_MSF(ms/60000, ms/1000%60, ms%1000*75/1000);
 								} else { /* MCI_FORMAT_TMSF */
@@ -567,23 +1873,23 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 								break;
 							case MCI_STATUS_MODE:
 								dprintf("      MCI_STATUS_MODE\n");
-								parms->dwReturn = mode;
+								parms->dwReturn = disc_out() ? MCI_MODE_OPEN : dev->mode;
 								break;
 							case MCI_STATUS_MEDIA_PRESENT:
 								dprintf("      MCI_STATUS_MEDIA_PRESENT\n");
-								parms->dwReturn = TRUE;
+								parms->dwReturn = !disc_out();
 								break;
 							case MCI_STATUS_TIME_FORMAT:
 								dprintf("      MCI_STATUS_TIME_FORMAT\n");
-								parms->dwReturn = time_format;
+								parms->dwReturn = dev->time_format;
 								break;
 							case MCI_STATUS_READY:
 								dprintf("      MCI_STATUS_READY\n");
-								parms->dwReturn = TRUE; /* TRUE=ready, FALSE=not ready */
+								parms->dwReturn = !disc_out(); /* TRUE=ready, FALSE=not ready */
 								break;
 							case MCI_STATUS_CURRENT_TRACK:
 								dprintf("      MCI_STATUS_CURRENT_TRACK\n");
-								parms->dwReturn = current;
+								parms->dwReturn = dev->current;
 								break;
 							case MCI_CDA_STATUS_TYPE_TRACK:
 								dprintf("      MCI_CDA_STATUS_TYPE_TRACK\n");
@@ -597,10 +1903,7 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 			case MCI_RESUME: /* FIXME: MCICDA does not support resume? */
 				{
 					dprintf("  MCI_RESUME\n");
-					if (mode == MCI_MODE_PAUSE) {
-						mode = MCI_MODE_PLAY;
-						plr_resume();
-					}
+					dev_resume(dev);
 				}
 				break;
 		}
@@ -608,22 +1911,163 @@ MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR
 	} else return relay_mciSendCommandA(IDDevice, uMsg, fdwCommand, dwParam);
 }
 
+/* Games send commands from several threads, e.g. a UI thread polling status while the game thread plays and stops.
+ * Commands that change a device run one at a time on it, reads go straight through and never wait behind a stop. */
+static MCIERROR mci_command(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam)
+{
+	struct device_info *dev = uMsg == MCI_OPEN ? NULL : device_get(IDDevice);
+	bool read = uMsg == MCI_STATUS || uMsg == MCI_INFO || uMsg == MCI_GETDEVCAPS || uMsg == MCI_SYSINFO;
+	if (!dev || (read && !(fdwCommand & MCI_NOTIFY))) return mci_dispatch(IDDevice, uMsg, fdwCommand, dwParam);
+
+	EnterCriticalSection(&dev->cs);
+	MCIERROR err = mci_dispatch(IDDevice, uMsg, fdwCommand, dwParam);
+	LeaveCriticalSection(&dev->cs);
+	return err;
+}
+
+/* Copy the next word of a command string, or a "quoted" one, returns what follows it */
+static const char *mci_word(const char *s, char *out, int len)
+{
+	char end = ' ';
+	int n = 0;
+	while (*s == ' ') s++;
+	if (*s == '"') {
+		end = '"';
+		s++;
+	}
+	for (; *s && *s != end; s++) {
+		if (n < len-1) out[n++] = *s;
+	}
+	out[n] = '\0';
+	return *s == '"' ? s+1 : s;
+}
+
+/* Command strings for waveaudio and sequencer files, e.g. "open voice.wav type waveaudio alias v" then "play v notify".
+ * Returns false for anything that is not ours, *err holds the result otherwise. */
+static bool wave_string(LPCSTR cmd, const char *cmdbuf, LPSTR ret, UINT cchReturn, HANDLE hwndCallback, MCIERROR *err)
+{
+	char verb[16], name[MAX_PATH];
+	struct device_info *dev = NULL;
+	const char *s = mci_word(mci_word(cmd, verb, sizeof(verb)), name, sizeof(name));
+	const char *args = cmdbuf + (s - cmd); /* lower case keywords of the rest */
+	DWORD flags = 0;
+	*err = 0;
+
+	if (stricmp(verb, "open") == 0) {
+		char alias[100];
+		const char *file = name;
+		const char *type = strstr(args, " type ");
+		const char *at = strstr(args, " alias ");
+		size_t len = strlen(name);
+		bool midi = false;
+		if (strnicmp(name, "waveaudio!", 10) == 0) file = name + 10;
+		else if (strnicmp(name, "sequencer!", 10) == 0) {file = name + 10; midi = true;}
+		else if (type) midi = strncmp(type + 6, "sequencer", 9) == 0;
+		else midi = midi_file(name);
+		if (file == name && !midi && (type ? strncmp(type + 6, "waveaudio", 9) != 0 : len <= 4 || stricmp(name + len - 4, ".wav") != 0)) return false;
+		if (!file[0] || !(midi ? midiSequencer : waveAudio)) return false;
+
+		if (at) mci_word(cmd + (at - cmdbuf) + 7, alias, sizeof(alias));
+		dev = midi ? midi_open(file, at ? alias : name, err) : wave_open(file, at ? alias : name, err);
+		if (!dev) return *err != 0;
+		if (ret && cchReturn) snprintf(ret, cchReturn, "%u", dev->id);
+		return true;
+	}
+
+	for (int i = MAX_DEVICES; i < ALL_DEVICES && !dev; i++) {
+		if (devices[i].open && stricmp(devices[i].alias, name) == 0) dev = &devices[i];
+	}
+	if (!dev) return false;
+
+	if (strstr(args, " notify")) flags |= MCI_NOTIFY;
+	if (strstr(args, " wait")) flags |= MCI_WAIT;
+
+	unsigned long pos;
+	if (stricmp(verb, "play") == 0) {
+		MCI_PLAY_PARMS parms = {(DWORD_PTR)hwndCallback};
+		const char *from = strstr(args, " from ");
+		const char *to = strstr(args, " to ");
+		if (from && sscanf(from, " from %lu", &pos) == 1) {
+			parms.dwFrom = pos;
+			flags |= MCI_FROM;
+		}
+		if (to && sscanf(to, " to %lu", &pos) == 1) {
+			parms.dwTo = pos;
+			flags |= MCI_TO;
+		}
+		*err = mci_command(dev->id, MCI_PLAY, flags, (DWORD_PTR)&parms);
+	} else if (stricmp(verb, "seek") == 0) {
+		MCI_SEEK_PARMS parms = {(DWORD_PTR)hwndCallback};
+		if (strstr(args, " to start")) flags |= MCI_SEEK_TO_START;
+		else if (strstr(args, " to end")) flags |= MCI_SEEK_TO_END;
+		else if (strstr(args, " to ") && sscanf(strstr(args, " to "), " to %lu", &pos) == 1) {
+			parms.dwTo = pos;
+			flags |= MCI_TO;
+		}
+		*err = mci_command(dev->id, MCI_SEEK, flags, (DWORD_PTR)&parms);
+	} else if (stricmp(verb, "set") == 0) {
+		MCI_SET_PARMS parms = {(DWORD_PTR)hwndCallback};
+		if (strstr(args, " time format ")) {
+			flags |= MCI_SET_TIME_FORMAT;
+			if (strstr(args, " samples")) parms.dwTimeFormat = MCI_FORMAT_SAMPLES;
+			else if (strstr(args, " bytes")) parms.dwTimeFormat = MCI_FORMAT_BYTES;
+			else if (strstr(args, " milliseconds") || strstr(args, " ms")) parms.dwTimeFormat = MCI_FORMAT_MILLISECONDS;
+			else parms.dwTimeFormat = -1;
+		} else {
+			*err = MCIERR_UNSUPPORTED_FUNCTION; /* e.g. "set m tempo 120" */
+			return true;
+		}
+		*err = mci_command(dev->id, MCI_SET, flags, (DWORD_PTR)&parms);
+	} else if (stricmp(verb, "status") == 0) {
+		MCI_STATUS_PARMS parms = {(DWORD_PTR)hwndCallback};
+		if (strstr(args, " length")) parms.dwItem = MCI_STATUS_LENGTH;
+		else if (strstr(args, " position")) parms.dwItem = MCI_STATUS_POSITION;
+		else if (strstr(args, " mode")) parms.dwItem = MCI_STATUS_MODE;
+		else if (strstr(args, " time format")) parms.dwItem = MCI_STATUS_TIME_FORMAT;
+		else if (strstr(args, " number of tracks")) parms.dwItem = MCI_STATUS_NUMBER_OF_TRACKS;
+		else if (strstr(args, " current track")) parms.dwItem = MCI_STATUS_CURRENT_TRACK;
+		else if (strstr(args, " media present")) parms.dwItem = MCI_STATUS_MEDIA_PRESENT;
+		else if (strstr(args, " ready")) parms.dwItem = MCI_STATUS_READY;
+		else if (strstr(args, " channels")) parms.dwItem = MCI_WAVE_STATUS_CHANNELS;
+		else if (strstr(args, " samplespersec")) parms.dwItem = MCI_WAVE_STATUS_SAMPLESPERSEC;
+		else if (strstr(args, " bitspersample")) parms.dwItem = MCI_WAVE_STATUS_BITSPERSAMPLE;
+		else {
+			*err = MCIERR_UNSUPPORTED_FUNCTION;
+			return true;
+		}
+		*err = mci_command(dev->id, MCI_STATUS, flags | MCI_STATUS_ITEM, (DWORD_PTR)&parms);
+		if (*err || !ret || !cchReturn) return true;
+
+		if (parms.dwItem == MCI_STATUS_MODE) {
+			snprintf(ret, cchReturn, "%s", parms.dwReturn == MCI_MODE_PLAY ? "playing" : parms.dwReturn == MCI_MODE_PAUSE ? "paused" : "stopped");
+		} else if (parms.dwItem == MCI_STATUS_TIME_FORMAT) {
+			snprintf(ret, cchReturn, "%s", parms.dwReturn == MCI_FORMAT_SAMPLES ? "samples" : parms.dwReturn == MCI_FORMAT_BYTES ? "bytes" : "milliseconds");
+		} else if (parms.dwItem == MCI_STATUS_MEDIA_PRESENT || parms.dwItem == MCI_STATUS_READY) {
+			snprintf(ret, cchReturn, "%s", parms.dwReturn ? "true" : "false");
+		} else {
+			snprintf(ret, cchReturn, "%lu", (unsigned long)parms.dwReturn);
+		}
+	} else {
+		MCI_GENERIC_PARMS parms = {(DWORD_PTR)hwndCallback};
+		UINT msg = stricmp(verb, "stop") == 0 ? MCI_STOP : stricmp(verb, "pause") == 0 ? MCI_PAUSE :
+			stricmp(verb, "resume") == 0 ? MCI_RESUME : stricmp(verb, "close") == 0 ? MCI_CLOSE :
+			stricmp(verb, "cue") == 0 ? MCI_CUE : 0;
+		*err = msg ? mci_command(dev->id, msg, flags, (DWORD_PTR)&parms) : MCIERR_UNSUPPORTED_FUNCTION;
+	}
+	return true;
+}
+
 /* MCI command strings */
 /* https://docs.microsoft.com/windows/win32/multimedia/multimedia-command-strings */
-MCIERROR WINAPI fake_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT cchReturn, HANDLE hwndCallback)
+/* cmdbuf is the lower case copy of cmd the front-ends make, see mci_lower and mci_narrow */
+static MCIERROR mci_string(LPCSTR cmd, const char *cmdbuf, LPSTR ret, UINT cchReturn, HANDLE hwndCallback)
 {
-	char cmdbuf[1000];
-	char cmp_str[1000];
+	struct device_info *dev;
 
 	dprintf("[MCI String = %s]\n", cmd);
 
-	/* copy cmd into cmdbuf */
-	strcpy (cmdbuf, cmd);
-	/* change cmdbuf into lower case */
-	for (int i = 0; cmdbuf[i]; i++)
-	{
-		cmdbuf[i] = tolower(cmdbuf[i]);
-	}
+	MCIERROR err;
+	if ((waveAudio || midiSequencer) && wave_string(cmd, cmdbuf, ret, cchReturn, hwndCallback, &err)) return err;
 
 	if (strstr(cmdbuf, "sysinfo cdaudio quantity"))
 	{
@@ -636,111 +2080,116 @@ MCIERROR WINAPI fake_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT cchReturn, HANDL
 	if (strstr(cmdbuf, "sysinfo cdaudio name"))
 	{
 		dprintf("  Returning name: cdaudio\n");
-		sprintf(ret, "%s", alias_s);
+		sprintf(ret, "%s", devices[0].alias);
 		return 0;
 	}
 
 	/* Handle "stop cdaudio/alias" */
-	sprintf(cmp_str, "stop %s", alias_s);
-	if (strstr(cmdbuf, cmp_str))
+	if ((dev = device_find(cmdbuf, "stop")))
 	{
-		fake_mciSendCommandA(MAGIC_DEVICEID, MCI_STOP, 0, (DWORD_PTR)NULL);
+		mci_command(dev->id, MCI_STOP, 0, (DWORD_PTR)NULL);
 		return 0;
 	}
 
 	/* Handle "pause cdaudio/alias" */
-	sprintf(cmp_str, "pause %s", alias_s);
-	if (strstr(cmdbuf, cmp_str))
+	if ((dev = device_find(cmdbuf, "pause")))
 	{
-		fake_mciSendCommandA(MAGIC_DEVICEID, MCI_PAUSE, 0, (DWORD_PTR)NULL);
+		mci_command(dev->id, MCI_PAUSE, 0, (DWORD_PTR)NULL);
 		return 0;
 	}
 
 	/* Handle "resume cdaudio/alias" */
-	sprintf(cmp_str, "resume %s", alias_s);
-	if (strstr(cmdbuf, cmp_str))
+	if ((dev = device_find(cmdbuf, "resume")))
 	{
-		fake_mciSendCommandA(MAGIC_DEVICEID, MCI_RESUME, 0, (DWORD_PTR)NULL);
+		mci_command(dev->id, MCI_RESUME, 0, (DWORD_PTR)NULL);
 		return 0;
 	}
 
 	/* Look for the use of an alias */
-	/* Example: "open d: type cdaudio alias cd1" */
-	if (strstr(cmdbuf, "type cdaudio alias"))
+	/* Example: "open d: type cdaudio alias cd1", also "open cdaudio!d:" or "open d:" alone */
+	/* A second alias opens a device of its own, e.g. "open cdaudio alias music" next to "alias voice" */
+	char word[MAX_PATH] = "";
+	if (strncmp(cmdbuf, "open ", 5) == 0) mci_word(cmdbuf + 5, word, sizeof(word));
+	if (word[0] && (strstr(cmdbuf, " type cdaudio") || cd_name(word)))
 	{
-		char *tmp_s = strrchr(cmdbuf, ' ');
-		if (tmp_s && tmp_s[1])
-		{
-			sprintf(alias_s, "%s", tmp_s+1);
-		}
-		fake_mciSendCommandA(MAGIC_DEVICEID, MCI_OPEN, 0, (DWORD_PTR)NULL);
+		char alias[100] = "";
+		char *tmp_s = strstr(cmdbuf, " alias ");
+		if (tmp_s) sscanf(tmp_s + 7, "%99s", alias);
+		if (!(dev = device_open(alias))) return MCIERR_OUT_OF_MEMORY;
 		return 0;
 	}
 
-	if (strstr(cmdbuf, "open cdaudio"))
+	/* reset alias with "close alias" string, other devices are closed for good */
+	if ((dev = device_find(cmdbuf, "close")))
 	{
-		fake_mciSendCommandA(MAGIC_DEVICEID, MCI_OPEN, 0, (DWORD_PTR)NULL);
-		return 0;
-	}
-
-	/* reset alias with "close alias" string */
-	sprintf(cmp_str, "close %s", alias_s);
-	if (strstr(cmdbuf, cmp_str))
-	{
-		strcpy(alias_s, alias_def);
+		if (dev == devices) {
+			EnterCriticalSection(&play_cs);
+			strcpy(dev->alias, alias_def);
+			LeaveCriticalSection(&play_cs);
+		} else {
+			mci_command(dev->id, MCI_CLOSE, 0, (DWORD_PTR)NULL);
+		}
 		return 0;
 	}
 
 	/* Handle "seek cdaudio/alias" */
-	sprintf(cmp_str, "seek %s", alias_s);
-	if (strstr(cmdbuf, cmp_str))
+	if ((dev = device_find(cmdbuf, "seek")))
 	{
-		fake_mciSendCommandA(MAGIC_DEVICEID, MCI_STOP, 0, (DWORD_PTR)NULL);
+		if (disc_out()) return MCIERR_DEVICE_NOT_READY;
+		EnterCriticalSection(&dev->cs);
+		mci_command(dev->id, MCI_STOP, 0, (DWORD_PTR)NULL);
 
 		int track;
+		EnterCriticalSection(&play_cs);
 		if (strstr(cmdbuf, "to start"))
 		{
-			info.first = 0;
+			dev->info.first = 0;
 		}
 		else if (strstr(cmdbuf, "to end"))
 		{
-			info.first = lastTrack + 1;
+			dev->info.first = lastTrack + 1;
 		}
 		else if (sscanf(cmdbuf, "seek %*s to %d", &track) == 1) // TMSF only
 		{
-			info.first = track;
+			dev->info.first = track;
 		}
-		info.from = 0;
+		dev->info.from = 0;
+		LeaveCriticalSection(&play_cs);
+		LeaveCriticalSection(&dev->cs);
 		return 0;
 	}
 
+	/* Handle "set cdaudio/alias door open|closed" */
+	if ((dev = device_find(cmdbuf, "set")) && strstr(cmdbuf, " door ")) {
+		MCI_SET_PARMS parms = {0};
+		return mci_command(dev->id, MCI_SET, strstr(cmdbuf, " door open") ? MCI_SET_DOOR_OPEN : MCI_SET_DOOR_CLOSED, (DWORD_PTR)&parms);
+	}
+
 	/* Handle "set cdaudio/alias time format" */
-	sprintf(cmp_str, "set %s time format", alias_s);
-	if (strstr(cmdbuf, cmp_str)){
+	if ((dev = device_find(cmdbuf, "set")) && strstr(cmdbuf, "time format")){
 		MCI_SET_PARMS parms;
 		if (strstr(cmdbuf, "milliseconds"))
 		{
 			parms.dwTimeFormat = MCI_FORMAT_MILLISECONDS;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_SET, MCI_SET_TIME_FORMAT, (DWORD_PTR)&parms);
+			mci_command(dev->id, MCI_SET, MCI_SET_TIME_FORMAT, (DWORD_PTR)&parms);
 			return 0;
 		}
 		if (strstr(cmdbuf, "tmsf"))
 		{
 			parms.dwTimeFormat = MCI_FORMAT_TMSF;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_SET, MCI_SET_TIME_FORMAT, (DWORD_PTR)&parms);
+			mci_command(dev->id, MCI_SET, MCI_SET_TIME_FORMAT, (DWORD_PTR)&parms);
 			return 0;
 		}
 		if (strstr(cmdbuf, "msf"))
 		{
 			parms.dwTimeFormat = MCI_FORMAT_MSF;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_SET, MCI_SET_TIME_FORMAT, (DWORD_PTR)&parms);
+			mci_command(dev->id, MCI_SET, MCI_SET_TIME_FORMAT, (DWORD_PTR)&parms);
 			return 0;
 		}
 	}
 
 	/* Handle "status cdaudio/alias" */
-	sprintf(cmp_str, "status %s", alias_s);
-	if (strstr(cmdbuf, cmp_str)){
+	if ((dev = device_find(cmdbuf, "status"))){
 		MCI_STATUS_PARMS parms;
 		if (strstr(cmdbuf, "number of tracks"))
 		{
@@ -753,9 +2202,9 @@ MCIERROR WINAPI fake_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT cchReturn, HANDL
 		{
 			parms.dwItem = MCI_STATUS_LENGTH;
 			parms.dwTrack = track;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_STATUS, MCI_STATUS_ITEM|MCI_TRACK, (DWORD_PTR)&parms);
-			if (time_format == MCI_FORMAT_MILLISECONDS) {
-				sprintf(ret, "%d", parms.dwReturn);
+			mci_command(dev->id, MCI_STATUS, MCI_STATUS_ITEM|MCI_TRACK, (DWORD_PTR)&parms);
+			if (dev->time_format == MCI_FORMAT_MILLISECONDS) {
+				sprintf(ret, "%lu", (unsigned long)parms.dwReturn);
 			} else {
 				sprintf(ret, "%02d:%02d:00", MCI_MSF_MINUTE(parms.dwReturn), MCI_MSF_SECOND(parms.dwReturn));
 			}
@@ -764,9 +2213,9 @@ MCIERROR WINAPI fake_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT cchReturn, HANDL
 		if (strstr(cmdbuf, "length"))
 		{
 			parms.dwItem = MCI_STATUS_LENGTH;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_STATUS, MCI_STATUS_ITEM, (DWORD_PTR)&parms);
-			if (time_format == MCI_FORMAT_MILLISECONDS) {
-				sprintf(ret, "%d", parms.dwReturn);
+			mci_command(dev->id, MCI_STATUS, MCI_STATUS_ITEM, (DWORD_PTR)&parms);
+			if (dev->time_format == MCI_FORMAT_MILLISECONDS) {
+				sprintf(ret, "%lu", (unsigned long)parms.dwReturn);
 			} else {
 				sprintf(ret, "%02d:%02d:00", MCI_MSF_MINUTE(parms.dwReturn), MCI_MSF_SECOND(parms.dwReturn));
 			}
@@ -776,32 +2225,62 @@ MCIERROR WINAPI fake_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT cchReturn, HANDL
 		{
 			parms.dwItem = MCI_STATUS_POSITION;
 			parms.dwTrack = track;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_STATUS, MCI_STATUS_ITEM|MCI_TRACK, (DWORD_PTR)&parms);
-			sprintf(ret, "%d", parms.dwReturn);
+			mci_command(dev->id, MCI_STATUS, MCI_STATUS_ITEM|MCI_TRACK, (DWORD_PTR)&parms);
+			sprintf(ret, "%lu", (unsigned long)parms.dwReturn);
 			return 0;
 		}
 		if (strstr(cmdbuf, "position"))
 		{
 			parms.dwItem = MCI_STATUS_POSITION;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_STATUS, MCI_STATUS_ITEM, (DWORD_PTR)&parms);
-			if (time_format == MCI_FORMAT_MILLISECONDS) {
-				sprintf(ret, "%d", parms.dwReturn);
-			} else if (time_format == MCI_FORMAT_MSF) {
+			mci_command(dev->id, MCI_STATUS, MCI_STATUS_ITEM, (DWORD_PTR)&parms);
+			if (dev->time_format == MCI_FORMAT_MILLISECONDS) {
+				sprintf(ret, "%lu", (unsigned long)parms.dwReturn);
+			} else if (dev->time_format == MCI_FORMAT_MSF) {
 				sprintf(ret, "%02d:%02d:%02d", MCI_MSF_MINUTE(parms.dwReturn), MCI_MSF_SECOND(parms.dwReturn), MCI_MSF_FRAME(parms.dwReturn));
 			} else { /* TMSF */
 				sprintf(ret, "%02d:%02d:%02d:%02d", MCI_TMSF_TRACK(parms.dwReturn), MCI_TMSF_MINUTE(parms.dwReturn), MCI_TMSF_SECOND(parms.dwReturn), MCI_TMSF_FRAME(parms.dwReturn));
 			}
 			return 0;
 		}
+		/* Vendor extension: playback health counters */
+		if (strstr(cmdbuf, "stats"))
+		{
+			if (ret && cchReturn) plr_stats(ret, cchReturn, FALSE);
+			return 0;
+		}
 		if (strstr(cmdbuf, "media present"))
 		{
-			strcpy(ret, "TRUE");
+			strcpy(ret, disc_out() ? "FALSE" : "TRUE");
+			return 0;
+		}
+		if (strstr(cmdbuf, "ready"))
+		{
+			strcpy(ret, disc_out() ? "false" : "true");
+			return 0;
+		}
+		if (strstr(cmdbuf, "current track"))
+		{
+			sprintf(ret, "%d", dev->current);
+			return 0;
+		}
+		if (sscanf(cmdbuf, "status %*s type track %d", &track) == 1)
+		{
+			strcpy(ret, track >= firstTrack && track <= lastTrack ? "audio" : "other");
+			return 0;
+		}
+		if (strstr(cmdbuf, "time format"))
+		{
+			strcpy(ret, dev->time_format == MCI_FORMAT_MILLISECONDS ? "milliseconds" : dev->time_format == MCI_FORMAT_TMSF ? "tmsf" : "msf");
 			return 0;
 		}
 		/* Add: Mode handling */
 		if (strstr(cmdbuf, "mode"))
 		{
-			switch (mode) {
+			switch (disc_out() ? MCI_MODE_OPEN : dev->mode) {
+				case MCI_MODE_OPEN:
+					dprintf("   -> open\n");
+					strcpy(ret, "open");
+					break;
 				case MCI_MODE_PLAY:
 					dprintf("   -> playing\n");
 					strcpy(ret, "playing");
@@ -821,52 +2300,384 @@ MCIERROR WINAPI fake_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT cchReturn, HANDL
 
 	/* Handle "play cdaudio/alias" */
 	int from = 0, to = 0;
-	sprintf(cmp_str, "play %s", alias_s);
-	if (strstr(cmdbuf, cmp_str)){
+	if ((dev = device_find(cmdbuf, "play"))){
 		MCI_PLAY_PARMS parms = {0};
+		DWORD flags = MCI_FROM;
 
-		if (strstr(cmdbuf, "notify")){
-			notify = 1; /* storing the notify request */
-			window = (HWND)hwndCallback;
-		}
 		if (sscanf(cmdbuf, "play %*s from %d to %d", &from, &to) == 2)
 		{
 			parms.dwFrom = from;
 			parms.dwTo = to;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_PLAY, MCI_FROM|MCI_TO, (DWORD_PTR)&parms);
-			return 0;
+			flags = MCI_FROM|MCI_TO;
 		}
-		if (sscanf(cmdbuf, "play %*s from %d", &from) == 1)
+		else if (sscanf(cmdbuf, "play %*s from %d", &from) == 1)
 		{
 			parms.dwFrom = from;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_PLAY, MCI_FROM, (DWORD_PTR)&parms);
-			return 0;
 		}
-		if (sscanf(cmdbuf, "play %*s to %d", &to) == 1)
+		else if (sscanf(cmdbuf, "play %*s to %d", &to) == 1)
 		{
 			parms.dwTo = to;
-			fake_mciSendCommandA(MAGIC_DEVICEID, MCI_PLAY, MCI_TO, (DWORD_PTR)&parms);
-			return 0;
+			flags = MCI_TO;
 		}
+		else from = -1;
+
+		/* The notify request and the PLAY it belongs to reach the device together */
+		EnterCriticalSection(&dev->cs);
+		if (strstr(cmdbuf, "notify")){
+			dev->notify = 1; /* storing the notify request */
+			dev->window = (HWND)hwndCallback;
+		}
+		if (from == -1) parms.dwFrom = dev->info.first;
+		MCIERROR err = mci_command(dev->id, MCI_PLAY, flags, (DWORD_PTR)&parms);
+		LeaveCriticalSection(&dev->cs);
+		return err;
+	}
+
+	/* Handle "info cdaudio/alias product|identity" */
+	if ((dev = device_find(cmdbuf, "info"))){
+		MCI_INFO_PARMS parms = {0, ret, cchReturn};
+		if (strstr(cmdbuf, "identity")) return mci_command(dev->id, MCI_INFO, MCI_INFO_MEDIA_IDENTITY, (DWORD_PTR)&parms);
+		mci_command(dev->id, MCI_INFO, MCI_INFO_PRODUCT, (DWORD_PTR)&parms);
+		return 0;
+	}
 
-		parms.dwFrom = info.first;
-		fake_mciSendCommandA(MAGIC_DEVICEID, MCI_PLAY, MCI_FROM, (DWORD_PTR)&parms);
+	/* Handle "capability cdaudio/alias" */
+	if ((dev = device_find(cmdbuf, "capability"))){
+		if (strstr(cmdbuf, "device type")) strcpy(ret, "cdaudio");
+		else if (strstr(cmdbuf, "can eject") || strstr(cmdbuf, "can play") || strstr(cmdbuf, "has audio")) strcpy(ret, "true");
+		else strcpy(ret, "false");
 		return 0;
 	}
 
-	return relay_mciSendStringA(cmd, ret, cchReturn, hwndCallback);
-	/* return 0; */
+	/* Anything else for a CD device is not passed on: the system winmm would open its driver for it, e.g. on "set cdaudio door open" */
+	char verb[16] = "";
+	mci_word(mci_word(cmdbuf, verb, sizeof(verb)), word, sizeof(word));
+	if ((dev = device_name(word)) && !dev->wave && !dev->seq)
+	{
+		dprintf("  Ignoring %s for %s\n", verb, dev->alias);
+		return strcmp(verb, "set") == 0 ? 0 : MCIERR_UNSUPPORTED_FUNCTION;
+	}
+
+	return MCI_RELAY;
+}
+
+/* A string as one field of a trace line: backslashes doubled, spaces and control characters as \xHH, "-" for none */
+static const char *trace_esc(char *dst, size_t len, const char *src)
+{
+	size_t n = 0;
+	if (!src || !src[0]) return "-";
+	for (; *src && n + 5 < len; src++) {
+		unsigned char c = *src;
+		if (c == '\\') {
+			dst[n++] = '\\';
+			dst[n++] = '\\';
+		} else if (c <= ' ' || c == 0x7F || (c == '-' && n == 0 && !src[1])) {
+			n += snprintf(dst + n, len - n, "\\x%02X", c);
+		} else {
+			dst[n++] = c;
+		}
+	}
+	dst[n] = '\0';
+	return dst;
+}
+
+/* "<usec> <thread> C <id> <msg> <flags> <a> <b> <type> <element> <alias> = <err> <ret> <duration>", a and b are the
+ * arguments of the message, ret the answer or the id MCI_OPEN returned */
+static void trace_command(unsigned int t, unsigned int d, MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR fdwCommand, DWORD a, DWORD b,
+	const char *type, const char *element, const char *alias, MCIERROR err, DWORD r)
+{
+	char te[100], ee[MAX_PATH * 4], ae[400];
+	tprintf("%u %lu C %X %X %X %X %X %s %s %s = %lu %lu %u\n", t - trace_t0, (unsigned long)GetCurrentThreadId(), IDDevice, uMsg,
+		(DWORD)fdwCommand, a, b, trace_esc(te, sizeof(te), type), trace_esc(ee, sizeof(ee), element),
+		trace_esc(ae, sizeof(ae), alias), (unsigned long)err, (unsigned long)r, d);
+}
+
+/* "<usec> <thread> S <err> <duration> <command> -> <answer>" */
+static void trace_string(unsigned int t, unsigned int d, MCIERROR err, const char *cmd, const char *ret, UINT cchReturn)
+{
+	/* Return buffers are often left untouched, so only keep the text before anything unprintable */
+	char rs[256] = "", ce[4000], re[1024];
+	for (int i = 0; !err && ret && i < cchReturn && i < sizeof(rs)-1 && (isprint((unsigned char)ret[i]) || isspace((unsigned char)ret[i])); i++) {
+		rs[i] = ret[i];
+		rs[i+1] = '\0';
+	}
+	tprintf("%u %lu S %lu %u %s -> %s\n", t - trace_t0, (unsigned long)GetCurrentThreadId(), (unsigned long)err, d, trace_esc(ce, sizeof(ce), cmd),
+		trace_esc(re, sizeof(re), rs));
+}
+
+MCIERROR WINAPI fake_mciSendCommandA(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam)
+{
+	scan_wait();
+
+	/* Capture the arguments before the call, handlers may convert them in place */
+	DWORD a = 0, b = 0;
+	const char *type = NULL, *element = NULL, *alias = NULL;
+	if (ft && dwParam) {
+		switch (uMsg) {
+			case MCI_PLAY:
+				a = ((LPMCI_PLAY_PARMS)dwParam)->dwFrom;
+				b = ((LPMCI_PLAY_PARMS)dwParam)->dwTo;
+				break;
+			case MCI_SEEK:
+				a = ((LPMCI_SEEK_PARMS)dwParam)->dwTo;
+				break;
+			case MCI_SET:
+				a = ((LPMCI_SET_PARMS)dwParam)->dwTimeFormat;
+				break;
+			case MCI_STATUS:
+				a = ((LPMCI_STATUS_PARMS)dwParam)->dwItem;
+				b = ((LPMCI_STATUS_PARMS)dwParam)->dwTrack;
+				break;
+			case MCI_GETDEVCAPS:
+				a = ((LPMCI_GETDEVCAPS_PARMS)dwParam)->dwItem;
+				break;
+			case MCI_SYSINFO:
+				a = ((LPMCI_SYSINFO_PARMSA)dwParam)->dwNumber;
+				b = ((LPMCI_SYSINFO_PARMSA)dwParam)->wDeviceType;
+				break;
+			case MCI_OPEN:
+				{
+					LPMCI_OPEN_PARMS parms = (LPVOID)dwParam;
+					if (fdwCommand & MCI_OPEN_TYPE_ID) a = LOWORD(parms->lpstrDeviceType);
+					else if (fdwCommand & MCI_OPEN_TYPE) type = parms->lpstrDeviceType;
+					if (fdwCommand & MCI_OPEN_ELEMENT_ID) b = (DWORD)(DWORD_PTR)parms->lpstrElementName;
+					else if (fdwCommand & MCI_OPEN_ELEMENT) element = parms->lpstrElementName;
+					if (fdwCommand & MCI_OPEN_ALIAS) alias = parms->lpstrAlias;
+				}
+				break;
+		}
+	}
+
+	unsigned int t = plr_usec();
+	MCIERROR err = mci_command(IDDevice, uMsg, fdwCommand, dwParam);
+	unsigned int d = plr_usec() - t;
+	plr_hist(PLR_HIST_CMD, d);
+
+	if (ft) {
+		DWORD_PTR r = 0;
+		if (dwParam && uMsg == MCI_STATUS) r = ((LPMCI_STATUS_PARMS)dwParam)->dwReturn;
+		else if (dwParam && uMsg == MCI_GETDEVCAPS) r = ((LPMCI_GETDEVCAPS_PARMS)dwParam)->dwReturn;
+		else if (dwParam && uMsg == MCI_OPEN) r = ((LPMCI_OPEN_PARMS)dwParam)->wDeviceID;
+		trace_command(t, d, IDDevice, uMsg, fdwCommand, a, b, type, element, alias, err, r);
+	}
+	return err;
+}
+
+/* Lower case copy of an ANSI command string for mci_string, false if it is too long */
+static bool mci_lower(char *dst, int len, LPCSTR src)
+{
+	for (int i = 0; i < len; i++) {
+		dst[i] = tolower((unsigned char)src[i]);
+		if (!src[i]) return true;
+	}
+	return false;
+}
+
+/* Copy and lower case copy of a UTF-16 command string in one pass, false if it is too long or not plain ASCII */
+static bool mci_narrow(char *dst, char *low, int len, LPCWSTR src)
+{
+	for (int i = 0; i < len; i++) {
+		WCHAR c = src[i];
+		if (c > 0x7F) return false;
+		dst[i] = c;
+		low[i] = c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+		if (!c) return true;
+	}
+	return false;
+}
+
+/* Write an answer back as UTF-16, len > 0 */
+static void mci_widen(LPWSTR dst, UINT len, const char *src)
+{
+	UINT i = 0;
+	for (; i < len-1 && src[i]; i++) {
+		if (src[i] & 0x80) {
+			/* e.g. a file name in the ANSI code page */
+			if (!MultiByteToWideChar(CP_ACP, 0, src, -1, dst, len)) dst[len-1] = 0;
+			return;
+		}
+		dst[i] = src[i];
+	}
+	dst[i] = 0;
+}
+
+MCIERROR WINAPI fake_mciSendStringA(LPCSTR cmd, LPSTR ret, UINT cchReturn, HANDLE hwndCallback)
+{
+	char cmdbuf[1000], none[MCI_RET_MAX];
+	scan_wait();
+
+	/* Commands without an answer leave an empty string, as the system's do and the wide answers are. Handlers answer
+	 * into none when the caller wants no answer. */
+	if (ret && cchReturn) ret[0] = '\0';
+	LPSTR ans = ret && cchReturn ? ret : none;
+	UINT len = ret && cchReturn ? cchReturn : sizeof(none);
+	unsigned int t = plr_usec();
+	MCIERROR err = mci_lower(cmdbuf, sizeof(cmdbuf), cmd) ? mci_string(cmd, cmdbuf, ans, len, hwndCallback) : MCI_RELAY;
+	if (err == MCI_RELAY) err = relay_mciSendStringA(cmd, ret, cchReturn, hwndCallback);
+	unsigned int d = plr_usec() - t;
+	plr_hist(PLR_HIST_CMD, d);
+
+	if (ft) trace_string(t, d, err, cmd, ret, cchReturn);
+	return err;
+}
+
+/* Wide commands share the ANSI handlers, only the strings of OPEN, INFO and SYSINFO need converting */
+MCIERROR WINAPI fake_mciSendCommandW(MCIDEVICEID IDDevice, UINT uMsg, DWORD_PTR fdwCommand, DWORD_PTR dwParam)
+{
+	if (uMsg == MCI_OPEN && dwParam) {
+		LPMCI_OPEN_PARMSW w = (LPVOID)dwParam;
+		char type[100] = "", element[MAX_PATH] = "", alias[100] = "";
+		MCI_OPEN_PARMSA a = {w->dwCallback, 0, type, element, alias};
+		if (fdwCommand & MCI_OPEN_TYPE_ID) a.lpstrDeviceType = (LPCSTR)w->lpstrDeviceType;
+		else if ((fdwCommand & MCI_OPEN_TYPE) && w->lpstrDeviceType) WideCharToMultiByte(CP_ACP, 0, w->lpstrDeviceType, -1, type, sizeof(type), NULL, NULL);
+		if (fdwCommand & MCI_OPEN_ELEMENT_ID) a.lpstrElementName = (LPCSTR)w->lpstrElementName;
+		else if ((fdwCommand & MCI_OPEN_ELEMENT) && w->lpstrElementName) WideCharToMultiByte(CP_ACP, 0, w->lpstrElementName, -1, element, sizeof(element), NULL, NULL);
+		if ((fdwCommand & MCI_OPEN_ALIAS) && w->lpstrAlias) WideCharToMultiByte(CP_ACP, 0, w->lpstrAlias, -1, alias, sizeof(alias), NULL, NULL);
+
+		struct device_info *dev = NULL;
+		MCIERROR err = 0;
+		if (cd_open(fdwCommand, &a)) {
+			err = fake_mciSendCommandA(IDDevice, uMsg, fdwCommand, (DWORD_PTR)&a);
+			w->wDeviceID = a.wDeviceID;
+			return err;
+		}
+		unsigned int t = plr_usec();
+		if (wave_type(fdwCommand, &a)) dev = wave_open(element, (fdwCommand & MCI_OPEN_ALIAS) ? alias : element, &err);
+		else if (midi_type(fdwCommand, &a)) dev = midi_open(element, (fdwCommand & MCI_OPEN_ALIAS) ? alias : element, &err);
+		if (dev) w->wDeviceID = dev->id;
+		else if (!err) err = relay_mciSendCommandW(IDDevice, uMsg, fdwCommand, dwParam);
+		unsigned int d = plr_usec() - t;
+		plr_hist(PLR_HIST_CMD, d);
+
+		if (ft) {
+			DWORD ta = (fdwCommand & MCI_OPEN_TYPE_ID) ? LOWORD(a.lpstrDeviceType) : 0;
+			DWORD tb = (fdwCommand & MCI_OPEN_ELEMENT_ID) ? (DWORD)(DWORD_PTR)a.lpstrElementName : 0;
+			trace_command(t, d, IDDevice, uMsg, fdwCommand, ta, tb, type, element, alias, err, err ? 0 : w->wDeviceID);
+		}
+		return err;
+	}
+
+	if (!device_get(IDDevice)) return relay_mciSendCommandW(IDDevice, uMsg, fdwCommand, dwParam);
+
+	if ((uMsg == MCI_INFO || uMsg == MCI_SYSINFO) && dwParam && !(uMsg == MCI_SYSINFO && (fdwCommand & MCI_SYSINFO_QUANTITY))) {
+		LPMCI_INFO_PARMSW w = (LPVOID)dwParam; /* MCI_SYSINFO_PARMSW starts the same */
+		char buf[MCI_RET_MAX];
+		LPWSTR ret = w->lpstrReturn;
+		DWORD len = w->dwRetSize;
+		buf[0] = '\0';
+		w->lpstrReturn = (LPWSTR)buf;
+		w->dwRetSize = ret && len < sizeof(buf) ? len : sizeof(buf);
+		MCIERROR err = fake_mciSendCommandA(IDDevice, uMsg, fdwCommand, dwParam);
+		w->lpstrReturn = ret;
+		w->dwRetSize = len;
+		if (ret && len) {
+			buf[sizeof(buf)-1] = '\0';
+			mci_widen(ret, len, buf);
+		}
+		return err;
+	}
+	return fake_mciSendCommandA(IDDevice, uMsg, fdwCommand, dwParam);
+}
+
+/* Wide command strings are narrowed and lower cased in the one pass the ANSI ones get, answers are widened on the way out.
+ * Strings with other than ASCII characters, e.g. file names, are passed on as they were. */
+MCIERROR WINAPI fake_mciSendStringW(LPCWSTR cmd, LPWSTR ret, UINT cchReturn, HANDLE hwndCallback)
+{
+	char cmdA[1000], cmdbuf[1000], retA[MCI_RET_MAX];
+	if (!cmd || !mci_narrow(cmdA, cmdbuf, sizeof(cmdbuf), cmd)) return relay_mciSendStringW(cmd, ret, cchReturn, hwndCallback);
+
+	/* Handlers answer into retA even when the caller wants no answer, it is as long as the caller's buffer up to the
+	 * longest answer there is */
+	UINT len = ret && cchReturn && cchReturn < sizeof(retA) ? cchReturn : sizeof(retA);
+	retA[0] = '\0';
+
+	scan_wait();
+
+	unsigned int t = plr_usec();
+	MCIERROR err = mci_string(cmdA, cmdbuf, retA, len, hwndCallback);
+	if (err == MCI_RELAY) err = relay_mciSendStringW(cmd, ret, cchReturn, hwndCallback);
+	else if (ret && cchReturn) mci_widen(ret, cchReturn, retA);
+	unsigned int d = plr_usec() - t;
+	plr_hist(PLR_HIST_CMD, d);
+
+	if (ft) trace_string(t, d, err, cmdA, ret && cchReturn ? retA : NULL, len);
+	return err;
+}
+
+/* mciExecute is mciSendString that reports errors itself, ours are only returned */
+BOOL WINAPI fake_mciExecute(LPCSTR cmd)
+{
+	scan_wait();
+
+	char cmdbuf[1000], ret[128] = "";
+	MCIERROR err = mci_lower(cmdbuf, sizeof(cmdbuf), cmd) ? mci_string(cmd, cmdbuf, ret, sizeof(ret), NULL) : MCI_RELAY;
+	return err == MCI_RELAY ? relay_mciExecute(cmd) : err == 0;
+}
+
+MCIDEVICEID WINAPI fake_mciGetDeviceIDA(LPCSTR name)
+{
+	struct device_info *dev = name ? device_name(name) : NULL;
+	dprintf("mciGetDeviceIDA(%s) = 0x%X\n", name, dev ? dev->id : 0);
+	return dev ? dev->id : relay_mciGetDeviceIDA(name);
+}
+
+MCIDEVICEID WINAPI fake_mciGetDeviceIDW(LPCWSTR name)
+{
+	char nameA[100], low[100];
+	if (!name || !mci_narrow(nameA, low, sizeof(nameA), name)) return relay_mciGetDeviceIDW(name);
+	struct device_info *dev = device_name(nameA);
+	return dev ? dev->id : relay_mciGetDeviceIDW(name);
+}
+
+/* English texts of the errors our devices return, for when the system winmm has none of its own */
+static const struct { MCIERROR err; const char *text; } mci_errors[] = {
+	{0, "The specified command was carried out."},
+	{MCIERR_OUT_OF_MEMORY, "Your system does not have enough memory for this task. Quit one or more applications to increase available memory, and then try again."},
+	{MCIERR_OUTOFRANGE, "The specified parameter is out of range for the specified command."},
+	{MCIERR_UNSUPPORTED_FUNCTION, "The MCI device driver the system is using does not support the specified command."},
+	{MCIERR_DUPLICATE_ALIAS, "The specified alias is already being used in this application. Use a unique alias."},
+	{MCIERR_BAD_TIME_FORMAT, "The specified value for the time format is invalid. Refer to the MCI documentation for valid formats."},
+	{MCIERR_DEVICE_NOT_READY, "The device is not ready."},
+};
+
+static const char *mci_error(MCIERROR err)
+{
+	for (int i = 0; i < sizeof(mci_errors) / sizeof(mci_errors[0]); i++) {
+		if (mci_errors[i].err == err) return mci_errors[i].text;
+	}
+	return NULL;
+}
+
+BOOL WINAPI fake_mciGetErrorStringA(MCIERROR err, LPSTR text, UINT len)
+{
+	/* The system's texts are in the user's language, ours only answer codes it does not know */
+	if (relay_mciGetErrorStringA(err, text, len)) return TRUE;
+	const char *s = mci_error(err);
+	if (!s || !text || !len) return FALSE;
+	snprintf(text, len, "%s", s);
+	return TRUE;
+}
+
+BOOL WINAPI fake_mciGetErrorStringW(MCIERROR err, LPWSTR text, UINT len)
+{
+	if (relay_mciGetErrorStringW(err, text, len)) return TRUE;
+	const char *s = mci_error(err);
+	if (!s || !text || !len) return FALSE;
+	mci_widen(text, len, s);
+	return TRUE;
 }
 
 UINT WINAPI fake_auxGetNumDevs()
 {
 	dprintf("fake_auxGetNumDevs() = 1\n");
+	tprintf("%u %lu N\n", plr_usec() - trace_t0, (unsigned long)GetCurrentThreadId());
 	return 1;
 }
 
 MMRESULT WINAPI fake_auxGetDevCapsA(UINT_PTR uDeviceID, LPAUXCAPS lpCaps, UINT cbCaps)
 {
 	dprintf("fake_auxGetDevCapsA(uDeviceID=%08X, lpCaps=%p, cbCaps=%08X\n", uDeviceID, lpCaps, cbCaps);
+	tprintf("%u %lu D %X\n", plr_usec() - trace_t0, (unsigned long)GetCurrentThreadId(), (UINT)uDeviceID);
 
 	lpCaps->wMid = 2 /*MM_CREATIVE*/;
 	lpCaps->wPid = 401 /*MM_CREATIVE_AUX_CD*/;
@@ -882,12 +2693,14 @@ MMRESULT WINAPI fake_auxGetVolume(UINT uDeviceID, LPDWORD lpdwVolume)
 {
 	*lpdwVolume = auxVol;
 	dprintf("fake_auxGetVolume(uDeviceId=%08X, dwVolume=%08X)\n", uDeviceID, *lpdwVolume);
+	tprintf("%u %lu G %X %lX\n", plr_usec() - trace_t0, (unsigned long)GetCurrentThreadId(), uDeviceID, (unsigned long)auxVol);
 	return MMSYSERR_NOERROR;
 }
 
 MMRESULT WINAPI fake_auxSetVolume(UINT uDeviceID, DWORD dwVolume)
 {
 	dprintf("fake_auxSetVolume(uDeviceId=%08X, dwVolume=%08X)\n", uDeviceID, dwVolume);
+	tprintf("%u %lu V %X %lX\n", plr_usec() - trace_t0, (unsigned long)GetCurrentThreadId(), uDeviceID, (unsigned long)dwVolume);
 
 	auxVol = dwVolume;
 	plr_volume((auxVol & 0xFFFF) * cddaVol / 65535, (auxVol >> 16) * cddaVol / 65535);